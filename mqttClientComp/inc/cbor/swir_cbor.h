@@ -0,0 +1,106 @@
+/*
+ * @file
+ *
+ *	Compact binary encoding (CBOR, RFC 7049) of the payloads otherwise sent as JSON: a writer into a
+ *  caller's buffer with the telemetry records built on it, and a reader for inbound tasks
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef _SWIR_CBOR_H_
+#define _SWIR_CBOR_H_
+
+#include <stdint.h>
+
+#include "json/swir_json.h"
+
+#define SWIRCBOR_ERROR_NOMEM    -1      // the buffer is too small
+#define SWIRCBOR_ERROR_INVALID  -2      // not CBOR, or nested deeper than SWIRCBOR_DEPTH_MAX
+#define SWIRCBOR_ERROR_PARTIAL  -3      // CBOR cut short
+
+#define SWIRCBOR_DEPTH_MAX      32
+#define SWIRCBOR_INDEFINITE     -1      // count of an array or map closed by swircbor_end()
+
+typedef enum
+{
+    SWIRCBOR_UINT = 0,
+    SWIRCBOR_NINT,                      // -1 - u64Value
+    SWIRCBOR_BYTES,
+    SWIRCBOR_STRING,
+    SWIRCBOR_ARRAY,
+    SWIRCBOR_MAP,
+    SWIRCBOR_TAG,                       // u64Value is the tag, the tagged item follows
+    SWIRCBOR_FALSE,
+    SWIRCBOR_TRUE,
+    SWIRCBOR_NULL,
+    SWIRCBOR_UNDEFINED,
+    SWIRCBOR_FLOAT,
+    SWIRCBOR_BREAK,                     // end of an indefinite array or map
+} swircbor_type_t;
+
+// one item as read from the input; strings point into it and are not NUL-terminated
+typedef struct
+{
+    swircbor_type_t     type;
+    uint64_t            u64Value;       // integers and tags
+    double              dValue;         // floats
+    const uint8_t*      pData;          // strings
+    int                 nLen;           // string length, elements or pairs, SWIRCBOR_INDEFINITE
+} swircbor_item_t;
+
+// the input and how far it has been read; copy it to come back to a position
+typedef struct
+{
+    const uint8_t*      pData;
+    int                 nLen;
+    int                 nPos;
+} swircbor_reader_t;
+
+/*
+ * Append-only writer, with the same sticky error as swirjson_writer_t: the first write that does not
+ * fit is recorded, later ones are ignored, and swircbor_finish() reports it.  Floats are written in
+ * the smallest of half, single and double precision that holds them exactly.
+ */
+typedef struct
+{
+    uint8_t*            pBuffer;
+    int                 nSize;
+    int                 nLen;
+    int                 nError;
+    int                 nIndefinite;    // open indefinite arrays and maps
+} swircbor_writer_t;
+
+void    swircbor_initWriter(swircbor_writer_t* pWriter, uint8_t* pBuffer, int nSize);
+void    swircbor_beginArray(swircbor_writer_t* pWriter, int nCount);
+void    swircbor_beginMap(swircbor_writer_t* pWriter, int nCount);
+void    swircbor_end(swircbor_writer_t* pWriter);
+void    swircbor_writeUInt(swircbor_writer_t* pWriter, uint64_t u64Value);
+void    swircbor_writeInt(swircbor_writer_t* pWriter, int64_t n64Value);
+void    swircbor_writeString(swircbor_writer_t* pWriter, const char* szValue);
+void    swircbor_writeStringN(swircbor_writer_t* pWriter, const char* pValue, int nLen);
+void    swircbor_writeBytes(swircbor_writer_t* pWriter, const uint8_t* pValue, int nLen);
+void    swircbor_writeFloat(swircbor_writer_t* pWriter, double dValue);
+void    swircbor_writeBool(swircbor_writer_t* pWriter, int bValue);
+void    swircbor_writeNull(swircbor_writer_t* pWriter);
+int     swircbor_finish(swircbor_writer_t* pWriter);
+
+/*
+ * Telemetry records shaped like the swirjson_*Serialize() ones, {key: value} or
+ * {timestamp: {key: value}}, and {key: [{"timestamp": t, "value": v}, ...]} for lists, where a zero
+ * timestamp is null.  The timestamp is an integer key and numbers keep their type.  Each returns the
+ * length written into pBuffer, or a SWIRCBOR_ERROR_ code.
+ */
+int     swircbor_encodeRecord(uint8_t* pBuffer, int nSize, const char* szKey, const char* szValue, unsigned long ulTimestamp);
+int     swircbor_encodeFloatRecord(uint8_t* pBuffer, int nSize, const char* szKey, float fValue, unsigned long ulTimestamp);
+int     swircbor_encodeIntRecord(uint8_t* pBuffer, int nSize, const char* szKey, int nValue, unsigned long ulTimestamp);
+int     swircbor_encodeList(uint8_t* pBuffer, int nSize, const char* szKey, int nValueCount, const char** pszValueList, const unsigned long* pulTimestampList);
+
+void    swircbor_initReader(swircbor_reader_t* pReader, const uint8_t* pData, int nLen);
+int     swircbor_read(swircbor_reader_t* pReader, swircbor_item_t* pItem);
+int     swircbor_skip(swircbor_reader_t* pReader);
+int     swircbor_find(const swircbor_reader_t* pMap, int nCount, const char* szKey, swircbor_reader_t* pValue);
+int     swircbor_toJson(swircbor_reader_t* pReader, swirjson_writer_t* pWriter);
+
+#endif	//_SWIR_CBOR_H_
@@ -12,7 +12,118 @@
 #ifndef _SWIR_JSON_H_
 #define _SWIR_JSON_H_
 
+#define SWIRJSON_ERROR_NOMEM    -1      // more tokens than the index was given room for
+#define SWIRJSON_ERROR_INVALID  -2      // not JSON
+#define SWIRJSON_ERROR_PARTIAL  -3      // JSON cut short
 
+// tokens enough for any text of nLen bytes, the densest being "[1,1,...]"
+#define SWIRJSON_TOKENS_FOR(nLen)   ((nLen) / 2 + 1)
+
+#define SWIRJSON_WRITER_DEPTH_MAX   32
+
+#define SWIRJSON_NUMBER_LEN_MAX     32  // any number the formatters write, with its NUL
+#define SWIRJSON_DECIMALS_MAX       17
+#define SWIRJSON_SHORTEST           -1  // decimals for the shortest text that reads back the same
+
+typedef enum
+{
+    SWIRJSON_PRIMITIVE = 0,             // number, true, false or null
+    SWIRJSON_STRING,
+    SWIRJSON_OBJECT,
+    SWIRJSON_ARRAY,
+} swirjson_type_t;
+
+// one value, or one key of an object, as a span of the parsed text
+typedef struct
+{
+    swirjson_type_t     type;
+    int                 nStart;         // first byte, past the opening quote of a string
+    int                 nEnd;           // past the last byte, on the closing quote of a string
+    int                 nSize;          // members of an object, elements of an array
+    int                 nParent;        // container of an element or a key, key of a member value
+    int                 nFirst;         // containers: where their children start in the order array
+} swirjson_token_t;
+
+/*
+ * Index over one JSON text, built in a single pass by swirjson_parse().  Token 0 is the root value,
+ * the value of an object member always directly follows its key.  Containers list their children in
+ * the order array: an array its elements, an object its keys in document order followed by the same
+ * keys sorted, so that members are reached by position in O(1) and by name in O(log n).
+ *
+ * The index does not copy the text, which must outlive it.  Both arrays are the caller's and need
+ * nMax entries, with one token per key and per value.
+ */
+typedef struct
+{
+    const char*         pszJson;
+    swirjson_token_t*   pTokens;
+    int*                pOrder;
+    int                 nMax;
+    int                 nCount;
+} swirjson_index_t;
+
+// non-owning view of a token's text, not NUL-terminated; escape sequences are left as they are
+typedef struct
+{
+    const char*         ptr;
+    int                 len;
+} swirjson_slice_t;
+
+/*
+ * Append-only writer into a buffer of the caller's.  Commas and key separators are placed by the
+ * writer, strings are escaped on the way in.  The first write that does not fit, or that would nest
+ * deeper than SWIRJSON_WRITER_DEPTH_MAX, sets the error and every write after it is ignored, so a
+ * document is built without checks and swirjson_finish() tells whether it is whole.
+ */
+typedef struct
+{
+    char*               pszBuffer;
+    int                 nSize;
+    int                 nLen;
+    int                 nError;
+    int                 nDepth;
+    unsigned int        uNotFirst;      // one bit per open container, set once it has a child
+    int                 bAfterKey;
+} swirjson_writer_t;
+
+/*
+ * Number formatting without printf.  Each writes at most SWIRJSON_NUMBER_LEN_MAX bytes including the
+ * NUL and returns the length, or SWIRJSON_ERROR_INVALID for NaN and infinity.  formatFixed() gives the
+ * same text as "%.*f" when that fits, the shortest form when it does not; the shortest forms are
+ * fixed-point when the value allows it, exponent form otherwise, and read back to the same double or
+ * float.
+ */
+int                 swirjson_formatInt(char* pszBuffer, long nValue);
+int                 swirjson_formatUInt(char* pszBuffer, unsigned long ulValue);
+int                 swirjson_formatFixed(char* pszBuffer, double dValue, int nDecimals);
+int                 swirjson_formatShortest(char* pszBuffer, double dValue);
+int                 swirjson_formatShortestFloat(char* pszBuffer, float fValue);
+
+void                swirjson_initWriter(swirjson_writer_t* pWriter, char* pszBuffer, int nSize);
+void                swirjson_beginObject(swirjson_writer_t* pWriter);
+void                swirjson_endObject(swirjson_writer_t* pWriter);
+void                swirjson_beginArray(swirjson_writer_t* pWriter);
+void                swirjson_endArray(swirjson_writer_t* pWriter);
+void                swirjson_writeKey(swirjson_writer_t* pWriter, const char* szKey);
+void                swirjson_writeKeyN(swirjson_writer_t* pWriter, const char* pKey, int nLen);
+void                swirjson_writeString(swirjson_writer_t* pWriter, const char* szValue);
+void                swirjson_writeStringN(swirjson_writer_t* pWriter, const char* pValue, int nLen);
+void                swirjson_writeInt(swirjson_writer_t* pWriter, long nValue);
+void                swirjson_writeUInt(swirjson_writer_t* pWriter, unsigned long ulValue);
+void                swirjson_writeFloat(swirjson_writer_t* pWriter, double dValue, int nDecimals);
+void                swirjson_writeBool(swirjson_writer_t* pWriter, int bValue);
+void                swirjson_writeNull(swirjson_writer_t* pWriter);
+void                swirjson_writeRaw(swirjson_writer_t* pWriter, const char* pJson, int nLen);
+int                 swirjson_finish(swirjson_writer_t* pWriter);
+
+void                swirjson_initIndex(swirjson_index_t* pIndex, swirjson_token_t* pTokens, int* pOrder, int nMax);
+int                 swirjson_parse(swirjson_index_t* pIndex, const char* szJson, int nLen);
+int                 swirjson_find(const swirjson_index_t* pIndex, int nObject, const char* szKey);
+int                 swirjson_getKey(const swirjson_index_t* pIndex, int nObject, int nMember);
+int                 swirjson_getItem(const swirjson_index_t* pIndex, int nContainer, int nItem);
+swirjson_slice_t    swirjson_getSlice(const swirjson_index_t* pIndex, int nToken);
+int                 swirjson_copy(const swirjson_index_t* pIndex, int nToken, char* szBuffer, int nSize);
+char*               swirjson_dup(const swirjson_index_t* pIndex, int nToken);
 
 char*		swirjson_szSerialize(const char* szKey, const char* szValue, unsigned long ulTimestamp);
 char*		swirjson_fSerialize(char* szKey, float fValue, unsigned long ulTimestamp);
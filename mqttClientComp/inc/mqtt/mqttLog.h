@@ -0,0 +1,50 @@
+/**
+ * @file
+ *
+ * Logging for the MQTT packet codec.  Inside the Legato component the codec logs through the
+ * Legato macros as before.  Built with MQTT_CODEC_STANDALONE (see src/mqtt/Makefile) it has no
+ * dependency on legato.h and hands every message to a hook installed with MQTTLog_setHook(); with
+ * no hook installed messages are discarded.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef MQTTLOG_H_
+#define MQTTLOG_H_
+
+#if defined(MQTT_CODEC_STANDALONE)
+
+#include <stdarg.h>
+
+#if !defined(DLLImport)
+  #define DLLImport
+#endif
+#if !defined(DLLExport)
+  #define DLLExport
+#endif
+
+enum MQTTLog_levels
+{
+	MQTTLOG_LEVEL_DEBUG, MQTTLOG_LEVEL_ERROR
+};
+
+typedef void (*MQTTLog_hook)(int level, const char* file, int line, const char* format, va_list args);
+
+DLLExport void MQTTLog_setHook(MQTTLog_hook hook);
+DLLExport void MQTTLog_write(int level, const char* file, int line, const char* format, ...);
+
+#define MQTTLOG_ERROR(...) MQTTLog_write(MQTTLOG_LEVEL_ERROR, __FILE__, __LINE__, __VA_ARGS__)
+#define MQTTLOG_DEBUG(...) MQTTLog_write(MQTTLOG_LEVEL_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+
+#else
+
+#include "legato.h"
+
+#define MQTTLOG_ERROR LE_ERROR
+#define MQTTLOG_DEBUG LE_DEBUG
+
+#endif
+
+#endif /* MQTTLOG_H_ */
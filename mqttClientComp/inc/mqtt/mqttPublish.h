@@ -28,6 +28,19 @@
 DLLExport int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
 		MQTTString topicName, unsigned char* payload, int payloadlen);
 
+DLLExport int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, int payloadlen);
+
+/* a template keeps room for the largest fixed header (1 + 4 bytes) in front of the topic, and the packetid after it */
+#define MQTTPUBLISH_TEMPLATE_OFFSET 5
+#define MQTTPUBLISH_TEMPLATE_LEN(topiclen) (MQTTPUBLISH_TEMPLATE_OFFSET + 2 + (topiclen) + 2)
+#define MQTTPUBLISH_MAX_REMAINING_LEN 268435455
+
+DLLExport int MQTTSerialize_publishTemplate(unsigned char* buf, int buflen, MQTTString topicName);
+
+DLLExport int MQTTSerialize_publishPrepared(unsigned char* tmpl, int tmpllen, unsigned char dup, int qos, unsigned char retained,
+		unsigned short packetid, int payloadlen, unsigned char** start);
+
 DLLExport int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
 		unsigned char** payload, int* payloadlen, unsigned char* buf, int len);
 
@@ -0,0 +1,43 @@
+/**
+ * @file
+ *
+ * Topic filter index.  Filters are stored in a trie with one node per topic level; a level's named
+ * children are found through a hash table shared by the whole tree, '+' and '#' children hang off
+ * dedicated pointers.  Matching a topic name therefore costs one hash lookup per level (plus the
+ * wildcard branches that actually exist), however many filters are subscribed, and reports every
+ * matching subscriber rather than the first one.
+ *
+ * Subscribers are opaque pointers owned by the caller.  Like the rest of the codec this builds
+ * without Legato.  Subscribers must not be added or removed from inside a match callback.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef MQTTTOPIC_H_
+#define MQTTTOPIC_H_
+
+#if !defined(DLLImport)
+  #define DLLImport
+#endif
+#if !defined(DLLExport)
+  #define DLLExport
+#endif
+
+typedef struct MQTTTopic_tree MQTTTopic_tree;
+
+/* return 1 when the subscriber took the message, it is counted in the result of MQTTTopic_match */
+typedef int (*MQTTTopic_deliverFn)(void* subscriber, void* context);
+
+DLLExport MQTTTopic_tree* MQTTTopic_create(void);
+DLLExport void MQTTTopic_destroy(MQTTTopic_tree* tree);
+
+DLLExport int MQTTTopic_isValidFilter(const char* filter);
+DLLExport int MQTTTopic_add(MQTTTopic_tree* tree, const char* filter, void* subscriber);
+DLLExport int MQTTTopic_remove(MQTTTopic_tree* tree, const char* filter, void* subscriber);
+DLLExport void* MQTTTopic_find(MQTTTopic_tree* tree, const char* filter);
+DLLExport int MQTTTopic_match(MQTTTopic_tree* tree, const char* topic, int topiclen, MQTTTopic_deliverFn deliver, void* context);
+DLLExport int MQTTTopic_count(MQTTTopic_tree* tree);
+
+#endif /* MQTTTOPIC_H_ */
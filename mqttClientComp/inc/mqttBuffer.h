@@ -0,0 +1,36 @@
+/**
+ * @file
+ *
+ * Size-classed packet buffers.  Small packets come from fixed-size pools so that the common case
+ * keeps a constant memory footprint, larger ones are borrowed from the heap only while in use.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_BUFFER_H_
+#define __MQTT_BUFFER_H_
+
+#define MQTT_BUFFER_CLASS_SMALL_SIZE                  256
+#define MQTT_BUFFER_CLASS_MEDIUM_SIZE                 2048
+#define MQTT_BUFFER_CLASS_LARGE_SIZE                  16384
+#define MQTT_BUFFER_CLASS_HUGE_SIZE                   131072
+
+#define MQTT_BUFFER_CLASS_SMALL_COUNT                 16
+#define MQTT_BUFFER_CLASS_MEDIUM_COUNT                8
+#define MQTT_BUFFER_CLASS_LARGE_COUNT                 0
+
+#define MQTT_BUFFER_DEFAULT_MAX_SIZE                  MQTT_BUFFER_CLASS_HUGE_SIZE
+
+void mqttBuffer_init(void);
+int mqttBuffer_setMaxSize(uint32_t);
+uint32_t mqttBuffer_getMaxSize(void);
+
+unsigned char* mqttBuffer_alloc(size_t);
+unsigned char* mqttBuffer_allocSlot(size_t);
+void mqttBuffer_addRef(unsigned char*);
+void mqttBuffer_release(unsigned char*);
+size_t mqttBuffer_capacity(const unsigned char*);
+
+#endif
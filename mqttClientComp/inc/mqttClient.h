@@ -17,19 +17,43 @@
 #ifndef __MQTT_CLIENT_C_
 #define __MQTT_CLIENT_C_
 
+#include <sys/uio.h>
+
 #include "mqtt/mqttPacket.h"
+#include "mqtt/mqttTopic.h"
+#include "mqttBuffer.h"
+#include "mqttResolver.h"
+#include "mqttSession.h"
+#include "mqttStore.h"
+#include "mqttCompress.h"
 
 #define MQTT_CLIENT_INVALID_SOCKET                    -1
 #define MQTT_CLIENT_SOCKET_MONITOR_NAME               "MQTTSockMonitor"
 #define MQTT_CLIENT_CONNECT_TIMER                     "MQTTConnTimer"
 #define MQTT_CLIENT_COMMAND_TIMER                     "MQTTCmdTimer"
 #define MQTT_CLIENT_PING_TIMER                        "MQTTPingTimer"
+#define MQTT_CLIENT_INFLIGHT_TIMER                    "MQTTInflightTimer"
+#define MQTT_CLIENT_LINGER_TIMER                      "MQTTLingerTimer"
+#define MQTT_CLIENT_ATTEMPT_TIMER                     "MQTTAttemptTimer"
+#define MQTT_CLIENT_RECONNECT_TIMER                   "MQTTReconnTimer"
+#define MQTT_CLIENT_ATTEMPT_MONITOR_NAME              "MQTTAttemptMonitor"
+#define MQTT_CLIENT_TX_POOL                           "MQTTTxPool"
+#define MQTT_CLIENT_SUB_POOL                          "MQTTSubPool"
+#define MQTT_CLIENT_SUBSCRIBER_POOL                   "MQTTSubscriberPool"
 #define MQTT_CLIENT_PING_TIMEOUT_MS                   30
 
 #define MQTT_CLIENT_CONNECT_SUCCESS                   0
 #define MQTT_CLIENT_MAX_SEND_RETRIES                  10
 #define MQTT_CLIENT_MAX_PACKET_ID                     65535
-#define MQTT_CLIENT_MAX_MESSAGE_HANDLERS              5
+#define MQTT_CLIENT_SUBSCRIBE_BATCH_MAX               64
+#define MQTT_CLIENT_SUBACK_FAILURE                    0x80
+#define MQTT_CLIENT_INFLIGHT_TABLE_SIZE               512
+#define MQTT_CLIENT_INFLIGHT_WINDOW_DEFAULT           32
+#define MQTT_CLIENT_INFLIGHT_WINDOW_MAX               256
+#define MQTT_CLIENT_INFLIGHT_RETRY_MS                 5000
+#define MQTT_CLIENT_TX_MAX_IOV                        64
+#define MQTT_CLIENT_RX_STAGE_SIZE                     4096
+#define MQTT_CLIENT_COALESCE_MAX_BYTES_DEFAULT        1400
 
 #define MQTT_CLIENT_TOPIC_NAME_LEN                    128
 #define MQTT_CLIENT_KEY_NAME_LEN                      128
@@ -39,17 +63,27 @@
 #define MQTT_CLIENT_DEFAULT_SIZE                      32
 #define MQTT_CLIENT_MAX_URL_LENGTH                    256
 #define MQTT_CLIENT_MAX_PAYLOAD_SIZE                  2048
+#define MQTT_CLIENT_RX_SLOT_SIZE                      MQTT_BUFFER_CLASS_MEDIUM_SIZE
 #define MQTT_CLIENT_MQTT_VERSION                      3
 #define MQTT_CLIENT_CONNECT_TIMEOUT_MS                10000
 #define MQTT_CLIENT_CMD_TIMEOUT_MS                    5000
+#define MQTT_CLIENT_CONNECT_ATTEMPT_DELAY_MS          250
+#define MQTT_CLIENT_CONNECT_MAX_ATTEMPTS              4
+#define MQTT_CLIENT_RECONNECT_BASE_MS                 1000
+#define MQTT_CLIENT_RECONNECT_CAP_MS                  120000
 #define MQTT_CLIENT_TOPIC_NAME_PUBLISH                "/messages/json"
 #define MQTT_CLIENT_TOPIC_NAME_SUBSCRIBE              "/tasks/json"
 #define MQTT_CLIENT_TOPIC_NAME_ACK                    "/acks/json"
 #define MQTT_CLIENT_URL_AIRVANTAGE_SERVER             "eu.airvantage.net"
 #define MQTT_CLIENT_PORT_AIRVANTAGE_SERVER            1883
 #define MQTT_CLIENT_DEFAULT_QOS                       0
-#define MQTT_CLIENT_AV_JSON_KEY_MAX_COUNT             10
-#define MQTT_CLIENT_AV_JSON_KEY_MAX_LENGTH            32
+#define MQTT_CLIENT_COMMAND_POOL                      "MQTTCommandPool"
+#define MQTT_CLIENT_COMMAND_ID_LEN                    64
+#define MQTT_CLIENT_COMMAND_UID_LEN                   64
+#define MQTT_CLIENT_COMMAND_PARAMS_SIZE               2048
+#define MQTT_CLIENT_JSON_TOKENS_MAX                   256
+#define MQTT_CLIENT_COMPRESS_MESSAGES                 0x1
+#define MQTT_CLIENT_COMPRESS_ACKS                     0x2
 
 typedef enum _mqttClient_QoS_e 
 { 
@@ -58,6 +92,40 @@ typedef enum _mqttClient_QoS_e
   MQTT_CLIENT_QOS2, 
 } mqttClient_QoS_e;
 
+// wire format of the payloads the client builds itself: Send() records and command acks
+typedef enum _mqttClient_payloadEncoding_e
+{
+  MQTT_CLIENT_PAYLOAD_JSON = 0,
+  MQTT_CLIENT_PAYLOAD_CBOR,
+} mqttClient_payloadEncoding_e;
+
+typedef enum _mqttClient_inflightState_e
+{
+  MQTT_CLIENT_INFLIGHT_FREE = 0,
+  MQTT_CLIENT_INFLIGHT_PUBLISH_SENT,
+  MQTT_CLIENT_INFLIGHT_PUBREC_RECEIVED,
+  MQTT_CLIENT_INFLIGHT_PUBREL_SENT,
+} mqttClient_inflightState_e;
+
+typedef enum _mqttClient_connState_e
+{
+  MQTT_CLIENT_CONN_IDLE = 0,
+  MQTT_CLIENT_CONN_CONNECTING,
+  MQTT_CLIENT_CONN_CONNECTED,
+  MQTT_CLIENT_CONN_BACKOFF,
+} mqttClient_connState_e;
+
+typedef enum _mqttClient_subState_e
+{
+  MQTT_CLIENT_SUB_FREE = 0,
+  MQTT_CLIENT_SUB_PENDING,
+  MQTT_CLIENT_SUB_SUBSCRIBING,
+  MQTT_CLIENT_SUB_SUBSCRIBED,
+  MQTT_CLIENT_SUB_FAILED,
+  MQTT_CLIENT_SUB_UNSUB_PENDING,
+  MQTT_CLIENT_SUB_UNSUBSCRIBING,
+} mqttClient_subState_e;
+
 typedef struct _mqttClient_connStateData_t
 {
     bool                               isConnected;
@@ -73,27 +141,72 @@ typedef struct _mqttClient_inMsg_t
     char                               timestamp[MQTT_CLIENT_TIMESTAMP_LEN + 1];
 } mqttClient_inMsg_t;
 
+// one AirVantage command with all of its params, reported once with reference counting: every
+// handler releases it.  params holds "key\0value\0" for each of the paramCount params
+typedef struct _mqttClient_command_t
+{
+  char                                 topicName[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+  char                                 id[MQTT_CLIENT_COMMAND_ID_LEN + 1];
+  char                                 uid[MQTT_CLIENT_COMMAND_UID_LEN + 1];
+  char                                 timestamp[MQTT_CLIENT_TIMESTAMP_LEN + 1];
+  uint32_t                             paramCount;
+  uint32_t                             paramsLen;
+  char                                 params[MQTT_CLIENT_COMMAND_PARAMS_SIZE];
+} mqttClient_command_t;
+
+// an inbound message's topic and payload point into its receive slot, a handler that wants to keep
+// them past its return takes a reference with mqttClient_msgRetain() instead of copying
 typedef struct _mqttClient_msg_t
 {
-  char*                                payload;
+  const char*                          payload;
   mqttClient_QoS_e                     qos;
   size_t                               payloadLen;
   unsigned short                       id;
   char                                 retained;
   char                                 dup;
+  unsigned char*                       slot;
 } mqttClient_msg_t;
 
+typedef struct _mqttClient_topic_t
+{
+  unsigned char                        tmpl[MQTTPUBLISH_TEMPLATE_LEN(MQTT_CLIENT_TOPIC_NAME_LEN)];
+  int                                  tmplLen;
+  size_t                               nameLen;
+  char                                 name[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+  uint8_t                              compress;
+} mqttClient_topic_t;
+
 typedef struct _mqttClient_msg_data_t
 {
   mqttClient_msg_t*                    message;
   MQTTString*                          topicName;
+  // -1 until a handler copies the payload to shared memory, the next handlers reuse that copy
+  int32_t                              shmOffset;
 } mqttClient_msg_data_t;
 
-typedef struct _mqttClient_msg_hndlrs_t
+typedef void (*mqttClient_msgHndlr_f)(mqttClient_msg_data_t*);
+typedef void (*mqttClient_subscriberHndlr_f)(mqttClient_msg_data_t*, void*);
+
+// one topic filter the broker should hold for us, restored in bulk after every reconnect
+typedef struct _mqttClient_sub_t
 {
-  const char*                          topicFilter;
-  void                                 (*fp)(mqttClient_msg_data_t*);
-} mqttClient_msg_hndlrs_t;
+  le_dls_Link_t                        link;
+  mqttClient_msgHndlr_f                handler;
+  le_dls_List_t                        subscribers;
+  char                                 topicFilter[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+  uint8_t                              qos;
+  uint8_t                              grantedQoS;
+  uint8_t                              state;
+} mqttClient_sub_t;
+
+// one more consumer of a filter, the broker subscription lives until the last one is removed
+typedef struct _mqttClient_subscriber_t
+{
+  le_dls_Link_t                        link;
+  mqttClient_sub_t*                    sub;
+  mqttClient_subscriberHndlr_f         handler;
+  void*                                context;
+} mqttClient_subscriber_t;
 
 typedef struct _mqttClient_bufferInfo_t 
 {
@@ -102,57 +215,158 @@ typedef struct _mqttClient_bufferInfo_t
   uint32_t                             bytesLeft;
 } mqttClient_bufferInfo_t;
 
+// QoS1/QoS2 publish awaiting acknowledgement, indexed by packet ID in the in-flight table
+typedef struct _mqttClient_inflight_t
+{
+  le_clk_Time_t                        deadline;
+  unsigned char*                       packet;
+  uint32_t                             packetLen;
+  uint32_t                             retries;
+  uint16_t                             packetId;
+  uint8_t                              qos;
+  uint8_t                              state;
+} mqttClient_inflight_t;
+
+// bytes waiting for the socket to become writable, kept in FIFO order
+typedef struct _mqttClient_txPacket_t
+{
+  le_dls_Link_t                        link;
+  uint32_t                             len;
+  uint32_t                             offset;
+  unsigned char                        data[MQTT_CLIENT_MAX_PAYLOAD_SIZE];
+} mqttClient_txPacket_t;
+
+// bytes received by the last recv(), consumed packet by packet by MQTTPacket_readnb()
+typedef struct _mqttClient_rxStage_t
+{
+  unsigned char                        buf[MQTT_CLIENT_RX_STAGE_SIZE];
+  uint32_t                             head;
+  uint32_t                             tail;
+} mqttClient_rxStage_t;
+
+// one of the connection attempts racing to the broker's addresses
+typedef struct _mqttClient_attempt_t
+{
+  le_fdMonitor_Ref_t                   fdMonitor;
+  int32_t                              sock;
+  uint32_t                             addrIdx;
+} mqttClient_attempt_t;
+
 typedef struct _mqttClient_config_t 
 {
   char                                 brokerUrl[MQTT_CLIENT_MAX_URL_LENGTH];
   uint32_t                             portNumber;
   uint32_t                             keepAlive;
   int32_t                              QoS;
+  uint32_t                             inflightWindow;
+  uint32_t                             coalesceLingerMs;
+  uint32_t                             coalesceMaxBytes;
+  uint32_t                             reconnectBaseMs;
+  uint32_t                             reconnectCapMs;
+  uint8_t                              persistentSession;
+  uint8_t                              payloadEncoding;
+  uint8_t                              compressTopics;
+  uint32_t                             compressMinBytes;
 } mqttClient_config_t;
 
+typedef struct _mqttClient_stats_t
+{
+  uint32_t                             connectAttempts;
+  uint32_t                             connectSuccesses;
+  uint32_t                             consecutiveFailures;
+} mqttClient_stats_t;
+
 typedef struct _mqttClient_session_t 
 {
   le_fdMonitor_Ref_t                   sockFdMonitor;
   le_timer_Ref_t                       connTimer;
   le_timer_Ref_t                       cmdTimer;
   le_timer_Ref_t                       pingTimer; 
+  le_timer_Ref_t                       inflightTimer;
+  le_timer_Ref_t                       lingerTimer;
+  le_timer_Ref_t                       attemptTimer;
+  le_timer_Ref_t                       reconnectTimer;
   mqttClient_config_t                  config;
   mqttClient_bufferInfo_t              tx;
-  mqttClient_bufferInfo_t              rx;
+  mqttClient_bufferInfo_t              cmd;
+  mqttClient_rxStage_t                 rxStage;
+  MQTTTransport                        rxTransport;
+  le_dls_List_t                        txQueue;
+  le_mem_PoolRef_t                     txPool;
+  uint32_t                             txQueuedBytes;
+  mqttClient_inflight_t                inflight[MQTT_CLIENT_INFLIGHT_TABLE_SIZE];
+  mqttResolver_addrList_t              addrs;
+  mqttClient_attempt_t                 attempts[MQTT_CLIENT_CONNECT_MAX_ATTEMPTS];
+  uint32_t                             addrNext;
+  uint32_t                             resolveId;
+  unsigned int                         backoffSeed;
+  uint8_t                              connState;
+  unsigned char*                       rxPacket;
+  uint32_t                             rxPacketSize;
+  uint8_t                              rxPaused;
   char                                 secret[MQTT_CLIENT_DEFAULT_SIZE];
   uint32_t                             cmdLen;
   uint32_t                             cmdRetries;
+  uint32_t                             cmdPacketId;
+  uint8_t                              cmdType;
+  mqttClient_sub_t*                    cmdSubs[MQTT_CLIENT_SUBSCRIBE_BATCH_MAX];
+  uint32_t                             cmdSubCount;
   uint32_t                             nextPacketId;
+  uint32_t                             inflightCount;
   int32_t                              sock;
   uint8_t                              isConnected;
 } mqttClient_session_t;
 
 typedef struct _mqttClient_t 
 {
-  mqttClient_msg_hndlrs_t              msgHndlrs[MQTT_CLIENT_MAX_MESSAGE_HANDLERS];
+  le_dls_List_t                        subList;
+  le_mem_PoolRef_t                     subPool;
+  le_mem_PoolRef_t                     subscriberPool;
+  MQTTTopic_tree*                      topicTree;
   le_data_ConnectionStateHandlerRef_t  dataConnectionState;
   le_data_RequestObjRef_t              requestRef;
   le_event_Id_t                        connStateEvent;
   le_event_Id_t                        inMsgEvent;   
+  le_event_Id_t                        commandEvent;
+  le_mem_PoolRef_t                     commandPool;
+  le_thread_Ref_t                      ioThread;
   mqttClient_session_t                 session;
   mqttClient_config_t                  config;
+  mqttClient_stats_t                   stats;
   char                                 key[MQTT_CLIENT_DEFAULT_SIZE];
   char                                 value[MQTT_CLIENT_DEFAULT_SIZE];
   char                                 deviceId[MQTT_CLIENT_DEFAULT_SIZE];
   char                                 subscribeTopic[2*MQTT_CLIENT_DEFAULT_SIZE];
-  void                                 (*defaultMsgHndlr)(mqttClient_msg_data_t*);
+  mqttClient_topic_t                   publishTopic;
+  mqttClient_topic_t                   ackTopic;
+  mqttClient_msgHndlr_f                defaultMsgHndlr;
 } mqttClient_t;
 
-typedef void (*mqttClient_msgHndlr_f)(mqttClient_msg_data_t*);
-
 int mqttClient_publish(mqttClient_t*, const char*, mqttClient_msg_t*);
+int mqttClient_prepareTopic(mqttClient_topic_t*, const char*);
+int mqttClient_publishPrepared(mqttClient_t*, mqttClient_topic_t*, mqttClient_msg_t*);
+void mqttClient_msgRetain(mqttClient_msg_t*);
+void mqttClient_msgRelease(mqttClient_msg_t*);
 int mqttClient_subscribe(mqttClient_t*, const char*, mqttClient_QoS_e, mqttClient_msgHndlr_f);
 int mqttClient_unsubscribe(mqttClient_t*, const char*);
+int mqttClient_subscribeMany(mqttClient_t*, const char* const*, const mqttClient_QoS_e*, int, mqttClient_msgHndlr_f);
+int mqttClient_unsubscribeMany(mqttClient_t*, const char* const*, int);
+mqttClient_subscriber_t* mqttClient_addSubscriber(mqttClient_t*, const char*, mqttClient_QoS_e, mqttClient_subscriberHndlr_f, void*);
+void mqttClient_removeSubscriber(mqttClient_t*, mqttClient_subscriber_t*);
 int mqttClient_disconnect(mqttClient_t*);
 
-int mqttClient_read(uint8_t*, int);
 int mqttClient_disconnectData(mqttClient_t*);
 int mqttClient_connectUser(mqttClient_t*, const char*);
+int mqttClient_setInflightWindow(mqttClient_t*, uint32_t);
+int mqttClient_setMaxPacketSize(mqttClient_t*, uint32_t);
+int mqttClient_setCoalescing(mqttClient_t*, uint32_t, uint32_t);
+int mqttClient_setDnsCacheTtl(mqttClient_t*, uint32_t);
+int mqttClient_setReconnectBackoff(mqttClient_t*, uint32_t, uint32_t);
+int mqttClient_setPersistentSession(mqttClient_t*, bool);
+int mqttClient_setStoreDrainRate(mqttClient_t*, uint32_t);
+int mqttClient_setDispatchWorkers(mqttClient_t*, uint32_t);
+int mqttClient_setPayloadEncoding(mqttClient_t*, uint32_t);
+int mqttClient_setCompression(mqttClient_t*, uint32_t, uint32_t);
 
 mqttClient_t* mqttMain_getClient(void);
 void mqttClient_init(mqttClient_t*);
@@ -0,0 +1,28 @@
+/**
+ * @file
+ *
+ * Optional deflate stage for the payloads the client builds itself.  A payload of at least the
+ * threshold is compressed into a zlib stream (RFC 1950) with a preset dictionary of the AirVantage
+ * message shapes, and sent in its place when that is smaller.  A zlib stream never starts with '['
+ * or '{', nor with a CBOR array or map, so a receiver tells compressed payloads from plain ones by
+ * their first byte; the dictionary id in the stream header names the dictionary.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_COMPRESS_H_
+#define __MQTT_COMPRESS_H_
+
+#define MQTT_COMPRESS_MIN_BYTES_DEFAULT               32
+#define MQTT_COMPRESS_LEVEL                           6
+#define MQTT_COMPRESS_WINDOW_BITS                     12
+#define MQTT_COMPRESS_MEM_LEVEL                       5
+
+int mqttCompress_init(void);
+void mqttCompress_setMinBytes(uint32_t);
+int mqttCompress_deflate(const void*, size_t, void*, size_t, size_t*);
+void mqttCompress_getStatus(uint32_t*, uint32_t*, uint64_t*, uint64_t*, uint64_t*);
+
+#endif
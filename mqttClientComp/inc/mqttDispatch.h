@@ -0,0 +1,30 @@
+/**
+ * @file
+ *
+ * Optional worker pool for inbound message handlers.  When started, the handlers the client
+ * registered for its own subscriptions run on worker threads instead of the Legato event loop, so
+ * the I/O loop only frames packets and sends acks.  Messages on the same topic always go to the
+ * same worker and are handled in arrival order; different topics are handled in parallel.  When a
+ * worker falls a whole ring behind, the I/O loop stops reading the socket until it catches up.
+ *
+ * Include after mqttClient.h.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_DISPATCH_H_
+#define __MQTT_DISPATCH_H_
+
+#define MQTT_DISPATCH_WORKERS_MAX                     8
+#define MQTT_DISPATCH_QUEUE_SIZE                      64
+#define MQTT_DISPATCH_THREAD_NAME                     "MQTTWorker"
+
+int mqttDispatch_start(uint32_t, le_thread_Ref_t, le_event_DeferredFunc_t, void*);
+bool mqttDispatch_isRunning(void);
+bool mqttDispatch_hasRoom(const char*, int, uint32_t);
+int mqttDispatch_post(mqttClient_msgHndlr_f, mqttClient_msg_data_t*);
+void mqttDispatch_getStatus(uint32_t*, uint32_t*, uint32_t*);
+
+#endif
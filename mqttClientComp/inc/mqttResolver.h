@@ -0,0 +1,41 @@
+/**
+ * @file
+ *
+ * Broker name resolution off the event loop.  Lookups run on a dedicated worker thread and the
+ * result is handed back to the requesting thread as a queued function, so a slow DNS server never
+ * stalls the timers and fd handlers of the main loop.  Answers are cached for a configurable time.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_RESOLVER_H_
+#define __MQTT_RESOLVER_H_
+
+#include <sys/socket.h>
+
+#define MQTT_RESOLVER_THREAD_NAME                     "MQTTResolver"
+#define MQTT_RESOLVER_REQUEST_POOL                    "MQTTResolverReq"
+#define MQTT_RESOLVER_MAX_HOST_LEN                    256
+#define MQTT_RESOLVER_MAX_ADDRS                       8
+#define MQTT_RESOLVER_CACHE_SIZE                      4
+#define MQTT_RESOLVER_CACHE_TTL_SEC                   300
+
+typedef struct _mqttResolver_addrList_t
+{
+  struct sockaddr_storage              addr[MQTT_RESOLVER_MAX_ADDRS];
+  socklen_t                            addrLen[MQTT_RESOLVER_MAX_ADDRS];
+  uint32_t                             count;
+} mqttResolver_addrList_t;
+
+// rc is LE_OK or the failure, addrs is only valid for the duration of the call
+typedef void (*mqttResolver_resultHndlr_f)(uint32_t requestId, int rc, const mqttResolver_addrList_t* addrs, void* context);
+
+void mqttResolver_init(void);
+uint32_t mqttResolver_resolve(const char*, mqttResolver_resultHndlr_f, void*);
+void mqttResolver_cancel(uint32_t);
+void mqttResolver_invalidate(const char*);
+void mqttResolver_setCacheTtl(uint32_t);
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * @file
+ *
+ * Durable MQTT session state.  When persistent sessions are enabled the in-flight QoS1/QoS2 table
+ * and the packet ID counter are mirrored into a small file, so that a restarted process can resume
+ * the broker-side session (cleansession=0) and finish every unacknowledged exchange.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_SESSION_H_
+#define __MQTT_SESSION_H_
+
+#define MQTT_SESSION_DIR                              "/home/root/mqttClient"
+#define MQTT_SESSION_FILE                             MQTT_SESSION_DIR "/session.dat"
+#define MQTT_SESSION_TMP_FILE                         MQTT_SESSION_DIR "/session.tmp"
+#define MQTT_SESSION_FLUSH_TIMER                      "MQTTSessionTimer"
+#define MQTT_SESSION_FLUSH_MS                         200
+#define MQTT_SESSION_MAGIC                            0x3153514d
+#define MQTT_SESSION_VERSION                          1
+
+struct _mqttClient_t;
+
+void mqttSession_init(struct _mqttClient_t*);
+int mqttSession_enable(struct _mqttClient_t*, bool);
+void mqttSession_markDirty(struct _mqttClient_t*);
+int mqttSession_flush(struct _mqttClient_t*);
+
+#endif
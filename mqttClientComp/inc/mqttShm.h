@@ -0,0 +1,27 @@
+/**
+ * @file
+ *
+ * Shared-memory ring for inbound payloads.  A payload is copied into the ring once and handed to any
+ * number of local apps as an offset into a read-only mapping of the same memory; its space is reused
+ * once every app it was given to has released it.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_SHM_H_
+#define __MQTT_SHM_H_
+
+#define MQTT_SHM_NAME                                 "/mqttClientRaw"
+#define MQTT_SHM_SIZE                                 (1024 * 1024)
+
+int mqttShm_init(void);
+int mqttShm_getFd(void);
+uint32_t mqttShm_getSize(void);
+int mqttShm_alloc(const void*, size_t, uint32_t*);
+void mqttShm_addRef(uint32_t);
+void mqttShm_release(uint32_t);
+void mqttShm_getStatus(uint32_t*, uint32_t*, uint32_t*);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file
+ *
+ * Offline store-and-forward log.  Publishes made while the broker is unreachable are appended to a
+ * memory-mapped ring of fixed-size segments on flash and drained, at a configurable rate, once the
+ * session is back up.  When the ring is full the oldest segment is evicted.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#ifndef __MQTT_STORE_H_
+#define __MQTT_STORE_H_
+
+#define MQTT_STORE_DIR                                "/home/root/mqttClient"
+#define MQTT_STORE_FILE                               MQTT_STORE_DIR "/store.log"
+#define MQTT_STORE_SYNC_TIMER                         "MQTTStoreSyncTimer"
+#define MQTT_STORE_DRAIN_TIMER                        "MQTTStoreDrainTimer"
+#define MQTT_STORE_SEGMENT_SIZE                       65536
+#define MQTT_STORE_SEGMENT_COUNT                      16
+#define MQTT_STORE_SEGMENT_MAGIC                      0x4753514d
+#define MQTT_STORE_MAX_TOPIC_LEN                      255
+#define MQTT_STORE_SYNC_MS                            100
+#define MQTT_STORE_DRAIN_TICK_MS                      100
+#define MQTT_STORE_DRAIN_BATCH_MAX                    64
+#define MQTT_STORE_DRAIN_RATE_DEFAULT                 50
+
+struct _mqttClient_t;
+
+int mqttStore_init(void);
+int mqttStore_append(const char*, const void*, size_t, uint8_t, uint8_t);
+int mqttStore_sync(void);
+void mqttStore_startDrain(struct _mqttClient_t*);
+void mqttStore_stopDrain(void);
+void mqttStore_setDrainRate(uint32_t);
+void mqttStore_getStatus(uint32_t*, uint32_t*, uint32_t*);
+
+#endif
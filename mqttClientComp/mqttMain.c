@@ -4,21 +4,38 @@
  * Copyright (C) Sierra Wireless Inc. Use of this work is subject to license.
  *
  */
+#include <sys/stat.h>
+
 #include "legato.h"
 #include "interfaces.h"
 #include "json/swir_json.h"
+#include "cbor/swir_cbor.h"
 #include "mqttMain.h"
 
 static mqttClient_t mqttClient;
+static le_mem_PoolRef_t mqttMain_subscriptionPool;
+static le_ref_MapRef_t mqttMain_subscriptionMap;
+static le_mem_PoolRef_t mqttMain_rawPayloadPool;
+static le_ref_MapRef_t mqttMain_rawPayloadMap;
 
 static int mqttMain_SendMessage(const char*, const char*);
 static void mqttMain_SessionStateHandler(void*, void*);
 static void mqttMain_IncomingMessageHandler(void*, void*);
+static void mqttMain_CommandHandler(void*, void*);
+static int mqttMain_GetTopicName(mqttClient_msg_data_t*, char*, size_t);
+static void mqttMain_SubscriptionHandler(mqttClient_msg_data_t*, void*);
+static void mqttMain_RawMessageHandler(mqttClient_msg_data_t*, void*);
+static mqttMain_subscription_t* mqttMain_CreateSubscription(const char*, uint8_t, mqttClient_subscriberHndlr_f, void*, void**);
+static void mqttMain_DeleteSubscription(void*, mqttMain_subscription_t*);
+static void mqttMain_ReleaseRawPayload(void*, mqttMain_rawPayload_t*);
+static void mqttMain_ServiceCloseHandler(le_msg_SessionRef_t, void*);
 static void mqttMain_SigTermEventHandler(int);
 
 static int mqttMain_SendMessage(const char* key, const char* value)
 {
-  char* payload = swirjson_szSerialize(key, value, 0);
+  char payload[MQTT_CLIENT_MAX_PAYLOAD_SIZE];
+  swirjson_writer_t writer;
+  int len;
   int rc = -1;
 
   mqttClient_msg_t msg = {
@@ -27,29 +44,49 @@ static int mqttMain_SendMessage(const char* key, const char* value)
     .dup = 0,
     .id = 0,
     .payload = payload,
-    .payloadLen = strlen(payload),
   };
 
-  char* topic = malloc(strlen(MQTT_CLIENT_TOPIC_NAME_PUBLISH) + strlen(mqttClient.deviceId) + 1);
-  if (!topic)
+  if (mqttClient.config.payloadEncoding == MQTT_CLIENT_PAYLOAD_CBOR)
   {
-    LE_ERROR("malloc() failed");
-    goto cleanup;
+    len = swircbor_encodeRecord((uint8_t*)payload, sizeof(payload), key, value, 0);
+    if (len < 0)
+    {
+      LE_ERROR("swircbor_encodeRecord() failed(%d)", len);
+      rc = LE_OVERFLOW;
+      goto cleanup;
+    }
+
+    LE_INFO("topic('%s') key('%s') CBOR len(%d)", mqttClient.publishTopic.name, key, len);
+  }
+  else
+  {
+    swirjson_initWriter(&writer, payload, sizeof(payload));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, key);
+    swirjson_writeString(&writer, value);
+    swirjson_endObject(&writer);
+
+    len = swirjson_finish(&writer);
+    if (len < 0)
+    {
+      LE_ERROR("swirjson_finish() failed(%d)", len);
+      rc = LE_OVERFLOW;
+      goto cleanup;
+    }
+
+    LE_INFO("topic('%s') payload('%s')", mqttClient.publishTopic.name, payload);
   }
 
-  sprintf(topic, "%s%s", mqttClient.deviceId, MQTT_CLIENT_TOPIC_NAME_PUBLISH);
-  LE_INFO("topic('%s') payload('%s')", topic, payload);
+  msg.payloadLen = len;
 
-  rc = mqttClient_publish(&mqttClient, topic, &msg);
+  rc = mqttClient_publishPrepared(&mqttClient, &mqttClient.publishTopic, &msg);
   if (rc)
   {
-    LE_ERROR("mqttClient_publish() failed(%d)", rc);
+    LE_ERROR("mqttClient_publishPrepared() failed(%d)", rc);
     goto cleanup;
   }
 
 cleanup:
-  if (topic) free(topic);
-  if (payload) free(payload);
   return rc;
 }
 
@@ -69,6 +106,28 @@ static void mqttMain_IncomingMessageHandler(void* reportPtr, void* incomingMessa
                     le_event_GetContextPtr());
 }
 
+static void mqttMain_CommandHandler(void* reportPtr, void* commandHandler)
+{
+  mqttClient_command_t* command = reportPtr;
+  mqtt_CommandHandlerFunc_t clientHandlerFunc = commandHandler;
+
+  LE_ASSERT(reportPtr);
+  LE_ASSERT(commandHandler);
+
+  LE_DEBUG("topic('%s') id('%s') params(%u) ts('%s')", command->topicName, command->id, command->paramCount, command->timestamp);
+  clientHandlerFunc(command->topicName,
+                    command->id,
+                    command->uid,
+                    command->timestamp,
+                    command->paramCount,
+                    (const uint8_t*)command->params,
+                    command->paramsLen,
+                    le_event_GetContextPtr());
+
+  // reported with reference counting, every handler drops its own reference
+  le_mem_Release(reportPtr);
+}
+
 static void mqttMain_SessionStateHandler(void* reportPtr, void* sessionStateHandler)
 {
   mqttClient_connStateData_t* eventDataPtr = reportPtr;
@@ -80,6 +139,163 @@ static void mqttMain_SessionStateHandler(void* reportPtr, void* sessionStateHand
                     le_event_GetContextPtr());
 }
 
+static int mqttMain_GetTopicName(mqttClient_msg_data_t* msgData, char* topicName, size_t size)
+{
+  int topicLen = MQTTstrlen(*msgData->topicName);
+
+  if (topicLen >= size)
+  {
+    LE_WARN("topic too long(%d)", topicLen);
+    return LE_OVERFLOW;
+  }
+
+  memcpy(topicName, msgData->topicName->cstring ? msgData->topicName->cstring:msgData->topicName->lenstring.data, topicLen);
+  topicName[topicLen] = '\0';
+  return LE_OK;
+}
+
+static void mqttMain_SubscriptionHandler(mqttClient_msg_data_t* msgData, void* context)
+{
+  mqttMain_subscription_t* subscription = context;
+  char topicName[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+
+  if (msgData->message->payloadLen > MQTT_MAIN_SUBSCRIPTION_PAYLOAD_MAX)
+  {
+    LE_WARN("payload too large(%zu) for subscription(%p)", msgData->message->payloadLen, subscription);
+    return;
+  }
+  else if (mqttMain_GetTopicName(msgData, topicName, sizeof(topicName)))
+  {
+    return;
+  }
+
+  // the handler is the IPC stub of the one client that subscribed, nobody else is woken up
+  subscription->handlerPtr(topicName, (const uint8_t*)msgData->message->payload, msgData->message->payloadLen, subscription->contextPtr);
+}
+
+static void mqttMain_RawMessageHandler(mqttClient_msg_data_t* msgData, void* context)
+{
+  mqttMain_subscription_t* subscription = context;
+  mqttMain_rawPayload_t* rawPayload = NULL;
+  char topicName[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+  uint32_t offset = 0;
+  int rc = LE_OK;
+
+  if (mqttMain_GetTopicName(msgData, topicName, sizeof(topicName)))
+  {
+    return;
+  }
+
+  // one copy per message, however many clients it goes to
+  if (msgData->shmOffset < 0)
+  {
+    rc = mqttShm_alloc(msgData->message->payload, msgData->message->payloadLen, &offset);
+    if (rc)
+    {
+      LE_ERROR("mqttShm_alloc() failed(%d), drop message for subscription(%p)", rc, subscription);
+      return;
+    }
+
+    msgData->shmOffset = offset;
+  }
+  else
+  {
+    offset = msgData->shmOffset;
+    mqttShm_addRef(offset);
+  }
+
+  rawPayload = le_mem_ForceAlloc(mqttMain_rawPayloadPool);
+  rawPayload->offset = offset;
+  rawPayload->sessionRef = subscription->sessionRef;
+
+  subscription->rawHandlerPtr(topicName,
+                              msgData->message->qos,
+                              msgData->message->retained,
+                              le_ref_CreateRef(mqttMain_rawPayloadMap, rawPayload),
+                              offset,
+                              msgData->message->payloadLen,
+                              subscription->contextPtr);
+}
+
+static mqttMain_subscription_t* mqttMain_CreateSubscription(const char* topicFilter, uint8_t QoS, mqttClient_subscriberHndlr_f handler,
+    void* contextPtr, void** refPtr)
+{
+  mqttMain_subscription_t* subscription = le_mem_ForceAlloc(mqttMain_subscriptionPool);
+
+  memset(subscription, 0, sizeof(*subscription));
+  subscription->contextPtr = contextPtr;
+  subscription->sessionRef = mqtt_GetClientSessionRef();
+  subscription->subscriber = mqttClient_addSubscriber(&mqttClient, topicFilter, QoS, handler, subscription);
+  if (!subscription->subscriber)
+  {
+    LE_ERROR("mqttClient_addSubscriber('%s') failed", topicFilter);
+    le_mem_Release(subscription);
+    *refPtr = NULL;
+    return NULL;
+  }
+
+  *refPtr = le_ref_CreateRef(mqttMain_subscriptionMap, subscription);
+  return subscription;
+}
+
+static void mqttMain_DeleteSubscription(void* ref, mqttMain_subscription_t* subscription)
+{
+  le_ref_DeleteRef(mqttMain_subscriptionMap, ref);
+  mqttClient_removeSubscriber(&mqttClient, subscription->subscriber);
+  le_mem_Release(subscription);
+}
+
+static void mqttMain_ReleaseRawPayload(void* ref, mqttMain_rawPayload_t* rawPayload)
+{
+  le_ref_DeleteRef(mqttMain_rawPayloadMap, ref);
+  mqttShm_release(rawPayload->offset);
+  le_mem_Release(rawPayload);
+}
+
+static void mqttMain_ServiceCloseHandler(le_msg_SessionRef_t sessionRef, void* contextPtr)
+{
+  le_ref_IterRef_t iter;
+  bool found = true;
+
+  // the map must not change while it is iterated, so start over after every deletion
+  while (found)
+  {
+    found = false;
+    iter = le_ref_GetIterator(mqttMain_subscriptionMap);
+    while (le_ref_NextNode(iter) == LE_OK)
+    {
+      mqttMain_subscription_t* subscription = le_ref_GetValue(iter);
+
+      if (subscription->sessionRef == sessionRef)
+      {
+        LE_DEBUG("client session(%p) closed, drop subscription(%p)", sessionRef, subscription);
+        mqttMain_DeleteSubscription((void*)le_ref_GetSafeRef(iter), subscription);
+        found = true;
+        break;
+      }
+    }
+  }
+
+  // payloads it never released would otherwise hold the shared memory ring forever
+  found = true;
+  while (found)
+  {
+    found = false;
+    iter = le_ref_GetIterator(mqttMain_rawPayloadMap);
+    while (le_ref_NextNode(iter) == LE_OK)
+    {
+      mqttMain_rawPayload_t* rawPayload = le_ref_GetValue(iter);
+
+      if (rawPayload->sessionRef == sessionRef)
+      {
+        mqttMain_ReleaseRawPayload((void*)le_ref_GetSafeRef(iter), rawPayload);
+        found = true;
+        break;
+      }
+    }
+  }
+}
+
 static void mqttMain_SigTermEventHandler(int sigNum)
 {
   LE_INFO("disconnect");
@@ -155,13 +371,222 @@ le_result_t mqtt_Publish(const char* topic, const uint8_t* payload, size_t paylo
         .retained = 0,
         .dup = 0,
         .id = 0,
-        .payload = (char*)payload, // gross, we have to cast away const-ness of the payload
+        .payload = (const char*)payload,
         .payloadLen = payloadLength,
     };
 
     return mqttClient_publish(&mqttClient, topic, &msg);
 }
 
+le_result_t mqtt_PublishFile(const char* topic, int payloadFd)
+{
+  uint32_t maxSize = mqttBuffer_getMaxSize();
+  unsigned char* payload = NULL;
+  size_t payloadLen = 0;
+  size_t capacity = MQTT_BUFFER_CLASS_SMALL_SIZE;
+  le_result_t rc = LE_OK;
+  struct stat st;
+
+  // a regular file is read into a buffer of its size, so small files stay in the pools
+  if (!fstat(payloadFd, &st) && S_ISREG(st.st_mode))
+  {
+    if (st.st_size > maxSize)
+    {
+      LE_ERROR("file too large(%jd > %u)", (intmax_t)st.st_size, maxSize);
+      rc = LE_OVERFLOW;
+      goto cleanup;
+    }
+
+    capacity = st.st_size;
+  }
+
+  payload = mqttBuffer_alloc(capacity);
+  if (!payload)
+  {
+    LE_ERROR("mqttBuffer_alloc() failed");
+    rc = LE_NO_MEMORY;
+    goto cleanup;
+  }
+
+  capacity = mqttBuffer_capacity(payload);
+  if (capacity > maxSize) capacity = maxSize;
+
+  for (;;)
+  {
+    unsigned char probe;
+    unsigned char* bigger;
+    ssize_t bytes;
+
+    if (payloadLen < capacity)
+    {
+      bytes = read(payloadFd, payload + payloadLen, capacity - payloadLen);
+    }
+    else
+    {
+      // full: one byte tells the end of the file from a pipe or a file that grew
+      bytes = read(payloadFd, &probe, 1);
+    }
+
+    if (bytes == -1)
+    {
+      if (errno == EINTR) continue;
+
+      LE_ERROR("read() failed(%d)", errno);
+      rc = LE_IO_ERROR;
+      goto cleanup;
+    }
+    else if (bytes == 0)
+    {
+      break;
+    }
+    else if (payloadLen < capacity)
+    {
+      payloadLen += bytes;
+      continue;
+    }
+
+    if (capacity >= maxSize)
+    {
+      LE_ERROR("file too large(> %u)", maxSize);
+      rc = LE_OVERFLOW;
+      goto cleanup;
+    }
+
+    // on to the next size class, the heap only past the largest pool
+    if (capacity < MQTT_BUFFER_CLASS_MEDIUM_SIZE) capacity = MQTT_BUFFER_CLASS_MEDIUM_SIZE;
+    else if (capacity < MQTT_BUFFER_CLASS_LARGE_SIZE) capacity = MQTT_BUFFER_CLASS_LARGE_SIZE;
+    else capacity = maxSize;
+
+    if (capacity > maxSize) capacity = maxSize;
+
+    bigger = mqttBuffer_alloc(capacity);
+    if (!bigger)
+    {
+      LE_ERROR("mqttBuffer_alloc() failed");
+      rc = LE_NO_MEMORY;
+      goto cleanup;
+    }
+
+    memcpy(bigger, payload, payloadLen);
+    bigger[payloadLen++] = probe;
+    mqttBuffer_release(payload);
+    payload = bigger;
+  }
+
+  mqttClient_msg_t msg =
+  {
+    .qos = mqttClient.session.config.QoS,
+    .retained = 0,
+    .dup = 0,
+    .id = 0,
+    .payload = (const char*)payload,
+    .payloadLen = payloadLen,
+  };
+
+  LE_INFO("topic('%s') file payload(%zu)", topic, payloadLen);
+  rc = mqttClient_publish(&mqttClient, topic, &msg);
+
+cleanup:
+  close(payloadFd);
+  mqttBuffer_release(payload);
+  return rc;
+}
+
+le_result_t mqtt_SetPublishCoalescing(uint32_t lingerMs, uint32_t maxBytes)
+{
+  return mqttClient_setCoalescing(&mqttClient, lingerMs, maxBytes);
+}
+
+le_result_t mqtt_SetDnsCacheTtl(uint32_t ttlSec)
+{
+  return mqttClient_setDnsCacheTtl(&mqttClient, ttlSec);
+}
+
+le_result_t mqtt_SetReconnectBackoff(uint32_t baseMs, uint32_t capMs)
+{
+  return mqttClient_setReconnectBackoff(&mqttClient, baseMs, capMs);
+}
+
+void mqtt_GetConnectionStats(uint32_t* connectAttempts, uint32_t* connectSuccesses, uint32_t* consecutiveFailures)
+{
+  *connectAttempts = mqttClient.stats.connectAttempts;
+  *connectSuccesses = mqttClient.stats.connectSuccesses;
+  *consecutiveFailures = mqttClient.stats.consecutiveFailures;
+}
+
+le_result_t mqtt_SetPersistentSession(bool enable)
+{
+  return mqttClient_setPersistentSession(&mqttClient, enable);
+}
+
+le_result_t mqtt_SetStoreDrainRate(uint32_t msgsPerSec)
+{
+  return mqttClient_setStoreDrainRate(&mqttClient, msgsPerSec);
+}
+
+void mqtt_GetStoreStatus(uint32_t* depth, uint32_t* bytes, uint32_t* dropped)
+{
+  mqttStore_getStatus(depth, bytes, dropped);
+}
+
+le_result_t mqtt_SetDispatchWorkers(uint32_t workerCount)
+{
+  return mqttClient_setDispatchWorkers(&mqttClient, workerCount);
+}
+
+le_result_t mqtt_SetPayloadEncoding(mqtt_PayloadEncoding_t encoding)
+{
+  switch (encoding)
+  {
+  case MQTT_PAYLOAD_ENCODING_JSON:
+    return mqttClient_setPayloadEncoding(&mqttClient, MQTT_CLIENT_PAYLOAD_JSON);
+
+  case MQTT_PAYLOAD_ENCODING_CBOR:
+    return mqttClient_setPayloadEncoding(&mqttClient, MQTT_CLIENT_PAYLOAD_CBOR);
+
+  default:
+    return LE_OUT_OF_RANGE;
+  }
+}
+
+le_result_t mqtt_SetCompression(mqtt_CompressTopic_t topics, uint32_t minBytes)
+{
+  uint32_t clientTopics = 0;
+
+  if (topics & ~(MQTT_COMPRESS_MESSAGES | MQTT_COMPRESS_ACKS))
+  {
+    return LE_OUT_OF_RANGE;
+  }
+
+  if (topics & MQTT_COMPRESS_MESSAGES)
+  {
+    clientTopics |= MQTT_CLIENT_COMPRESS_MESSAGES;
+  }
+
+  if (topics & MQTT_COMPRESS_ACKS)
+  {
+    clientTopics |= MQTT_CLIENT_COMPRESS_ACKS;
+  }
+
+  return mqttClient_setCompression(&mqttClient, clientTopics, minBytes);
+}
+
+void mqtt_GetCompressionStats(uint32_t* compressed, uint32_t* uncompressed, uint64_t* bytesIn, uint64_t* bytesOut,
+    uint64_t* cpuUs)
+{
+  mqttCompress_getStatus(compressed, uncompressed, bytesIn, bytesOut, cpuUs);
+}
+
+le_result_t mqtt_SetMaxPacketSize(uint32_t maxPacketSize)
+{
+  return mqttClient_setMaxPacketSize(&mqttClient, maxPacketSize);
+}
+
+le_result_t mqtt_SetInFlightWindow(uint32_t windowSize)
+{
+  return mqttClient_setInflightWindow(&mqttClient, windowSize);
+}
+
 mqtt_SessionStateHandlerRef_t mqtt_AddSessionStateHandler(mqtt_SessionStateHandlerFunc_t handlerPtr, void* contextPtr)
 {
   LE_DEBUG("add session state handler(%p)", handlerPtr);
@@ -198,6 +623,106 @@ void mqtt_RemoveIncomingMessageHandler(mqtt_IncomingMessageHandlerRef_t addHandl
   le_event_RemoveHandler((le_event_HandlerRef_t)addHandlerRef);
 }
 
+mqtt_CommandHandlerRef_t mqtt_AddCommandHandler(mqtt_CommandHandlerFunc_t handlerPtr, void* contextPtr)
+{
+  LE_DEBUG("add command handler(%p)", handlerPtr);
+  le_event_HandlerRef_t handlerRef = le_event_AddLayeredHandler("MqttCommand",
+                                                                mqttClient.commandEvent,
+                                                                mqttMain_CommandHandler,
+                                                                (le_event_HandlerFunc_t)handlerPtr);
+
+  le_event_SetContextPtr(handlerRef, contextPtr);
+  return (mqtt_CommandHandlerRef_t)(handlerRef);
+}
+
+void mqtt_RemoveCommandHandler(mqtt_CommandHandlerRef_t addHandlerRef)
+{
+  LE_DEBUG("remove command handler(%p)", addHandlerRef);
+  le_event_RemoveHandler((le_event_HandlerRef_t)addHandlerRef);
+}
+
+mqtt_SubscriptionHandlerRef_t mqtt_AddSubscriptionHandler(const char* topicFilter, uint8_t QoS, mqtt_MessageHandlerFunc_t handlerPtr, void* contextPtr)
+{
+  mqttMain_subscription_t* subscription = NULL;
+  void* ref = NULL;
+
+  LE_ASSERT(handlerPtr);
+
+  subscription = mqttMain_CreateSubscription(topicFilter, QoS, mqttMain_SubscriptionHandler, contextPtr, &ref);
+  if (subscription)
+  {
+    subscription->handlerPtr = handlerPtr;
+  }
+
+  LE_DEBUG("add subscription handler(%p) filter('%s') ref(%p)", handlerPtr, topicFilter, ref);
+  return (mqtt_SubscriptionHandlerRef_t)ref;
+}
+
+void mqtt_RemoveSubscriptionHandler(mqtt_SubscriptionHandlerRef_t addHandlerRef)
+{
+  mqttMain_subscription_t* subscription = le_ref_Lookup(mqttMain_subscriptionMap, addHandlerRef);
+
+  LE_DEBUG("remove subscription handler(%p)", addHandlerRef);
+  if (!subscription || !subscription->handlerPtr)
+  {
+    LE_ERROR("invalid subscription(%p)", addHandlerRef);
+    return;
+  }
+
+  mqttMain_DeleteSubscription(addHandlerRef, subscription);
+}
+
+mqtt_RawMessageHandlerRef_t mqtt_AddRawMessageHandler(const char* topicFilter, uint8_t QoS, mqtt_RawMessageHandlerFunc_t handlerPtr, void* contextPtr)
+{
+  mqttMain_subscription_t* subscription = NULL;
+  void* ref = NULL;
+
+  LE_ASSERT(handlerPtr);
+
+  subscription = mqttMain_CreateSubscription(topicFilter, QoS, mqttMain_RawMessageHandler, contextPtr, &ref);
+  if (subscription)
+  {
+    subscription->rawHandlerPtr = handlerPtr;
+  }
+
+  LE_DEBUG("add raw message handler(%p) filter('%s') ref(%p)", handlerPtr, topicFilter, ref);
+  return (mqtt_RawMessageHandlerRef_t)ref;
+}
+
+void mqtt_RemoveRawMessageHandler(mqtt_RawMessageHandlerRef_t addHandlerRef)
+{
+  mqttMain_subscription_t* subscription = le_ref_Lookup(mqttMain_subscriptionMap, addHandlerRef);
+
+  LE_DEBUG("remove raw message handler(%p)", addHandlerRef);
+  if (!subscription || !subscription->rawHandlerPtr)
+  {
+    LE_ERROR("invalid raw message handler(%p)", addHandlerRef);
+    return;
+  }
+
+  mqttMain_DeleteSubscription(addHandlerRef, subscription);
+}
+
+le_result_t mqtt_GetRawMessageBuffer(int* bufferFdPtr, uint32_t* sizePtr)
+{
+  *sizePtr = mqttShm_getSize();
+  *bufferFdPtr = mqttShm_getFd();
+  return (*bufferFdPtr == -1) ? LE_UNAVAILABLE:LE_OK;
+}
+
+void mqtt_ReleaseRawMessage(mqtt_RawPayloadRef_t payloadRef)
+{
+  mqttMain_rawPayload_t* rawPayload = le_ref_Lookup(mqttMain_rawPayloadMap, payloadRef);
+
+  if (!rawPayload || (rawPayload->sessionRef != mqtt_GetClientSessionRef()))
+  {
+    LE_ERROR("invalid payload(%p)", payloadRef);
+    return;
+  }
+
+  mqttMain_ReleaseRawPayload(payloadRef, rawPayload);
+}
+
 COMPONENT_INIT
 {
   LE_INFO("Init mqttClient");
@@ -206,5 +731,15 @@ COMPONENT_INIT
   le_sig_SetEventHandler(SIGTERM, mqttMain_SigTermEventHandler);
 
   mqttClient_init(&mqttClient);
+
+  mqttMain_subscriptionPool = le_mem_CreatePool(MQTT_MAIN_SUBSCRIPTION_POOL, sizeof(mqttMain_subscription_t));
+  mqttMain_subscriptionMap = le_ref_CreateMap(MQTT_MAIN_SUBSCRIPTION_MAP, MQTT_MAIN_SUBSCRIPTION_MAP_SIZE);
+  mqttMain_rawPayloadPool = le_mem_CreatePool(MQTT_MAIN_RAW_PAYLOAD_POOL, sizeof(mqttMain_rawPayload_t));
+  mqttMain_rawPayloadMap = le_ref_CreateMap(MQTT_MAIN_RAW_PAYLOAD_MAP, MQTT_MAIN_RAW_PAYLOAD_MAP_SIZE);
+  if (mqttShm_init())
+  {
+    LE_ERROR("shared memory unavailable, raw messages cannot be delivered");
+  }
+  le_msg_AddServiceCloseHandler(mqtt_GetServiceRef(), mqttMain_ServiceCloseHandler, NULL);
 }
 
@@ -8,9 +8,34 @@
 
 #include "le_data_interface.h"
 #include "mqttClient.h"
+#include "mqttShm.h"
 
 #ifndef __MQTT_MAIN_H_
 #define __MQTT_MAIN_H_
 
+#define MQTT_MAIN_SUBSCRIPTION_POOL                   "MqttSubscriptionPool"
+#define MQTT_MAIN_SUBSCRIPTION_MAP                    "MqttSubscriptions"
+#define MQTT_MAIN_SUBSCRIPTION_MAP_SIZE               32
+#define MQTT_MAIN_SUBSCRIPTION_PAYLOAD_MAX            2048
+#define MQTT_MAIN_RAW_PAYLOAD_POOL                    "MqttRawPayloadPool"
+#define MQTT_MAIN_RAW_PAYLOAD_MAP                     "MqttRawPayloads"
+#define MQTT_MAIN_RAW_PAYLOAD_MAP_SIZE                64
+
+// a topic filter one IPC client subscribed to, messages are sent to that client only
+typedef struct _mqttMain_subscription_t
+{
+  mqttClient_subscriber_t*             subscriber;
+  mqtt_MessageHandlerFunc_t            handlerPtr;
+  mqtt_RawMessageHandlerFunc_t         rawHandlerPtr;
+  void*                                contextPtr;
+  le_msg_SessionRef_t                  sessionRef;
+} mqttMain_subscription_t;
+
+// a payload in shared memory one IPC client has not released yet
+typedef struct _mqttMain_rawPayload_t
+{
+  uint32_t                             offset;
+  le_msg_SessionRef_t                  sessionRef;
+} mqttMain_rawPayload_t;
 
 #endif
@@ -0,0 +1,452 @@
+/**
+ * @file
+ *
+ * Size and cost of CBOR payloads against the JSON ones they replace.
+ *
+ * encode/ cases build the telemetry records Send() and the serializers produce, with the JSON
+ * writer and with the CBOR writer, into a stack buffer.  decode/ cases read the command files of the
+ * JSON corpus (../json/corpus/ by default, cmd_*.json) the way the client does: uid, timestamp, id,
+ * then every param, once from the JSON and once from a CBOR copy of it made at startup.
+ *
+ * Output is the format of ../json/bench_common.h, MB/s over the bytes produced or read.  Payload sizes are listed in '#' comments before
+ * the cases that build or read them.  Before timing, every CBOR copy of a command is read back to
+ * JSON and must index to as many tokens as the original, with the same params found.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json/swir_json.h"
+#include "cbor/swir_cbor.h"
+#include "../json/bench_common.h"
+
+#define BENCH_DEFAULT_CORPUS                          "../json/corpus"
+#define BENCH_JSON_TOKENS_MAX                         4096
+#define BENCH_KEY_LEN                                 128
+#define BENCH_LIST_COUNT                              16
+#define BENCH_TIMESTAMP                               1498662247030UL
+
+static double bench_doubles[BENCH_VALUE_COUNT];
+static float bench_floats[BENCH_VALUE_COUNT];
+static char bench_values[BENCH_VALUE_COUNT][16];
+static uint8_t* bench_cbor;
+static size_t bench_cborLen;
+static swirjson_token_t bench_tokens[BENCH_JSON_TOKENS_MAX];
+static int bench_order[BENCH_JSON_TOKENS_MAX];
+
+/* {key:value} or {timestamp:{key:value}}, what the serializers write, up to the value */
+static void bench_jsonRecord(swirjson_writer_t* writer, const char* key, unsigned long timestamp)
+{
+    char number[SWIRJSON_NUMBER_LEN_MAX];
+
+    swirjson_initWriter(writer, bench_buffer, sizeof(bench_buffer));
+    swirjson_beginObject(writer);
+    if (timestamp)
+    {
+        swirjson_formatUInt(number, timestamp);
+        swirjson_writeKey(writer, number);
+        swirjson_beginObject(writer);
+    }
+    swirjson_writeKey(writer, key);
+}
+
+static int bench_jsonFinish(swirjson_writer_t* writer, unsigned long timestamp)
+{
+    if (timestamp)
+        swirjson_endObject(writer);
+    swirjson_endObject(writer);
+    return swirjson_finish(writer);
+}
+
+static size_t bench_recordJson(void)
+{
+    swirjson_writer_t writer;
+
+    bench_jsonRecord(&writer, "status", 0);
+    swirjson_writeString(&writer, bench_values[bench_next()]);
+    return bench_sink = bench_jsonFinish(&writer, 0);
+}
+
+static size_t bench_recordCbor(void)
+{
+    return bench_sink = swircbor_encodeRecord((uint8_t*)bench_buffer, sizeof(bench_buffer), "status",
+                                              bench_values[bench_next()], 0);
+}
+
+/* JSON keeps two decimals as swirjson_fSerialize() does, CBOR keeps the whole float */
+static size_t bench_floatJson(void)
+{
+    swirjson_writer_t writer;
+
+    bench_jsonRecord(&writer, "temperature", 0);
+    swirjson_writeFloat(&writer, bench_floats[bench_next()], 2);
+    return bench_sink = bench_jsonFinish(&writer, 0);
+}
+
+static size_t bench_floatCbor(void)
+{
+    return bench_sink = swircbor_encodeFloatRecord((uint8_t*)bench_buffer, sizeof(bench_buffer), "temperature",
+                                                   bench_floats[bench_next()], 0);
+}
+
+static size_t bench_floatTimestampedJson(void)
+{
+    swirjson_writer_t writer;
+
+    bench_jsonRecord(&writer, "temperature", BENCH_TIMESTAMP);
+    swirjson_writeFloat(&writer, bench_floats[bench_next()], 2);
+    return bench_sink = bench_jsonFinish(&writer, BENCH_TIMESTAMP);
+}
+
+static size_t bench_floatTimestampedCbor(void)
+{
+    return bench_sink = swircbor_encodeFloatRecord((uint8_t*)bench_buffer, sizeof(bench_buffer), "temperature",
+                                                   bench_floats[bench_next()], BENCH_TIMESTAMP);
+}
+
+/* the swirjson_lstSerialize() shape, values as text */
+static size_t bench_listJson(void)
+{
+    swirjson_writer_t writer;
+    int i;
+
+    swirjson_initWriter(&writer, bench_buffer, sizeof(bench_buffer));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, "temperature");
+    swirjson_beginArray(&writer);
+    for (i = 0; i < BENCH_LIST_COUNT; i++)
+    {
+        int index = bench_next();
+
+        swirjson_beginObject(&writer);
+        swirjson_writeKey(&writer, "timestamp");
+        swirjson_writeUInt(&writer, BENCH_TIMESTAMP + index);
+        swirjson_writeKey(&writer, "value");
+        swirjson_writeString(&writer, bench_values[index]);
+        swirjson_endObject(&writer);
+    }
+    swirjson_endArray(&writer);
+    swirjson_endObject(&writer);
+    return bench_sink = swirjson_finish(&writer);
+}
+
+static size_t bench_listCbor(void)
+{
+    unsigned long timestamps[BENCH_LIST_COUNT];
+    const char* values[BENCH_LIST_COUNT];
+    int i;
+
+    for (i = 0; i < BENCH_LIST_COUNT; i++)
+    {
+        int index = bench_next();
+
+        values[i] = bench_values[index];
+        timestamps[i] = BENCH_TIMESTAMP + index;
+    }
+
+    return bench_sink = swircbor_encodeList((uint8_t*)bench_buffer, sizeof(bench_buffer), "temperature",
+                                            BENCH_LIST_COUNT, values, timestamps);
+}
+
+/* a command as mqttClient_parseJsonCommand() reads it, returns the params found */
+static int bench_jsonTask(const char* payload, size_t len)
+{
+    swirjson_index_t index;
+    char key[BENCH_KEY_LEN];
+    char value[BENCH_PAYLOAD_SIZE];
+    char timestamp[32];
+    int request, command, params;
+    int count;
+
+    swirjson_initIndex(&index, bench_tokens, bench_order, BENCH_JSON_TOKENS_MAX);
+    if (swirjson_parse(&index, payload, len) < 0)
+        return -1;
+
+    request = (bench_tokens[0].type == SWIRJSON_ARRAY) ? swirjson_getItem(&index, 0, 0) : 0;
+    swirjson_copy(&index, swirjson_find(&index, request, "uid"), key, sizeof(key));
+    swirjson_copy(&index, swirjson_find(&index, request, "timestamp"), timestamp, sizeof(timestamp));
+    command = swirjson_find(&index, request, "command");
+    swirjson_copy(&index, swirjson_find(&index, command, "id"), key, sizeof(key));
+    params = swirjson_find(&index, command, "params");
+
+    for (count = 0; swirjson_getKey(&index, params, count) >= 0; count++)
+    {
+        swirjson_copy(&index, swirjson_getKey(&index, params, count), key, sizeof(key));
+        swirjson_copy(&index, swirjson_getItem(&index, params, count), value, sizeof(value));
+        bench_sink = key[0] + value[0];
+    }
+
+    return count;
+}
+
+/* the same command as mqttClient_parseCborCommand() reads it */
+static int bench_cborTask(const uint8_t* payload, size_t len)
+{
+    swircbor_reader_t reader;
+    swircbor_reader_t command;
+    swircbor_reader_t value;
+    swircbor_item_t item;
+    swircbor_item_t key;
+    char text[BENCH_PAYLOAD_SIZE];
+    char timestamp[32];
+    int pairs;
+    int count;
+    int i;
+
+    swircbor_initReader(&reader, payload, len);
+    if (swircbor_read(&reader, &item) || ((item.type == SWIRCBOR_ARRAY) && swircbor_read(&reader, &item)))
+        return -1;
+
+    command.nLen = 0;
+    pairs = item.nLen;
+    for (i = 0; i < pairs; i++)
+    {
+        if (swircbor_read(&reader, &key) || (key.type != SWIRCBOR_STRING))
+            return -1;
+
+        value = reader;
+        if (swircbor_skip(&reader))
+            return -1;
+
+        if ((key.nLen == 3) && !memcmp(key.pData, "uid", 3) && !swircbor_read(&value, &item))
+            snprintf(text, sizeof(text), "%.*s", item.nLen, (const char*)item.pData);
+        else if ((key.nLen == 9) && !memcmp(key.pData, "timestamp", 9) && !swircbor_read(&value, &item))
+            swirjson_formatUInt(timestamp, item.u64Value);
+        else if ((key.nLen == 7) && !memcmp(key.pData, "command", 7))
+            command = value;
+    }
+
+    if (!command.nLen || swircbor_read(&command, &item) || (item.type != SWIRCBOR_MAP))
+        return -1;
+
+    pairs = item.nLen;
+    if (!swircbor_find(&command, pairs, "id", &value) && !swircbor_read(&value, &item))
+        snprintf(text, sizeof(text), "%.*s", item.nLen, (const char*)item.pData);
+    if (swircbor_find(&command, pairs, "params", &reader) || swircbor_read(&reader, &item))
+        return 0;
+
+    pairs = item.nLen;
+    for (count = 0; count < pairs; count++)
+    {
+        if (swircbor_read(&reader, &key) || (key.type != SWIRCBOR_STRING))
+            return -1;
+
+        value = reader;
+        if (swircbor_read(&value, &item))
+            return -1;
+
+        if (item.type == SWIRCBOR_STRING)
+        {
+            reader = value;
+            memcpy(text, item.pData, item.nLen);
+            text[item.nLen] = 0;
+        }
+        else
+        {
+            swirjson_writer_t writer;
+
+            swirjson_initWriter(&writer, text, sizeof(text));
+            if (swircbor_toJson(&reader, &writer) || (swirjson_finish(&writer) < 0))
+                return -1;
+        }
+        bench_sink = key.pData[0] + text[0];
+    }
+
+    return count;
+}
+
+static size_t bench_decodeJson(void)
+{
+    bench_jsonTask(bench_payload, bench_payloadLen);
+    return bench_payloadLen;
+}
+
+static size_t bench_decodeCbor(void)
+{
+    bench_cborTask(bench_cbor, bench_cborLen);
+    return bench_cborLen;
+}
+
+/* CBOR copy of an indexed JSON value; strings are copied without unescaping */
+static void bench_toCbor(swirjson_index_t* index, int token, swircbor_writer_t* writer)
+{
+    swirjson_token_t* tok = &bench_tokens[token];
+    swirjson_slice_t slice = swirjson_getSlice(index, token);
+    char number[SWIRJSON_NUMBER_LEN_MAX];
+    int i;
+
+    switch (tok->type)
+    {
+    case SWIRJSON_OBJECT:
+        swircbor_beginMap(writer, tok->nSize);
+        for (i = 0; i < tok->nSize; i++)
+        {
+            bench_toCbor(index, swirjson_getKey(index, token, i), writer);
+            bench_toCbor(index, swirjson_getItem(index, token, i), writer);
+        }
+        break;
+
+    case SWIRJSON_ARRAY:
+        swircbor_beginArray(writer, tok->nSize);
+        for (i = 0; i < tok->nSize; i++)
+            bench_toCbor(index, swirjson_getItem(index, token, i), writer);
+        break;
+
+    case SWIRJSON_STRING:
+        swircbor_writeStringN(writer, slice.ptr, slice.len);
+        break;
+
+    default:
+        snprintf(number, sizeof(number), "%.*s", slice.len, slice.ptr);
+        if (number[0] == 't' || number[0] == 'f')
+            swircbor_writeBool(writer, number[0] == 't');
+        else if (number[0] == 'n')
+            swircbor_writeNull(writer);
+        else if (strpbrk(number, ".eE"))
+            swircbor_writeFloat(writer, strtod(number, NULL));
+        else
+            swircbor_writeInt(writer, strtoll(number, NULL, 10));
+        break;
+    }
+}
+
+/* the CBOR copy read back to JSON must index to as many tokens, with the same params */
+static int bench_convert(const char* name)
+{
+    swirjson_index_t index;
+    swircbor_writer_t writer;
+    swirjson_writer_t json;
+    swircbor_reader_t reader;
+    char* text;
+    int tokens;
+    int found;
+    int len;
+
+    swirjson_initIndex(&index, bench_tokens, bench_order, BENCH_JSON_TOKENS_MAX);
+    tokens = swirjson_parse(&index, bench_payload, bench_payloadLen);
+    if (tokens < 0)
+    {
+        printf("# cannot parse '%s'\n", name);
+        return -1;
+    }
+
+    swircbor_initWriter(&writer, bench_cbor, BENCH_CORPUS_FILE_SIZE);
+    bench_toCbor(&index, 0, &writer);
+    len = swircbor_finish(&writer);
+    if (len < 0)
+    {
+        printf("# cannot encode '%s'(%d)\n", name, len);
+        return -1;
+    }
+    bench_cborLen = len;
+
+    text = malloc(BENCH_CORPUS_FILE_SIZE);
+    swircbor_initReader(&reader, bench_cbor, bench_cborLen);
+    swirjson_initWriter(&json, text, BENCH_CORPUS_FILE_SIZE);
+    if (swircbor_toJson(&reader, &json) || ((len = swirjson_finish(&json)) < 0) ||
+        (swirjson_parse(&index, text, len) != tokens))
+    {
+        printf("# '%s' does not read back from CBOR\n", name);
+        free(text);
+        return -1;
+    }
+    free(text);
+
+    found = bench_jsonTask(bench_payload, bench_payloadLen);
+    if (bench_cborTask(bench_cbor, bench_cborLen) != found)
+    {
+        printf("# '%s' params differ between JSON and CBOR\n", name);
+        return -1;
+    }
+
+    printf("# %s: %d params, json %zu bytes, cbor %zu bytes (%.0f%%)\n", name, found, bench_payloadLen,
+           bench_cborLen, 100.0 * bench_cborLen / bench_payloadLen);
+    return 0;
+}
+
+static int bench_file(const char* name)
+{
+    char caseName[512];
+
+    if (bench_convert(name) != 0)
+        return -1;
+
+    snprintf(caseName, sizeof(caseName), "decode/%s/json", name);
+    bench_run(caseName, bench_decodeJson);
+    snprintf(caseName, sizeof(caseName), "decode/%s/cbor", name);
+    bench_run(caseName, bench_decodeCbor);
+    return 0;
+}
+
+static void bench_setup(void)
+{
+    int i;
+
+    srand(1);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++)
+    {
+        /* the readings of the swirjson benchmark, and short status words */
+        bench_doubles[i] = (rand() % 200000 - 50000) / ((i % 3) ? 1000.0 : 7.0);
+        bench_floats[i] = (float)bench_doubles[i];
+        if (i % 2)
+            swirjson_formatFixed(bench_values[i], bench_doubles[i], 2);
+        else
+            snprintf(bench_values[i], sizeof(bench_values[i]), "%s", (i % 4) ? "running" : "idle");
+    }
+}
+
+/* average payload size of one case, for the comments */
+static void bench_size(const char* name, bench_op_f json, bench_op_f cbor)
+{
+    size_t jsonBytes = 0;
+    size_t cborBytes = 0;
+    int i;
+
+    if (bench_match && !strstr(name, bench_match))
+        return;
+
+    for (i = 0; i < BENCH_VALUE_COUNT; i++)
+        jsonBytes += json();
+    for (i = 0; i < BENCH_VALUE_COUNT; i++)
+        cborBytes += cbor();
+
+    printf("# %s: json %.1f bytes, cbor %.1f bytes (%.0f%%)\n", name, (double)jsonBytes / BENCH_VALUE_COUNT,
+           (double)cborBytes / BENCH_VALUE_COUNT, 100.0 * cborBytes / jsonBytes);
+}
+
+int main(int argc, char** argv)
+{
+    const char* corpus = BENCH_DEFAULT_CORPUS;
+
+    if (bench_options(argc, argv, &corpus) != 0)
+        return 1;
+
+    bench_setup();
+    bench_cbor = malloc(BENCH_CORPUS_FILE_SIZE);
+
+    bench_header("swircbor");
+
+    bench_size("encode/record", bench_recordJson, bench_recordCbor);
+    bench_run("encode/record/json", bench_recordJson);
+    bench_run("encode/record/cbor", bench_recordCbor);
+    bench_size("encode/float", bench_floatJson, bench_floatCbor);
+    bench_run("encode/float/json", bench_floatJson);
+    bench_run("encode/float/cbor", bench_floatCbor);
+    bench_size("encode/float_timestamped", bench_floatTimestampedJson, bench_floatTimestampedCbor);
+    bench_run("encode/float_timestamped/json", bench_floatTimestampedJson);
+    bench_run("encode/float_timestamped/cbor", bench_floatTimestampedCbor);
+    bench_size("encode/list16", bench_listJson, bench_listCbor);
+    bench_run("encode/list16/json", bench_listJson);
+    bench_run("encode/list16/cbor", bench_listCbor);
+
+    if (bench_corpus(corpus, "cmd_", bench_file) != 0)
+        return 1;
+
+    free(bench_cbor);
+    bench_done();
+    return 0;
+}
@@ -0,0 +1,699 @@
+/*
+ * @file
+ *
+ * CBOR writer, telemetry records and reader.  Only what the payloads need: definite and indefinite
+ * arrays and maps, integers, text and byte strings, floats, booleans and null.  The reader takes
+ * tags and simple values as they come but refuses indefinite-length strings, which no encoder on
+ * either end of the link produces.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "cbor/swir_cbor.h"
+
+#define CBOR_MAJOR_UINT         0
+#define CBOR_MAJOR_NINT         1
+#define CBOR_MAJOR_BYTES        2
+#define CBOR_MAJOR_STRING       3
+#define CBOR_MAJOR_ARRAY        4
+#define CBOR_MAJOR_MAP          5
+#define CBOR_MAJOR_TAG          6
+#define CBOR_MAJOR_SIMPLE       7
+
+#define CBOR_INFO_UINT8         24
+#define CBOR_INFO_UINT16        25
+#define CBOR_INFO_UINT32        26
+#define CBOR_INFO_UINT64        27
+#define CBOR_INFO_INDEFINITE    31
+
+#define CBOR_SIMPLE_FALSE       20
+#define CBOR_SIMPLE_TRUE        21
+#define CBOR_SIMPLE_NULL        22
+#define CBOR_SIMPLE_UNDEFINED   23
+
+#define CBOR_BREAK              0xff
+
+static void appendBytes(swircbor_writer_t* pWriter, const void* pData, int nLen)
+{
+    if (pWriter->nError)
+    {
+        return;
+    }
+
+    if (nLen > pWriter->nSize - pWriter->nLen)
+    {
+        pWriter->nError = SWIRCBOR_ERROR_NOMEM;
+        return;
+    }
+
+    memcpy(pWriter->pBuffer + pWriter->nLen, pData, nLen);
+    pWriter->nLen += nLen;
+}
+
+// initial byte and argument in the fewest bytes, big-endian
+static void appendHead(swircbor_writer_t* pWriter, int nMajor, uint64_t u64Value)
+{
+    uint8_t head[9];
+    int nLen;
+    int i;
+
+    if (u64Value < CBOR_INFO_UINT8)
+    {
+        head[0] = (nMajor << 5) | u64Value;
+        appendBytes(pWriter, head, 1);
+        return;
+    }
+    else if (u64Value <= 0xff)
+    {
+        head[0] = (nMajor << 5) | CBOR_INFO_UINT8;
+        nLen = 1;
+    }
+    else if (u64Value <= 0xffff)
+    {
+        head[0] = (nMajor << 5) | CBOR_INFO_UINT16;
+        nLen = 2;
+    }
+    else if (u64Value <= 0xffffffff)
+    {
+        head[0] = (nMajor << 5) | CBOR_INFO_UINT32;
+        nLen = 4;
+    }
+    else
+    {
+        head[0] = (nMajor << 5) | CBOR_INFO_UINT64;
+        nLen = 8;
+    }
+
+    for (i = nLen; i > 0; i--)
+    {
+        head[i] = u64Value & 0xff;
+        u64Value >>= 8;
+    }
+
+    appendBytes(pWriter, head, nLen + 1);
+}
+
+static void beginContainer(swircbor_writer_t* pWriter, int nMajor, int nCount)
+{
+    uint8_t head = (nMajor << 5) | CBOR_INFO_INDEFINITE;
+
+    if (nCount >= 0)
+    {
+        appendHead(pWriter, nMajor, nCount);
+        return;
+    }
+
+    appendBytes(pWriter, &head, 1);
+    pWriter->nIndefinite++;
+}
+
+// the half-precision bits of a float that is zero, infinite or a normal half, -1 when bits would be lost
+static int toHalf(float fValue)
+{
+    uint32_t u32Bits;
+    int nExponent;
+
+    memcpy(&u32Bits, &fValue, sizeof(u32Bits));
+    nExponent = (int)((u32Bits >> 23) & 0xff) - 127 + 15;
+
+    if ((u32Bits & 0x7fffffff) == 0)
+    {
+        return u32Bits >> 16;
+    }
+    else if ((u32Bits & 0x7fffffff) == 0x7f800000)
+    {
+        return ((u32Bits >> 16) & 0x8000) | 0x7c00;
+    }
+    else if ((nExponent < 1) || (nExponent > 30) || (u32Bits & 0x1fff))
+    {
+        return -1;
+    }
+
+    return ((u32Bits >> 16) & 0x8000) | (nExponent << 10) | ((u32Bits >> 13) & 0x3ff);
+}
+
+static double fromHalf(uint16_t u16Half)
+{
+    int nExponent = (u16Half >> 10) & 0x1f;
+    double dValue;
+
+    if (nExponent == 0)
+    {
+        dValue = ldexp(u16Half & 0x3ff, -24);
+    }
+    else if (nExponent == 31)
+    {
+        dValue = (u16Half & 0x3ff) ? NAN : INFINITY;
+    }
+    else
+    {
+        dValue = ldexp((u16Half & 0x3ff) + 1024, nExponent - 25);
+    }
+
+    return (u16Half & 0x8000) ? -dValue : dValue;
+}
+
+void swircbor_initWriter(swircbor_writer_t* pWriter, uint8_t* pBuffer, int nSize)
+{
+    pWriter->pBuffer = pBuffer;
+    pWriter->nSize = nSize;
+    pWriter->nLen = 0;
+    pWriter->nError = 0;
+    pWriter->nIndefinite = 0;
+}
+
+void swircbor_beginArray(swircbor_writer_t* pWriter, int nCount)
+{
+    beginContainer(pWriter, CBOR_MAJOR_ARRAY, nCount);
+}
+
+// nCount is the number of key/value pairs
+void swircbor_beginMap(swircbor_writer_t* pWriter, int nCount)
+{
+    beginContainer(pWriter, CBOR_MAJOR_MAP, nCount);
+}
+
+// closes the innermost indefinite array or map, definite ones close on their own
+void swircbor_end(swircbor_writer_t* pWriter)
+{
+    uint8_t brk = CBOR_BREAK;
+
+    if (!pWriter->nIndefinite)
+    {
+        if (!pWriter->nError)
+        {
+            pWriter->nError = SWIRCBOR_ERROR_INVALID;
+        }
+        return;
+    }
+
+    appendBytes(pWriter, &brk, 1);
+    pWriter->nIndefinite--;
+}
+
+void swircbor_writeUInt(swircbor_writer_t* pWriter, uint64_t u64Value)
+{
+    appendHead(pWriter, CBOR_MAJOR_UINT, u64Value);
+}
+
+void swircbor_writeInt(swircbor_writer_t* pWriter, int64_t n64Value)
+{
+    if (n64Value < 0)
+    {
+        appendHead(pWriter, CBOR_MAJOR_NINT, -1 - n64Value);
+    }
+    else
+    {
+        appendHead(pWriter, CBOR_MAJOR_UINT, n64Value);
+    }
+}
+
+void swircbor_writeString(swircbor_writer_t* pWriter, const char* szValue)
+{
+    swircbor_writeStringN(pWriter, szValue, strlen(szValue));
+}
+
+void swircbor_writeStringN(swircbor_writer_t* pWriter, const char* pValue, int nLen)
+{
+    appendHead(pWriter, CBOR_MAJOR_STRING, nLen);
+    appendBytes(pWriter, pValue, nLen);
+}
+
+void swircbor_writeBytes(swircbor_writer_t* pWriter, const uint8_t* pValue, int nLen)
+{
+    appendHead(pWriter, CBOR_MAJOR_BYTES, nLen);
+    appendBytes(pWriter, pValue, nLen);
+}
+
+void swircbor_writeFloat(swircbor_writer_t* pWriter, double dValue)
+{
+    float fValue = (float)dValue;
+    uint8_t value[9];
+    uint64_t u64Bits;
+    uint32_t u32Bits;
+    int nHalf;
+    int i;
+
+    if (isnan(dValue))
+    {
+        // the canonical NaN, payloads are not kept
+        static const uint8_t nan[] = { (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_UINT16, 0x7e, 0x00 };
+
+        appendBytes(pWriter, nan, sizeof(nan));
+    }
+    else if ((double)fValue != dValue)
+    {
+        memcpy(&u64Bits, &dValue, sizeof(u64Bits));
+        value[0] = (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_UINT64;
+        for (i = 8; i > 0; i--)
+        {
+            value[i] = u64Bits & 0xff;
+            u64Bits >>= 8;
+        }
+        appendBytes(pWriter, value, 9);
+    }
+    else if ((nHalf = toHalf(fValue)) >= 0)
+    {
+        value[0] = (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_UINT16;
+        value[1] = nHalf >> 8;
+        value[2] = nHalf & 0xff;
+        appendBytes(pWriter, value, 3);
+    }
+    else
+    {
+        memcpy(&u32Bits, &fValue, sizeof(u32Bits));
+        value[0] = (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_UINT32;
+        value[1] = u32Bits >> 24;
+        value[2] = u32Bits >> 16;
+        value[3] = u32Bits >> 8;
+        value[4] = u32Bits;
+        appendBytes(pWriter, value, 5);
+    }
+}
+
+void swircbor_writeBool(swircbor_writer_t* pWriter, int bValue)
+{
+    appendHead(pWriter, CBOR_MAJOR_SIMPLE, bValue ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE);
+}
+
+void swircbor_writeNull(swircbor_writer_t* pWriter)
+{
+    appendHead(pWriter, CBOR_MAJOR_SIMPLE, CBOR_SIMPLE_NULL);
+}
+
+// returns the length or the first error
+int swircbor_finish(swircbor_writer_t* pWriter)
+{
+    if (!pWriter->nError && pWriter->nIndefinite)
+    {
+        pWriter->nError = SWIRCBOR_ERROR_PARTIAL;
+    }
+
+    return pWriter->nError ? pWriter->nError : pWriter->nLen;
+}
+
+// opens {key: or {timestamp: {key: for the value to follow
+static void beginRecord(swircbor_writer_t* pWriter, const char* szKey, unsigned long ulTimestamp)
+{
+    swircbor_beginMap(pWriter, 1);
+    if (ulTimestamp != 0)
+    {
+        swircbor_writeUInt(pWriter, ulTimestamp);
+        swircbor_beginMap(pWriter, 1);
+    }
+    swircbor_writeString(pWriter, szKey);
+}
+
+int swircbor_encodeRecord(uint8_t* pBuffer, int nSize, const char* szKey, const char* szValue, unsigned long ulTimestamp)
+{
+    swircbor_writer_t writer;
+
+    swircbor_initWriter(&writer, pBuffer, nSize);
+    beginRecord(&writer, szKey, ulTimestamp);
+    swircbor_writeString(&writer, szValue);
+    return swircbor_finish(&writer);
+}
+
+int swircbor_encodeFloatRecord(uint8_t* pBuffer, int nSize, const char* szKey, float fValue, unsigned long ulTimestamp)
+{
+    swircbor_writer_t writer;
+
+    swircbor_initWriter(&writer, pBuffer, nSize);
+    beginRecord(&writer, szKey, ulTimestamp);
+    swircbor_writeFloat(&writer, fValue);
+    return swircbor_finish(&writer);
+}
+
+int swircbor_encodeIntRecord(uint8_t* pBuffer, int nSize, const char* szKey, int nValue, unsigned long ulTimestamp)
+{
+    swircbor_writer_t writer;
+
+    swircbor_initWriter(&writer, pBuffer, nSize);
+    beginRecord(&writer, szKey, ulTimestamp);
+    swircbor_writeInt(&writer, nValue);
+    return swircbor_finish(&writer);
+}
+
+// unlike swirjson_lstSerialize(), the values stay the caller's
+int swircbor_encodeList(uint8_t* pBuffer, int nSize, const char* szKey, int nValueCount, const char** pszValueList, const unsigned long* pulTimestampList)
+{
+    swircbor_writer_t writer;
+    int i;
+
+    swircbor_initWriter(&writer, pBuffer, nSize);
+    swircbor_beginMap(&writer, 1);
+    swircbor_writeString(&writer, szKey);
+    swircbor_beginArray(&writer, nValueCount);
+
+    for (i = 0; i < nValueCount; i++)
+    {
+        swircbor_beginMap(&writer, 2);
+        swircbor_writeString(&writer, "timestamp");
+        if ((pulTimestampList == NULL) || (pulTimestampList[i] == 0))
+        {
+            swircbor_writeNull(&writer);
+        }
+        else
+        {
+            swircbor_writeUInt(&writer, pulTimestampList[i]);
+        }
+        swircbor_writeString(&writer, "value");
+        swircbor_writeString(&writer, pszValueList[i]);
+    }
+
+    return swircbor_finish(&writer);
+}
+
+void swircbor_initReader(swircbor_reader_t* pReader, const uint8_t* pData, int nLen)
+{
+    pReader->pData = pData;
+    pReader->nLen = nLen;
+    pReader->nPos = 0;
+}
+
+// the next item; the content of strings is consumed with it, the content of containers is not
+int swircbor_read(swircbor_reader_t* pReader, swircbor_item_t* pItem)
+{
+    const uint8_t* pData = pReader->pData;
+    uint64_t u64Value = 0;
+    int nMajor;
+    int nInfo;
+    int nLen = 0;
+    int i;
+
+    if (pReader->nPos >= pReader->nLen)
+    {
+        return SWIRCBOR_ERROR_PARTIAL;
+    }
+
+    nMajor = pData[pReader->nPos] >> 5;
+    nInfo = pData[pReader->nPos] & 0x1f;
+    pReader->nPos++;
+
+    if (nInfo < CBOR_INFO_UINT8)
+    {
+        u64Value = nInfo;
+    }
+    else if (nInfo <= CBOR_INFO_UINT64)
+    {
+        nLen = 1 << (nInfo - CBOR_INFO_UINT8);
+        if (nLen > pReader->nLen - pReader->nPos)
+        {
+            return SWIRCBOR_ERROR_PARTIAL;
+        }
+
+        for (i = 0; i < nLen; i++)
+        {
+            u64Value = (u64Value << 8) | pData[pReader->nPos + i];
+        }
+        pReader->nPos += nLen;
+    }
+    else if ((nInfo != CBOR_INFO_INDEFINITE) ||
+             ((nMajor != CBOR_MAJOR_ARRAY) && (nMajor != CBOR_MAJOR_MAP) && (nMajor != CBOR_MAJOR_SIMPLE)))
+    {
+        return SWIRCBOR_ERROR_INVALID;
+    }
+
+    memset(pItem, 0, sizeof(*pItem));
+    pItem->u64Value = u64Value;
+
+    switch (nMajor)
+    {
+    case CBOR_MAJOR_UINT:
+        pItem->type = SWIRCBOR_UINT;
+        break;
+
+    case CBOR_MAJOR_NINT:
+        pItem->type = SWIRCBOR_NINT;
+        break;
+
+    case CBOR_MAJOR_BYTES:
+    case CBOR_MAJOR_STRING:
+        if (u64Value > (uint64_t)(pReader->nLen - pReader->nPos))
+        {
+            return SWIRCBOR_ERROR_PARTIAL;
+        }
+        pItem->type = (nMajor == CBOR_MAJOR_BYTES) ? SWIRCBOR_BYTES : SWIRCBOR_STRING;
+        pItem->pData = pData + pReader->nPos;
+        pItem->nLen = u64Value;
+        pReader->nPos += u64Value;
+        break;
+
+    case CBOR_MAJOR_ARRAY:
+    case CBOR_MAJOR_MAP:
+        // every element takes a byte at least, a larger count cannot be right
+        if ((nInfo != CBOR_INFO_INDEFINITE) && (u64Value > (uint64_t)(pReader->nLen - pReader->nPos)))
+        {
+            return SWIRCBOR_ERROR_PARTIAL;
+        }
+        pItem->type = (nMajor == CBOR_MAJOR_ARRAY) ? SWIRCBOR_ARRAY : SWIRCBOR_MAP;
+        pItem->nLen = (nInfo == CBOR_INFO_INDEFINITE) ? SWIRCBOR_INDEFINITE : (int)u64Value;
+        break;
+
+    case CBOR_MAJOR_TAG:
+        pItem->type = SWIRCBOR_TAG;
+        break;
+
+    default:
+        if (nInfo == CBOR_INFO_INDEFINITE)
+        {
+            pItem->type = SWIRCBOR_BREAK;
+        }
+        else if (nInfo == CBOR_INFO_UINT16)
+        {
+            pItem->type = SWIRCBOR_FLOAT;
+            pItem->dValue = fromHalf(u64Value);
+        }
+        else if (nInfo == CBOR_INFO_UINT32)
+        {
+            uint32_t u32Bits = u64Value;
+            float fValue;
+
+            memcpy(&fValue, &u32Bits, sizeof(fValue));
+            pItem->type = SWIRCBOR_FLOAT;
+            pItem->dValue = fValue;
+        }
+        else if (nInfo == CBOR_INFO_UINT64)
+        {
+            pItem->type = SWIRCBOR_FLOAT;
+            memcpy(&pItem->dValue, &u64Value, sizeof(pItem->dValue));
+        }
+        else if (u64Value == CBOR_SIMPLE_FALSE)
+        {
+            pItem->type = SWIRCBOR_FALSE;
+        }
+        else if (u64Value == CBOR_SIMPLE_TRUE)
+        {
+            pItem->type = SWIRCBOR_TRUE;
+        }
+        else if (u64Value == CBOR_SIMPLE_NULL)
+        {
+            pItem->type = SWIRCBOR_NULL;
+        }
+        else
+        {
+            pItem->type = SWIRCBOR_UNDEFINED;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+// JSON keys are strings: text keys are written as they are, unsigned ones (the timestamps) as their digits
+static int readKey(swircbor_reader_t* pReader, swirjson_writer_t* pWriter)
+{
+    char szKey[SWIRJSON_NUMBER_LEN_MAX];
+    swircbor_item_t key;
+    int nRc;
+
+    nRc = swircbor_read(pReader, &key);
+    if (nRc)
+    {
+        return nRc;
+    }
+
+    if (key.type == SWIRCBOR_STRING)
+    {
+        swirjson_writeKeyN(pWriter, (const char*)key.pData, key.nLen);
+    }
+    else if (key.type == SWIRCBOR_UINT)
+    {
+        swirjson_writeKeyN(pWriter, szKey, swirjson_formatUInt(szKey, key.u64Value));
+    }
+    else
+    {
+        return SWIRCBOR_ERROR_INVALID;
+    }
+
+    return 0;
+}
+
+// one whole item with whatever it contains, swirjson_writer_t output when pWriter is set
+static int readItem(swircbor_reader_t* pReader, swirjson_writer_t* pWriter, int nDepth)
+{
+    swircbor_item_t item;
+    int nRc;
+    int i;
+
+    if (nDepth > SWIRCBOR_DEPTH_MAX)
+    {
+        return SWIRCBOR_ERROR_INVALID;
+    }
+
+    nRc = swircbor_read(pReader, &item);
+    if (nRc)
+    {
+        return nRc;
+    }
+
+    switch (item.type)
+    {
+    case SWIRCBOR_ARRAY:
+    case SWIRCBOR_MAP:
+        if (pWriter && (item.type == SWIRCBOR_ARRAY))
+        {
+            swirjson_beginArray(pWriter);
+        }
+        else if (pWriter)
+        {
+            swirjson_beginObject(pWriter);
+        }
+
+        for (i = 0; (item.nLen == SWIRCBOR_INDEFINITE) || (i < item.nLen); i++)
+        {
+            swircbor_reader_t next = *pReader;
+            swircbor_item_t brk;
+
+            if (item.nLen == SWIRCBOR_INDEFINITE)
+            {
+                nRc = swircbor_read(&next, &brk);
+                if (nRc)
+                {
+                    return nRc;
+                }
+                else if (brk.type == SWIRCBOR_BREAK)
+                {
+                    *pReader = next;
+                    break;
+                }
+            }
+
+            if (item.type == SWIRCBOR_MAP)
+            {
+                // skipping takes any key, only JSON output needs them to be text or numbers
+                nRc = pWriter ? readKey(pReader, pWriter) : readItem(pReader, NULL, nDepth + 1);
+                if (nRc)
+                {
+                    return nRc;
+                }
+            }
+
+            nRc = readItem(pReader, pWriter, nDepth + 1);
+            if (nRc)
+            {
+                return nRc;
+            }
+        }
+
+        if (pWriter && (item.type == SWIRCBOR_ARRAY))
+        {
+            swirjson_endArray(pWriter);
+        }
+        else if (pWriter)
+        {
+            swirjson_endObject(pWriter);
+        }
+        break;
+
+    case SWIRCBOR_TAG:
+        return readItem(pReader, pWriter, nDepth + 1);
+
+    case SWIRCBOR_BREAK:
+        return SWIRCBOR_ERROR_INVALID;
+
+    default:
+        if (!pWriter)
+        {
+            break;
+        }
+
+        if (item.type == SWIRCBOR_UINT)
+        {
+            swirjson_writeUInt(pWriter, item.u64Value);
+        }
+        else if (item.type == SWIRCBOR_NINT)
+        {
+            swirjson_writeInt(pWriter, -1 - (long)item.u64Value);
+        }
+        else if ((item.type == SWIRCBOR_STRING) || (item.type == SWIRCBOR_BYTES))
+        {
+            swirjson_writeStringN(pWriter, (const char*)item.pData, item.nLen);
+        }
+        else if (item.type == SWIRCBOR_FLOAT)
+        {
+            swirjson_writeFloat(pWriter, item.dValue, SWIRJSON_SHORTEST);
+        }
+        else if ((item.type == SWIRCBOR_TRUE) || (item.type == SWIRCBOR_FALSE))
+        {
+            swirjson_writeBool(pWriter, item.type == SWIRCBOR_TRUE);
+        }
+        else
+        {
+            swirjson_writeNull(pWriter);
+        }
+        break;
+    }
+
+    return 0;
+}
+
+int swircbor_skip(swircbor_reader_t* pReader)
+{
+    return readItem(pReader, NULL, 0);
+}
+
+/*
+ * pMap is just past the head of a map of nCount pairs; on success pValue is at the value of the first
+ * text key equal to szKey.  Maps are not indexed, each call walks the pairs.
+ */
+int swircbor_find(const swircbor_reader_t* pMap, int nCount, const char* szKey, swircbor_reader_t* pValue)
+{
+    swircbor_reader_t reader = *pMap;
+    int nKeyLen = strlen(szKey);
+    int i;
+
+    for (i = 0; (nCount == SWIRCBOR_INDEFINITE) || (i < nCount); i++)
+    {
+        swircbor_item_t key;
+
+        if (swircbor_read(&reader, &key) || (key.type == SWIRCBOR_BREAK))
+        {
+            break;
+        }
+
+        if ((key.type == SWIRCBOR_STRING) && (key.nLen == nKeyLen) && !memcmp(key.pData, szKey, nKeyLen))
+        {
+            *pValue = reader;
+            return 0;
+        }
+
+        if (swircbor_skip(&reader))
+        {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+// the next item as JSON text; strings and byte strings both become JSON strings
+int swircbor_toJson(swircbor_reader_t* pReader, swirjson_writer_t* pWriter)
+{
+    return readItem(pReader, pWriter, 0);
+}
@@ -0,0 +1,188 @@
+/**
+ * @file
+ *
+ * Harness shared by the host benchmarks of the payload helpers, see bench_common.h.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "bench_common.h"
+
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+
+char bench_buffer[BENCH_PAYLOAD_SIZE];
+const char* bench_match = NULL;
+volatile int bench_sink;
+char* bench_payload;
+size_t bench_payloadLen;
+
+static long bench_minNs = BENCH_DEFAULT_MIN_MS * 1000000L;
+static long bench_allocs;
+static int bench_index;
+static const char* bench_prefix = "";
+
+void* __wrap_malloc(size_t size)
+{
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+/* the compiler turns malloc() and memset() into calloc() */
+void* __wrap_calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    return __real_calloc(count, size);
+}
+
+static long bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void bench_usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-t min_ms_per_case] [-m case_substring] [-d corpus_dir]\n", prog);
+}
+
+/* -t, -m and -d, the corpus keeps its default unless given */
+int bench_options(int argc, char** argv, const char** corpus)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:m:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            bench_minNs = atol(optarg) * 1000000L;
+            break;
+        case 'm':
+            bench_match = optarg;
+            break;
+        case 'd':
+            *corpus = optarg;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    bench_payload = malloc(BENCH_CORPUS_FILE_SIZE);
+    return 0;
+}
+
+void bench_header(const char* name)
+{
+    printf("# %s benchmark format(%d) min_ms(%ld)\n", name, BENCH_FORMAT_VERSION, bench_minNs / 1000000L);
+    printf("# case\tns_op\tMB_s\tallocs_op\titerations\n");
+}
+
+void bench_run(const char* name, bench_op_f op)
+{
+    long iterations = BENCH_VALUE_COUNT;
+    long elapsed = 0;
+    double bytes = 0;
+    long i;
+
+    if (bench_match && !strstr(name, bench_match))
+        return;
+
+    for (;;)
+    {
+        long start = bench_now();
+
+        bytes = 0;
+        bench_allocs = 0;
+        for (i = 0; i < iterations; i++)
+            bytes += op();
+        elapsed = bench_now() - start;
+
+        if (elapsed >= bench_minNs)
+            break;
+        iterations *= 2;
+    }
+
+    printf("%s\t%.1f\t%.1f\t%.2f\t%ld\n", name, (double)elapsed / iterations, bytes * 1000.0 / elapsed,
+           (double)bench_allocs / iterations, iterations);
+    fflush(stdout);
+}
+
+/* walks the value tables so that no case sees the same value twice in a row */
+int bench_next(void)
+{
+    return bench_index++ & (BENCH_VALUE_COUNT - 1);
+}
+
+static int bench_filter(const struct dirent* entry)
+{
+    size_t len = strlen(entry->d_name);
+    size_t prefixLen = strlen(bench_prefix);
+
+    return !strncmp(entry->d_name, bench_prefix, prefixLen) && (len > prefixLen + 5) &&
+           !strcmp(entry->d_name + len - 5, ".json");
+}
+
+/* the <prefix>*.json files of dir in name order, read one at a time into bench_payload */
+int bench_corpus(const char* dir, const char* prefix, bench_file_f onFile)
+{
+    struct dirent** entries;
+    char path[512];
+    int count;
+    int rc = 0;
+    int i;
+
+    bench_prefix = prefix;
+    count = scandir(dir, &entries, bench_filter, alphasort);
+    if (count <= 0)
+    {
+        printf("# no corpus in '%s'\n", dir);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        FILE* file;
+
+        if (!rc)
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+            file = fopen(path, "r");
+            if (!file)
+            {
+                printf("# cannot read '%s'\n", path);
+                rc = -1;
+            }
+            else
+            {
+                bench_payloadLen = fread(bench_payload, 1, BENCH_CORPUS_FILE_SIZE - 1, file);
+                bench_payload[bench_payloadLen] = 0;
+                fclose(file);
+
+                entries[i]->d_name[strlen(entries[i]->d_name) - 5] = 0;
+                rc = onFile(entries[i]->d_name);
+            }
+        }
+        free(entries[i]);
+    }
+
+    free(entries);
+    return rc;
+}
+
+void bench_done(void)
+{
+    free(bench_payload);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file
+ *
+ * Harness shared by the host benchmarks of the payload helpers: timing, allocation counting,
+ * options and the corpus loader.
+ *
+ * A case is a function returning the bytes it parsed or produced.  bench_run() calls it, doubling
+ * the iterations until they take at least the -t time, and prints one line:
+ *
+ *     <case>\t<ns/op>\t<MB/s>\t<allocs/op>\t<iterations>
+ *
+ * Allocations are counted by linking with -Wl,--wrap=malloc,--wrap=calloc.  Lines starting with '#'
+ * are comments.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#ifndef _BENCH_COMMON_H_
+#define _BENCH_COMMON_H_
+
+#include <stddef.h>
+
+#define BENCH_FORMAT_VERSION                          2
+#define BENCH_DEFAULT_MIN_MS                          200
+#define BENCH_VALUE_COUNT                             256
+#define BENCH_PAYLOAD_SIZE                            2048
+#define BENCH_CORPUS_FILE_SIZE                        65536
+
+/* bytes parsed or produced */
+typedef size_t (*bench_op_f)(void);
+
+/* called with each corpus file in bench_payload and its name without ".json", non-zero stops */
+typedef int (*bench_file_f)(const char* name);
+
+extern char bench_buffer[BENCH_PAYLOAD_SIZE];
+extern const char* bench_match;
+extern volatile int bench_sink;
+extern char* bench_payload;
+extern size_t bench_payloadLen;
+
+int bench_options(int argc, char** argv, const char** corpus);
+void bench_header(const char* name);
+void bench_run(const char* name, bench_op_f op);
+int bench_next(void);
+int bench_corpus(const char* dir, const char* prefix, bench_file_f onFile);
+void bench_done(void);
+
+#endif
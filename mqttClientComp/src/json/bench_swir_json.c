@@ -0,0 +1,375 @@
+/**
+ * @file
+ *
+ * Cost of the JSON helpers on the payloads the client actually handles.
+ *
+ * parse/ cases read every file of the corpus directory (corpus/ by default) the way an inbound task is
+ * handled: uid, timestamp, then each param of a command or each key of a write task, once with
+ * swirjson_getValue() and once with the index.  serialize/ cases build telemetry with each serializer
+ * and with the writer.  number/ cases compare the number formatters with the printf calls they
+ * replace, over a table of readings so that no case formats the same number twice in a row.
+ *
+ * Output is the format of bench_common.h, MB/s over the bytes parsed or produced.  Before timing, every formatter is checked against printf (fixed and integer) or strtod (shortest) on the
+ * whole table, and the params each parser finds in a corpus file are listed in a comment:
+ * swirjson_getValue() does not know about escaped quotes and loses track on some of them.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "json/swir_json.h"
+#include "bench_common.h"
+
+#define BENCH_DEFAULT_CORPUS                          "corpus"
+#define BENCH_JSON_TOKENS_MAX                         4096
+#define BENCH_KEY_LEN                                 128
+#define BENCH_LIST_COUNT                              16
+
+static double bench_doubles[BENCH_VALUE_COUNT];
+static float bench_floats[BENCH_VALUE_COUNT];
+static long bench_ints[BENCH_VALUE_COUNT];
+static swirjson_token_t bench_tokens[BENCH_JSON_TOKENS_MAX];
+static int bench_order[BENCH_JSON_TOKENS_MAX];
+
+static size_t bench_intPrintf(void)
+{
+    return bench_sink = sprintf(bench_buffer, "%ld", bench_ints[bench_next()]);
+}
+
+static size_t bench_intFormat(void)
+{
+    return bench_sink = swirjson_formatInt(bench_buffer, bench_ints[bench_next()]);
+}
+
+static size_t bench_fixedPrintf(void)
+{
+    return bench_sink = sprintf(bench_buffer, "%.2f", bench_doubles[bench_next()]);
+}
+
+static size_t bench_fixedFormat(void)
+{
+    return bench_sink = swirjson_formatFixed(bench_buffer, bench_doubles[bench_next()], 2);
+}
+
+static size_t bench_shortestPrintf(void)
+{
+    return bench_sink = sprintf(bench_buffer, "%.17g", bench_doubles[bench_next()]);
+}
+
+static size_t bench_shortestFormat(void)
+{
+    return bench_sink = swirjson_formatShortest(bench_buffer, bench_doubles[bench_next()]);
+}
+
+static size_t bench_floatPrintf(void)
+{
+    return bench_sink = sprintf(bench_buffer, "%.9g", bench_floats[bench_next()]);
+}
+
+static size_t bench_floatFormat(void)
+{
+    return bench_sink = swirjson_formatShortestFloat(bench_buffer, bench_floats[bench_next()]);
+}
+
+/* swirjson_fSerialize() as it was: format the value, format the payload, copy it to the heap */
+static size_t bench_serializePrintf(void)
+{
+    char szPayload[BENCH_PAYLOAD_SIZE];
+    char szValue[16];
+    char* pszJson;
+
+    memset(szPayload, 0, sizeof(szPayload));
+    sprintf(szValue, "%.2f", bench_floats[bench_next()]);
+    sprintf(szPayload, "{\"%s\":\"%s\"}", "temperature", szValue);
+    pszJson = (char*) malloc(strlen(szPayload) + 1);
+    strcpy(pszJson, szPayload);
+    bench_sink = pszJson[0];
+    free(pszJson);
+    return strlen(szPayload);
+}
+
+static size_t bench_serialized(char* pszJson)
+{
+    size_t len = strlen(pszJson);
+
+    free(pszJson);
+    return len;
+}
+
+static size_t bench_serializeWriter(void)
+{
+    return bench_serialized(swirjson_fSerialize("temperature", bench_floats[bench_next()], 0));
+}
+
+static size_t bench_serializeString(void)
+{
+    return bench_serialized(swirjson_szSerialize("status", "running", 0));
+}
+
+static size_t bench_serializeTimestamped(void)
+{
+    return bench_serialized(swirjson_fSerialize("temperature", bench_floats[bench_next()], 1498662247030UL));
+}
+
+static size_t bench_serializeInt(void)
+{
+    return bench_serialized(swirjson_nSerialize("counter", bench_ints[bench_next()], 0));
+}
+
+/* the list takes ownership of its values, their allocations are part of the count */
+static size_t bench_serializeList(void)
+{
+    unsigned long timestamps[BENCH_LIST_COUNT];
+    char* values[BENCH_LIST_COUNT];
+    char value[32];
+    int i;
+
+    for (i = 0; i < BENCH_LIST_COUNT; i++)
+    {
+        int index = bench_next();
+
+        swirjson_formatFixed(value, bench_doubles[index], 2);
+        values[i] = strcpy(malloc(strlen(value) + 1), value);
+        timestamps[i] = 1498662247030UL + index;
+    }
+
+    return bench_serialized(swirjson_lstSerialize("temperature", BENCH_LIST_COUNT, values, timestamps));
+}
+
+/* a batch of readings written straight into one payload */
+static size_t bench_batchPrintf(void)
+{
+    int len = sprintf(bench_buffer, "{\"temperature\":[");
+    int i;
+
+    for (i = 0; i < 16; i++)
+        len += sprintf(bench_buffer + len, "%s%.2f", i ? "," : "", bench_doubles[bench_next()]);
+    len += sprintf(bench_buffer + len, "]}");
+    return bench_sink = len;
+}
+
+static size_t bench_batchWriter(void)
+{
+    swirjson_writer_t writer;
+    int i;
+
+    swirjson_initWriter(&writer, bench_buffer, sizeof(bench_buffer));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, "temperature");
+    swirjson_beginArray(&writer);
+    for (i = 0; i < 16; i++)
+        swirjson_writeFloat(&writer, bench_doubles[bench_next()], 2);
+    swirjson_endArray(&writer);
+    swirjson_endObject(&writer);
+    return bench_sink = swirjson_finish(&writer);
+}
+
+/* an inbound task as mqttClient_onIncomingMessage() used to read it, returns the params found */
+static int bench_getValueTask(char* payload)
+{
+    char key[BENCH_KEY_LEN];
+    char* uid = swirjson_getValue(payload, -1, "uid");
+    char* timestamp = swirjson_getValue(payload, -1, "timestamp");
+    char* command = swirjson_getValue(payload, -1, "command");
+    char* id = NULL;
+    char* params = NULL;
+    int count = 0;
+
+    if (command)
+    {
+        id = swirjson_getValue(command, -1, "id");
+        params = swirjson_getValue(command, -1, "params");
+    }
+    else
+    {
+        params = swirjson_getValue(payload, -1, "write");
+    }
+
+    while (params)
+    {
+        char* value = swirjson_getValue(params, count, key);
+
+        if (!value)
+            break;
+        bench_sink = key[0] + value[0];
+        free(value);
+        count++;
+    }
+
+    free(uid);
+    free(timestamp);
+    free(command);
+    free(id);
+    free(params);
+    return count;
+}
+
+/* the same task through the index, values copied out as the client copies them */
+static int bench_indexTask(const char* payload, size_t len)
+{
+    swirjson_index_t index;
+    char key[BENCH_KEY_LEN];
+    char value[BENCH_PAYLOAD_SIZE];
+    char timestamp[32];
+    int request, command, params;
+    int count;
+
+    swirjson_initIndex(&index, bench_tokens, bench_order, BENCH_JSON_TOKENS_MAX);
+    if (swirjson_parse(&index, payload, len) < 0)
+        return -1;
+
+    request = (bench_tokens[0].type == SWIRJSON_ARRAY) ? swirjson_getItem(&index, 0, 0) : 0;
+    swirjson_copy(&index, swirjson_find(&index, request, "uid"), key, sizeof(key));
+    swirjson_copy(&index, swirjson_find(&index, request, "timestamp"), timestamp, sizeof(timestamp));
+
+    command = swirjson_find(&index, request, "command");
+    if (command >= 0)
+    {
+        swirjson_copy(&index, swirjson_find(&index, command, "id"), key, sizeof(key));
+        params = swirjson_find(&index, command, "params");
+    }
+    else
+    {
+        params = swirjson_getItem(&index, swirjson_find(&index, request, "write"), 0);
+    }
+
+    for (count = 0; swirjson_getKey(&index, params, count) >= 0; count++)
+    {
+        swirjson_copy(&index, swirjson_getKey(&index, params, count), key, sizeof(key));
+        swirjson_copy(&index, swirjson_getItem(&index, params, count), value, sizeof(value));
+        bench_sink = key[0] + value[0];
+    }
+
+    return count;
+}
+
+static size_t bench_parseGetValue(void)
+{
+    bench_getValueTask(bench_payload);
+    return bench_payloadLen;
+}
+
+static size_t bench_parseIndex(void)
+{
+    bench_indexTask(bench_payload, bench_payloadLen);
+    return bench_payloadLen;
+}
+
+static int bench_file(const char* name)
+{
+    char caseName[512];
+    int found;
+    int foundGetValue;
+
+    found = bench_indexTask(bench_payload, bench_payloadLen);
+    if (found < 0)
+    {
+        printf("# cannot parse '%s'\n", name);
+        return -1;
+    }
+    foundGetValue = bench_getValueTask(bench_payload);
+
+    printf("# %s: %zu bytes, %d params, %d found by getValue\n", name, bench_payloadLen, found, foundGetValue);
+
+    snprintf(caseName, sizeof(caseName), "parse/getValue/%s", name);
+    bench_run(caseName, bench_parseGetValue);
+    snprintf(caseName, sizeof(caseName), "parse/index/%s", name);
+    bench_run(caseName, bench_parseIndex);
+    return 0;
+}
+
+static void bench_setup(void)
+{
+    int i;
+
+    srand(1);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++)
+    {
+        /* readings with a few significant decimals, the odd large counter and negative offset */
+        bench_doubles[i] = (rand() % 200000 - 50000) / ((i % 3) ? 1000.0 : 7.0);
+        bench_floats[i] = (float)bench_doubles[i];
+        bench_ints[i] = (i % 4) ? rand() % 10000 : (long)rand() * rand();
+    }
+}
+
+static int bench_check(void)
+{
+    char expected[64];
+    int i;
+
+    for (i = 0; i < BENCH_VALUE_COUNT; i++)
+    {
+        sprintf(expected, "%.2f", bench_doubles[i]);
+        swirjson_formatFixed(bench_buffer, bench_doubles[i], 2);
+        if (strcmp(bench_buffer, expected) != 0)
+        {
+            printf("# fixed mismatch '%s' != '%s'\n", bench_buffer, expected);
+            return -1;
+        }
+
+        sprintf(expected, "%ld", bench_ints[i]);
+        swirjson_formatInt(bench_buffer, bench_ints[i]);
+        if (strcmp(bench_buffer, expected) != 0)
+        {
+            printf("# int mismatch '%s' != '%s'\n", bench_buffer, expected);
+            return -1;
+        }
+
+        swirjson_formatShortest(bench_buffer, bench_doubles[i]);
+        if (strtod(bench_buffer, NULL) != bench_doubles[i])
+        {
+            printf("# shortest '%s' does not read back\n", bench_buffer);
+            return -1;
+        }
+
+        swirjson_formatShortestFloat(bench_buffer, bench_floats[i]);
+        if (strtof(bench_buffer, NULL) != bench_floats[i])
+        {
+            printf("# shortest float '%s' does not read back\n", bench_buffer);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* corpus = BENCH_DEFAULT_CORPUS;
+
+    if (bench_options(argc, argv, &corpus) != 0)
+        return 1;
+
+    bench_setup();
+    if (bench_check() != 0)
+        return 1;
+
+    bench_header("swirjson");
+    if (bench_corpus(corpus, "", bench_file) != 0)
+        return 1;
+
+    bench_run("serialize/sz", bench_serializeString);
+    bench_run("serialize/n", bench_serializeInt);
+    bench_run("serialize/f/printf", bench_serializePrintf);
+    bench_run("serialize/f", bench_serializeWriter);
+    bench_run("serialize/f_timestamped", bench_serializeTimestamped);
+    bench_run("serialize/lst16", bench_serializeList);
+    bench_run("serialize/batch16/printf", bench_batchPrintf);
+    bench_run("serialize/batch16/writer", bench_batchWriter);
+
+    bench_run("number/int/printf", bench_intPrintf);
+    bench_run("number/int/format", bench_intFormat);
+    bench_run("number/fixed2/printf", bench_fixedPrintf);
+    bench_run("number/fixed2/format", bench_fixedFormat);
+    bench_run("number/shortest/printf", bench_shortestPrintf);
+    bench_run("number/shortest/format", bench_shortestFormat);
+    bench_run("number/shortest_float/printf", bench_floatPrintf);
+    bench_run("number/shortest_float/format", bench_floatFormat);
+
+    bench_done();
+    return 0;
+}
@@ -11,7 +11,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <math.h>
+#include <string.h>
 
 #include <memory.h>
 
@@ -27,6 +30,18 @@
 #define JSON_OBJECT_END         '}'
 #define JSON_ARRAY_START        '['
 #define JSON_ARRAY_END          ']'
+#define JSON_ESCAPE             '\\'
+
+enum
+{
+    JSON_STATE_VALUE,           // a value
+    JSON_STATE_VALUE_OR_END,    // a value, or the end of an empty array
+    JSON_STATE_KEY,             // a key
+    JSON_STATE_KEY_OR_END,      // a key, or the end of an empty object
+    JSON_STATE_COLON,           // the separator after a key
+    JSON_STATE_NEXT,            // a comma, or the end of the container
+    JSON_STATE_DONE,            // only white space after the root value
+};
 
 static void trim(char *input)
 {
@@ -53,83 +68,1060 @@ static void trim(char *input)
     }
 }
 
-char* swirjson_szSerialize(const char* szKey, const char* szValue, unsigned long ulTimestamp)
+static int addToken(swirjson_index_t* pIndex, swirjson_type_t type, int nStart, int nParent)
 {
-    char szPayload[JSON_MAX_PAYLOAD_SIZE];
+    swirjson_token_t* pToken;
+
+    if (pIndex->nCount >= pIndex->nMax)
+    {
+        return SWIRJSON_ERROR_NOMEM;
+    }
+
+    pToken = &pIndex->pTokens[pIndex->nCount];
+    pToken->type = type;
+    pToken->nStart = nStart;
+    pToken->nEnd = -1;
+    pToken->nSize = 0;
+    pToken->nParent = nParent;
+    pToken->nFirst = -1;
+
+    // an object counts its keys, the values hang off the keys
+    if ((nParent >= 0) && (pIndex->pTokens[nParent].type == SWIRJSON_ARRAY))
+    {
+        pIndex->pTokens[nParent].nSize++;
+    }
+
+    return pIndex->nCount++;
+}
+
+static int compareKeys(const char* pKey1, int nLen1, const char* pKey2, int nLen2)
+{
+    int nRc = memcmp(pKey1, pKey2, (nLen1 < nLen2) ? nLen1 : nLen2);
+
+    return nRc ? nRc : nLen1 - nLen2;
+}
+
+// fills the order array once every container knows its size, which only the end of the text tells
+static void buildOrder(swirjson_index_t* pIndex)
+{
+    swirjson_token_t* pTokens = pIndex->pTokens;
+    int nOffset = 0;
+    int i, j, k;
+
+    // a member takes two slots and two tokens, an element one of each, so nCount slots are enough
+    for (i = 0; i < pIndex->nCount; i++)
+    {
+        if (pTokens[i].type == SWIRJSON_OBJECT)
+        {
+            pTokens[i].nFirst = nOffset;
+            nOffset += 2 * pTokens[i].nSize;
+            pTokens[i].nSize = 0;
+        }
+        else if (pTokens[i].type == SWIRJSON_ARRAY)
+        {
+            pTokens[i].nFirst = nOffset;
+            nOffset += pTokens[i].nSize;
+            pTokens[i].nSize = 0;
+        }
+    }
+
+    // children come in document order, keys are the only children of an object
+    for (i = 1; i < pIndex->nCount; i++)
+    {
+        swirjson_token_t* pParent = &pTokens[pTokens[i].nParent];
+
+        if ((pParent->type == SWIRJSON_OBJECT) || (pParent->type == SWIRJSON_ARRAY))
+        {
+            pIndex->pOrder[pParent->nFirst + pParent->nSize++] = i;
+        }
+    }
+
+    // insertion sort, objects are small and equal keys keep their document order
+    for (i = 0; i < pIndex->nCount; i++)
+    {
+        int* pSorted = pIndex->pOrder + pTokens[i].nFirst + pTokens[i].nSize;
+
+        if (pTokens[i].type != SWIRJSON_OBJECT)
+        {
+            continue;
+        }
+
+        memcpy(pSorted, pSorted - pTokens[i].nSize, pTokens[i].nSize * sizeof(int));
+        for (j = 1; j < pTokens[i].nSize; j++)
+        {
+            int nKey = pSorted[j];
+            swirjson_token_t* pKey = &pTokens[nKey];
+
+            for (k = j; k > 0; k--)
+            {
+                swirjson_token_t* pPrev = &pTokens[pSorted[k - 1]];
+
+                if (compareKeys(pIndex->pszJson + pPrev->nStart, pPrev->nEnd - pPrev->nStart,
+                                pIndex->pszJson + pKey->nStart, pKey->nEnd - pKey->nStart) <= 0)
+                {
+                    break;
+                }
+                pSorted[k] = pSorted[k - 1];
+            }
+            pSorted[k] = nKey;
+        }
+    }
+}
+
+void swirjson_initIndex(swirjson_index_t* pIndex, swirjson_token_t* pTokens, int* pOrder, int nMax)
+{
+    pIndex->pszJson = NULL;
+    pIndex->pTokens = pTokens;
+    pIndex->pOrder = pOrder;
+    pIndex->nMax = nMax;
+    pIndex->nCount = 0;
+}
+
+// returns the number of tokens, or one of the SWIRJSON_ERROR_ codes
+int swirjson_parse(swirjson_index_t* pIndex, const char* szJson, int nLen)
+{
+    swirjson_token_t* pTokens = pIndex->pTokens;
+    int nState = JSON_STATE_VALUE;
+    int nContainer = -1;        // innermost open object or array
+    int nParent = -1;           // of the next token: the open container, or the key of a member value
+    int nPos;
+    int nToken;
+
+    pIndex->pszJson = szJson;
+    pIndex->nCount = 0;
+
+    for (nPos = 0; nPos < nLen; nPos++)
+    {
+        char cChar = szJson[nPos];
+
+        if (isspace((unsigned char)cChar))
+        {
+            continue;
+        }
+
+        switch (cChar)
+        {
+        case JSON_OBJECT_START:
+        case JSON_ARRAY_START:
+            if ((nState != JSON_STATE_VALUE) && (nState != JSON_STATE_VALUE_OR_END))
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            nToken = addToken(pIndex, (cChar == JSON_OBJECT_START) ? SWIRJSON_OBJECT : SWIRJSON_ARRAY, nPos, nParent);
+            if (nToken < 0)
+            {
+                return nToken;
+            }
+
+            nContainer = nParent = nToken;
+            nState = (cChar == JSON_OBJECT_START) ? JSON_STATE_KEY_OR_END : JSON_STATE_VALUE_OR_END;
+            break;
+
+        case JSON_OBJECT_END:
+        case JSON_ARRAY_END:
+            if ((nContainer < 0) ||
+                (pTokens[nContainer].type != ((cChar == JSON_OBJECT_END) ? SWIRJSON_OBJECT : SWIRJSON_ARRAY)) ||
+                ((nState != JSON_STATE_NEXT) &&
+                 (nState != ((cChar == JSON_OBJECT_END) ? JSON_STATE_KEY_OR_END : JSON_STATE_VALUE_OR_END))))
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            pTokens[nContainer].nEnd = nPos + 1;
+
+            // up to the enclosing container, through the key if this was a member value
+            nContainer = pTokens[nContainer].nParent;
+            if ((nContainer >= 0) && (pTokens[nContainer].type == SWIRJSON_STRING))
+            {
+                nContainer = pTokens[nContainer].nParent;
+            }
+
+            nParent = nContainer;
+            nState = (nContainer < 0) ? JSON_STATE_DONE : JSON_STATE_NEXT;
+            break;
+
+        case JSON_KEY_VAL_END_MARKER:
+            if (nState != JSON_STATE_NEXT)
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            nState = (pTokens[nContainer].type == SWIRJSON_OBJECT) ? JSON_STATE_KEY : JSON_STATE_VALUE;
+            break;
+
+        case JSON_KEY_VAL_SEPARATOR:
+            if (nState != JSON_STATE_COLON)
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            nState = JSON_STATE_VALUE;
+            break;
+
+        case JSON_QUOTE:
+            if ((nState != JSON_STATE_VALUE) && (nState != JSON_STATE_VALUE_OR_END) &&
+                (nState != JSON_STATE_KEY) && (nState != JSON_STATE_KEY_OR_END))
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            nToken = addToken(pIndex, SWIRJSON_STRING, nPos + 1, nParent);
+            if (nToken < 0)
+            {
+                return nToken;
+            }
+
+            for (nPos++; (nPos < nLen) && (szJson[nPos] != JSON_QUOTE); nPos++)
+            {
+                if ((unsigned char)szJson[nPos] < ' ')
+                {
+                    return SWIRJSON_ERROR_INVALID;
+                }
+                else if (szJson[nPos] == JSON_ESCAPE)
+                {
+                    nPos++;
+                }
+            }
+
+            if (nPos >= nLen)
+            {
+                return SWIRJSON_ERROR_PARTIAL;
+            }
+
+            pTokens[nToken].nEnd = nPos;
+
+            if ((nState == JSON_STATE_KEY) || (nState == JSON_STATE_KEY_OR_END))
+            {
+                pTokens[nContainer].nSize++;
+                nParent = nToken;
+                nState = JSON_STATE_COLON;
+            }
+            else
+            {
+                nParent = nContainer;
+                nState = (nContainer < 0) ? JSON_STATE_DONE : JSON_STATE_NEXT;
+            }
+            break;
+
+        default:
+            if (((nState != JSON_STATE_VALUE) && (nState != JSON_STATE_VALUE_OR_END)) ||
+                !cChar || !strchr("-0123456789tfn", cChar))
+            {
+                return SWIRJSON_ERROR_INVALID;
+            }
+
+            nToken = addToken(pIndex, SWIRJSON_PRIMITIVE, nPos, nParent);
+            if (nToken < 0)
+            {
+                return nToken;
+            }
+
+            while ((nPos + 1 < nLen) && !isspace((unsigned char)szJson[nPos + 1]) &&
+                   !strchr(",:]}[{\"", szJson[nPos + 1]))
+            {
+                nPos++;
+            }
+
+            pTokens[nToken].nEnd = nPos + 1;
+            nParent = nContainer;
+            nState = (nContainer < 0) ? JSON_STATE_DONE : JSON_STATE_NEXT;
+            break;
+        }
+    }
+
+    if (nState != JSON_STATE_DONE)
+    {
+        return SWIRJSON_ERROR_PARTIAL;
+    }
+
+    buildOrder(pIndex);
+    return pIndex->nCount;
+}
+
+// value of the first member named szKey, -1 if nObject has none
+int swirjson_find(const swirjson_index_t* pIndex, int nObject, const char* szKey)
+{
+    const swirjson_token_t* pObject;
+    const int* pSorted;
+    int nKeyLen = strlen(szKey);
+    int nLow = 0;
+    int nHigh;
+
+    if ((nObject < 0) || (nObject >= pIndex->nCount) || (pIndex->pTokens[nObject].type != SWIRJSON_OBJECT))
+    {
+        return -1;
+    }
+
+    pObject = &pIndex->pTokens[nObject];
+    pSorted = pIndex->pOrder + pObject->nFirst + pObject->nSize;
+    nHigh = pObject->nSize;
+
+    // lower bound, the first of equal keys is the first in the document
+    while (nLow < nHigh)
+    {
+        int nMid = (nLow + nHigh) / 2;
+        const swirjson_token_t* pKey = &pIndex->pTokens[pSorted[nMid]];
+
+        if (compareKeys(pIndex->pszJson + pKey->nStart, pKey->nEnd - pKey->nStart, szKey, nKeyLen) < 0)
+        {
+            nLow = nMid + 1;
+        }
+        else
+        {
+            nHigh = nMid;
+        }
+    }
+
+    if (nLow < pObject->nSize)
+    {
+        const swirjson_token_t* pKey = &pIndex->pTokens[pSorted[nLow]];
+
+        if (!compareKeys(pIndex->pszJson + pKey->nStart, pKey->nEnd - pKey->nStart, szKey, nKeyLen))
+        {
+            return pSorted[nLow] + 1;
+        }
+    }
+
+    return -1;
+}
+
+// key of the nMember-th member in document order, -1 past the last
+int swirjson_getKey(const swirjson_index_t* pIndex, int nObject, int nMember)
+{
+    const swirjson_token_t* pObject;
+
+    if ((nObject < 0) || (nObject >= pIndex->nCount) || (pIndex->pTokens[nObject].type != SWIRJSON_OBJECT))
+    {
+        return -1;
+    }
+
+    pObject = &pIndex->pTokens[nObject];
+    if ((nMember < 0) || (nMember >= pObject->nSize))
+    {
+        return -1;
+    }
+
+    return pIndex->pOrder[pObject->nFirst + nMember];
+}
+
+// nItem-th element of an array or member value of an object, -1 past the last
+int swirjson_getItem(const swirjson_index_t* pIndex, int nContainer, int nItem)
+{
+    const swirjson_token_t* pContainer;
 
-    memset(szPayload, 0, sizeof(szPayload));
+    if ((nContainer < 0) || (nContainer >= pIndex->nCount))
+    {
+        return -1;
+    }
+
+    pContainer = &pIndex->pTokens[nContainer];
+    if (pContainer->type == SWIRJSON_OBJECT)
+    {
+        int nKey = swirjson_getKey(pIndex, nContainer, nItem);
 
-    if (ulTimestamp == 0)
+        return (nKey < 0) ? -1 : nKey + 1;
+    }
+    else if ((pContainer->type != SWIRJSON_ARRAY) || (nItem < 0) || (nItem >= pContainer->nSize))
     {
-        //sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : 1426939843000, \"value\" : \"%s\"}]}]", szKey, szValue);
-        //sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : \"\", \"value\" : \"%s\"}]}]", szKey, szValue);
-        sprintf(szPayload, "{\"%s\":\"%s\"}", szKey, szValue);
+        return -1;
+    }
+
+    return pIndex->pOrder[pContainer->nFirst + nItem];
+}
+
+swirjson_slice_t swirjson_getSlice(const swirjson_index_t* pIndex, int nToken)
+{
+    swirjson_slice_t slice = { NULL, 0 };
+
+    if ((nToken >= 0) && (nToken < pIndex->nCount))
+    {
+        slice.ptr = pIndex->pszJson + pIndex->pTokens[nToken].nStart;
+        slice.len = pIndex->pTokens[nToken].nEnd - pIndex->pTokens[nToken].nStart;
+    }
+
+    return slice;
+}
+
+// like snprintf: always terminated, returns the full length so that truncation shows as >= nSize
+int swirjson_copy(const swirjson_index_t* pIndex, int nToken, char* szBuffer, int nSize)
+{
+    swirjson_slice_t slice = swirjson_getSlice(pIndex, nToken);
+
+    if (!slice.ptr)
+    {
+        return -1;
+    }
+
+    if (nSize > 0)
+    {
+        int nLen = (slice.len < nSize) ? slice.len : nSize - 1;
+
+        memcpy(szBuffer, slice.ptr, nLen);
+        szBuffer[nLen] = 0;
+    }
+
+    return slice.len;
+}
+
+// NUL-terminated copy the caller frees
+char* swirjson_dup(const swirjson_index_t* pIndex, int nToken)
+{
+    swirjson_slice_t slice = swirjson_getSlice(pIndex, nToken);
+    char* pszValue;
+
+    if (!slice.ptr)
+    {
+        return NULL;
+    }
+
+    pszValue = (char *) malloc(slice.len + 1);
+    if (pszValue)
+    {
+        memcpy(pszValue, slice.ptr, slice.len);
+        pszValue[slice.len] = 0;
+    }
+
+    return pszValue;
+}
+
+static const char szDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const double dPow10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const uint64_t u64Pow10[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+// integers up to here are exact in a double, and so is the product that produced them
+#define JSON_EXACT_INT_MAX      9007199254740992.0
+
+static int formatU64(char* pszBuffer, uint64_t u64Value)
+{
+    char szDigits[20];
+    char* pDigit = szDigits + sizeof(szDigits);
+    int nLen;
+
+    // two digits per division
+    while (u64Value >= 100)
+    {
+        const char* pPair = szDigitPairs + (u64Value % 100) * 2;
+
+        u64Value /= 100;
+        *--pDigit = pPair[1];
+        *--pDigit = pPair[0];
+    }
+
+    if (u64Value >= 10)
+    {
+        *--pDigit = szDigitPairs[u64Value * 2 + 1];
+        *--pDigit = szDigitPairs[u64Value * 2];
     }
     else
     {
-        //sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : %lu, \"value\" : \"%s\"}]}]", szKey, ulTimestamp, szValue);
-        sprintf(szPayload, "{\"%lu\":{\"%s\":\"%s\"}}", ulTimestamp, szKey, szValue);
+        *--pDigit = '0' + u64Value;
     }
 
-    char* pszJson = (char*) malloc(strlen(szPayload)+1);
+    nLen = szDigits + sizeof(szDigits) - pDigit;
+    memcpy(pszBuffer, pDigit, nLen);
+    pszBuffer[nLen] = 0;
+    return nLen;
+}
 
-    strcpy(pszJson, szPayload);
+// u64Scaled / 10^nDecimals, with every decimal written out
+static int formatScaled(char* pszBuffer, int bNegative, uint64_t u64Scaled, int nDecimals)
+{
+    uint64_t u64Fraction = u64Scaled % u64Pow10[nDecimals];
+    int nLen = 0;
+    int i;
 
-    return pszJson;
+    if (bNegative)
+    {
+        pszBuffer[nLen++] = '-';
+    }
+
+    nLen += formatU64(pszBuffer + nLen, u64Scaled / u64Pow10[nDecimals]);
+
+    if (nDecimals)
+    {
+        pszBuffer[nLen++] = '.';
+        for (i = nDecimals; i > 0; i--)
+        {
+            pszBuffer[nLen + i - 1] = '0' + u64Fraction % 10;
+            u64Fraction /= 10;
+        }
+        nLen += nDecimals;
+        pszBuffer[nLen] = 0;
+    }
+
+    return nLen;
 }
 
-char* swirjson_fSerialize(char* szKey, float fValue, unsigned long ulTimestamp)
+// shortest decimal that reads back as dValue, as a double or, with bFloat, as a float
+static int formatShortest(char* pszBuffer, double dValue, int bFloat)
 {
-    char szValue[16];
+    double dAbs = fabs(dValue);
+    int nPrecision = 1;
+    int nLen = 0;
+    int i;
+
+    if (!isfinite(dValue))
+    {
+        return SWIRJSON_ERROR_INVALID;
+    }
 
-    sprintf(szValue, "%.2f", fValue);
+    if (dAbs == 0)
+    {
+        return formatScaled(pszBuffer, signbit(dValue) != 0, 0, 0);
+    }
+
+    // the first number of decimals whose rounding divides back to the same value; the division of two
+    // exact doubles is correctly rounded, so it reads back exactly as strtod() would read the text
+    if ((dAbs >= 1e-3) && (dAbs < 1e15))
+    {
+        // in this range every precision up to 15 digits is tried on the way
+        nPrecision = bFloat ? 9 : 16;
 
-    return swirjson_szSerialize(szKey, szValue, ulTimestamp);
+        for (i = 0; i < sizeof(u64Pow10) / sizeof(u64Pow10[0]); i++)
+        {
+            double dScaled = dAbs * dPow10[i];
+            double dRounded;
+
+            if (dScaled >= JSON_EXACT_INT_MAX)
+            {
+                break;
+            }
+
+            dRounded = floor(dScaled + 0.5);
+            if (bFloat ? ((float)(dRounded / dPow10[i]) == (float)dAbs) : (dRounded / dPow10[i] == dAbs))
+            {
+                return formatScaled(pszBuffer, dValue < 0, (uint64_t)dRounded, i);
+            }
+        }
+    }
+
+    // very large, very small or more than 15 digits: printf, at the lowest precision that reads back
+    for (; nPrecision <= (bFloat ? 9 : 17); nPrecision++)
+    {
+        nLen = snprintf(pszBuffer, SWIRJSON_NUMBER_LEN_MAX, "%.*g", nPrecision, dValue);
+        if (bFloat ? (strtof(pszBuffer, NULL) == (float)dValue) : (strtod(pszBuffer, NULL) == dValue))
+        {
+            break;
+        }
+    }
+
+    return nLen;
 }
 
-char* swirjson_nSerialize(char* szKey, int nValue, unsigned long ulTimestamp)
+int swirjson_formatInt(char* pszBuffer, long nValue)
 {
-    char szValue[16];
+    if (nValue < 0)
+    {
+        pszBuffer[0] = '-';
+        return 1 + formatU64(pszBuffer + 1, 0 - (uint64_t)nValue);
+    }
 
-    sprintf(szValue, "%d", nValue);
+    return formatU64(pszBuffer, nValue);
+}
 
-    return swirjson_szSerialize(szKey, szValue, ulTimestamp);
+int swirjson_formatUInt(char* pszBuffer, unsigned long ulValue)
+{
+    return formatU64(pszBuffer, ulValue);
 }
 
-char* swirjson_lstSerialize(char* szKey, int nValueCount, char** pszValueList, unsigned long* pulTimestampList)
+// same text as printf("%.*f"), which it falls back to when the value is too large for the fast path
+// or so close to a tie that the scaling could round it the wrong way
+int swirjson_formatFixed(char* pszBuffer, double dValue, int nDecimals)
 {
-    char* szPayload = (char *) malloc(JSON_MAX_PAYLOAD_SIZE);
+    double dScaled;
+    double dFloor;
+    int nLen;
 
-    memset(szPayload, 0, JSON_MAX_PAYLOAD_SIZE);
+    if (!isfinite(dValue))
+    {
+        return SWIRJSON_ERROR_INVALID;
+    }
 
-    sprintf(szPayload, "{\"%s\": [", szKey);
+    if (nDecimals < 0)
+    {
+        nDecimals = 0;
+    }
+    else if (nDecimals > SWIRJSON_DECIMALS_MAX)
+    {
+        nDecimals = SWIRJSON_DECIMALS_MAX;
+    }
 
-    int i = 0;
-    for (i=0; i<nValueCount; i++)
+    // the product is off by at most half an ulp, a fraction that far from .5 rounds the same either way
+    dScaled = fabs(dValue) * dPow10[nDecimals];
+    dFloor = floor(dScaled);
+    if ((dScaled < JSON_EXACT_INT_MAX) && (fabs(dScaled - dFloor - 0.5) > dScaled * 0x1p-52))
+    {
+        return formatScaled(pszBuffer, signbit(dValue) != 0, (uint64_t)dFloor + (dScaled - dFloor > 0.5), nDecimals);
+    }
+
+    nLen = snprintf(pszBuffer, SWIRJSON_NUMBER_LEN_MAX, "%.*f", nDecimals, dValue);
+    if (nLen >= SWIRJSON_NUMBER_LEN_MAX)
     {
-        if (pulTimestampList == NULL)
+        nLen = formatShortest(pszBuffer, dValue, 0);
+    }
+
+    return nLen;
+}
+
+int swirjson_formatShortest(char* pszBuffer, double dValue)
+{
+    return formatShortest(pszBuffer, dValue, 0);
+}
+
+int swirjson_formatShortestFloat(char* pszBuffer, float fValue)
+{
+    return formatShortest(pszBuffer, fValue, 1);
+}
+
+static void appendBytes(swirjson_writer_t* pWriter, const char* pData, int nLen)
+{
+    if (pWriter->nError)
+    {
+        return;
+    }
+
+    // room is always kept for the terminating NUL
+    if (nLen > pWriter->nSize - 1 - pWriter->nLen)
+    {
+        pWriter->nError = SWIRJSON_ERROR_NOMEM;
+        return;
+    }
+
+    memcpy(pWriter->pszBuffer + pWriter->nLen, pData, nLen);
+    pWriter->nLen += nLen;
+}
+
+static void appendChar(swirjson_writer_t* pWriter, char cChar)
+{
+    appendBytes(pWriter, &cChar, 1);
+}
+
+// numbers are formatted in place when the longest one fits, so they are not copied
+static char* beginNumber(swirjson_writer_t* pWriter, char* szSpare)
+{
+    return (pWriter->nSize - pWriter->nLen > SWIRJSON_NUMBER_LEN_MAX) ? pWriter->pszBuffer + pWriter->nLen : szSpare;
+}
+
+// JSON has no NaN or infinity, the formatters refuse them and they are written as null
+static void endNumber(swirjson_writer_t* pWriter, const char* pNumber, int nLen)
+{
+    if (nLen < 0)
+    {
+        appendBytes(pWriter, "null", 4);
+    }
+    else if (!pWriter->nError && (pNumber == pWriter->pszBuffer + pWriter->nLen))
+    {
+        pWriter->nLen += nLen;
+    }
+    else
+    {
+        appendBytes(pWriter, pNumber, nLen);
+    }
+}
+
+static void appendFixed(swirjson_writer_t* pWriter, double dValue, int nDecimals)
+{
+    char szSpare[SWIRJSON_NUMBER_LEN_MAX];
+    char* pNumber = beginNumber(pWriter, szSpare);
+
+    if (nDecimals == SWIRJSON_SHORTEST)
+    {
+        endNumber(pWriter, pNumber, swirjson_formatShortest(pNumber, dValue));
+    }
+    else
+    {
+        endNumber(pWriter, pNumber, swirjson_formatFixed(pNumber, dValue, nDecimals));
+    }
+}
+
+// one pass: runs that need no escaping are copied as they are
+static void appendEscaped(swirjson_writer_t* pWriter, const char* pValue, int nLen)
+{
+    static const char szHex[] = "0123456789abcdef";
+    int nRun = 0;
+    int i;
+
+    appendChar(pWriter, JSON_QUOTE);
+
+    for (i = 0; i < nLen; i++)
+    {
+        unsigned char cChar = pValue[i];
+        char szEscape[6] = { JSON_ESCAPE, 0, '0', '0', 0, 0 };
+        int nEscapeLen = 2;
+
+        if ((cChar >= ' ') && (cChar != JSON_QUOTE) && (cChar != JSON_ESCAPE))
         {
-            sprintf(szPayload, "%s {\"timestamp\" : \"\", \"value\" : \"%s\"}", szPayload, pszValueList[i]);
+            continue;
         }
-        else if (pulTimestampList[i] == 0)
+
+        appendBytes(pWriter, pValue + nRun, i - nRun);
+        nRun = i + 1;
+
+        switch (cChar)
         {
-            sprintf(szPayload, "%s {\"timestamp\" : \"\", \"value\" : \"%s\"}", szPayload, pszValueList[i]);
+        case JSON_QUOTE:
+        case JSON_ESCAPE:
+            szEscape[1] = cChar;
+            break;
+        case '\b':
+            szEscape[1] = 'b';
+            break;
+        case '\f':
+            szEscape[1] = 'f';
+            break;
+        case '\n':
+            szEscape[1] = 'n';
+            break;
+        case '\r':
+            szEscape[1] = 'r';
+            break;
+        case '\t':
+            szEscape[1] = 't';
+            break;
+        default:
+            szEscape[1] = 'u';
+            szEscape[4] = szHex[cChar >> 4];
+            szEscape[5] = szHex[cChar & 0xf];
+            nEscapeLen = 6;
+            break;
         }
-        else
+
+        appendBytes(pWriter, szEscape, nEscapeLen);
+    }
+
+    appendBytes(pWriter, pValue + nRun, nLen - nRun);
+    appendChar(pWriter, JSON_QUOTE);
+}
+
+// a comma before every child of a container but the first, nothing between a key and its value
+static void beginValue(swirjson_writer_t* pWriter)
+{
+    unsigned int uBit;
+
+    if (pWriter->bAfterKey)
+    {
+        pWriter->bAfterKey = 0;
+        return;
+    }
+
+    if (pWriter->nDepth == 0)
+    {
+        return;
+    }
+
+    uBit = 1u << (pWriter->nDepth - 1);
+    if (pWriter->uNotFirst & uBit)
+    {
+        appendChar(pWriter, JSON_KEY_VAL_END_MARKER);
+    }
+    pWriter->uNotFirst |= uBit;
+}
+
+static void beginContainer(swirjson_writer_t* pWriter, char cOpen)
+{
+    beginValue(pWriter);
+
+    if (pWriter->nDepth >= SWIRJSON_WRITER_DEPTH_MAX)
+    {
+        if (!pWriter->nError)
         {
-            sprintf(szPayload, "%s {\"timestamp\" : %lu, \"value\" : \"%s\"}", szPayload, pulTimestampList[i], pszValueList[i]);
+            pWriter->nError = SWIRJSON_ERROR_INVALID;
         }
-        free(pszValueList[i]);
+        return;
+    }
+
+    appendChar(pWriter, cOpen);
+    pWriter->uNotFirst &= ~(1u << pWriter->nDepth);
+    pWriter->nDepth++;
+}
 
-        if (i < nValueCount-1)
+static void endContainer(swirjson_writer_t* pWriter, char cClose)
+{
+    if ((pWriter->nDepth == 0) || pWriter->bAfterKey)
+    {
+        if (!pWriter->nError)
         {
-            strcat(szPayload, ",");
+            pWriter->nError = SWIRJSON_ERROR_INVALID;
         }
+        return;
     }
 
-    strcat(szPayload, "]}");
+    pWriter->nDepth--;
+    appendChar(pWriter, cClose);
+}
+
+// a malloc'd copy of a finished document, NULL if it did not fit
+static char* dupDocument(swirjson_writer_t* pWriter)
+{
+    int nLen = swirjson_finish(pWriter);
+    char* pszJson;
+
+    if (nLen < 0)
+    {
+        return NULL;
+    }
+
+    pszJson = (char*) malloc(nLen + 1);
+    if (pszJson)
+    {
+        memcpy(pszJson, pWriter->pszBuffer, nLen + 1);
+    }
+
+    return pszJson;
+}
+
+void swirjson_initWriter(swirjson_writer_t* pWriter, char* pszBuffer, int nSize)
+{
+    pWriter->pszBuffer = pszBuffer;
+    pWriter->nSize = nSize;
+    pWriter->nLen = 0;
+    pWriter->nError = (nSize > 0) ? 0 : SWIRJSON_ERROR_NOMEM;
+    pWriter->nDepth = 0;
+    pWriter->uNotFirst = 0;
+    pWriter->bAfterKey = 0;
+}
+
+void swirjson_beginObject(swirjson_writer_t* pWriter)
+{
+    beginContainer(pWriter, JSON_OBJECT_START);
+}
+
+void swirjson_endObject(swirjson_writer_t* pWriter)
+{
+    endContainer(pWriter, JSON_OBJECT_END);
+}
+
+void swirjson_beginArray(swirjson_writer_t* pWriter)
+{
+    beginContainer(pWriter, JSON_ARRAY_START);
+}
+
+void swirjson_endArray(swirjson_writer_t* pWriter)
+{
+    endContainer(pWriter, JSON_ARRAY_END);
+}
+
+void swirjson_writeKey(swirjson_writer_t* pWriter, const char* szKey)
+{
+    swirjson_writeKeyN(pWriter, szKey, strlen(szKey));
+}
+
+void swirjson_writeKeyN(swirjson_writer_t* pWriter, const char* pKey, int nLen)
+{
+    beginValue(pWriter);
+    appendEscaped(pWriter, pKey, nLen);
+    appendChar(pWriter, JSON_KEY_VAL_SEPARATOR);
+    pWriter->bAfterKey = 1;
+}
+
+void swirjson_writeString(swirjson_writer_t* pWriter, const char* szValue)
+{
+    swirjson_writeStringN(pWriter, szValue, strlen(szValue));
+}
+
+void swirjson_writeStringN(swirjson_writer_t* pWriter, const char* pValue, int nLen)
+{
+    beginValue(pWriter);
+    appendEscaped(pWriter, pValue, nLen);
+}
+
+void swirjson_writeInt(swirjson_writer_t* pWriter, long nValue)
+{
+    char szSpare[SWIRJSON_NUMBER_LEN_MAX];
+    char* pNumber;
+
+    beginValue(pWriter);
+    pNumber = beginNumber(pWriter, szSpare);
+    endNumber(pWriter, pNumber, swirjson_formatInt(pNumber, nValue));
+}
+
+void swirjson_writeUInt(swirjson_writer_t* pWriter, unsigned long ulValue)
+{
+    char szSpare[SWIRJSON_NUMBER_LEN_MAX];
+    char* pNumber;
+
+    beginValue(pWriter);
+    pNumber = beginNumber(pWriter, szSpare);
+    endNumber(pWriter, pNumber, swirjson_formatUInt(pNumber, ulValue));
+}
+
+// nDecimals fixed decimals, or SWIRJSON_SHORTEST for the shortest text that reads back the same
+void swirjson_writeFloat(swirjson_writer_t* pWriter, double dValue, int nDecimals)
+{
+    beginValue(pWriter);
+    appendFixed(pWriter, dValue, nDecimals);
+}
+
+void swirjson_writeBool(swirjson_writer_t* pWriter, int bValue)
+{
+    beginValue(pWriter);
+    if (bValue)
+    {
+        appendBytes(pWriter, "true", 4);
+    }
+    else
+    {
+        appendBytes(pWriter, "false", 5);
+    }
+}
+
+void swirjson_writeNull(swirjson_writer_t* pWriter)
+{
+    beginValue(pWriter);
+    appendBytes(pWriter, "null", 4);
+}
+
+// a value that is JSON already, written as it is
+void swirjson_writeRaw(swirjson_writer_t* pWriter, const char* pJson, int nLen)
+{
+    beginValue(pWriter);
+    appendBytes(pWriter, pJson, nLen);
+}
+
+// terminates the buffer, returns the length or the first error
+int swirjson_finish(swirjson_writer_t* pWriter)
+{
+    if (!pWriter->nError && (pWriter->nDepth || pWriter->bAfterKey))
+    {
+        pWriter->nError = SWIRJSON_ERROR_PARTIAL;
+    }
+
+    if (pWriter->nSize > 0)
+    {
+        pWriter->pszBuffer[pWriter->nError ? 0 : pWriter->nLen] = 0;
+    }
+
+    return pWriter->nError ? pWriter->nError : pWriter->nLen;
+}
+
+// opens {"key": or {"timestamp":{"key": for the value to follow
+static void beginSerialize(swirjson_writer_t* pWriter, const char* szKey, unsigned long ulTimestamp)
+{
+    swirjson_beginObject(pWriter);
+
+    if (ulTimestamp != 0)
+    {
+        char szTimestamp[SWIRJSON_NUMBER_LEN_MAX];
+
+        swirjson_formatUInt(szTimestamp, ulTimestamp);
+        swirjson_writeKey(pWriter, szTimestamp);
+        swirjson_beginObject(pWriter);
+    }
+
+    swirjson_writeKey(pWriter, szKey);
+}
+
+static char* endSerialize(swirjson_writer_t* pWriter, unsigned long ulTimestamp)
+{
+    if (ulTimestamp != 0)
+    {
+        swirjson_endObject(pWriter);
+    }
+
+    swirjson_endObject(pWriter);
+    return dupDocument(pWriter);
+}
+
+char* swirjson_szSerialize(const char* szKey, const char* szValue, unsigned long ulTimestamp)
+{
+    char szPayload[JSON_MAX_PAYLOAD_SIZE];
+    swirjson_writer_t writer;
+
+    swirjson_initWriter(&writer, szPayload, sizeof(szPayload));
+    beginSerialize(&writer, szKey, ulTimestamp);
+    swirjson_writeString(&writer, szValue);
+    return endSerialize(&writer, ulTimestamp);
+}
+
+// the value goes out as a string, as it always has, but is formatted straight into the payload
+char* swirjson_fSerialize(char* szKey, float fValue, unsigned long ulTimestamp)
+{
+    char szPayload[JSON_MAX_PAYLOAD_SIZE];
+    swirjson_writer_t writer;
+
+    swirjson_initWriter(&writer, szPayload, sizeof(szPayload));
+    beginSerialize(&writer, szKey, ulTimestamp);
+    beginValue(&writer);
+    appendChar(&writer, JSON_QUOTE);
+    appendFixed(&writer, fValue, 2);
+    appendChar(&writer, JSON_QUOTE);
+    return endSerialize(&writer, ulTimestamp);
+}
+
+char* swirjson_nSerialize(char* szKey, int nValue, unsigned long ulTimestamp)
+{
+    char szPayload[JSON_MAX_PAYLOAD_SIZE];
+    char szSpare[SWIRJSON_NUMBER_LEN_MAX];
+    swirjson_writer_t writer;
+    char* pNumber;
+
+    swirjson_initWriter(&writer, szPayload, sizeof(szPayload));
+    beginSerialize(&writer, szKey, ulTimestamp);
+    beginValue(&writer);
+    appendChar(&writer, JSON_QUOTE);
+    pNumber = beginNumber(&writer, szSpare);
+    endNumber(&writer, pNumber, swirjson_formatInt(pNumber, nValue));
+    appendChar(&writer, JSON_QUOTE);
+    return endSerialize(&writer, ulTimestamp);
+}
+
+// takes ownership of the values, which are freed whether or not the list fits
+char* swirjson_lstSerialize(char* szKey, int nValueCount, char** pszValueList, unsigned long* pulTimestampList)
+{
+    char szPayload[JSON_MAX_PAYLOAD_SIZE];
+    swirjson_writer_t writer;
+    int i = 0;
+
+    swirjson_initWriter(&writer, szPayload, sizeof(szPayload));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, szKey);
+    swirjson_beginArray(&writer);
+
+    for (i=0; i<nValueCount; i++)
+    {
+        swirjson_beginObject(&writer);
+        swirjson_writeKey(&writer, "timestamp");
+        if ((pulTimestampList == NULL) || (pulTimestampList[i] == 0))
+        {
+            swirjson_writeString(&writer, "");
+        }
+        else
+        {
+            swirjson_writeUInt(&writer, pulTimestampList[i]);
+        }
+        swirjson_writeKey(&writer, "value");
+        swirjson_writeString(&writer, pszValueList[i]);
+        swirjson_endObject(&writer);
+
+        free(pszValueList[i]);
+    }
 
-    return szPayload;
+    swirjson_endArray(&writer);
+    swirjson_endObject(&writer);
+    return dupDocument(&writer);
 }
 
 char *swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
@@ -146,6 +1138,7 @@ char *swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
 
     int nKeyStartPos = -1, nKeyEndPos = -1;
     int nValStartPos = -1, nValEndPos = -1;
+    int nLen = strlen(szJson);
 
     do
     {
@@ -307,7 +1300,7 @@ char *swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
 
         nPos++;
 
-    } while (nPos <= strlen(szJson));
+    } while (nPos <= nLen);
 
     return pszValue;
 }
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
 
 #include "json/swir_json.h"
 
@@ -18,6 +20,9 @@
 #define MQTT_CLIENT_AV_JSON_KEY_MAX_COUNT             10
 #define MQTT_CLIENT_AV_JSON_KEY_MAX_LENGTH            32
 #define MQTT_CLIENT_KEY_NAME_LEN                      128
+#define TEST_JSON_TOKENS_MAX                          64
+#define TEST_COMMAND_TOKENS_MAX                       256     // MQTT_CLIENT_JSON_TOKENS_MAX
+#define TEST_COMMAND_PARAMS                           200
 
 void ParseMessage(char* payload)
 {
@@ -152,6 +157,295 @@ cleanup:
     "}" \
 "]"
 
+#define MSG_5 "[" \
+    "{" \
+        "\"uid\": \"d4a1c2\"," \
+        "\"timestamp\": 1498662247030," \
+        "\"command\": {" \
+            "\"params\": {\"zeta\": [1, {\"x\": null}], \"alpha\": \"say \\\"hi\\\"\", \"mid\": -2.5e3, \"alpha\": false}," \
+            "\"id\": \"reboot\"" \
+        "}" \
+    "}" \
+"]"
+
+/* Same lookups as ParseMessage() through the index, checked against the expected slices */
+int CheckIndexed(const char* payload, const char* expectedKeys[], const char* expectedValues[], int expectedCount)
+{
+    swirjson_token_t tokens[TEST_JSON_TOKENS_MAX];
+    int order[TEST_JSON_TOKENS_MAX];
+    swirjson_index_t index;
+    char value[64];
+    int object, write, i;
+    int failures = 0;
+
+    swirjson_initIndex(&index, tokens, order, TEST_JSON_TOKENS_MAX);
+    if (swirjson_parse(&index, payload, strlen(payload)) <= 0) {
+        ERROR("swirjson_parse() failed");
+        return 1;
+    }
+
+    object = swirjson_getItem(&index, 0, 0);
+    if (swirjson_find(&index, object, "uid") < 0 || swirjson_find(&index, object, "timestamp") < 0) {
+        ERROR("missing 'uid' or 'timestamp'");
+        failures++;
+    }
+
+    write = swirjson_find(&index, object, "write");
+    if (write < 0) {
+        write = swirjson_find(&index, swirjson_find(&index, object, "command"), "params");
+    } else {
+        write = swirjson_getItem(&index, write, 0);
+    }
+
+    for (i = 0; i < expectedCount; i++) {
+        swirjson_copy(&index, swirjson_getKey(&index, write, i), value, sizeof(value));
+        ERROR_IF(!strcmp(value, expectedKeys[i]), "key(%d) '%s' != '%s'", i, value, expectedKeys[i]);
+        failures += strcmp(value, expectedKeys[i]) != 0;
+
+        swirjson_copy(&index, swirjson_getItem(&index, write, i), value, sizeof(value));
+        ERROR_IF(!strcmp(value, expectedValues[i]), "value(%d) '%s' != '%s'", i, value, expectedValues[i]);
+        failures += strcmp(value, expectedValues[i]) != 0;
+
+        /* by name finds the first of duplicate keys */
+        swirjson_copy(&index, swirjson_find(&index, write, expectedKeys[i]), value, sizeof(value));
+        failures += strcmp(value, expectedValues[i]) != 0 && strcmp(expectedKeys[i], "alpha") != 0;
+    }
+    if (swirjson_getKey(&index, write, expectedCount) != -1) {
+        ERROR("more than %d members", expectedCount);
+        failures++;
+    }
+
+    return failures;
+}
+
+int CheckInvalid(void)
+{
+    static const struct { const char* json; int rc; } cases[] = {
+        { "", SWIRJSON_ERROR_PARTIAL },
+        { "{\"a\":1", SWIRJSON_ERROR_PARTIAL },
+        { "{\"a\":\"1}", SWIRJSON_ERROR_PARTIAL },
+        { "{\"a\" 1}", SWIRJSON_ERROR_INVALID },
+        { "{\"a\":1,}", SWIRJSON_ERROR_INVALID },
+        { "[1 2]", SWIRJSON_ERROR_INVALID },
+        { "[1]]", SWIRJSON_ERROR_INVALID },
+        { "{1:2}", SWIRJSON_ERROR_INVALID },
+        { "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]", SWIRJSON_ERROR_NOMEM },
+    };
+    swirjson_token_t tokens[TEST_JSON_TOKENS_MAX];
+    int order[TEST_JSON_TOKENS_MAX];
+    swirjson_index_t index;
+    int failures = 0;
+    int i;
+
+    swirjson_initIndex(&index, tokens, order, TEST_JSON_TOKENS_MAX);
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int rc = swirjson_parse(&index, cases[i].json, strlen(cases[i].json));
+        ERROR_IF(rc == cases[i].rc, "'%s' returned %d, expected %d", cases[i].json, rc, cases[i].rc);
+        failures += rc != cases[i].rc;
+    }
+    return failures;
+}
+
+int CheckWriter(void)
+{
+    struct { char* json; const char* expected; } serialized[] = {
+        { NULL, "{\"temp\":\"21\"}" },
+        { NULL, "{\"1498662247030\":{\"temp\":\"21.50\"}}" },
+        { NULL, "{\"log\":[{\"timestamp\":\"\",\"value\":\"a\\\"b\"},{\"timestamp\":42,\"value\":\"c\\n\"}]}" },
+    };
+    char* values[] = { strdup("a\"b"), strdup("c\n") };
+    unsigned long timestamps[] = { 0, 42 };
+    const char* expected = "{\"s\":\"tab\\t\\u0001\",\"n\":[-3,7,1.25,null,true,false,null]}";
+    swirjson_token_t tokens[TEST_JSON_TOKENS_MAX];
+    int order[TEST_JSON_TOKENS_MAX];
+    swirjson_index_t index;
+    swirjson_writer_t writer;
+    char buffer[128];
+    int failures = 0;
+    int len, i;
+
+    swirjson_initWriter(&writer, buffer, sizeof(buffer));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, "s");
+    swirjson_writeString(&writer, "tab\t\x01");
+    swirjson_writeKey(&writer, "n");
+    swirjson_beginArray(&writer);
+    swirjson_writeInt(&writer, -3);
+    swirjson_writeUInt(&writer, 7);
+    swirjson_writeFloat(&writer, 1.25, 2);
+    swirjson_writeFloat(&writer, NAN, 2);
+    swirjson_writeBool(&writer, 1);
+    swirjson_writeBool(&writer, 0);
+    swirjson_writeNull(&writer);
+    swirjson_endArray(&writer);
+    swirjson_endObject(&writer);
+    len = swirjson_finish(&writer);
+    ERROR_IF(len == strlen(expected) && !strcmp(buffer, expected), "writer produced '%s'", buffer);
+    failures += len != strlen(expected) || strcmp(buffer, expected);
+
+    /* whatever the writer produces, the parser reads back */
+    swirjson_initIndex(&index, tokens, order, TEST_JSON_TOKENS_MAX);
+    len = swirjson_parse(&index, buffer, len);
+    ERROR_IF(len == 12, "parse of written JSON returned %d", len);
+    failures += len != 12;
+
+    /* an overflow is sticky and reported, the buffer is left empty */
+    swirjson_initWriter(&writer, buffer, 8);
+    swirjson_beginArray(&writer);
+    swirjson_writeString(&writer, "too long");
+    swirjson_writeNull(&writer);
+    swirjson_endArray(&writer);
+    len = swirjson_finish(&writer);
+    ERROR_IF(len == SWIRJSON_ERROR_NOMEM && !buffer[0], "overflow returned %d '%s'", len, buffer);
+    failures += len != SWIRJSON_ERROR_NOMEM || buffer[0];
+
+    swirjson_initWriter(&writer, buffer, sizeof(buffer));
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, "k");
+    len = swirjson_finish(&writer);
+    ERROR_IF(len == SWIRJSON_ERROR_PARTIAL, "unterminated document returned %d", len);
+    failures += len != SWIRJSON_ERROR_PARTIAL;
+
+    serialized[0].json = swirjson_nSerialize("temp", 21, 0);
+    serialized[1].json = swirjson_fSerialize("temp", 21.5, 1498662247030UL);
+    serialized[2].json = swirjson_lstSerialize("log", 2, values, timestamps);
+    for (i = 0; i < sizeof(serialized) / sizeof(serialized[0]); i++) {
+        ERROR_IF(serialized[i].json && !strcmp(serialized[i].json, serialized[i].expected), "serialized '%s'", serialized[i].json ? serialized[i].json : "(null)");
+        failures += !serialized[i].json || strcmp(serialized[i].json, serialized[i].expected);
+        free(serialized[i].json);
+    }
+
+    return failures;
+}
+
+/* The formatters against printf and strtod over values shaped like sensor readings and random bits */
+/* a command with more params than the client's stack index holds, re-parsed sized for its payload */
+int CheckManyParams(void)
+{
+    char json[8192];
+    char expected[16];
+    char value[16];
+    swirjson_token_t* tokens;
+    int* order;
+    swirjson_index_t index;
+    int failures = 0;
+    int len;
+    int count;
+    int params;
+    int i;
+
+    len = snprintf(json, sizeof(json), "[{\"uid\":\"7\",\"timestamp\":1,\"command\":{\"id\":\"set\",\"params\":{");
+    for (i = 0; i < TEST_COMMAND_PARAMS; i++) {
+        len += snprintf(json + len, sizeof(json) - len, "%s\"p%d\":\"%d\"", i ? ",":"", i, i * 3);
+    }
+    len += snprintf(json + len, sizeof(json) - len, "}}}]");
+
+    count = SWIRJSON_TOKENS_FOR(len) > TEST_COMMAND_TOKENS_MAX ? SWIRJSON_TOKENS_FOR(len):TEST_COMMAND_TOKENS_MAX;
+    tokens = malloc(count * sizeof(*tokens));
+    order = malloc(count * sizeof(*order));
+
+    swirjson_initIndex(&index, tokens, order, TEST_COMMAND_TOKENS_MAX);
+    i = swirjson_parse(&index, json, len);
+    ERROR_IF(i == SWIRJSON_ERROR_NOMEM, "%d params in %d tokens returned %d", TEST_COMMAND_PARAMS, TEST_COMMAND_TOKENS_MAX, i);
+    failures += i != SWIRJSON_ERROR_NOMEM;
+
+    swirjson_initIndex(&index, tokens, order, SWIRJSON_TOKENS_FOR(len));
+    i = swirjson_parse(&index, json, len);
+    ERROR_IF(i >= 0, "%d params in %d tokens returned %d", TEST_COMMAND_PARAMS, SWIRJSON_TOKENS_FOR(len), i);
+    failures += i < 0;
+
+    params = swirjson_find(&index, swirjson_find(&index, swirjson_getItem(&index, 0, 0), "command"), "params");
+    count = (params >= 0) ? tokens[params].nSize:0;
+    ERROR_IF(count == TEST_COMMAND_PARAMS, "%d params, expected %d", count, TEST_COMMAND_PARAMS);
+    failures += count != TEST_COMMAND_PARAMS;
+    for (i = 0; i < count; i++) {
+        snprintf(expected, sizeof(expected), "p%d", i);
+        swirjson_copy(&index, swirjson_getKey(&index, params, i), value, sizeof(value));
+        failures += strcmp(value, expected) != 0;
+
+        snprintf(expected, sizeof(expected), "%d", i * 3);
+        swirjson_copy(&index, swirjson_getItem(&index, params, i), value, sizeof(value));
+        failures += strcmp(value, expected) != 0;
+    }
+
+    /* the densest text fills the sized index exactly */
+    len = snprintf(json, sizeof(json), "[1");
+    for (i = 1; i < 1000; i++) {
+        len += snprintf(json + len, sizeof(json) - len, ",1");
+    }
+    len += snprintf(json + len, sizeof(json) - len, "]");
+    free(tokens);
+    free(order);
+    tokens = malloc(SWIRJSON_TOKENS_FOR(len) * sizeof(*tokens));
+    order = malloc(SWIRJSON_TOKENS_FOR(len) * sizeof(*order));
+    swirjson_initIndex(&index, tokens, order, SWIRJSON_TOKENS_FOR(len));
+    i = swirjson_parse(&index, json, len);
+    ERROR_IF(i >= 0, "dense array in %d tokens returned %d", SWIRJSON_TOKENS_FOR(len), i);
+    failures += i < 0;
+
+    free(tokens);
+    free(order);
+    return failures;
+}
+
+int CheckNumbers(void)
+{
+    static const double edges[] = { 0.0, -0.0, 0.005, 0.015, 1.005, 2.675, -0.001, 0.125, 1e-7, 123456789.125,
+                                    9007199254740993.0, 1e300, -1.7976931348623157e308, 4.9e-324, 0.1, 1.0 / 3 };
+    char expected[512];
+    char buffer[SWIRJSON_NUMBER_LEN_MAX];
+    int failures = 0;
+    int i, d;
+
+    srand(1);
+    for (i = 0; i < 200000 + sizeof(edges) / sizeof(edges[0]); i++) {
+        double value;
+        uint64_t bits;
+        long integer = ((long)rand() << 31 | rand()) >> (rand() % 62);
+
+        if (i < sizeof(edges) / sizeof(edges[0])) {
+            value = edges[i];
+        } else if (i & 1) {
+            value = (rand() - RAND_MAX / 2) / (double)(1 << (rand() % 20));
+        } else {
+            bits = (uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^ rand();
+            memcpy(&value, &bits, sizeof(value));
+            if (!isfinite(value)) continue;
+        }
+
+        if (i & 2) integer = -integer;
+        snprintf(expected, sizeof(expected), "%ld", integer);
+        swirjson_formatInt(buffer, integer);
+        failures += strcmp(buffer, expected) != 0;
+
+        for (d = 0; d <= 6; d += 2) {
+            int len = snprintf(expected, sizeof(expected), "%.*f", d, value);
+            if (len < SWIRJSON_NUMBER_LEN_MAX) {
+                swirjson_formatFixed(buffer, value, d);
+                ERROR_IF(!strcmp(buffer, expected), "fixed(%d) '%s' != '%s'", d, buffer, expected);
+                failures += strcmp(buffer, expected) != 0;
+            }
+        }
+
+        swirjson_formatShortest(buffer, value);
+        ERROR_IF(strtod(buffer, NULL) == value, "shortest '%s' != %.17g", buffer, value);
+        failures += strtod(buffer, NULL) != value;
+
+        swirjson_formatShortestFloat(buffer, (float)value);
+        failures += isfinite((float)value) && strtof(buffer, NULL) != (float)value;
+    }
+
+    failures += swirjson_formatFixed(buffer, NAN, 2) != SWIRJSON_ERROR_INVALID;
+    failures += swirjson_formatShortest(buffer, INFINITY) != SWIRJSON_ERROR_INVALID;
+    swirjson_formatShortestFloat(buffer, 21.1f);
+    failures += strcmp(buffer, "21.1") != 0;
+    swirjson_formatInt(buffer, LONG_MIN);
+    snprintf(expected, sizeof(expected), "%ld", LONG_MIN);
+    failures += strcmp(buffer, expected) != 0;
+
+    return failures;
+}
+
 /*------------------------------------------------------------------------------*/
 /* Main                                                                         */
 /*------------------------------------------------------------------------------*/
@@ -169,5 +463,32 @@ int main(int argc, char *argv[])
     DEBUG("%s", MSG_4);
     ParseMessage(MSG_4);
 
+    {
+        static const char* keys1[] = { "key1.id1.test" };
+        static const char* values1[] = { "0" };
+        static const char* keys3[] = { "key3.id3.test" };
+        static const char* values3[] = { "85" };
+        static const char* keys4[] = { "key4.id4.message" };
+        static const char* values4[] = { "The test message " };
+        static const char* keys5[] = { "zeta", "alpha", "mid", "alpha" };
+        static const char* values5[] = { "[1, {\"x\": null}]", "say \\\"hi\\\"", "-2.5e3", "false" };
+        int failures = 0;
+
+        failures += CheckIndexed(MSG_1, keys1, values1, 1);
+        failures += CheckIndexed(MSG_3, keys3, values3, 1);
+        failures += CheckIndexed(MSG_4, keys4, values4, 1);
+        failures += CheckIndexed(MSG_5, keys5, values5, 4);
+        failures += CheckInvalid();
+        failures += CheckManyParams();
+        failures += CheckWriter();
+        failures += CheckNumbers();
+
+        if (failures) {
+            ERROR("%d parser and writer checks failed", failures);
+            return 1;
+        }
+        INFO("parser and writer checks passed");
+    }
+
     return 0;
 }
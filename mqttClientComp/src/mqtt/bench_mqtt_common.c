@@ -0,0 +1,110 @@
+/**
+ * @file
+ *
+ * Harness shared by the off-target benchmarks of the MQTT codec and topic index, see
+ * bench_mqtt_common.h.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqttLog.h"
+#include "bench_mqtt_common.h"
+
+static long bench_minNs = BENCH_DEFAULT_MIN_MS * 1000000L;
+static const char* bench_match = NULL;
+static volatile long bench_sink;
+
+static long bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void bench_log(int level, const char* file, int line, const char* format, va_list args)
+{
+	fprintf(stderr, "[%s] (%s:%d): ", (level == MQTTLOG_LEVEL_ERROR) ? "ERROR" : "DEBUG", file, line);
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+}
+
+static void bench_usage(const char* prog)
+{
+	fprintf(stderr, "usage: %s [-t min_ms_per_case] [-m case_substring] [-v]\n", prog);
+}
+
+int bench_options(int argc, char** argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:m:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			bench_minNs = atol(optarg) * 1000000L;
+			break;
+		case 'm':
+			bench_match = optarg;
+			break;
+		case 'v':
+			MQTTLog_setHook(bench_log);
+			break;
+		default:
+			bench_usage(argv[0]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void bench_header(const char* name, const char* unit)
+{
+	printf("# %s benchmark format(%d) min_ms(%ld)\n", name, BENCH_FORMAT_VERSION, bench_minNs / 1000000L);
+	printf("# case\tns_op\t%s_op\titerations\n", unit);
+}
+
+void bench_run(const char* name, bench_op_f op)
+{
+	long iterations = 1;
+	long elapsed = 0;
+	long total = 0;
+	long rc;
+	long i;
+
+	if (bench_match && !strstr(name, bench_match))
+		return;
+
+	if ((rc = op()) < 0)
+	{
+		printf("# %s failed(%ld)\n", name, rc);
+		return;
+	}
+
+	for (;;)
+	{
+		long start = bench_now();
+
+		total = 0;
+		for (i = 0; i < iterations; i++)
+			total += op();
+		elapsed = bench_now() - start;
+		bench_sink = total;
+
+		if (elapsed >= bench_minNs)
+			break;
+		iterations *= 2;
+	}
+
+	printf("%s\t%.1f\t%.2f\t%ld\n", name, (double)elapsed / iterations, (double)total / iterations, iterations);
+	fflush(stdout);
+}
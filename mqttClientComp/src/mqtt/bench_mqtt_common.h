@@ -0,0 +1,32 @@
+/**
+ * @file
+ *
+ * Harness shared by the off-target benchmarks of the MQTT codec and topic index: options, timing
+ * and output.
+ *
+ * A case returns what it handled in one call (bytes, matches), or a negative value on failure.  It
+ * is repeated, doubling the iteration count, until it has run for at least the minimum time, then
+ * one line is printed per case:
+ *
+ *     <case>\t<ns/op>\t<unit/op>\t<iterations>
+ *
+ * Lines starting with '#' are comments.  Case names are stable so that the output of two releases
+ * can be joined on the first column and diffed.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#ifndef _BENCH_MQTT_COMMON_H_
+#define _BENCH_MQTT_COMMON_H_
+
+#define BENCH_FORMAT_VERSION                          2
+#define BENCH_DEFAULT_MIN_MS                          200
+
+typedef int (*bench_op_f)(void);
+
+int bench_options(int argc, char** argv);
+void bench_header(const char* name, const char* unit);
+void bench_run(const char* name, bench_op_f op);
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * @file
+ *
+ * Serialize/deserialize cost per packet type for the MQTT codec, built off-target against
+ * libmqttpacket.a (see the Makefile next to this file).  Output is the format of
+ * bench_mqtt_common.h, in bytes serialized or deserialized per op.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mqttPacket.h"
+#include "bench_mqtt_common.h"
+
+#define BENCH_BUFFER_SIZE                             (64 * 1024)
+#define BENCH_TOPIC                                   "359377060000000/messages/json"
+#define BENCH_FILTER                                  "359377060000000/tasks/json"
+
+static unsigned char bench_buf[BENCH_BUFFER_SIZE];
+static unsigned char bench_packet[BENCH_BUFFER_SIZE];
+static unsigned char bench_payload[BENCH_BUFFER_SIZE];
+static unsigned char bench_tmpl[MQTTPUBLISH_TEMPLATE_LEN(sizeof(BENCH_TOPIC))];
+static int bench_tmplLen;
+static int bench_packetLen;
+static int bench_qos;
+static int bench_payloadLen;
+static unsigned short bench_packetId = 1;
+
+static int bench_serializeConnect(void)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+	data.clientID.cstring = "359377060000000";
+	data.username.cstring = "359377060000000";
+	data.password.cstring = "sierra";
+	data.keepAliveInterval = 30;
+	data.cleansession = 1;
+	data.MQTTVersion = 3;
+	return MQTTSerialize_connect(bench_buf, sizeof(bench_buf), &data);
+}
+
+static int bench_deserializeConnect(void)
+{
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+	return (MQTTDeserialize_connect(&data, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializeConnack(void)
+{
+	return MQTTSerialize_connack(bench_buf, sizeof(bench_buf), 0, 1);
+}
+
+static int bench_deserializeConnack(void)
+{
+	unsigned char sessionPresent, rc;
+
+	return (MQTTDeserialize_connack(&sessionPresent, &rc, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializePublish(void)
+{
+	MQTTString topic = MQTTString_initializer;
+
+	topic.cstring = BENCH_TOPIC;
+	return MQTTSerialize_publish(bench_buf, sizeof(bench_buf), 0, bench_qos, 0, bench_packetId, topic, bench_payload, bench_payloadLen);
+}
+
+static int bench_serializePublishHeader(void)
+{
+	MQTTString topic = MQTTString_initializer;
+
+	topic.cstring = BENCH_TOPIC;
+	return MQTTSerialize_publishHeader(bench_buf, sizeof(bench_buf), 0, bench_qos, 0, bench_packetId, topic, bench_payloadLen)
+			+ bench_payloadLen;
+}
+
+static int bench_serializePublishPrepared(void)
+{
+	unsigned char* start = NULL;
+
+	return MQTTSerialize_publishPrepared(bench_tmpl, bench_tmplLen, 0, bench_qos, 0, bench_packetId, bench_payloadLen, &start)
+			+ bench_payloadLen;
+}
+
+static int bench_deserializePublish(void)
+{
+	unsigned char dup, retained;
+	unsigned short packetId;
+	MQTTString topic;
+	unsigned char* payload;
+	int qos, payloadLen;
+
+	return (MQTTDeserialize_publish(&dup, &qos, &retained, &packetId, &topic, &payload, &payloadLen,
+			bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializeSubscribe(void)
+{
+	MQTTString filter = MQTTString_initializer;
+	int qos = 1;
+
+	filter.cstring = BENCH_FILTER;
+	return MQTTSerialize_subscribe(bench_buf, sizeof(bench_buf), 0, bench_packetId, 1, &filter, &qos);
+}
+
+static int bench_deserializeSubscribe(void)
+{
+	MQTTString filter;
+	unsigned char dup;
+	unsigned short packetId;
+	int count, qos;
+
+	return (MQTTDeserialize_subscribe(&dup, &packetId, 1, &count, &filter, &qos, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializeSuback(void)
+{
+	int qos = 1;
+
+	return MQTTSerialize_suback(bench_buf, sizeof(bench_buf), bench_packetId, 1, &qos);
+}
+
+static int bench_deserializeSuback(void)
+{
+	unsigned short packetId;
+	int count, qos;
+
+	return (MQTTDeserialize_suback(&packetId, 1, &count, &qos, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializeUnsubscribe(void)
+{
+	MQTTString filter = MQTTString_initializer;
+
+	filter.cstring = BENCH_FILTER;
+	return MQTTSerialize_unsubscribe(bench_buf, sizeof(bench_buf), 0, bench_packetId, 1, &filter);
+}
+
+static int bench_deserializeUnsuback(void)
+{
+	unsigned short packetId;
+
+	return (MQTTDeserialize_unsuback(&packetId, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializePuback(void)
+{
+	return MQTTSerialize_puback(bench_buf, sizeof(bench_buf), bench_packetId);
+}
+
+static int bench_serializePubrec(void)
+{
+	return MQTTSerialize_ack(bench_buf, sizeof(bench_buf), PUBREC, 0, bench_packetId);
+}
+
+static int bench_serializePubrel(void)
+{
+	return MQTTSerialize_pubrel(bench_buf, sizeof(bench_buf), 0, bench_packetId);
+}
+
+static int bench_serializePubcomp(void)
+{
+	return MQTTSerialize_pubcomp(bench_buf, sizeof(bench_buf), bench_packetId);
+}
+
+static int bench_deserializeAck(void)
+{
+	unsigned char type, dup;
+	unsigned short packetId;
+
+	return (MQTTDeserialize_ack(&type, &dup, &packetId, bench_packet, bench_packetLen) == 1) ? bench_packetLen : -1;
+}
+
+static int bench_serializePingreq(void)
+{
+	return MQTTSerialize_pingreq(bench_buf, sizeof(bench_buf));
+}
+
+// serializes one packet with the given op and keeps it as the input of the deserialize cases
+static void bench_prepare(bench_op_f op)
+{
+	bench_packetLen = op();
+	if (bench_packetLen > 0)
+		memcpy(bench_packet, bench_buf, bench_packetLen);
+}
+
+int main(int argc, char** argv)
+{
+	static const int payloadSizes[] = { 16, 128, 1024, 8192 };
+	static const struct
+	{
+		const char* packet;
+		bench_op_f ack;
+	} acks[] =
+	{
+		{ "PUBACK", bench_serializePuback },
+		{ "PUBREC", bench_serializePubrec },
+		{ "PUBREL", bench_serializePubrel },
+		{ "PUBCOMP", bench_serializePubcomp },
+	};
+	MQTTString topic = MQTTString_initializer;
+	char name[64];
+	int i, j;
+
+	if (bench_options(argc, argv) != 0)
+		return 1;
+
+	for (i = 0; i < (int)sizeof(bench_payload); i++)
+		bench_payload[i] = 'a' + (i % 26);
+
+	topic.cstring = BENCH_TOPIC;
+	bench_tmplLen = MQTTSerialize_publishTemplate(bench_tmpl, sizeof(bench_tmpl), topic);
+
+	bench_header("mqtt codec", "bytes");
+
+	bench_run("serialize/CONNECT", bench_serializeConnect);
+	bench_prepare(bench_serializeConnect);
+	bench_run("deserialize/CONNECT", bench_deserializeConnect);
+
+	bench_run("serialize/CONNACK", bench_serializeConnack);
+	bench_prepare(bench_serializeConnack);
+	bench_run("deserialize/CONNACK", bench_deserializeConnack);
+
+	for (bench_qos = 0; bench_qos <= 2; bench_qos++)
+	{
+		for (j = 0; j < (int)(sizeof(payloadSizes) / sizeof(payloadSizes[0])); j++)
+		{
+			bench_payloadLen = payloadSizes[j];
+
+			snprintf(name, sizeof(name), "serialize/PUBLISH/qos%d/%d", bench_qos, bench_payloadLen);
+			bench_run(name, bench_serializePublish);
+			snprintf(name, sizeof(name), "serialize/PUBLISH_HEADER/qos%d/%d", bench_qos, bench_payloadLen);
+			bench_run(name, bench_serializePublishHeader);
+			snprintf(name, sizeof(name), "serialize/PUBLISH_PREPARED/qos%d/%d", bench_qos, bench_payloadLen);
+			bench_run(name, bench_serializePublishPrepared);
+
+			bench_prepare(bench_serializePublish);
+			snprintf(name, sizeof(name), "deserialize/PUBLISH/qos%d/%d", bench_qos, bench_payloadLen);
+			bench_run(name, bench_deserializePublish);
+		}
+	}
+
+	bench_run("serialize/SUBSCRIBE", bench_serializeSubscribe);
+	bench_prepare(bench_serializeSubscribe);
+	bench_run("deserialize/SUBSCRIBE", bench_deserializeSubscribe);
+
+	bench_run("serialize/SUBACK", bench_serializeSuback);
+	bench_prepare(bench_serializeSuback);
+	bench_run("deserialize/SUBACK", bench_deserializeSuback);
+
+	bench_run("serialize/UNSUBSCRIBE", bench_serializeUnsubscribe);
+	bench_packetLen = MQTTSerialize_unsuback(bench_packet, sizeof(bench_packet), bench_packetId);
+	bench_run("deserialize/UNSUBACK", bench_deserializeUnsuback);
+
+	for (i = 0; i < (int)(sizeof(acks) / sizeof(acks[0])); i++)
+	{
+		snprintf(name, sizeof(name), "serialize/%s", acks[i].packet);
+		bench_run(name, acks[i].ack);
+		bench_prepare(acks[i].ack);
+		snprintf(name, sizeof(name), "deserialize/%s", acks[i].packet);
+		bench_run(name, bench_deserializeAck);
+	}
+
+	bench_run("serialize/PINGREQ", bench_serializePingreq);
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file
+ *
+ * Matching cost of the topic filter index (mqttTopic.c) against thousands of filters, next to a
+ * linear scan over the same filters as a baseline.  Built off-target like bench_mqtt_packet.c.
+ *
+ * Each asset subscribes three filters, "assets/<id>/telemetry/+", "assets/<id>/cmd/#" and
+ * "assets/<id>/status", and a handful of fleet-wide wildcards are added on top.  Topic names rotate
+ * over the assets so that lookups are not served from one hot cache line.  Output is the format of
+ * bench_mqtt_common.h, in matches per op.  Before timing, every case checks that the index and the
+ * linear scan agree on the number of matches.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mqttTopic.h"
+#include "bench_mqtt_common.h"
+
+#define BENCH_FILTER_LEN                              64
+#define BENCH_TOPIC_COUNT                             256
+
+static const char* bench_wildcards[] =
+{
+  "assets/+/alarm",
+  "assets/+/telemetry/battery",
+  "+/+/cmd/reboot",
+  "fleet/#",
+  "$SYS/#",
+};
+
+static char (*bench_filters)[BENCH_FILTER_LEN];
+static int bench_filterCount;
+static char bench_topics[BENCH_TOPIC_COUNT][BENCH_FILTER_LEN];
+static int bench_topicLens[BENCH_TOPIC_COUNT];
+static int bench_topicIndex;
+static MQTTTopic_tree* bench_tree;
+
+/* the straightforward per-filter matcher the index replaces */
+static int bench_isMatched(const char* filter, const char* topic, int topicLen)
+{
+	const char* end = topic + topicLen;
+
+	if (topicLen > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+		return 0;
+
+	while (*filter && topic < end)
+	{
+		if (*filter == '#')
+			return 1;
+		if (*filter == '+')
+		{
+			while (topic < end && *topic != '/')
+				topic++;
+			filter++;
+		}
+		else
+		{
+			while (*filter && *filter != '/' && topic < end && *topic == *filter)
+			{
+				filter++;
+				topic++;
+			}
+			if ((*filter && *filter != '/') || (topic < end && *topic != '/'))
+				return 0;
+		}
+
+		if (*filter == '/' && topic < end && *topic == '/')
+		{
+			filter++;
+			topic++;
+		}
+		else if (*filter || topic < end)
+			break;
+	}
+
+	if (topic == end)
+	{
+		/* "a/#" matches "a", "a/+" matches "a/" */
+		if (*filter == '\0' || strcmp(filter, "/#") == 0 || strcmp(filter, "#") == 0)
+			return 1;
+		if (strcmp(filter, "+") == 0 && topicLen > 0 && end[-1] == '/')
+			return 1;
+	}
+	return 0;
+}
+
+static int bench_count(void* subscriber, void* context)
+{
+	return 1;
+}
+
+static const char* bench_nextTopic(int* len)
+{
+	int i = bench_topicIndex++ & (BENCH_TOPIC_COUNT - 1);
+
+	*len = bench_topicLens[i];
+	return bench_topics[i];
+}
+
+static int bench_matchTrie(void)
+{
+	int len = 0;
+	const char* topic = bench_nextTopic(&len);
+
+	return MQTTTopic_match(bench_tree, topic, len, bench_count, NULL);
+}
+
+static int bench_matchLinear(void)
+{
+	int len = 0;
+	const char* topic = bench_nextTopic(&len);
+	int matches = 0;
+	int i;
+
+	for (i = 0; i < bench_filterCount; i++)
+		matches += bench_isMatched(bench_filters[i], topic, len);
+	return matches;
+}
+
+/* unsubscribe and resubscribe one asset's telemetry filter, the churn of a device coming and going */
+static int bench_addRemove(void)
+{
+	int i = (bench_topicIndex++ % (bench_filterCount - (int)(sizeof(bench_wildcards) / sizeof(bench_wildcards[0])))) / 3 * 3;
+
+	MQTTTopic_remove(bench_tree, bench_filters[i], &bench_filters[i]);
+	return MQTTTopic_add(bench_tree, bench_filters[i], &bench_filters[i]);
+}
+
+static int bench_setup(int assets)
+{
+	int wildcards = sizeof(bench_wildcards) / sizeof(bench_wildcards[0]);
+	int i;
+
+	MQTTTopic_destroy(bench_tree);
+	free(bench_filters);
+
+	bench_filterCount = assets * 3 + wildcards;
+	if ((bench_filters = malloc(bench_filterCount * sizeof(*bench_filters))) == NULL ||
+	    (bench_tree = MQTTTopic_create()) == NULL)
+		return -1;
+
+	for (i = 0; i < assets; i++)
+	{
+		snprintf(bench_filters[i * 3], BENCH_FILTER_LEN, "assets/%08d/telemetry/+", i);
+		snprintf(bench_filters[i * 3 + 1], BENCH_FILTER_LEN, "assets/%08d/cmd/#", i);
+		snprintf(bench_filters[i * 3 + 2], BENCH_FILTER_LEN, "assets/%08d/status", i);
+	}
+	for (i = 0; i < wildcards; i++)
+		strcpy(bench_filters[assets * 3 + i], bench_wildcards[i]);
+
+	for (i = 0; i < bench_filterCount; i++)
+	{
+		if (MQTTTopic_add(bench_tree, bench_filters[i], &bench_filters[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_topicsFor(const char* kind, int assets)
+{
+	int i;
+
+	for (i = 0; i < BENCH_TOPIC_COUNT; i++)
+	{
+		int asset = (int)((i * 2654435761u) % (unsigned)assets);
+
+		if (strcmp(kind, "telemetry") == 0)
+			snprintf(bench_topics[i], BENCH_FILTER_LEN, "assets/%08d/telemetry/%s", asset, (i & 1) ? "battery" : "temp");
+		else if (strcmp(kind, "cmd") == 0)
+			snprintf(bench_topics[i], BENCH_FILTER_LEN, "assets/%08d/cmd/reboot/now", asset);
+		else
+			snprintf(bench_topics[i], BENCH_FILTER_LEN, "gateways/%08d/telemetry/temp", asset);
+		bench_topicLens[i] = strlen(bench_topics[i]);
+	}
+
+	/* both implementations must agree before either is timed */
+	for (i = 0; i < BENCH_TOPIC_COUNT; i++)
+	{
+		int trie = bench_matchTrie();
+
+		bench_topicIndex--;
+		if (trie != bench_matchLinear())
+		{
+			printf("# mismatch on %s\n", bench_topics[i]);
+			return -1;
+		}
+	}
+	bench_topicIndex = 0;
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	static const int assetCounts[] = { 100, 1000, 10000 };
+	static const char* kinds[] = { "telemetry", "cmd", "miss" };
+	char name[64];
+	int i, j;
+
+	if (bench_options(argc, argv) != 0)
+		return 1;
+
+	bench_header("mqtt topic index", "matches");
+
+	for (i = 0; i < (int)(sizeof(assetCounts) / sizeof(assetCounts[0])); i++)
+	{
+		if (bench_setup(assetCounts[i]) != 0)
+		{
+			printf("# setup failed for %d assets\n", assetCounts[i]);
+			return 1;
+		}
+
+		for (j = 0; j < (int)(sizeof(kinds) / sizeof(kinds[0])); j++)
+		{
+			if (bench_topicsFor(kinds[j], assetCounts[i]) != 0)
+				return 1;
+
+			snprintf(name, sizeof(name), "match/trie/%s/%d", kinds[j], bench_filterCount);
+			bench_run(name, bench_matchTrie);
+			snprintf(name, sizeof(name), "match/linear/%s/%d", kinds[j], bench_filterCount);
+			bench_run(name, bench_matchLinear);
+		}
+
+		snprintf(name, sizeof(name), "update/trie/%d", bench_filterCount);
+		bench_run(name, bench_addRemove);
+	}
+
+	MQTTTopic_destroy(bench_tree);
+	free(bench_filters);
+	return 0;
+}
@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -66,7 +66,7 @@ int MQTTSerialize_connect(unsigned char* buf, int buflen, MQTTPacket_connectData
 	FUNC_ENTRY;
 	if (MQTTPacket_len(len = MQTTSerialize_connectLength(options)) > buflen)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
@@ -143,7 +143,7 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	header.byte = readChar(&curdata);
 	if (header.bits.type != CONNACK)
         {
-                LE_ERROR("header type != CONNACK");
+                MQTTLOG_ERROR("header type != CONNACK");
 		goto exit;
         }
 
@@ -151,7 +151,7 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	enddata = curdata + mylen;
 	if (enddata - curdata < 2)
         {
-                LE_ERROR("invalid remaining length(%u)", mylen);
+                MQTTLOG_ERROR("invalid remaining length(%u)", mylen);
                 rc = 0;
 		goto exit;
         }
@@ -183,7 +183,7 @@ int MQTTSerialize_zero(unsigned char* buf, int buflen, unsigned char packettype)
 	FUNC_ENTRY;
 	if (buflen < 2)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
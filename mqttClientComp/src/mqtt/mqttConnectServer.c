@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "StackTrace.h"
 #include "mqttPacket.h"
 #include <string.h>
@@ -69,7 +69,7 @@ int MQTTDeserialize_connect(MQTTPacket_connectData* data, unsigned char* buf, in
 	if (!readMQTTLenString(&Protocol, &curdata, enddata) ||
 		enddata - curdata < 0) /* do we have enough data to read the protocol version byte? */
         {
-                LE_ERROR("not enough data");
+                MQTTLOG_ERROR("not enough data");
 		goto exit;
         }
 
@@ -84,7 +84,7 @@ int MQTTDeserialize_connect(MQTTPacket_connectData* data, unsigned char* buf, in
 		data->keepAliveInterval = readInt(&curdata);
 		if (!readMQTTLenString(&data->clientID, &curdata, enddata))
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		data->willFlag = flags.bits.will;
@@ -95,7 +95,7 @@ int MQTTDeserialize_connect(MQTTPacket_connectData* data, unsigned char* buf, in
 			if (!readMQTTLenString(&data->will.topicName, &curdata, enddata) ||
 				  !readMQTTLenString(&data->will.message, &curdata, enddata))
                         {
-                                LE_ERROR("invalid data");
+                                MQTTLOG_ERROR("invalid data");
 				goto exit;
                         }
 		}
@@ -103,19 +103,19 @@ int MQTTDeserialize_connect(MQTTPacket_connectData* data, unsigned char* buf, in
 		{
 			if (enddata - curdata < 3 || !readMQTTLenString(&data->username, &curdata, enddata))
                         {
-                                LE_ERROR("no username");
+                                MQTTLOG_ERROR("no username");
 				goto exit; /* username flag set, but no username supplied - invalid */
                         }
 			if (flags.bits.password &&
 				(enddata - curdata < 3 || !readMQTTLenString(&data->password, &curdata, enddata)))
                         {
-                                LE_ERROR("no password");
+                                MQTTLOG_ERROR("no password");
 				goto exit; /* password flag set, but no password supplied - invalid */
                         }
 		}
 		else if (flags.bits.password)
                 {
-                        LE_ERROR("no username");
+                        MQTTLOG_ERROR("no username");
 			goto exit; /* password flag set without username - invalid */
                 }
 
@@ -145,7 +145,7 @@ int MQTTSerialize_connack(unsigned char* buf, int buflen, unsigned char connack_
 	FUNC_ENTRY;
 	if (buflen < 2)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
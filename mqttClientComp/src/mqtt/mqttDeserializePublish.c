@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "StackTrace.h"
 #include "mqttPacket.h"
 #include <string.h>
@@ -46,7 +46,7 @@ int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retaine
 	header.byte = readChar(&curdata);
 	if (header.bits.type != PUBLISH)
         {
-                LE_ERROR("header type != PUBLISH");
+                MQTTLOG_ERROR("header type != PUBLISH");
 		goto exit;
         }
 
@@ -60,7 +60,7 @@ int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retaine
 	if (!readMQTTLenString(topicName, &curdata, enddata) ||
 		enddata - curdata < 0) /* do we have enough data to read the protocol version byte? */
         {
-                LE_ERROR("invalid data");
+                MQTTLOG_ERROR("invalid data");
 		goto exit;
         }
 
@@ -104,7 +104,7 @@ int MQTTDeserialize_ack(unsigned char* packettype, unsigned char* dup, unsigned
 
 	if (enddata - curdata < 2)
         {
-                LE_ERROR("invalid data");
+                MQTTLOG_ERROR("invalid data");
 		goto exit;
         }
 	*packetid = readInt(&curdata);
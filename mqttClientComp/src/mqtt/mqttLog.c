@@ -0,0 +1,36 @@
+/**
+ * @file
+ *
+ * Log hook for the standalone codec build.  Nothing here is compiled into the Legato component,
+ * where mqttLog.h maps the codec's log macros straight onto the Legato ones.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include "mqttLog.h"
+
+#include <stddef.h>
+
+#if defined(MQTT_CODEC_STANDALONE)
+
+static MQTTLog_hook MQTTLog_current = NULL;
+
+void MQTTLog_setHook(MQTTLog_hook hook)
+{
+	MQTTLog_current = hook;
+}
+
+void MQTTLog_write(int level, const char* file, int line, const char* format, ...)
+{
+	va_list args;
+
+	if (!MQTTLog_current)
+		return;
+
+	va_start(args, format);
+	(*MQTTLog_current)(level, file, line, format, args);
+	va_end(args);
+}
+
+#endif
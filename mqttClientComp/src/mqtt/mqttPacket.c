@@ -14,7 +14,7 @@
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *    Sergio R. Caprile - non-blocking packet read functions for stream transport
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "StackTrace.h"
 #include "mqttPacket.h"
 
@@ -66,21 +66,21 @@ int MQTTPacket_decode(int (*getcharfn)(unsigned char*, int), int* value)
 
 		if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
 		{
-                        LE_ERROR("read error");
+                        MQTTLOG_ERROR("read error");
 			rc = MQTTPACKET_READ_ERROR;	/* bad data */
 			goto exit;
 		}
 		rc = (*getcharfn)(&c, 1);
 		if (rc != 1)
                 {
-                        LE_ERROR("read error");
+                        MQTTLOG_ERROR("read error");
 			goto exit;
                 }
 		*value += (c & 127) * multiplier;
 		multiplier *= 128;
 	} while ((c & 128) != 0);
 exit:
-        LE_DEBUG("message length(%u)", len);
+        MQTTLOG_DEBUG("message length(%u)", len);
 	FUNC_EXIT_RC(len);
 	return len;
 }
@@ -302,7 +302,7 @@ int MQTTPacket_read(unsigned char* buf, int buflen, int (*getfn)(unsigned char*,
 	/* 1. read the header byte.  This has the packet type in it */
 	if ((*getfn)(buf, 1) != 1)
         {
-                LE_ERROR("read header byte failed");
+                MQTTLOG_ERROR("read header byte failed");
 		goto exit;
         }
 
@@ -314,12 +314,12 @@ int MQTTPacket_read(unsigned char* buf, int buflen, int (*getfn)(unsigned char*,
 	/* 3. read the rest of the buffer using a callback to supply the rest of the data */
 	if((rem_len + len) > buflen)
         {
-                LE_ERROR("invalid data");
+                MQTTLOG_ERROR("invalid data");
 		goto exit;
         }
 	if ((*getfn)(buf + len, rem_len) != rem_len)
         {
-                LE_ERROR("invalid data");
+                MQTTLOG_ERROR("invalid data");
 		goto exit;
         }
 
@@ -349,12 +349,12 @@ static int MQTTPacket_decodenb(MQTTTransport *trp)
 		int frc;
 		if (++(trp->len) > MAX_NO_OF_REMAINING_LENGTH_BYTES)
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		if ((frc=(*trp->getfn)(trp->sck, &c, 1)) == -1)
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		if (frc == 0){
@@ -375,8 +375,9 @@ exit:
  * @param buf the buffer into which the packet will be serialized
  * @param buflen the length in bytes of the supplied buffer
  * @param trp pointer to a transport structure holding what is needed to solve getting data from it
- * @return integer MQTT packet type, 0 for call again, or -1 on error
- * @note  the whole message must fit into the caller's buffer
+ * @return integer MQTT packet type, 0 for call again, -1 on error, or MQTTPACKET_BUFFER_TOO_SHORT
+ *         if the packet does not fit: the header bytes already read stay in buf and the call can
+ *         be repeated with a larger buffer holding a copy of them
  */
 int MQTTPacket_readnb(unsigned char* buf, int buflen, MQTTTransport *trp)
 {
@@ -391,7 +392,7 @@ int MQTTPacket_readnb(unsigned char* buf, int buflen, MQTTTransport *trp)
 		/* 1. read the header byte.  This has the packet type in it */
 		if ((frc=(*trp->getfn)(trp->sck, buf, 1)) == -1)
                 {
-                        LE_ERROR("read header byte failed");
+                        MQTTLOG_ERROR("read header byte failed");
 			goto exit;
                 }
 		if (frc == 0)
@@ -400,35 +401,37 @@ int MQTTPacket_readnb(unsigned char* buf, int buflen, MQTTTransport *trp)
 		++trp->state;
 		/*FALLTHROUGH*/
 		/* 2. read the remaining length.  This is variable in itself */
-	case 2:
+	case 1:
 		if((frc=MQTTPacket_decodenb(trp)) == MQTTPACKET_READ_ERROR)
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		if(frc == 0)
 			return 0;
 		trp->len = 1 + MQTTPacket_encode(buf + 1, trp->rem_len); /* put the original remaining length back into the buffer */
-		if((trp->rem_len + trp->len) > buflen)
-                {
-                        LE_ERROR("invalid data");
-			goto exit;
-                }
 		++trp->state;
 		/*FALLTHROUGH*/
-	case 3:
-		/* 3. read the rest of the buffer using a callback to supply the rest of the data */
-		if ((frc=(*trp->getfn)(trp->sck, buf + trp->len, trp->rem_len)) == -1)
-                {
-                        LE_ERROR("invalid data");
-			goto exit;
-                }
-		if (frc == 0)
-			return 0;
-		trp->rem_len -= frc;
-		trp->len += frc;
-		if(trp->rem_len)
-			return 0;
+	case 2:
+		if((trp->rem_len + trp->len) > buflen)
+		{
+			/* keep the state so the caller can move the trp->len header bytes to a bigger buffer and call again */
+			return MQTTPACKET_BUFFER_TOO_SHORT;
+		}
+		if(trp->rem_len){
+			/* 3. read the rest of the buffer using a callback to supply the rest of the data */
+			if ((frc=(*trp->getfn)(trp->sck, buf + trp->len, trp->rem_len)) == -1)
+	                {
+	                        MQTTLOG_ERROR("invalid data");
+				goto exit;
+	                }
+			if (frc == 0)
+				return 0;
+			trp->rem_len -= frc;
+			trp->len += frc;
+			if(trp->rem_len)
+				return 0;
+		}
 
 		header.byte = buf[0];
 		rc = header.bits.type;
@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -62,7 +62,7 @@ int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int
 	FUNC_ENTRY;
 	if (MQTTPacket_len(rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen)) > buflen)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
@@ -91,6 +91,148 @@ exit:
 }
 
 
+/**
+  * Serializes everything of a publish packet except the payload, so that the payload can be sent
+  * from the caller's own buffer (e.g. as a second iovec)
+  * @param buf the buffer into which the packet header will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @param payloadlen integer - the length of the MQTT payload that will follow the header
+  * @return the length of the serialized header.  <= 0 indicates error
+  */
+int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+		MQTTString topicName, int payloadlen)
+{
+	unsigned char *ptr = buf;
+	MQTTHeader header = {0};
+	int rem_len = 0;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen);
+	if (MQTTPacket_len(rem_len) - payloadlen > buflen)
+	{
+                MQTTLOG_ERROR("buffer too short");
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	header.bits.type = PUBLISH;
+	header.bits.dup = dup;
+	header.bits.qos = qos;
+	header.bits.retain = retained;
+	writeChar(&ptr, header.byte); /* write header */
+
+	ptr += MQTTPacket_encode(ptr, rem_len); /* write remaining length */;
+
+	writeMQTTString(&ptr, topicName);
+
+	if (qos > 0)
+		writeInt(&ptr, packetid);
+
+	rc = ptr - buf;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Serializes the parts of a publish packet that only depend on the topic, once, into a template
+  * that MQTTSerialize_publishPrepared() later completes in place for each message
+  * @param buf the buffer into which the template will be serialized
+  * @param buflen the length in bytes of the supplied buffer, see MQTTPUBLISH_TEMPLATE_LEN
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @return the length of the template.  <= 0 indicates error
+  */
+int MQTTSerialize_publishTemplate(unsigned char* buf, int buflen, MQTTString topicName)
+{
+	unsigned char *ptr = buf + MQTTPUBLISH_TEMPLATE_OFFSET;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (MQTTPUBLISH_TEMPLATE_LEN(MQTTstrlen(topicName)) > buflen)
+	{
+                MQTTLOG_ERROR("buffer too short");
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	memset(buf, 0, MQTTPUBLISH_TEMPLATE_OFFSET);
+	writeMQTTString(&ptr, topicName);
+	writeInt(&ptr, 0); /* packetid, filled in per message */
+
+	rc = ptr - buf;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Completes a template made by MQTTSerialize_publishTemplate() into the header of one publish packet.
+  * The fixed header is written right-aligned in front of the topic, so the packet starts at *start
+  * rather than at the beginning of the template
+  * @param tmpl the template, modified in place
+  * @param tmpllen the template length returned by MQTTSerialize_publishTemplate()
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param payloadlen integer - the length of the MQTT payload that will follow the header
+  * @param start returns the first byte of the serialized header
+  * @return the length of the serialized header.  <= 0 indicates error
+  */
+int MQTTSerialize_publishPrepared(unsigned char* tmpl, int tmpllen, unsigned char dup, int qos, unsigned char retained,
+		unsigned short packetid, int payloadlen, unsigned char** start)
+{
+	unsigned char remlen[4];
+	unsigned char *ptr = NULL;
+	MQTTHeader header = {0};
+	int topiclen = tmpllen - MQTTPUBLISH_TEMPLATE_OFFSET - 2;
+	int rem_len = topiclen + payloadlen;
+	int enclen = 0;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (qos > 0)
+	{
+		ptr = tmpl + tmpllen - 2;
+		writeInt(&ptr, packetid);
+		rem_len += 2;
+	}
+
+	if (rem_len > MQTTPUBLISH_MAX_REMAINING_LEN)
+	{
+                MQTTLOG_ERROR("remaining length too large(%d)", rem_len);
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	header.bits.type = PUBLISH;
+	header.bits.dup = dup;
+	header.bits.qos = qos;
+	header.bits.retain = retained;
+
+	enclen = MQTTPacket_encode(remlen, rem_len);
+	ptr = tmpl + MQTTPUBLISH_TEMPLATE_OFFSET - enclen - 1;
+	*start = ptr;
+	writeChar(&ptr, header.byte); /* write header */
+	memcpy(ptr, remlen, enclen); /* write remaining length */
+
+	rc = MQTTPUBLISH_TEMPLATE_OFFSET - (*start - tmpl) + topiclen + ((qos > 0) ? 2 : 0);
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
 
 /**
   * Serializes the ack packet into the supplied buffer.
@@ -110,13 +252,13 @@ int MQTTSerialize_ack(unsigned char* buf, int buflen, unsigned char packettype,
 	FUNC_ENTRY;
 	if (buflen < 4)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
 	header.bits.type = packettype;
 	header.bits.dup = dup;
-	header.bits.qos = 0;
+	header.bits.qos = (packettype == PUBREL) ? 1 : 0;
 	writeChar(&ptr, header.byte); /* write header */
 
 	ptr += MQTTPacket_encode(ptr, 2); /* write remaining length */
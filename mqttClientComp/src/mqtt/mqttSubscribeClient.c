@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -59,7 +59,7 @@ int MQTTSerialize_subscribe(unsigned char* buf, int buflen, unsigned char dup, u
 	FUNC_ENTRY;
 	if (MQTTPacket_len(rem_len = MQTTSerialize_subscribeLength(count, topicFilters)) > buflen)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
@@ -110,7 +110,7 @@ int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, i
 	header.byte = readChar(&curdata);
 	if (header.bits.type != SUBACK)
         {
-                LE_ERROR("header type != SUBACK");
+                MQTTLOG_ERROR("header type != SUBACK");
 		goto exit;
         }
 
@@ -118,7 +118,7 @@ int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, i
 	enddata = curdata + mylen;
 	if (enddata - curdata < 2)
         {
-                LE_ERROR("invalid data");
+                MQTTLOG_ERROR("invalid data");
 		goto exit;
         }
 
@@ -127,9 +127,9 @@ int MQTTDeserialize_suback(unsigned short* packetid, int maxcount, int* count, i
 	*count = 0;
 	while (curdata < enddata)
 	{
-		if (*count > maxcount)
+		if (*count >= maxcount)
 		{
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			rc = -1;
 			goto exit;
 		}
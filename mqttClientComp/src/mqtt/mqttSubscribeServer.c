@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -45,7 +45,7 @@ int MQTTDeserialize_subscribe(unsigned char* dup, unsigned short* packetid, int
 	header.byte = readChar(&curdata);
 	if (header.bits.type != SUBSCRIBE)
         {
-                LE_ERROR("header type != SUBSCRIBE");
+                MQTTLOG_ERROR("header type != SUBSCRIBE");
 		goto exit;
         }
 	*dup = header.bits.dup;
@@ -60,12 +60,12 @@ int MQTTDeserialize_subscribe(unsigned char* dup, unsigned short* packetid, int
 	{
 		if (!readMQTTLenString(&topicFilters[*count], &curdata, enddata))
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		if (curdata >= enddata) /* do we have enough data to read the req_qos version byte? */
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		requestedQoSs[*count] = readChar(&curdata);
@@ -98,7 +98,7 @@ int MQTTSerialize_suback(unsigned char* buf, int buflen, unsigned short packetid
 	FUNC_ENTRY;
 	if (buflen < 2 + count)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
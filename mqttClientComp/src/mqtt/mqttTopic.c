@@ -0,0 +1,459 @@
+/**
+ * @file
+ *
+ * Topic filter index, see mqttTopic.h.
+ *
+ * Every edge of the trie lives in one hash table keyed by the parent node and the level text, so a
+ * node with thousands of children (one per asset, say) costs no more to traverse than one with two.
+ * '+' and '#' children are in the table too, which is how MQTTTopic_destroy finds every node, but
+ * matching reaches them through the parent's plus and multi pointers.  The table doubles once it
+ * holds twice as many nodes as it has buckets.  Nodes are pruned as soon as they have neither
+ * subscribers nor children.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include "mqttTopic.h"
+#include "StackTrace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MQTTTOPIC_INITIAL_BUCKETS 64
+
+typedef struct MQTTTopic_subscriber
+{
+	struct MQTTTopic_subscriber* next;
+	void* subscriber;
+} MQTTTopic_subscriber;
+
+typedef struct MQTTTopic_node
+{
+	struct MQTTTopic_node* parent;
+	struct MQTTTopic_node* next;     /* hash chain */
+	struct MQTTTopic_node* plus;     /* '+' child */
+	struct MQTTTopic_node* multi;    /* '#' child */
+	MQTTTopic_subscriber* subscribers;
+	unsigned int hash;
+	int children;
+	int levellen;
+	char level[1];
+} MQTTTopic_node;
+
+struct MQTTTopic_tree
+{
+	MQTTTopic_node* root;
+	MQTTTopic_node** buckets;
+	unsigned int bucketcount;
+	unsigned int nodecount;
+	int subscribercount;
+};
+
+
+static unsigned int MQTTTopic_hash(const MQTTTopic_node* parent, const char* level, int len)
+{
+	unsigned int hash = 2166136261u ^ (unsigned int)(size_t)parent;
+
+	while (len--)
+	{
+		hash ^= (unsigned char)*level++;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+
+static MQTTTopic_node* MQTTTopic_newNode(MQTTTopic_node* parent, const char* level, int len)
+{
+	MQTTTopic_node* node = calloc(1, sizeof(MQTTTopic_node) + len);
+
+	if (node)
+	{
+		node->parent = parent;
+		node->levellen = len;
+		memcpy(node->level, level, len);
+	}
+	return node;
+}
+
+
+static MQTTTopic_node* MQTTTopic_lookup(MQTTTopic_tree* tree, MQTTTopic_node* parent, const char* level, int len,
+		unsigned int hash)
+{
+	MQTTTopic_node* node = tree->buckets[hash & (tree->bucketcount - 1)];
+
+	while (node && (node->hash != hash || node->parent != parent || node->levellen != len ||
+			memcmp(node->level, level, len)))
+		node = node->next;
+	return node;
+}
+
+
+static void MQTTTopic_rehash(MQTTTopic_tree* tree)
+{
+	unsigned int count = tree->bucketcount * 2;
+	MQTTTopic_node** buckets = calloc(count, sizeof(MQTTTopic_node*));
+	unsigned int i;
+
+	if (!buckets)
+		return; /* keep the longer chains, still correct */
+
+	for (i = 0; i < tree->bucketcount; i++)
+	{
+		MQTTTopic_node* node = tree->buckets[i];
+
+		while (node)
+		{
+			MQTTTopic_node* next = node->next;
+
+			node->next = buckets[node->hash & (count - 1)];
+			buckets[node->hash & (count - 1)] = node;
+			node = next;
+		}
+	}
+
+	free(tree->buckets);
+	tree->buckets = buckets;
+	tree->bucketcount = count;
+}
+
+
+/* walks the filter one level at a time; creates missing nodes when create is set */
+static MQTTTopic_node* MQTTTopic_walk(MQTTTopic_tree* tree, const char* filter, int create)
+{
+	MQTTTopic_node* node = tree->root;
+	const char* level = filter;
+
+	for (;;)
+	{
+		const char* end = strchr(level, '/');
+		int len = end ? end - level : (int)strlen(level);
+		unsigned int hash = MQTTTopic_hash(node, level, len);
+		MQTTTopic_node* child = MQTTTopic_lookup(tree, node, level, len, hash);
+
+		if (!child)
+		{
+			if (!create || (child = MQTTTopic_newNode(node, level, len)) == NULL)
+				return NULL;
+
+			if (len == 1 && level[0] == '+')
+				node->plus = child;
+			else if (len == 1 && level[0] == '#')
+				node->multi = child;
+
+			child->hash = hash;
+			child->next = tree->buckets[hash & (tree->bucketcount - 1)];
+			tree->buckets[hash & (tree->bucketcount - 1)] = child;
+			if (++tree->nodecount > tree->bucketcount * 2)
+				MQTTTopic_rehash(tree);
+			node->children++;
+		}
+
+		node = child;
+		if (!end)
+			return node;
+		level = end + 1;
+	}
+}
+
+
+static void MQTTTopic_prune(MQTTTopic_tree* tree, MQTTTopic_node* node)
+{
+	while (node != tree->root && !node->subscribers && !node->children)
+	{
+		MQTTTopic_node* parent = node->parent;
+		MQTTTopic_node** link = &tree->buckets[node->hash & (tree->bucketcount - 1)];
+
+		while (*link != node)
+			link = &(*link)->next;
+		*link = node->next;
+		tree->nodecount--;
+
+		if (parent->plus == node)
+			parent->plus = NULL;
+		else if (parent->multi == node)
+			parent->multi = NULL;
+
+		parent->children--;
+		free(node);
+		node = parent;
+	}
+}
+
+
+static int MQTTTopic_deliverAll(MQTTTopic_node* node, MQTTTopic_deliverFn deliver, void* context)
+{
+	MQTTTopic_subscriber* sub;
+	int count = 0;
+
+	for (sub = node->subscribers; sub; sub = sub->next)
+		count += deliver(sub->subscriber, context);
+	return count;
+}
+
+
+/* level points at the current level of the topic name, NULL once every level has been consumed */
+static int MQTTTopic_matchLevel(MQTTTopic_tree* tree, MQTTTopic_node* node, const char* level, const char* end,
+		int wildcards, MQTTTopic_deliverFn deliver, void* context)
+{
+	const char* sep;
+	const char* next;
+	MQTTTopic_node* child = NULL;
+	int len = 0;
+	int count = 0;
+
+	/* "a/#" also matches "a" itself */
+	if (wildcards && node->multi)
+		count += MQTTTopic_deliverAll(node->multi, deliver, context);
+
+	if (!level)
+		return count + MQTTTopic_deliverAll(node, deliver, context);
+
+	sep = memchr(level, '/', end - level);
+	next = sep ? sep + 1 : NULL;
+
+	len = (sep ? sep : end) - level;
+
+	/* a wildcard character in a topic name is not a wildcard, and its node must not be taken twice */
+	if (len != 1 || (level[0] != '+' && level[0] != '#'))
+		child = MQTTTopic_lookup(tree, node, level, len, MQTTTopic_hash(node, level, len));
+	if (child)
+		count += MQTTTopic_matchLevel(tree, child, next, end, 1, deliver, context);
+
+	if (wildcards && node->plus)
+		count += MQTTTopic_matchLevel(tree, node->plus, next, end, 1, deliver, context);
+
+	return count;
+}
+
+
+static void MQTTTopic_freeNode(MQTTTopic_node* node)
+{
+	while (node->subscribers)
+	{
+		MQTTTopic_subscriber* sub = node->subscribers;
+
+		node->subscribers = sub->next;
+		free(sub);
+	}
+	free(node);
+}
+
+
+/**
+  * Creates an empty index
+  * @return the index, NULL when out of memory
+  */
+MQTTTopic_tree* MQTTTopic_create(void)
+{
+	MQTTTopic_tree* tree = calloc(1, sizeof(MQTTTopic_tree));
+
+	FUNC_ENTRY;
+	if (!tree)
+		goto exit;
+
+	tree->bucketcount = MQTTTOPIC_INITIAL_BUCKETS;
+	tree->buckets = calloc(tree->bucketcount, sizeof(MQTTTopic_node*));
+	tree->root = MQTTTopic_newNode(NULL, "", 0);
+	if (!tree->buckets || !tree->root)
+	{
+		free(tree->buckets);
+		free(tree->root);
+		free(tree);
+		tree = NULL;
+	}
+
+exit:
+	FUNC_EXIT;
+	return tree;
+}
+
+
+/**
+  * Frees the index and every node in it, the subscribers themselves belong to the caller
+  * @param tree the index
+  */
+void MQTTTopic_destroy(MQTTTopic_tree* tree)
+{
+	unsigned int i;
+
+	if (!tree)
+		return;
+
+	for (i = 0; i < tree->bucketcount; i++)
+	{
+		while (tree->buckets[i])
+		{
+			MQTTTopic_node* node = tree->buckets[i];
+
+			tree->buckets[i] = node->next;
+			MQTTTopic_freeNode(node);
+		}
+	}
+
+	MQTTTopic_freeNode(tree->root);
+	free(tree->buckets);
+	free(tree);
+}
+
+
+/**
+  * Checks a topic filter: not empty, '+' and '#' only as whole levels, '#' only as the last level
+  * @param filter the topic filter
+  * @return 1 if valid, 0 otherwise
+  */
+int MQTTTopic_isValidFilter(const char* filter)
+{
+	const char* p = filter;
+
+	if (!filter || !*filter)
+		return 0;
+
+	for (; *p; p++)
+	{
+		if (*p != '+' && *p != '#')
+			continue;
+		if (p != filter && p[-1] != '/')
+			return 0;
+		if (*p == '#' && p[1] != '\0')
+			return 0;
+		if (*p == '+' && p[1] != '\0' && p[1] != '/')
+			return 0;
+	}
+	return 1;
+}
+
+
+/**
+  * Adds a subscriber to a topic filter
+  * @param tree the index
+  * @param filter the topic filter
+  * @param subscriber the caller's subscriber, passed back by MQTTTopic_match
+  * @return 1 if added, 0 if the subscriber already had this filter, -1 for an invalid filter or no memory
+  */
+int MQTTTopic_add(MQTTTopic_tree* tree, const char* filter, void* subscriber)
+{
+	MQTTTopic_node* node = NULL;
+	MQTTTopic_subscriber* sub = NULL;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	if (!MQTTTopic_isValidFilter(filter))
+		goto exit;
+
+	if ((node = MQTTTopic_walk(tree, filter, 1)) == NULL)
+		goto exit;
+
+	for (sub = node->subscribers; sub; sub = sub->next)
+	{
+		if (sub->subscriber == subscriber)
+		{
+			rc = 0;
+			goto exit;
+		}
+	}
+
+	if ((sub = malloc(sizeof(MQTTTopic_subscriber))) == NULL)
+	{
+		MQTTTopic_prune(tree, node);
+		goto exit;
+	}
+
+	sub->subscriber = subscriber;
+	sub->next = node->subscribers;
+	node->subscribers = sub;
+	tree->subscribercount++;
+	rc = 1;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Removes a subscriber from a topic filter
+  * @param tree the index
+  * @param filter the topic filter
+  * @param subscriber the subscriber given to MQTTTopic_add
+  * @return 1 if removed, 0 if the subscriber did not have this filter
+  */
+int MQTTTopic_remove(MQTTTopic_tree* tree, const char* filter, void* subscriber)
+{
+	MQTTTopic_node* node = NULL;
+	MQTTTopic_subscriber** link = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (!MQTTTopic_isValidFilter(filter) || (node = MQTTTopic_walk(tree, filter, 0)) == NULL)
+		goto exit;
+
+	for (link = &node->subscribers; *link; link = &(*link)->next)
+	{
+		if ((*link)->subscriber == subscriber)
+		{
+			MQTTTopic_subscriber* sub = *link;
+
+			*link = sub->next;
+			free(sub);
+			tree->subscribercount--;
+			MQTTTopic_prune(tree, node);
+			rc = 1;
+			break;
+		}
+	}
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Looks up a filter exactly (wildcards are taken literally, not matched)
+  * @param tree the index
+  * @param filter the topic filter
+  * @return the most recently added subscriber of that filter, NULL if it has none
+  */
+void* MQTTTopic_find(MQTTTopic_tree* tree, const char* filter)
+{
+	MQTTTopic_node* node = NULL;
+
+	if (!MQTTTopic_isValidFilter(filter) || (node = MQTTTopic_walk(tree, filter, 0)) == NULL || !node->subscribers)
+		return NULL;
+	return node->subscribers->subscriber;
+}
+
+
+/**
+  * Calls deliver for every subscriber of every filter matching a topic name.  A subscriber with
+  * several matching filters is called once per filter.  Names starting with '$' are not matched by
+  * wildcards in the first level
+  * @param tree the index
+  * @param topic the topic name, need not be NUL-terminated
+  * @param topiclen the length of the topic name
+  * @param deliver called per matching subscriber
+  * @param context passed to deliver
+  * @return the sum of what deliver returned
+  */
+int MQTTTopic_match(MQTTTopic_tree* tree, const char* topic, int topiclen, MQTTTopic_deliverFn deliver, void* context)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	rc = MQTTTopic_matchLevel(tree, tree->root, topic, topic + topiclen, !(topiclen > 0 && topic[0] == '$'),
+			deliver, context);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * @param tree the index
+  * @return the number of (filter, subscriber) pairs in the index
+  */
+int MQTTTopic_count(MQTTTopic_tree* tree)
+{
+	return tree->subscribercount;
+}
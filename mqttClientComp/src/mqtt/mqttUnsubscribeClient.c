@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -58,7 +58,7 @@ int MQTTSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup,
 	FUNC_ENTRY;
 	if (MQTTPacket_len(rem_len = MQTTSerialize_unsubscribeLength(count, topicFilters)) > buflen)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
@@ -102,7 +102,7 @@ int MQTTDeserialize_unsuback(unsigned short* packetid, unsigned char* buf, int b
 		rc = 1;
         else
         {
-          LE_ERROR("type != UNSUBACK");
+          MQTTLOG_ERROR("type != UNSUBACK");
         }
 	FUNC_EXIT_RC(rc);
 	return rc;
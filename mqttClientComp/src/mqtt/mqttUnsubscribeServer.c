@@ -13,7 +13,7 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
-#include "legato.h"
+#include "mqttLog.h"
 #include "mqttPacket.h"
 #include "StackTrace.h"
 
@@ -44,7 +44,7 @@ int MQTTDeserialize_unsubscribe(unsigned char* dup, unsigned short* packetid, in
 	header.byte = readChar(&curdata);
 	if (header.bits.type != UNSUBSCRIBE)
         {
-                LE_ERROR("header type != UNSUBSCRIBE");
+                MQTTLOG_ERROR("header type != UNSUBSCRIBE");
 		goto exit;
         }
 	*dup = header.bits.dup;
@@ -59,7 +59,7 @@ int MQTTDeserialize_unsubscribe(unsigned char* dup, unsigned short* packetid, in
 	{
 		if (!readMQTTLenString(&topicFilters[*count], &curdata, enddata))
                 {
-                        LE_ERROR("invalid data");
+                        MQTTLOG_ERROR("invalid data");
 			goto exit;
                 }
 		(*count)++;
@@ -88,7 +88,7 @@ int MQTTSerialize_unsuback(unsigned char* buf, int buflen, unsigned short packet
 	FUNC_ENTRY;
 	if (buflen < 2)
 	{
-                LE_ERROR("buffer too short");
+                MQTTLOG_ERROR("buffer too short");
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
 	}
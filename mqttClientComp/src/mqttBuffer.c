@@ -0,0 +1,186 @@
+/**
+ * @file
+ *
+ * Size-classed packet buffers.
+ *
+ * Buffers up to MQTT_BUFFER_CLASS_LARGE_SIZE are served from one le_mem pool per size class.  The
+ * small and medium pools are pre-expanded at start-up, so typical telemetry and acks never hit the
+ * heap.  Anything bigger, up to the configured maximum packet size, is malloc'd and freed again as
+ * soon as the last reference is released, so a firmware manifest does not pin 128 KB for the rest
+ * of the process lifetime.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include "legato.h"
+#include "mqttBuffer.h"
+
+#define MQTT_BUFFER_CLASS_COUNT                       3
+#define MQTT_BUFFER_CLASS_HEAP                        MQTT_BUFFER_CLASS_COUNT
+
+typedef struct _mqttBuffer_hdr_t
+{
+  uint32_t                             capacity;
+  uint16_t                             refCount;
+  uint16_t                             cls;
+} mqttBuffer_hdr_t;
+
+typedef struct _mqttBuffer_class_t
+{
+  const char*                          name;
+  size_t                               size;
+  size_t                               count;
+  le_mem_PoolRef_t                     pool;
+} mqttBuffer_class_t;
+
+static mqttBuffer_class_t mqttBuffer_classes[MQTT_BUFFER_CLASS_COUNT] =
+{
+  { "MQTTBuf256",  MQTT_BUFFER_CLASS_SMALL_SIZE,  MQTT_BUFFER_CLASS_SMALL_COUNT,  NULL },
+  { "MQTTBuf2K",   MQTT_BUFFER_CLASS_MEDIUM_SIZE, MQTT_BUFFER_CLASS_MEDIUM_COUNT, NULL },
+  { "MQTTBuf16K",  MQTT_BUFFER_CLASS_LARGE_SIZE,  MQTT_BUFFER_CLASS_LARGE_COUNT,  NULL },
+};
+
+static uint32_t mqttBuffer_maxSize = MQTT_BUFFER_DEFAULT_MAX_SIZE;
+
+static inline mqttBuffer_hdr_t* mqttBuffer_hdr(const unsigned char* data)
+{
+  return ((mqttBuffer_hdr_t*)data) - 1;
+}
+
+void mqttBuffer_init(void)
+{
+  int i;
+
+  for (i = 0; i < MQTT_BUFFER_CLASS_COUNT; i++)
+  {
+    mqttBuffer_classes[i].pool = le_mem_CreatePool(mqttBuffer_classes[i].name, sizeof(mqttBuffer_hdr_t) + mqttBuffer_classes[i].size);
+    if (mqttBuffer_classes[i].count)
+    {
+      le_mem_ExpandPool(mqttBuffer_classes[i].pool, mqttBuffer_classes[i].count);
+    }
+  }
+}
+
+int mqttBuffer_setMaxSize(uint32_t maxSize)
+{
+  int rc = LE_OK;
+
+  if ((maxSize < MQTT_BUFFER_CLASS_MEDIUM_SIZE) || (maxSize > MQTT_BUFFER_CLASS_HUGE_SIZE))
+  {
+    LE_ERROR("invalid maximum packet size(%u)", maxSize);
+    rc = LE_OUT_OF_RANGE;
+    goto cleanup;
+  }
+
+  LE_INFO("maximum packet size(%u -> %u)", mqttBuffer_maxSize, maxSize);
+  mqttBuffer_maxSize = maxSize;
+
+cleanup:
+  return rc;
+}
+
+uint32_t mqttBuffer_getMaxSize(void)
+{
+  return mqttBuffer_maxSize;
+}
+
+static unsigned char* mqttBuffer_allocAny(size_t size)
+{
+  mqttBuffer_hdr_t* hdr = NULL;
+  int i;
+
+  for (i = 0; i < MQTT_BUFFER_CLASS_COUNT; i++)
+  {
+    if (size <= mqttBuffer_classes[i].size)
+    {
+      hdr = le_mem_ForceAlloc(mqttBuffer_classes[i].pool);
+      hdr->capacity = mqttBuffer_classes[i].size;
+      hdr->cls = i;
+      break;
+    }
+  }
+
+  if (!hdr)
+  {
+    hdr = malloc(sizeof(mqttBuffer_hdr_t) + size);
+    if (!hdr)
+    {
+      LE_ERROR("malloc() failed(%zu)", size);
+      goto cleanup;
+    }
+
+    hdr->capacity = size;
+    hdr->cls = MQTT_BUFFER_CLASS_HEAP;
+  }
+
+  hdr->refCount = 1;
+
+cleanup:
+  return hdr ? (unsigned char*)(hdr + 1):NULL;
+}
+
+unsigned char* mqttBuffer_alloc(size_t size)
+{
+  if (size > mqttBuffer_maxSize)
+  {
+    LE_ERROR("buffer too large(%zu > %u)", size, mqttBuffer_maxSize);
+    return NULL;
+  }
+
+  return mqttBuffer_allocAny(size);
+}
+
+// a received packet and the byte behind it that NUL-terminates the payload, which may go past the
+// limit so that a packet of the maximum size is received like it is sent
+unsigned char* mqttBuffer_allocSlot(size_t packetLen)
+{
+  if (packetLen > mqttBuffer_maxSize)
+  {
+    LE_ERROR("packet too large(%zu > %u)", packetLen, mqttBuffer_maxSize);
+    return NULL;
+  }
+
+  return mqttBuffer_allocAny(packetLen + 1);
+}
+
+void mqttBuffer_addRef(unsigned char* data)
+{
+  mqttBuffer_hdr_t* hdr = mqttBuffer_hdr(data);
+  uint16_t refCount;
+
+  // references may be dropped by dispatch workers while the I/O loop takes new ones
+  refCount = __atomic_add_fetch(&hdr->refCount, 1, __ATOMIC_RELAXED);
+  LE_ASSERT(refCount > 1);
+}
+
+void mqttBuffer_release(unsigned char* data)
+{
+  mqttBuffer_hdr_t* hdr = NULL;
+
+  if (!data)
+  {
+    return;
+  }
+
+  hdr = mqttBuffer_hdr(data);
+  LE_ASSERT(hdr->refCount);
+  if (__atomic_sub_fetch(&hdr->refCount, 1, __ATOMIC_ACQ_REL))
+  {
+    return;
+  }
+
+  if (hdr->cls == MQTT_BUFFER_CLASS_HEAP)
+  {
+    free(hdr);
+  }
+  else
+  {
+    le_mem_Release(hdr);
+  }
+}
+
+size_t mqttBuffer_capacity(const unsigned char* data)
+{
+  return mqttBuffer_hdr(data)->capacity;
+}
@@ -16,26 +16,52 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <inttypes.h>
 
 #include "legato.h"
 #include "interfaces.h"
 #include "json/swir_json.h"
+#include "cbor/swir_cbor.h"
 #include "mqttClient.h"
+#include "mqttDispatch.h"
 
 static void mqttClient_newMsgData(mqttClient_msg_data_t*, MQTTString*, mqttClient_msg_t*);
 static int mqttClient_getNextPacketId(mqttClient_t*);
-static char mqttClient_isTopicMatched(char*, MQTTString*);
+static mqttClient_inflight_t* mqttClient_inflightFind(mqttClient_t*, uint16_t);
+static int mqttClient_inflightAdd(mqttClient_t*, uint16_t, mqttClient_QoS_e, const struct iovec*, int);
+static void mqttClient_inflightRemove(mqttClient_t*, mqttClient_inflight_t*);
+static void mqttClient_inflightStartTimer(mqttClient_t*);
+static int mqttClient_inflightResend(mqttClient_t*, mqttClient_inflight_t*);
+static void mqttClient_inflightResendAll(mqttClient_t*);
+static int mqttClient_deliverSub(void*, void*);
+static int mqttClient_countHandlers(void*, void*);
 static int mqttClient_deliverMsg(mqttClient_t*, MQTTString*, mqttClient_msg_t*);
+static mqttClient_sub_t* mqttClient_subFind(mqttClient_t*, const char*);
+static mqttClient_sub_t* mqttClient_subAdd(mqttClient_t*, const char*);
+static void mqttClient_subFree(mqttClient_t*, mqttClient_sub_t*);
+static void mqttClient_subRelease(mqttClient_t*, mqttClient_sub_t*);
+static void mqttClient_subRestore(mqttClient_t*, bool);
+static int mqttClient_subSendNext(mqttClient_t*);
 
 static void mqttClient_SendConnStateEvent(bool, int32_t, int32_t);
 static void mqttClient_SendIncomingMessageEvent(const char*, const char*, const char*, const char*);
+static int mqttClient_addCommandParam(mqttClient_command_t*, swirjson_slice_t, swirjson_slice_t);
+static void mqttClient_onCommandParam(mqttClient_command_t*, swirjson_slice_t, swirjson_slice_t, bool*);
+static int mqttClient_parseJsonCommand(mqttClient_command_t*, const char*, size_t, char**, bool*);
+static int mqttClient_parseCborCommand(mqttClient_command_t*, const uint8_t*, size_t, char**, bool*);
 
 static void mqttClient_connExpiryHndlr(le_timer_Ref_t);
+static void mqttClient_reconnectExpiryHndlr(le_timer_Ref_t);
 static void mqttClient_cmdExpiryHndlr(le_timer_Ref_t);
 static void mqttClient_pingExpiryHndlr(le_timer_Ref_t);
+static void mqttClient_inflightExpiryHndlr(le_timer_Ref_t);
+static void mqttClient_lingerExpiryHndlr(le_timer_Ref_t);
 
 static int mqttClient_sendConnect(mqttClient_t*, MQTTPacket_connectData*);
 static int mqttClient_sendPublishAck(const char*, int, const char*);
+static void mqttClient_queuedPublishAck(void*, void*);
 static void mqttClient_onIncomingMessage(mqttClient_msg_data_t*);
 
 static int mqttClient_processConnAck(mqttClient_t*);
@@ -49,10 +75,33 @@ static void mqttClient_processPingResp(mqttClient_t*);
 
 static void mqttClient_dataConnectionStateHandler(const char*, bool, void*);
 static void mqttClient_socketFdEventHandler(int, short);
-
+static int mqttClient_rxGet(void*, unsigned char*, int);
+static int mqttClient_receive(mqttClient_t*);
+static int mqttClient_rxFrame(mqttClient_t*);
+static void mqttClient_rxResume(void*, void*);
+static int mqttClient_processPacket(mqttClient_t*, int);
+static void mqttClient_rxRelease(mqttClient_t*);
+
+static void mqttClient_resolveHndlr(uint32_t, int, const mqttResolver_addrList_t*, void*);
+static void mqttClient_attemptExpiryHndlr(le_timer_Ref_t);
+static void mqttClient_attemptFdEventHandler(int, short);
+static void mqttClient_attemptNext(mqttClient_t*);
+static void mqttClient_attemptWon(mqttClient_t*, mqttClient_attempt_t*);
+static void mqttClient_attemptsAbort(mqttClient_t*);
+static uint32_t mqttClient_backoffDelay(mqttClient_t*);
+static void mqttClient_scheduleReconnect(mqttClient_t*);
+static void mqttClient_connectionLost(mqttClient_t*, int);
 static int mqttClient_connect(mqttClient_t*);
 static int mqttClient_close(mqttClient_t*);
 static int mqttClient_write(mqttClient_t*, int);
+static int mqttClient_writeCmd(mqttClient_t*, int);
+static int mqttClient_writev(mqttClient_t*, const struct iovec*, int);
+static void mqttClient_txEnqueue(mqttClient_t*, const struct iovec*, int, size_t);
+static int mqttClient_txFlush(mqttClient_t*);
+static void mqttClient_txPurge(mqttClient_t*);
+static int mqttClient_writeCoalesced(mqttClient_t*, const struct iovec*, int);
+static int mqttClient_publishBegin(mqttClient_t*, const char*, size_t, mqttClient_msg_t*, bool*);
+static int mqttClient_publishEnd(mqttClient_t*, const struct iovec*, int, mqttClient_msg_t*);
 
 static const char* mqttClient_connectionRsp(uint8_t);
 static void mqttClient_dumpBuffer(const unsigned char*, unsigned int);
@@ -172,440 +221,559 @@ static void mqttClient_newMsgData(mqttClient_msg_data_t* msgData, MQTTString* to
 
   msgData->topicName = topicName;
   msgData->message = msg;
+  msgData->shmOffset = -1;
 }
 
 static int mqttClient_getNextPacketId(mqttClient_t* clientData) 
 {
   LE_ASSERT(clientData);
-  return clientData->session.nextPacketId = (clientData->session.nextPacketId == MQTT_CLIENT_MAX_PACKET_ID) ? 1 : clientData->session.nextPacketId + 1;
-}
-
-static void mqttClient_SendConnStateEvent(bool isConnected, int32_t connectErrorCode, int32_t subErrorCode)
-{
-  mqttClient_connStateData_t eventData;
-  mqttClient_t* clientData = mqttMain_getClient();
 
-  eventData.isConnected = isConnected;
-  eventData.connectErrorCode = connectErrorCode;
-  eventData.subErrorCode = subErrorCode;
+  // skip IDs whose in-flight slot is still waiting for an acknowledgement
+  do
+  {
+    clientData->session.nextPacketId = (clientData->session.nextPacketId == MQTT_CLIENT_MAX_PACKET_ID) ? 1 : clientData->session.nextPacketId + 1;
+  }
+  while (clientData->session.inflight[clientData->session.nextPacketId % MQTT_CLIENT_INFLIGHT_TABLE_SIZE].state != MQTT_CLIENT_INFLIGHT_FREE);
 
-  LE_DEBUG("MQTT connected(%d), error(%d), sub-error(%d)", eventData.isConnected, eventData.connectErrorCode, eventData.subErrorCode);
-  le_event_Report(clientData->connStateEvent, &eventData, sizeof(eventData));
+  return clientData->session.nextPacketId;
 }
 
-static void mqttClient_SendIncomingMessageEvent(const char* topicName, const char* keyName, const char* value, const char* timestamp)
+static mqttClient_inflight_t* mqttClient_inflightFind(mqttClient_t* clientData, uint16_t packetId)
 {
-  mqttClient_inMsg_t eventData;
-  mqttClient_t* clientData = mqttMain_getClient();
+  mqttClient_inflight_t* entry = &clientData->session.inflight[packetId % MQTT_CLIENT_INFLIGHT_TABLE_SIZE];
 
-  strcpy(eventData.topicName, topicName);
-  strcpy(eventData.keyName, keyName);
-  strcpy(eventData.value, value);
-  strcpy(eventData.timestamp, timestamp);
+  if ((entry->state == MQTT_CLIENT_INFLIGHT_FREE) || (entry->packetId != packetId))
+  {
+    return NULL;
+  }
 
-  LE_DEBUG("Send MQTT incoming message('%s', ['%s':'%s'@'%s'])", eventData.topicName, eventData.keyName, eventData.value, eventData.timestamp);
-  le_event_Report(clientData->inMsgEvent, &eventData, sizeof(eventData));
+  return entry;
 }
 
-static int mqttClient_sendConnect(mqttClient_t* clientData, MQTTPacket_connectData* connectData)
+static int mqttClient_inflightAdd(mqttClient_t* clientData, uint16_t packetId, mqttClient_QoS_e qos, const struct iovec* iov, int iovcnt)
 {
+  mqttClient_inflight_t* entry = &clientData->session.inflight[packetId % MQTT_CLIENT_INFLIGHT_TABLE_SIZE];
+  le_clk_Time_t retry = { MQTT_CLIENT_INFLIGHT_RETRY_MS / 1000, (MQTT_CLIENT_INFLIGHT_RETRY_MS % 1000) * 1000 };
+  size_t len = 0;
   int rc = LE_OK;
+  int i;
 
-  LE_ASSERT(clientData);
-  LE_ASSERT(connectData);
+  LE_ASSERT(entry->state == MQTT_CLIENT_INFLIGHT_FREE);
 
-  if (clientData->session.isConnected)
-  {
-    LE_WARN("already connected"); 
-    goto cleanup;
-  } 
-    
-  int len = MQTTSerialize_connect(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), connectData);
-  if (len <= 0)
+  for (i = 0; i < iovcnt; i++)
   {
-    LE_ERROR("MQTTSerialize_connect() failed(%d)", len);
-    rc = len;
-    goto cleanup;
+    len += iov[i].iov_len;
   }
 
-  LE_DEBUG("<--- CONNECT");
-  rc = mqttClient_write(clientData, len);
-  if (rc)
-  {  
-    LE_ERROR("mqttClient_write() failed(%d)", rc);
-    goto cleanup;
-  } 
-
-  rc = le_timer_Start(clientData->session.cmdTimer);
-  if (rc)
+  entry->packet = mqttBuffer_alloc(len);
+  if (!entry->packet)
   {
-    LE_ERROR("le_timer_Start() failed(%d)", rc);
+    LE_ERROR("packet too large(%zu)", len);
+    rc = LE_OVERFLOW;
     goto cleanup;
   }
 
-cleanup:
-  return rc;
-}
-
-static int mqttClient_sendPublishAck(const char* uid, int nAck, const char* message)
-{
-  mqttClient_t* clientData = mqttMain_getClient();
-  char* payload = (char*) malloc(strlen(uid) + strlen(message)+48);
-
-  if (nAck == 0)
-  {
-    sprintf(payload, "[{\"uid\": \"%s\", \"status\" : \"OK\"", uid);
-  }
-  else
-  {
-    sprintf(payload, "[{\"uid\": \"%s\", \"status\" : \"ERROR\"", uid);
-  }
-
-  if (strlen(message) > 0)
+  entry->packetLen = 0;
+  for (i = 0; i < iovcnt; i++)
   {
-    sprintf(payload, "%s, \"message\" : \"%s\"}]", payload, message);
-  }
-  else
-  {     
-    sprintf(payload, "%s}]", payload);
+    memcpy(entry->packet + entry->packetLen, iov[i].iov_base, iov[i].iov_len);
+    entry->packetLen += iov[i].iov_len;
   }
 
-  LE_DEBUG("ACK Message('%s')", payload);
-
-  mqttClient_msg_t msg;
-  msg.qos = clientData->session.config.QoS;
-  msg.retained = 0;
-  msg.dup = 0;
-  msg.id = 0;
-  msg.payload = payload;
-  msg.payloadLen = strlen(payload);
+  entry->packetId = packetId;
+  entry->qos = qos;
+  entry->retries = 0;
+  entry->state = MQTT_CLIENT_INFLIGHT_PUBLISH_SENT;
+  entry->deadline = le_clk_Add(le_clk_GetRelativeTime(), retry);
 
-  char* topic = malloc(strlen(MQTT_CLIENT_TOPIC_NAME_ACK) + strlen(clientData->deviceId) + 1);
-  sprintf(topic, "%s%s", clientData->deviceId, MQTT_CLIENT_TOPIC_NAME_ACK);
-
-  LE_INFO("<--- PUBLISH('%s')", topic);
-  int rc = mqttClient_publish(clientData, topic, &msg);
-  if (rc)
-  {
-    LE_ERROR("mqttClient_publish() failed(%d)", rc);
-    goto cleanup;
-  }
+  clientData->session.inflightCount++;
+  mqttClient_inflightStartTimer(clientData);
+  mqttSession_markDirty(clientData);
 
 cleanup:
-  if (topic) free(topic);
-  if (payload) free(payload);
   return rc;
 }
 
-static void mqttClient_onIncomingMessage(mqttClient_msg_data_t* md)
+static void mqttClient_inflightRemove(mqttClient_t* clientData, mqttClient_inflight_t* entry)
 {
-  char topicName[MQTT_CLIENT_TOPIC_NAME_LEN + 1] = {0};
-  mqttClient_msg_t* message = md->message;
-  char* payload = NULL;
-  char* command = NULL;
-  char* uid = NULL;
-  char* timestamp = NULL;
-  char* id = NULL;
-  char* param = NULL;
-  int32_t rc = LE_OK;
-
-  memcpy(topicName, md->topicName->lenstring.data, md->topicName->lenstring.len);
-  topicName[md->topicName->lenstring.len] = 0;
+  LE_ASSERT(entry->state != MQTT_CLIENT_INFLIGHT_FREE);
+
+  mqttBuffer_release(entry->packet);
+  entry->packet = NULL;
+  entry->packetLen = 0;
+  entry->state = MQTT_CLIENT_INFLIGHT_FREE;
+  clientData->session.inflightCount--;
+  mqttSession_markDirty(clientData);
+}
 
-  LE_INFO("---> topic('%s') len(%zu) data('%s')", topicName, message->payloadLen, message->payload);
+static void mqttClient_inflightStartTimer(mqttClient_t* clientData)
+{
+  le_clk_Time_t now = le_clk_GetRelativeTime();
+  le_clk_Time_t earliest = {0, 0};
+  bool found = false;
+  int i;
 
-  payload = malloc(message->payloadLen + 1);
-  if (!payload)
+  if (!clientData->session.inflightTimer || le_timer_IsRunning(clientData->session.inflightTimer))
   {
-    LE_ERROR("malloc() failed");
     goto cleanup;
   }
 
-  memcpy(payload, (char*)message->payload, message->payloadLen);
-  payload[message->payloadLen] = 0;
-
-  command = swirjson_getValue(payload, -1, "command");
-  if (command)
+  for (i = 0; i < MQTT_CLIENT_INFLIGHT_TABLE_SIZE; i++)
   {
-    int i = 0;
+    mqttClient_inflight_t* entry = &clientData->session.inflight[i];
 
-    uid = swirjson_getValue(payload, -1, "uid");
-    timestamp = swirjson_getValue(payload, -1, "timestamp");
-    id = swirjson_getValue(command, -1, "id");
-    param = swirjson_getValue(command, -1, "params");
-
-    for (i = 0; i < MQTT_CLIENT_AV_JSON_KEY_MAX_COUNT; i++)
+    if ((entry->state != MQTT_CLIENT_INFLIGHT_FREE) && (!found || le_clk_GreaterThan(earliest, entry->deadline)))
     {
-      char key[MQTT_CLIENT_AV_JSON_KEY_MAX_LENGTH];
-
-      char* value = swirjson_getValue(param, i, key);
-      if (value)
-      {
-        char fullKey[MQTT_CLIENT_KEY_NAME_LEN + 1];
+      earliest = entry->deadline;
+      found = true;
+    }
+  }
 
-        LE_DEBUG("--> AV message id('%s') key('%s') value('%s') ts('%s')", id, key, value, timestamp);
+  if (found)
+  {
+    uint32_t ms = 0;
 
-        sprintf(fullKey, "%s.%s", id, key);
-        mqttClient_SendIncomingMessageEvent(topicName, fullKey, value, timestamp);
-        free(value);
-      }
-      else
-      {
-        break;
-      }
+    if (le_clk_GreaterThan(earliest, now))
+    {
+      le_clk_Time_t delta = le_clk_Sub(earliest, now);
+      ms = delta.sec * 1000 + delta.usec / 1000;
     }
 
-    rc = mqttClient_sendPublishAck(uid, 0, "");
-    if (rc)
-    {
-      LE_ERROR("mqttClient_sendPublishAck() failed(%d)", rc);
-      goto cleanup;
-    } 
-  }
-  else
-  {
-    LE_WARN("failed to find command key");
+    le_timer_SetMsInterval(clientData->session.inflightTimer, ms ? ms:1);
+    le_timer_Start(clientData->session.inflightTimer);
   }
 
 cleanup:
-  if (command) free(command);
-  if (id) free(id);
-  if (param) free(param);
-  if (timestamp) free(timestamp);
-  if (uid) free(uid);
-  if (payload) free(payload);
+  return;
 }
 
-static void mqttClient_connExpiryHndlr(le_timer_Ref_t timer)
+static int mqttClient_inflightResend(mqttClient_t* clientData, mqttClient_inflight_t* entry)
 {
-  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
-  int32_t rc = LE_OK;
+  int len = 0;
+  int rc = LE_OK;
 
-  LE_ASSERT(clientData);
+  if (entry->state == MQTT_CLIENT_INFLIGHT_PUBLISH_SENT)
+  {
+    // retransmitted PUBLISH carries the DUP flag
+    MQTTHeader header = {0};
+    struct iovec iov = { entry->packet, entry->packetLen };
 
-  rc = mqttClient_close(clientData);
-  if (rc)
+    header.byte = entry->packet[0];
+    header.bits.dup = 1;
+    entry->packet[0] = header.byte;
+
+    LE_DEBUG("<--- resend PUBLISH(%u)", entry->packetId);
+    rc = mqttClient_writev(clientData, &iov, 1);
+  }
+  else
   {
-    LE_ERROR("mqttClient_close() failed(%d)", rc);
-    goto cleanup;
+    len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBREL, 0, entry->packetId);
+    if (len <= 0)
+    {
+      LE_ERROR("MQTTSerialize_ack() failed(%d)", len);
+      rc = LE_BAD_PARAMETER;
+      goto cleanup;
+    }
+
+    LE_DEBUG("<--- resend PUBREL(%u)", entry->packetId);
+    rc = mqttClient_write(clientData, len);
   }
 
-  LE_DEBUG("<--- reconnect");
-  rc = mqttClient_connect(clientData);
   if (rc)
   {
-    LE_ERROR("mqttClient_connect() failed(%d)", rc);
+    LE_ERROR("mqttClient_write() failed(%d)", rc);
     goto cleanup;
   }
 
+  if (entry->state == MQTT_CLIENT_INFLIGHT_PUBREC_RECEIVED)
+  {
+    entry->state = MQTT_CLIENT_INFLIGHT_PUBREL_SENT;
+  }
+
 cleanup:
-  return;
+  return rc;
 }
 
-static void mqttClient_cmdExpiryHndlr(le_timer_Ref_t timer)
+static void mqttClient_inflightResendAll(mqttClient_t* clientData)
 {
-  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
-  int32_t rc = LE_OK;
-
-  LE_ASSERT(clientData);
+  le_clk_Time_t retry = { MQTT_CLIENT_INFLIGHT_RETRY_MS / 1000, (MQTT_CLIENT_INFLIGHT_RETRY_MS % 1000) * 1000 };
+  le_clk_Time_t deadline = le_clk_Add(le_clk_GetRelativeTime(), retry);
+  int i;
 
-  if (clientData->session.cmdRetries < MQTT_CLIENT_MAX_SEND_RETRIES)
+  // a resumed session has to finish every exchange before anything new is sent
+  for (i = 0; i < MQTT_CLIENT_INFLIGHT_TABLE_SIZE; i++)
   {
-    if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+    mqttClient_inflight_t* entry = &clientData->session.inflight[i];
+
+    if (entry->state == MQTT_CLIENT_INFLIGHT_FREE)
     {
-      LE_DEBUG("<--- reconnect");
-      rc = mqttClient_connect(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_connect() failed(%d)", rc);
-        goto cleanup;
-      }
+      continue;
     }
-    else
+
+    entry->deadline = deadline;
+    if (mqttClient_inflightResend(clientData, entry))
     {
-      LE_DEBUG("<--- resend CMD(%u)", clientData->session.cmdRetries++);
-      rc = mqttClient_write(clientData, clientData->session.cmdLen);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_write() failed(%d)", rc);
-        goto cleanup;
-      }
+      LE_ERROR("mqttClient_inflightResend() failed");
+      break;
     }
   }
-  else
+
+  if (le_timer_IsRunning(clientData->session.inflightTimer))
   {
-    LE_ERROR("maximum retries reached(%u)", MQTT_CLIENT_MAX_SEND_RETRIES);
-    goto cleanup;
+    le_timer_Stop(clientData->session.inflightTimer);
   }
 
-cleanup:
-  return;
+  mqttClient_inflightStartTimer(clientData);
 }
 
-static void mqttClient_pingExpiryHndlr(le_timer_Ref_t timer)
+static void mqttClient_SendConnStateEvent(bool isConnected, int32_t connectErrorCode, int32_t subErrorCode)
 {
-  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
-  int32_t rc = LE_OK;
+  mqttClient_connStateData_t eventData;
+  mqttClient_t* clientData = mqttMain_getClient();
 
-  LE_ASSERT(clientData);
+  eventData.isConnected = isConnected;
+  eventData.connectErrorCode = connectErrorCode;
+  eventData.subErrorCode = subErrorCode;
 
-  int len = MQTTSerialize_pingreq(clientData->session.tx.buf, sizeof(clientData->session.tx.buf));
-  if (len < 0)
-  {
-    LE_ERROR("MQTTSerialize_pingreq() failed(%d)", len);
-    goto cleanup;
-  }
+  LE_DEBUG("MQTT connected(%d), error(%d), sub-error(%d)", eventData.isConnected, eventData.connectErrorCode, eventData.subErrorCode);
+  le_event_Report(clientData->connStateEvent, &eventData, sizeof(eventData));
+}
 
-  LE_DEBUG("<--- PING");
-  rc = mqttClient_write(clientData, len);
-  if (rc)
-  {
-    LE_ERROR("mqttClient_write() failed(%d)", rc);
-    goto cleanup;
-  }
+static void mqttClient_SendIncomingMessageEvent(const char* topicName, const char* keyName, const char* value, const char* timestamp)
+{
+  mqttClient_inMsg_t eventData;
+  mqttClient_t* clientData = mqttMain_getClient();
 
-cleanup:
-  return;
+  snprintf(eventData.topicName, sizeof(eventData.topicName), "%s", topicName);
+  snprintf(eventData.keyName, sizeof(eventData.keyName), "%s", keyName);
+  snprintf(eventData.value, sizeof(eventData.value), "%s", value);
+  snprintf(eventData.timestamp, sizeof(eventData.timestamp), "%s", timestamp);
+
+  LE_DEBUG("Send MQTT incoming message('%s', ['%s':'%s'@'%s'])", eventData.topicName, eventData.keyName, eventData.value, eventData.timestamp);
+  le_event_Report(clientData->inMsgEvent, &eventData, sizeof(eventData));
 }
 
-static const char* mqttClient_connectionRsp(uint8_t rc)
+static int mqttClient_addCommandParam(mqttClient_command_t* command, swirjson_slice_t key, swirjson_slice_t value)
 {
-  switch(rc)
+  char* param = command->params + command->paramsLen;
+
+  if (command->paramsLen + key.len + value.len + 2 > sizeof(command->params))
   {
-  case 0: return "Connection Accepted";
-  case 1: return "Connection Refused, unacceptable protocol version";
-  case 2: return "Connection Refused, identifier rejected";
-  case 3: return "Connection Refused, Server unavailable";
-  case 4: return "Connection Refused, bad user name or password";
-  case 5: return "Connection Refused, not authorized";
-  default: break;
+    return LE_OVERFLOW;
   }
 
-  return "N/A";
+  memcpy(param, key.ptr, key.len);
+  param[key.len] = 0;
+  memcpy(param + key.len + 1, value.ptr, value.len);
+  param[key.len + 1 + value.len] = 0;
+  command->paramsLen += key.len + value.len + 2;
+  command->paramCount++;
+  return LE_OK;
 }
 
-static int mqttClient_processConnAck(mqttClient_t* clientData)
+static void mqttClient_onCommandParam(mqttClient_command_t* report, swirjson_slice_t key, swirjson_slice_t value, bool* overflow)
 {
-  int32_t rc = LE_OK;
-  uint8_t sessionPresent = 0;
-  uint8_t connack_rc = 0;
+  char fullKey[MQTT_CLIENT_KEY_NAME_LEN + 1];
+  char valueName[MQTT_CLIENT_VALUE_LEN + 1];
 
-  LE_DEBUG("---> CONNACK");
-  LE_ASSERT(clientData);
+  LE_DEBUG("--> AV message id('%s') key('%.*s') value('%.*s') ts('%s')", report->id, key.len, key.ptr, value.len, value.ptr, report->timestamp);
 
-  rc = le_timer_Stop(clientData->session.cmdTimer);
-  if (rc)
+  if (!*overflow && mqttClient_addCommandParam(report, key, value))
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
-    goto cleanup;
+    LE_ERROR("command('%s') params exceed %u bytes", report->id, MQTT_CLIENT_COMMAND_PARAMS_SIZE);
+    *overflow = true;
   }
 
+  // per-param event kept for existing apps
+  snprintf(fullKey, sizeof(fullKey), "%s.%.*s", report->id, key.len, key.ptr);
+  snprintf(valueName, sizeof(valueName), "%.*s", value.len, value.ptr);
+  mqttClient_SendIncomingMessageEvent(report->topicName, fullKey, valueName, report->timestamp);
+}
 
-  rc = MQTTDeserialize_connack((unsigned char*)&sessionPresent, &connack_rc, clientData->session.rx.buf, sizeof(clientData->session.rx.buf));
-  if (rc != 1)
-  {
-    LE_ERROR("MQTTDeserialize_connack() failed(%d)", rc);
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
-  }
-
-  LE_DEBUG("session present(%u) connection ACK(%u)", sessionPresent, connack_rc);
-  clientData->session.isConnected = (connack_rc == MQTT_CLIENT_CONNECT_SUCCESS);
+// LE_NOT_FOUND when the payload is not a command
+static int mqttClient_parseJsonCommand(mqttClient_command_t* report, const char* payload, size_t payloadLen, char** uid, bool* overflow)
+{
+  swirjson_token_t stackTokens[MQTT_CLIENT_JSON_TOKENS_MAX];
+  int stackOrder[MQTT_CLIENT_JSON_TOKENS_MAX];
+  swirjson_token_t* tokens = stackTokens;
+  int* order = stackOrder;
+  swirjson_index_t json;
+  int request;
+  int command;
+  int params;
+  int i;
+  int rc = LE_OK;
 
-  if (clientData->session.isConnected)
+  // one pass over the payload, every lookup after that is on the index
+  swirjson_initIndex(&json, tokens, order, MQTT_CLIENT_JSON_TOKENS_MAX);
+  rc = swirjson_parse(&json, payload, payloadLen);
+  if (rc == SWIRJSON_ERROR_NOMEM)
   {
-    mqttClient_SendConnStateEvent(true, 0, rc);
+    // many params: parse again into an index sized for the payload, which always fits
+    int count = SWIRJSON_TOKENS_FOR(payloadLen);
 
-    LE_INFO("subscribe('%s')", clientData->subscribeTopic);
-    rc = mqttClient_subscribe(clientData, clientData->subscribeTopic, 0, mqttClient_onIncomingMessage);
-    if (rc)
+    LE_DEBUG("large command(%zu), %d tokens", payloadLen, count);
+    tokens = malloc(count * sizeof(*tokens));
+    order = malloc(count * sizeof(*order));
+    if (!tokens || !order)
     {
-      LE_ERROR("mqttClient_subscribe() failed(%d)", rc);
+      LE_ERROR("malloc() failed");
+      rc = LE_NO_MEMORY;
       goto cleanup;
     }
+
+    swirjson_initIndex(&json, tokens, order, count);
+    rc = swirjson_parse(&json, payload, payloadLen);
   }
-  else
+
+  if (rc < 0)
   {
-    LE_ERROR("response('%s')", mqttClient_connectionRsp(connack_rc));
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("swirjson_parse() failed(%d)", rc);
+    rc = LE_FORMAT_ERROR;
+    goto cleanup;
+  }
+  rc = LE_OK;
+
+  // AirVantage wraps the request in an array
+  request = (tokens[0].type == SWIRJSON_ARRAY) ? swirjson_getItem(&json, 0, 0):0;
+  command = swirjson_find(&json, request, "command");
+  if (command < 0)
+  {
+    rc = LE_NOT_FOUND;
     goto cleanup;
   }
 
+  *uid = swirjson_dup(&json, swirjson_find(&json, request, "uid"));
+  snprintf(report->uid, sizeof(report->uid), "%s", *uid ? *uid:"");
+  swirjson_copy(&json, swirjson_find(&json, request, "timestamp"), report->timestamp, sizeof(report->timestamp));
+  swirjson_copy(&json, swirjson_find(&json, command, "id"), report->id, sizeof(report->id));
+  params = swirjson_find(&json, command, "params");
+
+  for (i = 0; i < ((params >= 0) ? tokens[params].nSize:0); i++)
+  {
+    swirjson_slice_t key = swirjson_getSlice(&json, swirjson_getKey(&json, params, i));
+    swirjson_slice_t value = swirjson_getSlice(&json, swirjson_getItem(&json, params, i));
+
+    mqttClient_onCommandParam(report, key, value, overflow);
+  }
+
 cleanup:
+  if (tokens != stackTokens) free(tokens);
+  if (order != stackOrder) free(order);
   return rc;
 }
 
-static int mqttClient_processSubAck(mqttClient_t* clientData)
+// same request as the JSON one, with the same keys; params that are not text are passed on as JSON
+static int mqttClient_parseCborCommand(mqttClient_command_t* report, const uint8_t* payload, size_t payloadLen, char** uid, bool* overflow)
 {
-  int count = 0;
-  int grantedQoS = -1;
+  swircbor_reader_t reader;
+  swircbor_reader_t command;
+  swircbor_reader_t value;
+  swircbor_item_t item;
+  bool hasCommand = false;
+  int count;
+  int i;
   int rc = LE_OK;
-  unsigned short packetId = 0;
 
-  LE_DEBUG("---> SUBACK");
-  LE_ASSERT(clientData);
+  swircbor_initReader(&reader, payload, payloadLen);
+  if (swircbor_read(&reader, &item))
+  {
+    goto invalid;
+  }
 
-  rc = le_timer_Stop(clientData->session.cmdTimer);
-  if (rc)
+  // AirVantage wraps the request in an array
+  if ((item.type == SWIRCBOR_ARRAY) && swircbor_read(&reader, &item))
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
-    goto cleanup;
+    goto invalid;
   }
 
-  rc = MQTTDeserialize_suback(&packetId, 1, &count, &grantedQoS, clientData->session.rx.buf, sizeof(clientData->session.rx.buf));
-  if (rc != 1)
+  if (item.type != SWIRCBOR_MAP)
   {
-    LE_ERROR("MQTTDeserialize_suback() failed");
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    goto invalid;
   }
-  else if (clientData->session.nextPacketId != packetId)
+
+  // one walk over the request, the few keys are picked as they come
+  count = item.nLen;
+  for (i = 0; (count == SWIRCBOR_INDEFINITE) || (i < count); i++)
   {
-    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.nextPacketId, packetId);
-    rc = LE_BAD_PARAMETER;
+    swircbor_item_t key;
+
+    if (swircbor_read(&reader, &key))
+    {
+      goto invalid;
+    }
+    else if (key.type == SWIRCBOR_BREAK)
+    {
+      break;
+    }
+    else if (key.type != SWIRCBOR_STRING)
+    {
+      goto invalid;
+    }
+
+    value = reader;
+    if (swircbor_skip(&reader))
+    {
+      goto invalid;
+    }
+
+    if ((key.nLen == 3) && !memcmp(key.pData, "uid", 3) && !swircbor_read(&value, &item) &&
+        (item.type == SWIRCBOR_STRING))
+    {
+      free(*uid);
+      *uid = strndup((const char*)item.pData, item.nLen);
+      snprintf(report->uid, sizeof(report->uid), "%s", *uid ? *uid:"");
+    }
+    else if ((key.nLen == 9) && !memcmp(key.pData, "timestamp", 9) && !swircbor_read(&value, &item))
+    {
+      if (item.type == SWIRCBOR_UINT)
+      {
+        snprintf(report->timestamp, sizeof(report->timestamp), "%" PRIu64, item.u64Value);
+      }
+      else if (item.type == SWIRCBOR_STRING)
+      {
+        snprintf(report->timestamp, sizeof(report->timestamp), "%.*s", item.nLen, (const char*)item.pData);
+      }
+    }
+    else if ((key.nLen == 7) && !memcmp(key.pData, "command", 7))
+    {
+      command = value;
+      hasCommand = true;
+    }
+  }
+
+  if (!hasCommand)
+  {
+    rc = LE_NOT_FOUND;
     goto cleanup;
   }
 
-  rc = LE_OK;
+  if (swircbor_read(&command, &item) || (item.type != SWIRCBOR_MAP))
+  {
+    goto invalid;
+  }
+  count = item.nLen;
 
-  LE_DEBUG("returned count(%u) granted QoS(0x%02x)", count, grantedQoS);
-  if ((count == 0) && (grantedQoS == 0x80))
+  if (!swircbor_find(&command, count, "id", &value) && !swircbor_read(&value, &item) &&
+      (item.type == SWIRCBOR_STRING))
+  {
+    snprintf(report->id, sizeof(report->id), "%.*s", item.nLen, (const char*)item.pData);
+  }
+
+  if (swircbor_find(&command, count, "params", &reader))
   {
-    LE_ERROR("no granted QoS");
-    rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
+  if (swircbor_read(&reader, &item) || (item.type != SWIRCBOR_MAP))
+  {
+    goto invalid;
+  }
+
+  count = item.nLen;
+  for (i = 0; (count == SWIRCBOR_INDEFINITE) || (i < count); i++)
+  {
+    char text[MQTT_CLIENT_COMMAND_PARAMS_SIZE];
+    swirjson_writer_t writer;
+    swirjson_slice_t keySlice;
+    swirjson_slice_t valueSlice;
+    swircbor_item_t key;
+    int len;
+
+    if (swircbor_read(&reader, &key))
+    {
+      goto invalid;
+    }
+    else if (key.type == SWIRCBOR_BREAK)
+    {
+      break;
+    }
+    else if (key.type != SWIRCBOR_STRING)
+    {
+      goto invalid;
+    }
+
+    keySlice.ptr = (const char*)key.pData;
+    keySlice.len = key.nLen;
+
+    value = reader;
+    if (swircbor_read(&value, &item))
+    {
+      goto invalid;
+    }
+
+    if (item.type == SWIRCBOR_STRING)
+    {
+      // text is used in place, as the unquoted JSON strings are
+      reader = value;
+      valueSlice.ptr = (const char*)item.pData;
+      valueSlice.len = item.nLen;
+    }
+    else
+    {
+      swirjson_initWriter(&writer, text, sizeof(text));
+      if (swircbor_toJson(&reader, &writer))
+      {
+        goto invalid;
+      }
+
+      len = swirjson_finish(&writer);
+      if (len < 0)
+      {
+        LE_ERROR("command('%s') params exceed %u bytes", report->id, MQTT_CLIENT_COMMAND_PARAMS_SIZE);
+        *overflow = true;
+        goto cleanup;
+      }
+
+      valueSlice.ptr = text;
+      valueSlice.len = len;
+    }
+
+    mqttClient_onCommandParam(report, keySlice, valueSlice, overflow);
+  }
+  goto cleanup;
+
+invalid:
+  LE_ERROR("invalid CBOR command");
+  rc = LE_FORMAT_ERROR;
+
 cleanup:
   return rc;
 }
 
-static int mqttClient_processUnSubAck(mqttClient_t* clientData)
+static int mqttClient_sendConnect(mqttClient_t* clientData, MQTTPacket_connectData* connectData)
 {
-  int32_t rc = LE_OK;
-  uint16_t packetId;
+  int rc = LE_OK;
 
-  LE_DEBUG("---> UNSUBACK");
   LE_ASSERT(clientData);
+  LE_ASSERT(connectData);
 
-  rc = le_timer_Stop(clientData->session.cmdTimer);
-  if (rc)
+  if (clientData->session.isConnected)
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
+    LE_WARN("already connected"); 
     goto cleanup;
-  }
-
-  rc = MQTTDeserialize_unsuback(&packetId, clientData->session.rx.buf, sizeof(clientData->session.rx.buf));
-  if (rc != 1)
+  } 
+    
+  int len = MQTTSerialize_connect(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), connectData);
+  if (len <= 0)
   {
-    LE_ERROR("MQTTDeserialize_unsuback() failed");
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("MQTTSerialize_connect() failed(%d)", len);
+    rc = len;
     goto cleanup;
   }
-  else if (clientData->session.nextPacketId != packetId)
+
+  LE_DEBUG("<--- CONNECT");
+  rc = mqttClient_writeCmd(clientData, len);
+  if (rc)
+  {  
+    LE_ERROR("mqttClient_write() failed(%d)", rc);
+    goto cleanup;
+  } 
+
+  rc = le_timer_Start(clientData->session.cmdTimer);
+  if (rc)
   {
-    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.nextPacketId, packetId);
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("le_timer_Start() failed(%d)", rc);
     goto cleanup;
   }
 
@@ -613,51 +781,94 @@ cleanup:
   return rc;
 }
 
-static int mqttClient_processPublish(mqttClient_t* clientData)
+static void mqttClient_queuedPublishAck(void* uid, void* unused)
 {
-  MQTTString topicName;
-  mqttClient_msg_t msg;
-  int len = 0;
-  int32_t rc = LE_OK;
-
-  LE_DEBUG("---> PUBLISH");
-  LE_ASSERT(clientData);
-
-  if (MQTTDeserialize_publish((unsigned char*)&msg.dup, (int*)&msg.qos, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
-          (unsigned char**)&msg.payload, (int*)&msg.payloadLen, clientData->session.rx.buf, sizeof(clientData->session.rx.buf)) != 1)
+  int rc = mqttClient_sendPublishAck(uid, 0, "");
+  if (rc)
   {
-    LE_ERROR("MQTTDeserialize_publish() failed");
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    LE_ERROR("mqttClient_sendPublishAck() failed(%d)", rc);
   }
 
-  if (msg.qos != MQTT_CLIENT_QOS0)
+  free(uid);
+}
+
+static int mqttClient_sendPublishAck(const char* uid, int nAck, const char* message)
+{
+  mqttClient_t* clientData = mqttMain_getClient();
+  char payload[MQTT_CLIENT_MAX_PAYLOAD_SIZE];
+  mqttClient_msg_t msg;
+  int len;
+  int rc = LE_OK;
+
+  if (clientData->config.payloadEncoding == MQTT_CLIENT_PAYLOAD_CBOR)
   {
-    if (msg.qos == MQTT_CLIENT_QOS1)
-      len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBACK, 0, msg.id);
-    else if (msg.qos == MQTT_CLIENT_QOS2)
-      len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBREC, 0, msg.id);
+    swircbor_writer_t writer;
 
-    if (len <= 0)
+    swircbor_initWriter(&writer, (uint8_t*)payload, sizeof(payload));
+    swircbor_beginArray(&writer, 1);
+    swircbor_beginMap(&writer, message[0] ? 3:2);
+    swircbor_writeString(&writer, "uid");
+    swircbor_writeString(&writer, uid);
+    swircbor_writeString(&writer, "status");
+    swircbor_writeString(&writer, nAck ? "ERROR":"OK");
+    if (message[0])
     {
-      LE_ERROR("MQTTSerialize_ack() failed(%d)", len);
-      rc = LE_BAD_PARAMETER;
+      swircbor_writeString(&writer, "message");
+      swircbor_writeString(&writer, message);
+    }
+
+    len = swircbor_finish(&writer);
+    if (len < 0)
+    {
+      LE_ERROR("swircbor_finish() failed(%d)", len);
+      rc = LE_OVERFLOW;
       goto cleanup;
     }
-        
-    LE_DEBUG("<--- PUBACK");
-    rc = mqttClient_write(clientData, len);
-    if (rc)
+
+    LE_DEBUG("ACK Message(uid('%s') CBOR len(%d))", uid, len);
+  }
+  else
+  {
+    swirjson_writer_t writer;
+
+    swirjson_initWriter(&writer, payload, sizeof(payload));
+    swirjson_beginArray(&writer);
+    swirjson_beginObject(&writer);
+    swirjson_writeKey(&writer, "uid");
+    swirjson_writeString(&writer, uid);
+    swirjson_writeKey(&writer, "status");
+    swirjson_writeString(&writer, nAck ? "ERROR":"OK");
+    if (message[0])
     {
-      LE_ERROR("mqttClient_write() failed(%d)", rc);
+      swirjson_writeKey(&writer, "message");
+      swirjson_writeString(&writer, message);
+    }
+    swirjson_endObject(&writer);
+    swirjson_endArray(&writer);
+
+    len = swirjson_finish(&writer);
+    if (len < 0)
+    {
+      LE_ERROR("swirjson_finish() failed(%d)", len);
+      rc = LE_OVERFLOW;
       goto cleanup;
     }
+
+    LE_DEBUG("ACK Message('%s')", payload);
   }
 
-  rc = mqttClient_deliverMsg(clientData, &topicName, &msg);
+  msg.qos = clientData->session.config.QoS;
+  msg.retained = 0;
+  msg.dup = 0;
+  msg.id = 0;
+  msg.payload = payload;
+  msg.payloadLen = len;
+
+  LE_INFO("<--- PUBLISH('%s')", clientData->ackTopic.name);
+  rc = mqttClient_publishPrepared(clientData, &clientData->ackTopic, &msg);
   if (rc)
   {
-    LE_ERROR("mqttClient_deliverMsg() failed(%d)", rc);
+    LE_ERROR("mqttClient_publishPrepared() failed(%d)", rc);
     goto cleanup;
   }
 
@@ -665,954 +876,2664 @@ cleanup:
   return rc;
 }
 
-static int mqttClient_processPubComp(mqttClient_t* clientData)
+static void mqttClient_onIncomingMessage(mqttClient_msg_data_t* md)
 {
+  mqttClient_t* clientData = mqttMain_getClient();
+  mqttClient_command_t* report = NULL;
+  mqttClient_msg_t* message = md->message;
+  const char* payload = message->payload;
+  char* uid = NULL;
+  bool overflow = false;
+  size_t i;
   int32_t rc = LE_OK;
-  uint16_t packetId;
-  uint8_t dup;
-  uint8_t type;
 
-  LE_DEBUG("---> PUBCOMP");
-  LE_ASSERT(clientData);
+  report = le_mem_ForceAlloc(clientData->commandPool);
+  memset(report, 0, offsetof(mqttClient_command_t, params));
+  memcpy(report->topicName, md->topicName->lenstring.data, md->topicName->lenstring.len);
+  report->topicName[md->topicName->lenstring.len] = 0;
+
+  // a JSON request starts with '[' or '{' after any whitespace, neither is a valid first CBOR byte
+  // for a map or an array, so the tasks topic takes both without a setting on the server side
+  for (i = 0; (i < message->payloadLen) && isspace((unsigned char)payload[i]); i++);
+
+  if ((i < message->payloadLen) && ((payload[i] == '[') || (payload[i] == '{')))
+  {
+    LE_INFO("---> topic('%s') len(%zu) data('%.*s')", report->topicName, message->payloadLen, (int)message->payloadLen, payload);
+    rc = mqttClient_parseJsonCommand(report, payload, message->payloadLen, &uid, &overflow);
+  }
+  else
+  {
+    LE_INFO("---> topic('%s') len(%zu) CBOR", report->topicName, message->payloadLen);
+    rc = mqttClient_parseCborCommand(report, (const uint8_t*)payload, message->payloadLen, &uid, &overflow);
+  }
 
-  rc = le_timer_Stop(clientData->session.cmdTimer);
   if (rc)
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
+    if (rc == LE_NOT_FOUND)
+    {
+      LE_WARN("failed to find command key");
+    }
+
+    le_mem_Release(report);
     goto cleanup;
   }
 
-  rc = MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rx.buf, sizeof(clientData->session.rx.buf));
-  if (rc != 1)
+  if (!uid)
+  {
+    LE_WARN("command('%s') without uid, not acknowledged", report->id);
+  }
+
+  // one report for every command handler, never a partial command
+  if (!overflow)
+  {
+    LE_DEBUG("--> AV command id('%s') params(%u)", report->id, report->paramCount);
+    le_event_ReportWithRefCounting(clientData->commandEvent, report);
+  }
+  else
+  {
+    le_mem_Release(report);
+  }
+
+  if (!uid)
   {
-    LE_ERROR("MQTTDeserialize_ack() failed");
-    rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
-  else if (clientData->session.nextPacketId != packetId)
+
+  if (le_thread_GetCurrent() != clientData->ioThread)
   {
-    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.nextPacketId, packetId);
-    rc = LE_BAD_PARAMETER;
+    // running on a dispatch worker, only the I/O loop writes to the socket
+    le_event_QueueFunctionToThread(clientData->ioThread, mqttClient_queuedPublishAck, uid, NULL);
+    uid = NULL;
     goto cleanup;
   }
 
+  rc = mqttClient_sendPublishAck(uid, 0, "");
+  if (rc)
+  {
+    LE_ERROR("mqttClient_sendPublishAck() failed(%d)", rc);
+    goto cleanup;
+  } 
+
 cleanup:
-  return rc;    
+  if (uid) free(uid);
 }
 
-static int mqttClient_processPubRec(mqttClient_t* clientData)
+static void mqttClient_connExpiryHndlr(le_timer_Ref_t timer)
 {
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+
+  LE_ASSERT(clientData);
+
+  LE_WARN("connect timeout('%s')", clientData->session.config.brokerUrl);
+  mqttClient_connectionLost(clientData, LE_TIMEOUT);
+}
+
+static void mqttClient_reconnectExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
   int32_t rc = LE_OK;
-  uint16_t packetId;
-  uint8_t dup;
-  uint8_t type;
 
-  LE_DEBUG("---> PUBREC");
   LE_ASSERT(clientData);
 
-  if (MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rx.buf, sizeof(clientData->session.rx.buf)) != 1)
+  LE_DEBUG("<--- reconnect(%u)", clientData->stats.consecutiveFailures);
+  rc = mqttClient_connect(clientData);
+  if (rc)
   {
-    LE_ERROR("MQTTDeserialize_ack() failed");
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("mqttClient_connect() failed(%d)", rc);
+    mqttClient_scheduleReconnect(clientData);
     goto cleanup;
   }
-  else if (clientData->session.nextPacketId != packetId)
+
+cleanup:
+  return;
+}
+
+static uint32_t mqttClient_backoffDelay(mqttClient_t* clientData)
+{
+  uint32_t failures = clientData->stats.consecutiveFailures;
+  uint32_t ceiling = clientData->session.config.reconnectBaseMs;
+
+  // the first retry goes out immediately, a single dropped connection should not cost a full base delay
+  if (failures <= 1)
   {
-    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.nextPacketId, packetId);
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    return 0;
   }
 
-  int len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBREL, 0, packetId);
-  if (len <= 0)
+  while ((--failures > 1) && (ceiling < clientData->session.config.reconnectCapMs))
   {
-    LE_ERROR("MQTTSerialize_ack() failed(%d)", len);
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    ceiling <<= 1;
   }
 
-  LE_DEBUG("<--- PUBREL");
-  rc = mqttClient_write(clientData, len);
-  if (rc) 
+  if (ceiling > clientData->session.config.reconnectCapMs)
   {
-    LE_ERROR("mqttClient_write() failed(%d)", rc);
-    goto cleanup;
+    ceiling = clientData->session.config.reconnectCapMs;
   }
 
-cleanup:
-  return rc;
+  // full jitter: anywhere between now and the ceiling, so a fleet does not reconnect in lockstep
+  return rand_r(&clientData->session.backoffSeed) % (ceiling + 1);
 }
 
-static int mqttClient_processPubAck(mqttClient_t* clientData)
+static void mqttClient_scheduleReconnect(mqttClient_t* clientData)
 {
-  int32_t rc = LE_OK;
-  uint16_t packetId;
-  uint8_t dup;
-  uint8_t type;
+  uint32_t delay;
 
-  LE_DEBUG("---> UNSUBACK");
   LE_ASSERT(clientData);
 
-  rc = le_timer_Stop(clientData->session.cmdTimer);
-  if (rc)
+  if (!clientData->session.reconnectTimer || (clientData->session.connState == MQTT_CLIENT_CONN_IDLE))
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
-    goto cleanup;
+    LE_DEBUG("session stopped, no reconnect");
+    return;
   }
 
-  rc = MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rx.buf, sizeof(clientData->session.rx.buf));
+  clientData->stats.consecutiveFailures++;
+  delay = mqttClient_backoffDelay(clientData);
+
+  LE_INFO("reconnect in %u ms (failures %u)", delay, clientData->stats.consecutiveFailures);
+  clientData->session.connState = MQTT_CLIENT_CONN_BACKOFF;
+  le_timer_Stop(clientData->session.reconnectTimer);
+  le_timer_SetMsInterval(clientData->session.reconnectTimer, delay ? delay:1);
+  le_timer_Start(clientData->session.reconnectTimer);
+}
+
+static void mqttClient_connectionLost(mqttClient_t* clientData, int reason)
+{
+  bool wasConnected;
+
+  LE_ASSERT(clientData);
+
+  wasConnected = clientData->session.isConnected;
+  LE_WARN("connection lost(%d) state(%u)", reason, clientData->session.connState);
+
+  if (le_timer_IsRunning(clientData->session.connTimer)) le_timer_Stop(clientData->session.connTimer);
+  if (le_timer_IsRunning(clientData->session.cmdTimer)) le_timer_Stop(clientData->session.cmdTimer);
+  if (le_timer_IsRunning(clientData->session.pingTimer)) le_timer_Stop(clientData->session.pingTimer);
+  if (le_timer_IsRunning(clientData->session.lingerTimer)) le_timer_Stop(clientData->session.lingerTimer);
+
+  mqttStore_stopDrain();
+  mqttClient_close(clientData);
+  clientData->session.isConnected = 0;
+  clientData->session.cmdRetries = 0;
+
+  if (wasConnected)
+  {
+    mqttClient_SendConnStateEvent(false, reason, -1);
+  }
+
+  mqttClient_scheduleReconnect(clientData);
+}
+
+static void mqttClient_cmdExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  int32_t rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+  {
+    // reconnecting is up to the backoff scheduler
+    goto cleanup;
+  }
+
+  if (clientData->session.cmdRetries < MQTT_CLIENT_MAX_SEND_RETRIES)
+  {
+    struct iovec iov = { clientData->session.cmd.buf, clientData->session.cmdLen };
+
+    LE_DEBUG("<--- resend CMD(%u)", clientData->session.cmdRetries++);
+    rc = mqttClient_writev(clientData, &iov, 1);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_write() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+  else
+  {
+    LE_ERROR("maximum retries reached(%u)", MQTT_CLIENT_MAX_SEND_RETRIES);
+    mqttClient_connectionLost(clientData, LE_TIMEOUT);
+    goto cleanup;
+  }
+
+cleanup:
+  return;
+}
+
+static void mqttClient_pingExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  int32_t rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  int len = MQTTSerialize_pingreq(clientData->session.tx.buf, sizeof(clientData->session.tx.buf));
+  if (len < 0)
+  {
+    LE_ERROR("MQTTSerialize_pingreq() failed(%d)", len);
+    goto cleanup;
+  }
+
+  LE_DEBUG("<--- PING");
+  rc = mqttClient_write(clientData, len);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_write() failed(%d)", rc);
+    goto cleanup;
+  }
+
+cleanup:
+  return;
+}
+
+static void mqttClient_inflightExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  le_clk_Time_t now = le_clk_GetRelativeTime();
+  le_clk_Time_t retry = { MQTT_CLIENT_INFLIGHT_RETRY_MS / 1000, (MQTT_CLIENT_INFLIGHT_RETRY_MS % 1000) * 1000 };
+  int i;
+
+  LE_ASSERT(clientData);
+
+  for (i = 0; i < MQTT_CLIENT_INFLIGHT_TABLE_SIZE; i++)
+  {
+    mqttClient_inflight_t* entry = &clientData->session.inflight[i];
+
+    if ((entry->state == MQTT_CLIENT_INFLIGHT_FREE) || le_clk_GreaterThan(entry->deadline, now))
+    {
+      continue;
+    }
+
+    entry->deadline = le_clk_Add(now, retry);
+    if (!clientData->session.isConnected)
+    {
+      continue;
+    }
+
+    if (entry->retries++ >= MQTT_CLIENT_MAX_SEND_RETRIES)
+    {
+      LE_ERROR("packet ID(%u) maximum retries reached(%u)", entry->packetId, MQTT_CLIENT_MAX_SEND_RETRIES);
+      mqttClient_inflightRemove(clientData, entry);
+      continue;
+    }
+
+    if (mqttClient_inflightResend(clientData, entry))
+    {
+      LE_ERROR("mqttClient_inflightResend() failed");
+    }
+  }
+
+  mqttClient_inflightStartTimer(clientData);
+}
+
+static void mqttClient_lingerExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  int32_t rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+  {
+    goto cleanup;
+  }
+
+  LE_DEBUG("<--- linger flush(%u)", clientData->session.txQueuedBytes);
+  rc = mqttClient_txFlush(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_txFlush() failed(%d)", rc);
+    goto cleanup;
+  }
+
+cleanup:
+  return;
+}
+
+static const char* mqttClient_connectionRsp(uint8_t rc)
+{
+  switch(rc)
+  {
+  case 0: return "Connection Accepted";
+  case 1: return "Connection Refused, unacceptable protocol version";
+  case 2: return "Connection Refused, identifier rejected";
+  case 3: return "Connection Refused, Server unavailable";
+  case 4: return "Connection Refused, bad user name or password";
+  case 5: return "Connection Refused, not authorized";
+  default: break;
+  }
+
+  return "N/A";
+}
+
+static int mqttClient_processConnAck(mqttClient_t* clientData)
+{
+  int32_t rc = LE_OK;
+  uint8_t sessionPresent = 0;
+  uint8_t connack_rc = 0;
+
+  LE_DEBUG("---> CONNACK");
+  LE_ASSERT(clientData);
+
+  rc = le_timer_Stop(clientData->session.cmdTimer);
+  if (rc)
+  {
+    LE_ERROR("le_timer_Stop() failed(%d)", rc);
+    goto cleanup;
+  }
+
+
+  rc = MQTTDeserialize_connack((unsigned char*)&sessionPresent, &connack_rc, clientData->session.rxPacket, clientData->session.rxPacketSize);
+  if (rc != 1)
+  {
+    LE_ERROR("MQTTDeserialize_connack() failed(%d)", rc);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  LE_DEBUG("session present(%u) connection ACK(%u)", sessionPresent, connack_rc);
+  clientData->session.isConnected = (connack_rc == MQTT_CLIENT_CONNECT_SUCCESS);
+
+  if (clientData->session.isConnected)
+  {
+    clientData->session.connState = MQTT_CLIENT_CONN_CONNECTED;
+    clientData->stats.connectSuccesses++;
+    clientData->stats.consecutiveFailures = 0;
+    mqttClient_SendConnStateEvent(true, 0, rc);
+
+    if (clientData->session.config.persistentSession)
+    {
+      mqttClient_inflightResendAll(clientData);
+    }
+
+    mqttStore_startDrain(clientData);
+
+    sessionPresent = sessionPresent && clientData->session.config.persistentSession;
+    mqttClient_subRestore(clientData, sessionPresent);
+
+    if (sessionPresent && !mqttClient_subFind(clientData, clientData->subscribeTopic))
+    {
+      mqttClient_sub_t* sub = mqttClient_subAdd(clientData, clientData->subscribeTopic);
+
+      // restarted process, but the broker kept our subscription: only the local handler is missing
+      LE_INFO("session present, skip subscribe('%s')", clientData->subscribeTopic);
+      if (sub) sub->state = MQTT_CLIENT_SUB_SUBSCRIBED;
+    }
+
+    // sends one SUBSCRIBE carrying the device topic and every filter that needs restoring
+    rc = mqttClient_subscribe(clientData, clientData->subscribeTopic, 0, mqttClient_onIncomingMessage);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_subscribe() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+  else
+  {
+    LE_ERROR("response('%s')", mqttClient_connectionRsp(connack_rc));
+    mqttClient_connectionLost(clientData, connack_rc);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_processSubAck(mqttClient_t* clientData)
+{
+  int grantedQoS[MQTT_CLIENT_SUBSCRIBE_BATCH_MAX];
+  int count = 0;
+  int rc = LE_OK;
+  unsigned short packetId = 0;
+  uint32_t i;
+
+  LE_DEBUG("---> SUBACK");
+  LE_ASSERT(clientData);
+
+  rc = le_timer_Stop(clientData->session.cmdTimer);
+  if (rc)
+  {
+    LE_ERROR("le_timer_Stop() failed(%d)", rc);
+    goto cleanup;
+  }
+
+  rc = MQTTDeserialize_suback(&packetId, NUM_ARRAY_MEMBERS(grantedQoS), &count, grantedQoS, clientData->session.rxPacket, clientData->session.rxPacketSize);
   if (rc != 1)
   {
-    LE_ERROR("MQTTDeserialize_ack() failed");
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("MQTTDeserialize_suback() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+  else if ((clientData->session.cmdType != SUBSCRIBE) || (clientData->session.cmdPacketId != packetId))
+  {
+    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.cmdPacketId, packetId);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  rc = LE_OK;
+
+  if (count != clientData->session.cmdSubCount)
+  {
+    LE_WARN("returned count(%d) requested(%u)", count, clientData->session.cmdSubCount);
+  }
+
+  // return codes come back in the order the filters were packed, a missing one counts as a failure
+  for (i = 0; i < clientData->session.cmdSubCount; i++)
+  {
+    mqttClient_sub_t* sub = clientData->session.cmdSubs[i];
+
+    if (sub->state != MQTT_CLIENT_SUB_SUBSCRIBING)
+    {
+      // changed by the application while the SUBSCRIBE was out, its new state is handled later
+      continue;
+    }
+
+    if ((i >= count) || (grantedQoS[i] & MQTT_CLIENT_SUBACK_FAILURE))
+    {
+      LE_ERROR("subscribe('%s') rejected", sub->topicFilter);
+      sub->state = MQTT_CLIENT_SUB_FAILED;
+    }
+    else
+    {
+      LE_DEBUG("subscribed('%s') granted QoS(%d)", sub->topicFilter, grantedQoS[i]);
+      sub->grantedQoS = grantedQoS[i];
+      sub->state = MQTT_CLIENT_SUB_SUBSCRIBED;
+    }
+  }
+
+  clientData->session.cmdType = 0;
+  clientData->session.cmdSubCount = 0;
+
+  rc = mqttClient_subSendNext(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
+    goto cleanup;
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_processUnSubAck(mqttClient_t* clientData)
+{
+  int32_t rc = LE_OK;
+  uint16_t packetId;
+  uint32_t i;
+
+  LE_DEBUG("---> UNSUBACK");
+  LE_ASSERT(clientData);
+
+  rc = le_timer_Stop(clientData->session.cmdTimer);
+  if (rc)
+  {
+    LE_ERROR("le_timer_Stop() failed(%d)", rc);
+    goto cleanup;
+  }
+
+  rc = MQTTDeserialize_unsuback(&packetId, clientData->session.rxPacket, clientData->session.rxPacketSize);
+  if (rc != 1)
+  {
+    LE_ERROR("MQTTDeserialize_unsuback() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+  else if ((clientData->session.cmdType != UNSUBSCRIBE) || (clientData->session.cmdPacketId != packetId))
+  {
+    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.cmdPacketId, packetId);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  for (i = 0; i < clientData->session.cmdSubCount; i++)
+  {
+    mqttClient_sub_t* sub = clientData->session.cmdSubs[i];
+
+    if (sub->state == MQTT_CLIENT_SUB_UNSUBSCRIBING)
+    {
+      LE_DEBUG("unsubscribed('%s')", sub->topicFilter);
+      mqttClient_subFree(clientData, sub);
+    }
+  }
+
+  clientData->session.cmdType = 0;
+  clientData->session.cmdSubCount = 0;
+
+  rc = mqttClient_subSendNext(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
+    goto cleanup;
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_processPublish(mqttClient_t* clientData)
+{
+  MQTTString topicName;
+  mqttClient_msg_t msg = {0};
+  int len = 0;
+  int32_t rc = LE_OK;
+
+  LE_DEBUG("---> PUBLISH");
+  LE_ASSERT(clientData);
+
+  if (MQTTDeserialize_publish((unsigned char*)&msg.dup, (int*)&msg.qos, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
+          (unsigned char**)&msg.payload, (int*)&msg.payloadLen, clientData->session.rxPacket, clientData->session.rxPacketSize) != 1)
+  {
+    LE_ERROR("MQTTDeserialize_publish() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  // a worker a whole ring behind holds the packet unacked in its slot until it catches up
+  if (mqttDispatch_isRunning())
+  {
+    const char* topic = topicName.cstring ? topicName.cstring:topicName.lenstring.data;
+    int topicLen = MQTTstrlen(topicName);
+    uint32_t need = MQTTTopic_match(clientData->topicTree, topic, topicLen, mqttClient_countHandlers, NULL);
+
+    if (!mqttDispatch_hasRoom(topic, topicLen, need))
+    {
+      LE_DEBUG("dispatch full, reading paused");
+      rc = LE_WOULD_BLOCK;
+      goto cleanup;
+    }
+  }
+
+  // the payload ends the packet, and the slot always has a spare byte behind it
+  msg.slot = clientData->session.rxPacket;
+  ((unsigned char*)msg.payload)[msg.payloadLen] = '\0';
+
+  if (msg.qos != MQTT_CLIENT_QOS0)
+  {
+    if (msg.qos == MQTT_CLIENT_QOS1)
+      len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBACK, 0, msg.id);
+    else if (msg.qos == MQTT_CLIENT_QOS2)
+      len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBREC, 0, msg.id);
+
+    if (len <= 0)
+    {
+      LE_ERROR("MQTTSerialize_ack() failed(%d)", len);
+      rc = LE_BAD_PARAMETER;
+      goto cleanup;
+    }
+        
+    LE_DEBUG("<--- PUBACK");
+    rc = mqttClient_write(clientData, len);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_write() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
+  rc = mqttClient_deliverMsg(clientData, &topicName, &msg);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_deliverMsg() failed(%d)", rc);
+    goto cleanup;
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_processPubComp(mqttClient_t* clientData)
+{
+  mqttClient_inflight_t* entry = NULL;
+  int32_t rc = LE_OK;
+  uint16_t packetId;
+  uint8_t dup;
+  uint8_t type;
+
+  LE_DEBUG("---> PUBCOMP");
+  LE_ASSERT(clientData);
+
+  rc = MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rxPacket, clientData->session.rxPacketSize);
+  if (rc != 1)
+  {
+    LE_ERROR("MQTTDeserialize_ack() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  rc = LE_OK;
+
+  entry = mqttClient_inflightFind(clientData, packetId);
+  if (!entry || (entry->qos != MQTT_CLIENT_QOS2) || (entry->state == MQTT_CLIENT_INFLIGHT_PUBLISH_SENT))
+  {
+    LE_WARN("unexpected PUBCOMP packet ID(%u)", packetId);
+    goto cleanup;
+  }
+
+  mqttClient_inflightRemove(clientData, entry);
+
+cleanup:
+  return rc;    
+}
+
+static int mqttClient_processPubRec(mqttClient_t* clientData)
+{
+  mqttClient_inflight_t* entry = NULL;
+  int32_t rc = LE_OK;
+  uint16_t packetId;
+  uint8_t dup;
+  uint8_t type;
+
+  LE_DEBUG("---> PUBREC");
+  LE_ASSERT(clientData);
+
+  if (MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rxPacket, clientData->session.rxPacketSize) != 1)
+  {
+    LE_ERROR("MQTTDeserialize_ack() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  entry = mqttClient_inflightFind(clientData, packetId);
+  if (!entry || (entry->qos != MQTT_CLIENT_QOS2))
+  {
+    LE_WARN("unexpected PUBREC packet ID(%u)", packetId);
+    goto cleanup;
+  }
+
+  // the stored PUBLISH is no longer needed, only the PUBREL may have to be resent
+  entry->state = MQTT_CLIENT_INFLIGHT_PUBREC_RECEIVED;
+  entry->retries = 0;
+  mqttSession_markDirty(clientData);
+
+  int len = MQTTSerialize_ack(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), PUBREL, 0, packetId);
+  if (len <= 0)
+  {
+    LE_ERROR("MQTTSerialize_ack() failed(%d)", len);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  LE_DEBUG("<--- PUBREL");
+  rc = mqttClient_write(clientData, len);
+  if (rc) 
+  {
+    LE_ERROR("mqttClient_write() failed(%d)", rc);
+    goto cleanup;
+  }
+
+  entry->state = MQTT_CLIENT_INFLIGHT_PUBREL_SENT;
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_processPubAck(mqttClient_t* clientData)
+{
+  mqttClient_inflight_t* entry = NULL;
+  int32_t rc = LE_OK;
+  uint16_t packetId;
+  uint8_t dup;
+  uint8_t type;
+
+  LE_DEBUG("---> PUBACK");
+  LE_ASSERT(clientData);
+
+  rc = MQTTDeserialize_ack(&type, &dup, &packetId, clientData->session.rxPacket, clientData->session.rxPacketSize);
+  if (rc != 1)
+  {
+    LE_ERROR("MQTTDeserialize_ack() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  rc = LE_OK;
+
+  entry = mqttClient_inflightFind(clientData, packetId);
+  if (!entry || (entry->qos != MQTT_CLIENT_QOS1))
+  {
+    LE_WARN("unexpected PUBACK packet ID(%u)", packetId);
+    goto cleanup;
+  }
+
+  mqttClient_inflightRemove(clientData, entry);
+
+cleanup:
+  return rc;
+}
+
+static void mqttClient_processPingResp(mqttClient_t* clientData)
+{
+  LE_DEBUG("---> PINGRESP");
+  LE_ASSERT(clientData);
+  le_timer_Restart(clientData->session.pingTimer);
+}
+
+static int mqttClient_rxGet(void* sck, unsigned char* buf, int count)
+{
+  mqttClient_rxStage_t* stage = &((mqttClient_t*)sck)->session.rxStage;
+  int avail = stage->tail - stage->head;
+
+  if (count > avail)
+  {
+    count = avail;
+  }
+
+  memcpy(buf, stage->buf + stage->head, count);
+  stage->head += count;
+  return count;
+}
+
+// drops the receive path's reference, a handler that retained the packet keeps the slot alive
+static void mqttClient_rxRelease(mqttClient_t* clientData)
+{
+  mqttBuffer_release(clientData->session.rxPacket);
+  clientData->session.rxPacket = NULL;
+  clientData->session.rxPacketSize = 0;
+}
+
+static int mqttClient_receive(mqttClient_t* clientData)
+{
+  mqttClient_rxStage_t* stage = &clientData->session.rxStage;
+  int rc = LE_OK;
+
+  // one recv() per wakeup, then frame as many packets as it delivered
+  ssize_t bytes = recv(clientData->session.sock, stage->buf, sizeof(stage->buf), 0);
+  if (bytes == -1)
+  {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+    {
+      LE_ERROR("recv() failed(%d)", errno);
+      mqttClient_connectionLost(clientData, LE_IO_ERROR);
+      rc = LE_IO_ERROR;
+    }
+
+    goto cleanup;
+  }
+  else if (bytes == 0)
+  {
+    LE_WARN("peer closed connection");
+    mqttClient_connectionLost(clientData, LE_CLOSED);
+    goto cleanup;
+  }
+
+  mqttClient_dumpBuffer(stage->buf, bytes);
+  stage->head = 0;
+  stage->tail = bytes;
+
+  rc = mqttClient_rxFrame(clientData);
+
+cleanup:
+  return rc;
+}
+
+// frames what is left in the stage, stops early when a PUBLISH has to wait for a dispatch worker
+static int mqttClient_rxFrame(mqttClient_t* clientData)
+{
+  mqttClient_rxStage_t* stage = &clientData->session.rxStage;
+  int rc = LE_OK;
+
+  while ((stage->head < stage->tail) && (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET))
+  {
+    // every packet lands in its own slot, one byte is held back to NUL-terminate the payload
+    if (!clientData->session.rxPacket)
+    {
+      clientData->session.rxPacket = mqttBuffer_alloc(MQTT_CLIENT_RX_SLOT_SIZE);
+      clientData->session.rxPacketSize = mqttBuffer_capacity(clientData->session.rxPacket) - 1;
+    }
+
+    // a packet cut short stays in rxPacket and the transport state until the next wakeup
+    int packetType = MQTTPacket_readnb(clientData->session.rxPacket, clientData->session.rxPacketSize, &clientData->session.rxTransport);
+    if (packetType == MQTTPACKET_BUFFER_TOO_SHORT)
+    {
+      // borrow a bigger buffer for this packet only
+      MQTTTransport* trp = &clientData->session.rxTransport;
+      unsigned char* big = mqttBuffer_allocSlot(trp->len + trp->rem_len);
+
+      if (!big)
+      {
+        LE_ERROR("mqttBuffer_allocSlot() failed(%d)", trp->len + trp->rem_len);
+        packetType = MQTTPACKET_READ_ERROR;
+      }
+      else
+      {
+        LE_DEBUG("large packet(%d)", trp->len + trp->rem_len);
+        memcpy(big, clientData->session.rxPacket, trp->len);
+        mqttClient_rxRelease(clientData);
+        clientData->session.rxPacket = big;
+        clientData->session.rxPacketSize = mqttBuffer_capacity(big) - 1;
+        continue;
+      }
+    }
+
+    if (packetType == 0)
+    {
+      LE_DEBUG("partial packet(%d/%d)", clientData->session.rxTransport.len, clientData->session.rxTransport.len + clientData->session.rxTransport.rem_len);
+      break;
+    }
+    else if (packetType < 0)
+    {
+      LE_ERROR("MQTTPacket_readnb() failed(%d)", packetType);
+      stage->head = stage->tail = 0;
+      mqttClient_connectionLost(clientData, LE_FORMAT_ERROR);
+
+      rc = LE_FORMAT_ERROR;
+      goto cleanup;
+    }
+
+    rc = mqttClient_processPacket(clientData, packetType);
+    if (rc == LE_WOULD_BLOCK)
+    {
+      // the rest of the stage and the socket wait, the worker resumes us once it has room
+      clientData->session.rxPaused = 1;
+      le_fdMonitor_Disable(clientData->session.sockFdMonitor, POLLIN);
+      break;
+    }
+    else if (rc)
+    {
+      LE_ERROR("mqttClient_processPacket() failed(%d)", rc);
+    }
+
+    mqttClient_rxRelease(clientData);
+
+    clientData->session.cmdRetries = 0;
+  }
+
+  rc = LE_OK;
+
+cleanup:
+  return rc;
+}
+
+// queued by a dispatch worker that made room, runs on the I/O thread
+static void mqttClient_rxResume(void* context, void* unused)
+{
+  mqttClient_t* clientData = context;
+  int rc;
+
+  LE_ASSERT(clientData);
+
+  // a connection lost while paused dropped the packet with it
+  if (!clientData->session.rxPaused || (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET))
+  {
+    return;
+  }
+
+  rc = mqttClient_processPacket(clientData, PUBLISH);
+  if (rc == LE_WOULD_BLOCK)
+  {
+    return;
+  }
+  else if (rc)
+  {
+    LE_ERROR("mqttClient_processPacket() failed(%d)", rc);
+  }
+
+  mqttClient_rxRelease(clientData);
+  clientData->session.rxPaused = 0;
+  clientData->session.cmdRetries = 0;
+
+  rc = mqttClient_rxFrame(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_rxFrame() failed(%d)", rc);
+  }
+
+  if (!clientData->session.rxPaused && (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET))
+  {
+    le_fdMonitor_Enable(clientData->session.sockFdMonitor, POLLIN);
+  }
+}
+
+static int mqttClient_processPacket(mqttClient_t* clientData, int packetType)
+{
+  int rc = LE_OK;
+
+  LE_DEBUG("packet type(%d)", packetType);
+  switch (packetType)
+  {
+  case CONNACK:
+    rc = mqttClient_processConnAck(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processConnAck() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+
+  case PUBACK:
+    rc = mqttClient_processPubAck(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processPubAck() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+
+  case SUBACK:
+    rc = mqttClient_processSubAck(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processSubAck() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+
+  case UNSUBACK:
+    rc = mqttClient_processUnSubAck(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processUnSubAck() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+
+  case PUBLISH:
+    rc = mqttClient_processPublish(clientData);
+    if (rc && (rc != LE_WOULD_BLOCK))
+    {
+      LE_ERROR("mqttClient_processPublish() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+  
+  case PUBREC:
+    rc = mqttClient_processPubRec(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processPubRec() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+  
+  case PUBCOMP:
+    rc = mqttClient_processPubComp(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_processPubComp() failed(%d)", rc);
+      goto cleanup;
+    }
+
+    break;
+
+  case PINGRESP:
+    mqttClient_processPingResp(clientData);
+    break;
+
+  default:
+    LE_ERROR("unknown packet type(%u)", packetType);
+    break;
+  }
+
+cleanup:
+  return rc;
+}
+
+static void mqttClient_socketFdEventHandler(int sockFd, short events)
+{
+  mqttClient_t* clientData = le_fdMonitor_GetContextPtr();
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  LE_DEBUG("events(0x%08x)", events);
+  if (events & POLLOUT)
+  {
+    le_fdMonitor_Disable(clientData->session.sockFdMonitor, POLLOUT);
+
+    if (!le_dls_IsEmpty(&clientData->session.txQueue))
+    {
+      rc = mqttClient_txFlush(clientData);
+      if (rc)
+      {
+        LE_ERROR("mqttClient_txFlush() failed(%d)", rc);
+        goto cleanup;
+      }
+    }
+    else if ((clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET) && !clientData->session.isConnected)
+    {
+      LE_INFO("connected(%s:%d)", clientData->session.config.brokerUrl, clientData->session.config.portNumber);
+      rc = le_timer_Stop(clientData->session.connTimer);
+      if (rc)
+      {
+        LE_ERROR("le_timer_Stop() failed(%d)", rc);
+        goto cleanup;
+      }
+
+      MQTTPacket_connectData data = MQTTPacket_connectData_initializer;       
+      data.willFlag = 0;
+      data.MQTTVersion = MQTT_CLIENT_MQTT_VERSION;
+
+      LE_INFO("deviceId('%s'), pwd('%s')", clientData->deviceId, clientData->session.secret);
+      if (strlen(clientData->deviceId) > 0)
+      {
+        data.clientID.cstring = clientData->deviceId;
+        data.username.cstring = clientData->deviceId;
+        data.password.cstring = clientData->session.secret;
+      }
+
+      data.keepAliveInterval = clientData->session.config.keepAlive;
+      // a persistent session keeps our subscriptions and queued commands on the broker while offline
+      data.cleansession = !clientData->session.config.persistentSession;
+
+      rc = mqttClient_sendConnect(clientData, &data);
+      if (rc)
+      {
+        LE_ERROR("mqttClient_sendConnect() failed(%d)", rc);
+        goto cleanup;
+      }
+    }
+  }
+
+  if ((events & POLLIN) && (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET) && !clientData->session.rxPaused)
+  {
+    rc = mqttClient_receive(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_receive() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
+cleanup:
+  return;
+}
+
+static void mqttClient_dataConnectionStateHandler(const char* intfName, bool isConnected, void* contextPtr)
+{
+  mqttClient_t* clientData = (mqttClient_t*)contextPtr;
+  int32_t rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  LE_DEBUG("interface('%s') connected(%u)", intfName, isConnected);
+  if (isConnected)
+  {
+    if (clientData->session.connState == MQTT_CLIENT_CONN_IDLE)
+    {
+      LE_INFO("starting session");           
+      rc = mqttClient_startSession(clientData);
+      if (rc)
+      {        
+        LE_ERROR("mqttClient_startSession() failed(%d)", rc);
+        goto cleanup;
+      }
+    }
+    else
+    {
+        LE_INFO("No ongoing MQTT Connection request");
+    }
+  }
+  else
+  {
+    LE_INFO("disconnected('%s')", intfName);
+    mqttClient_disconnectData(clientData);
+  }
+
+cleanup:
+  if (rc)
+  {
+    int32_t err = mqttClient_disconnectData(clientData);
+    if (err)
+    {        
+      LE_ERROR("mqttClient_disconnectData() failed(%d)", err);
+    }
+  }
+
+  return;
+}
+
+static void mqttClient_resolveHndlr(uint32_t requestId, int result, const mqttResolver_addrList_t* addrs, void* context)
+{
+  mqttClient_t* clientData = context;
+
+  LE_ASSERT(clientData);
+
+  if (requestId != clientData->session.resolveId)
+  {
+    LE_DEBUG("stale resolve request(%u)", requestId);
+    goto cleanup;
+  }
+
+  clientData->session.resolveId = 0;
+  if (result)
+  {
+    LE_ERROR("resolve('%s') failed(%d)", clientData->session.config.brokerUrl, result);
+    mqttClient_connectionLost(clientData, result);
+    goto cleanup;
+  }
+
+  memcpy(&clientData->session.addrs, addrs, sizeof(clientData->session.addrs));
+  clientData->session.addrNext = 0;
+  mqttClient_attemptNext(clientData);
+
+cleanup:
+  return;
+}
+
+static void mqttClient_attemptExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+
+  LE_ASSERT(clientData);
+
+  LE_DEBUG("<--- attempt delay expired");
+  mqttClient_attemptNext(clientData);
+}
+
+static void mqttClient_attemptFdEventHandler(int sockFd, short events)
+{
+  mqttClient_t* clientData = le_fdMonitor_GetContextPtr();
+  socklen_t optLen = sizeof(int);
+  int err = 0;
+  int i;
+
+  LE_ASSERT(clientData);
+
+  for (i = 0; i < MQTT_CLIENT_CONNECT_MAX_ATTEMPTS; i++)
+  {
+    mqttClient_attempt_t* attempt = &clientData->session.attempts[i];
+
+    if (attempt->sock != sockFd)
+    {
+      continue;
+    }
+
+    if (getsockopt(sockFd, SOL_SOCKET, SO_ERROR, &err, &optLen) == -1)
+    {
+      err = errno;
+    }
+
+    if (!err && !(events & (POLLERR | POLLHUP)))
+    {
+      mqttClient_attemptWon(clientData, attempt);
+    }
+    else
+    {
+      LE_WARN("connect attempt(%u) failed(%d)", attempt->addrIdx, err);
+      le_fdMonitor_Delete(attempt->fdMonitor);
+      close(attempt->sock);
+      attempt->fdMonitor = NULL;
+      attempt->sock = MQTT_CLIENT_INVALID_SOCKET;
+
+      // a refused address should not hold up the next one for the full attempt delay
+      mqttClient_attemptNext(clientData);
+    }
+
+    break;
+  }
+}
+
+static void mqttClient_attemptNext(mqttClient_t* clientData)
+{
+  mqttClient_attempt_t* attempt = NULL;
+  int pending = 0;
+  int i;
+
+  LE_ASSERT(clientData);
+
+  for (i = 0; i < MQTT_CLIENT_CONNECT_MAX_ATTEMPTS; i++)
+  {
+    if (clientData->session.attempts[i].sock != MQTT_CLIENT_INVALID_SOCKET)
+    {
+      pending++;
+    }
+    else if (!attempt)
+    {
+      attempt = &clientData->session.attempts[i];
+    }
+  }
+
+  while (attempt && (clientData->session.addrNext < clientData->session.addrs.count))
+  {
+    uint32_t idx = clientData->session.addrNext++;
+    struct sockaddr_storage* addr = &clientData->session.addrs.addr[idx];
+    char name[INET6_ADDRSTRLEN] = "";
+    int sock;
+
+    if (addr->ss_family == AF_INET6)
+    {
+      struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+      in6->sin6_port = htons(clientData->session.config.portNumber);
+      inet_ntop(AF_INET6, &in6->sin6_addr, name, sizeof(name));
+    }
+    else
+    {
+      struct sockaddr_in* in = (struct sockaddr_in*)addr;
+      in->sin_port = htons(clientData->session.config.portNumber);
+      inet_ntop(AF_INET, &in->sin_addr, name, sizeof(name));
+    }
+
+    sock = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1)
+    {
+      LE_ERROR("socket() failed(%d)", errno);
+      continue;
+    }
+
+    LE_DEBUG("connect attempt(%u) '%s'", idx, name);
+    attempt->sock = sock;
+    attempt->addrIdx = idx;
+
+    if (connect(sock, (struct sockaddr*)addr, clientData->session.addrs.addrLen[idx]) == 0)
+    {
+      mqttClient_attemptWon(clientData, attempt);
+      return;
+    }
+
+    if (errno != EINPROGRESS)
+    {
+      LE_WARN("connect('%s') failed(%d)", name, errno);
+      close(sock);
+      attempt->sock = MQTT_CLIENT_INVALID_SOCKET;
+      continue;
+    }
+
+    attempt->fdMonitor = le_fdMonitor_Create(MQTT_CLIENT_ATTEMPT_MONITOR_NAME, sock, mqttClient_attemptFdEventHandler, POLLOUT);
+    le_fdMonitor_SetContextPtr(attempt->fdMonitor, clientData);
+    pending++;
+
+    // give this attempt a head start before racing the next address
+    if (clientData->session.addrNext < clientData->session.addrs.count)
+    {
+      le_timer_Restart(clientData->session.attemptTimer);
+    }
+
+    return;
+  }
+
+  if (!pending && (clientData->session.addrNext >= clientData->session.addrs.count))
+  {
+    // every address failed, do not trust the cached answer on the next try
+    LE_ERROR("connect('%s') failed on all %u addresses", clientData->session.config.brokerUrl, clientData->session.addrs.count);
+    mqttResolver_invalidate(clientData->session.config.brokerUrl);
+    mqttClient_connectionLost(clientData, LE_COMM_ERROR);
+  }
+}
+
+static void mqttClient_attemptWon(mqttClient_t* clientData, mqttClient_attempt_t* winner)
+{
+  int sock = winner->sock;
+
+  LE_ASSERT(clientData);
+
+  LE_DEBUG("connect attempt(%u) won", winner->addrIdx);
+  if (winner->fdMonitor)
+  {
+    le_fdMonitor_Delete(winner->fdMonitor);
+    winner->fdMonitor = NULL;
+  }
+
+  winner->sock = MQTT_CLIENT_INVALID_SOCKET;
+  mqttClient_attemptsAbort(clientData);
+
+  clientData->session.sock = sock;
+  clientData->session.sockFdMonitor = le_fdMonitor_Create(MQTT_CLIENT_SOCKET_MONITOR_NAME, sock, mqttClient_socketFdEventHandler, POLLIN | POLLOUT);
+  le_fdMonitor_SetContextPtr(clientData->session.sockFdMonitor, clientData);
+}
+
+static void mqttClient_attemptsAbort(mqttClient_t* clientData)
+{
+  int i;
+
+  if (clientData->session.resolveId)
+  {
+    mqttResolver_cancel(clientData->session.resolveId);
+    clientData->session.resolveId = 0;
+  }
+
+  if (clientData->session.attemptTimer && le_timer_IsRunning(clientData->session.attemptTimer))
+  {
+    le_timer_Stop(clientData->session.attemptTimer);
+  }
+
+  for (i = 0; i < MQTT_CLIENT_CONNECT_MAX_ATTEMPTS; i++)
+  {
+    mqttClient_attempt_t* attempt = &clientData->session.attempts[i];
+
+    if (attempt->sock != MQTT_CLIENT_INVALID_SOCKET)
+    {
+      le_fdMonitor_Delete(attempt->fdMonitor);
+      close(attempt->sock);
+      attempt->fdMonitor = NULL;
+      attempt->sock = MQTT_CLIENT_INVALID_SOCKET;
+    }
+  }
+}
+
+static int mqttClient_connect(mqttClient_t* clientData)
+{
+  int rc = LE_OK;
+  int i;
+
+  LE_ASSERT(clientData);
+
+  if (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET)
+  {
+    LE_WARN("socket already connected");
+    goto cleanup;
+  }
+
+  if (clientData->session.resolveId)
+  {
+    LE_WARN("connect already in progress");
+    goto cleanup;
+  }
+
+  for (i = 0; i < MQTT_CLIENT_CONNECT_MAX_ATTEMPTS; i++)
+  {
+    if (clientData->session.attempts[i].sock != MQTT_CLIENT_INVALID_SOCKET)
+    {
+      LE_WARN("connect already in progress");
+      goto cleanup;
+    }
+  }
+
+  clientData->session.tx.ptr = clientData->session.tx.buf;
+  memset(&clientData->session.rxTransport, 0, sizeof(clientData->session.rxTransport));
+  clientData->session.rxTransport.getfn = mqttClient_rxGet;
+  clientData->session.rxTransport.sck = clientData;
+  clientData->session.rxStage.head = clientData->session.rxStage.tail = 0;
+  clientData->session.rxPaused = 0;
+  mqttClient_rxRelease(clientData);
+
+  clientData->session.connState = MQTT_CLIENT_CONN_CONNECTING;
+  clientData->stats.connectAttempts++;
+
+  // covers resolution and every attempt, expiry hands over to the backoff scheduler
+  rc = le_timer_Start(clientData->session.connTimer);
+  if (rc)
+  {
+    LE_ERROR("le_timer_Start() failed(%d)", rc);
+    goto cleanup;
+  }
+
+  LE_DEBUG("connecting('%s')", clientData->session.config.brokerUrl);
+  clientData->session.addrs.count = 0;
+  clientData->session.addrNext = 0;
+  clientData->session.resolveId = mqttResolver_resolve(clientData->session.config.brokerUrl, mqttClient_resolveHndlr, clientData);
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_close(mqttClient_t* clientData)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  mqttClient_attemptsAbort(clientData);
+
+  if (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET)
+  {
+    le_fdMonitor_Delete(clientData->session.sockFdMonitor);
+    mqttClient_txPurge(clientData);
+
+    rc = close(clientData->session.sock);
+    if (rc == -1)
+    {
+      LE_ERROR("close() failed(%d)", errno);
+      rc = LE_FAULT;
+      goto cleanup;
+    }
+
+    clientData->session.sock = MQTT_CLIENT_INVALID_SOCKET;
+  }
+  else
+  {
+    LE_WARN("socket already closed");
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_write(mqttClient_t* clientData, int length)
+{
+  struct iovec iov = { clientData->session.tx.buf, length };
+
+  return mqttClient_writev(clientData, &iov, 1);
+}
+
+static int mqttClient_writeCmd(mqttClient_t* clientData, int length)
+{
+  struct iovec iov = { clientData->session.cmd.buf, length };
+
+  // keep a private copy so the command can be resent after tx.buf was reused
+  memcpy(clientData->session.cmd.buf, clientData->session.tx.buf, length);
+  clientData->session.cmdLen = length;
+
+  return mqttClient_writev(clientData, &iov, 1);
+}
+
+static void mqttClient_txEnqueue(mqttClient_t* clientData, const struct iovec* iov, int iovcnt, size_t skip)
+{
+  mqttClient_txPacket_t* pkt = NULL;
+  le_dls_Link_t* tail = le_dls_PeekTail(&clientData->session.txQueue);
+  int i;
+
+  if (tail)
+  {
+    pkt = CONTAINER_OF(tail, mqttClient_txPacket_t, link);
+  }
+
+  for (i = 0; i < iovcnt; i++)
+  {
+    const unsigned char* src = iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+
+    if (skip >= len)
+    {
+      skip -= len;
+      continue;
+    }
+
+    src += skip;
+    len -= skip;
+    skip = 0;
+
+    while (len > 0)
+    {
+      size_t chunk;
+
+      if (!pkt || (pkt->len == sizeof(pkt->data)))
+      {
+        pkt = le_mem_ForceAlloc(clientData->session.txPool);
+        pkt->link = LE_DLS_LINK_INIT;
+        pkt->len = 0;
+        pkt->offset = 0;
+        le_dls_Queue(&clientData->session.txQueue, &pkt->link);
+      }
+
+      chunk = sizeof(pkt->data) - pkt->len;
+      if (chunk > len) chunk = len;
+
+      memcpy(pkt->data + pkt->len, src, chunk);
+      pkt->len += chunk;
+      clientData->session.txQueuedBytes += chunk;
+      src += chunk;
+      len -= chunk;
+    }
+  }
+}
+
+static void mqttClient_txPurge(mqttClient_t* clientData)
+{
+  le_dls_Link_t* link;
+
+  while ((link = le_dls_Pop(&clientData->session.txQueue)) != NULL)
+  {
+    le_mem_Release(CONTAINER_OF(link, mqttClient_txPacket_t, link));
+  }
+
+  clientData->session.txQueuedBytes = 0;
+}
+
+static int mqttClient_txFlush(mqttClient_t* clientData)
+{
+  struct iovec iov[MQTT_CLIENT_TX_MAX_IOV];
+  le_dls_Link_t* link = le_dls_Peek(&clientData->session.txQueue);
+  int iovcnt = 0;
+  int rc = LE_OK;
+
+  while (link && (iovcnt < MQTT_CLIENT_TX_MAX_IOV))
+  {
+    mqttClient_txPacket_t* pkt = CONTAINER_OF(link, mqttClient_txPacket_t, link);
+
+    iov[iovcnt].iov_base = pkt->data + pkt->offset;
+    iov[iovcnt].iov_len = pkt->len - pkt->offset;
+    iovcnt++;
+    link = le_dls_PeekNext(&clientData->session.txQueue, link);
+  }
+
+  if (!iovcnt)
+  {
     goto cleanup;
   }
-  else if (clientData->session.nextPacketId != packetId)
+
+  ssize_t sent = writev(clientData->session.sock, iov, iovcnt);
+  if (sent == -1)
   {
-    LE_ERROR("invalid packet ID(%u != %u)", clientData->session.nextPacketId, packetId);
-    rc = LE_BAD_PARAMETER;
+    if (errno == EAGAIN)
+    {
+      le_fdMonitor_Enable(clientData->session.sockFdMonitor, POLLOUT);
+      goto cleanup;
+    }
+
+    LE_ERROR("writev() failed(%d)", errno);
+    mqttClient_connectionLost(clientData, LE_IO_ERROR);
+    rc = LE_IO_ERROR;
     goto cleanup;
   }
 
+  LE_DEBUG("flushed(%zd/%u) segments(%d)", sent, clientData->session.txQueuedBytes, iovcnt);
+  clientData->session.txQueuedBytes -= sent;
+
+  while ((sent > 0) && ((link = le_dls_Peek(&clientData->session.txQueue)) != NULL))
+  {
+    mqttClient_txPacket_t* pkt = CONTAINER_OF(link, mqttClient_txPacket_t, link);
+    size_t left = pkt->len - pkt->offset;
+
+    if ((size_t)sent < left)
+    {
+      pkt->offset += sent;
+      break;
+    }
+
+    sent -= left;
+    le_dls_Pop(&clientData->session.txQueue);
+    le_mem_Release(pkt);
+  }
+
+  le_timer_Restart(clientData->session.pingTimer);
+
+  if (!le_dls_IsEmpty(&clientData->session.txQueue))
+  {
+    le_fdMonitor_Enable(clientData->session.sockFdMonitor, POLLOUT);
+  }
+
 cleanup:
   return rc;
 }
 
-static void mqttClient_processPingResp(mqttClient_t* clientData)
+static int mqttClient_writeCoalesced(mqttClient_t* clientData, const struct iovec* iov, int iovcnt)
 {
-  LE_DEBUG("---> PINGRESP");
+  int rc = LE_OK;
+
   LE_ASSERT(clientData);
-  le_timer_Restart(clientData->session.pingTimer);
+
+  if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+  {
+    rc = mqttClient_writev(clientData, iov, iovcnt);
+    goto cleanup;
+  }
+
+  // hold the packet back until the linger time expires or enough bytes are waiting
+  mqttClient_txEnqueue(clientData, iov, iovcnt, 0);
+
+  if (clientData->session.txQueuedBytes >= clientData->session.config.coalesceMaxBytes)
+  {
+    if (le_timer_IsRunning(clientData->session.lingerTimer))
+    {
+      le_timer_Stop(clientData->session.lingerTimer);
+    }
+
+    rc = mqttClient_txFlush(clientData);
+    if (rc)
+    {
+      LE_ERROR("mqttClient_txFlush() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+  else if (!le_timer_IsRunning(clientData->session.lingerTimer))
+  {
+    le_timer_Start(clientData->session.lingerTimer);
+  }
+
+cleanup:
+  return rc;
 }
 
-static void mqttClient_socketFdEventHandler(int sockFd, short events)
+static int mqttClient_writev(mqttClient_t* clientData, const struct iovec* iov, int iovcnt)
 {
-  mqttClient_t* clientData = le_fdMonitor_GetContextPtr();
-  int rc = LE_OK;
+  size_t total = 0;
+  ssize_t sent = 0;
+  le_result_t rc = LE_OK;
+  int i;
 
   LE_ASSERT(clientData);
 
-  LE_DEBUG("events(0x%08x)", events);
-  if (events & POLLOUT)
+  for (i = 0; i < iovcnt; i++)
   {
-    le_fdMonitor_Disable(clientData->session.sockFdMonitor, POLLOUT);
+    total += iov[i].iov_len;
+  }
 
-    if ((clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET) && !clientData->session.isConnected)
+  if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+  {
+    // never connect from here, the backoff scheduler owns every (re)connect
+    LE_DEBUG("not connected, dropped(%zu)", total);
+    rc = LE_CLOSED;
+    goto cleanup;
+  }
+  else
+  {
+    // anything already queued must leave first to preserve packet order
+    if (le_dls_IsEmpty(&clientData->session.txQueue))
     {
-      LE_INFO("connected(%s:%d)", clientData->session.config.brokerUrl, clientData->session.config.portNumber);
-      rc = le_timer_Stop(clientData->session.connTimer);
-      if (rc)
+      for (i = 0; i < iovcnt; i++)
       {
-        LE_ERROR("le_timer_Stop() failed(%d)", rc);
-        goto cleanup;
+        mqttClient_dumpBuffer(iov[i].iov_base, iov[i].iov_len);
       }
 
-      MQTTPacket_connectData data = MQTTPacket_connectData_initializer;       
-      data.willFlag = 0;
-      data.MQTTVersion = MQTT_CLIENT_MQTT_VERSION;
-
-      LE_INFO("deviceId('%s'), pwd('%s')", clientData->deviceId, clientData->session.secret);
-      if (strlen(clientData->deviceId) > 0)
+      sent = writev(clientData->session.sock, iov, iovcnt);
+      if (sent == -1)
       {
-        data.clientID.cstring = clientData->deviceId;
-        data.username.cstring = clientData->deviceId;
-        data.password.cstring = clientData->session.secret;
-      }
+        if (errno != EAGAIN)
+        {
+          LE_ERROR("writev() failed(%d)", errno);
+          mqttClient_connectionLost(clientData, LE_IO_ERROR);
+          rc = LE_IO_ERROR;
+          goto cleanup;
+        }
 
-      data.keepAliveInterval = clientData->session.config.keepAlive;
-      data.cleansession = 1;
+        sent = 0;
+      }
 
-      rc = mqttClient_sendConnect(clientData, &data);
-      if (rc)
+      if (sent > 0)
       {
-        LE_ERROR("mqttClient_sendConnect() failed(%d)", rc);
-        goto cleanup;
+        le_timer_Restart(clientData->session.pingTimer);
       }
     }
-    else if (clientData->session.tx.bytesLeft)
+
+    if ((size_t)sent < total)
     {
-      rc = mqttClient_write(clientData, 0);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_write() failed(%d)", rc);
-        goto cleanup;
-      }
+      mqttClient_txEnqueue(clientData, iov, iovcnt, sent);
+      le_fdMonitor_Enable(clientData->session.sockFdMonitor, POLLOUT);
+      LE_DEBUG("send queued(%zu) pending(%u)", total - sent, clientData->session.txQueuedBytes);
+    }
+  }
+
+cleanup:
+  return rc;
+}
+
+static int mqttClient_countHandlers(void* subscriber, void* context)
+{
+  return ((mqttClient_sub_t*)subscriber)->handler ? 1:0;
+}
+
+static int mqttClient_deliverSub(void* subscriber, void* context)
+{
+  mqttClient_sub_t* sub = subscriber;
+  le_dls_Link_t* link = le_dls_Peek(&sub->subscribers);
+  int count = 0;
+  int rc;
+
+  // an unsubscribed filter stays in the index until the broker confirms, but no longer has a handler
+  if (sub->handler)
+  {
+    // with workers started the client's own handlers run off the I/O loop, subscribers only
+    // forward to IPC and stay here.  Room was checked before the ack, a full ring is left to
+    // messages matching more handlers than a ring holds
+    rc = mqttDispatch_post(sub->handler, (mqttClient_msg_data_t*)context);
+    if (rc == LE_NO_MEMORY)
+    {
+      LE_WARN("dispatch full, handler runs on the I/O loop");
     }
+
+    if (rc != LE_OK)
+    {
+      sub->handler((mqttClient_msg_data_t*)context);
+    }
+
+    count++;
+  }
+
+  while (link)
+  {
+    mqttClient_subscriber_t* subscriber = CONTAINER_OF(link, mqttClient_subscriber_t, link);
+
+    link = le_dls_PeekNext(&sub->subscribers, link);
+    subscriber->handler((mqttClient_msg_data_t*)context, subscriber->context);
+    count++;
+  }
+
+  return count;
+}
+
+static int mqttClient_deliverMsg(mqttClient_t* clientData, MQTTString* topicName, mqttClient_msg_t* message)
+{
+  mqttClient_msg_data_t msgData;
+  const char* topic = NULL;
+  int topicLen = 0;
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+  LE_ASSERT(topicName);
+  LE_ASSERT(message);
+
+  if (topicName->cstring)
+  {
+    topic = topicName->cstring;
+    topicLen = strlen(topicName->cstring);
+  }
+  else
+  {
+    topic = topicName->lenstring.data;
+    topicLen = topicName->lenstring.len;
   }
-  else if (events & POLLIN)
+
+  // every matching filter gets its own callback, the default handler only sees unclaimed messages.
+  // Those arrive after an unsubscribe until the broker confirms it, and on a persistent session
+  // before the subscribers register again; without a default handler they are dropped, already acked
+  mqttClient_newMsgData(&msgData, topicName, message);
+  if (!MQTTTopic_match(clientData->topicTree, topic, topicLen, mqttClient_deliverSub, &msgData))
   {
-    const int packetType = MQTTPacket_read(
-        clientData->session.rx.buf, sizeof(clientData->session.rx.buf), mqttClient_read);
-    LE_DEBUG("packet type(%d)", packetType);
-    switch (packetType)
+    if (clientData->defaultMsgHndlr)
     {
-    case CONNACK:
-      rc = mqttClient_processConnAck(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processConnAck() failed(%d)", rc);
-        goto cleanup;
-      }
+      clientData->defaultMsgHndlr(&msgData);
+    }
+    else
+    {
+      LE_WARN("no handler for topic('%.*s'), message dropped", topicLen, topic);
+    }
+  }
 
-      break;
+  return rc;
+}
 
-    case PUBACK:
-      rc = mqttClient_processPubAck(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processPubAck() failed(%d)", rc);
-        goto cleanup;
-      }
+static int mqttClient_startSession(mqttClient_t* clientData)
+{
+  int rc = LE_OK;
 
-      break;
+  LE_ASSERT(clientData);
 
-    case SUBACK:
-      rc = mqttClient_processSubAck(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processSubAck() failed(%d)", rc);
-        goto cleanup;
-      }
+  memcpy(&clientData->session.config, &clientData->config, sizeof(clientData->config));
 
-      break;
+  clientData->session.connTimer = le_timer_Create(MQTT_CLIENT_CONNECT_TIMER);
+  if (!clientData->session.connTimer)
+  {
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
 
-    case UNSUBACK:
-      rc = mqttClient_processUnSubAck(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processUnSubAck() failed(%d)", rc);
-        goto cleanup;
-      }
+  rc = le_timer_SetHandler(clientData->session.connTimer, mqttClient_connExpiryHndlr);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
+    goto cleanup;
+  }
 
-      break;
+  rc = le_timer_SetMsInterval(clientData->session.connTimer, MQTT_CLIENT_CONNECT_TIMEOUT_MS);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    goto cleanup;
+  }  
 
-    case PUBLISH:
-      rc = mqttClient_processPublish(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processPublish() failed(%d)", rc);
-        goto cleanup;
-      }
+  rc = le_timer_SetContextPtr(clientData->session.connTimer, clientData);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
 
-      break;
-    
-    case PUBREC:
-      rc = mqttClient_processPubRec(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processPubRec() failed(%d)", rc);
-        goto cleanup;
-      }
-  
-      break;
-    
-    case PUBCOMP:
-      rc = mqttClient_processPubComp(clientData);
-      if (rc)
-      {
-        LE_ERROR("mqttClient_processPubComp() failed(%d)", rc);
-        goto cleanup;
-      }
+  clientData->session.cmdTimer = le_timer_Create(MQTT_CLIENT_COMMAND_TIMER);
+  if (!clientData->session.cmdTimer)
+  {
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
 
-      break;
+  rc = le_timer_SetHandler(clientData->session.cmdTimer, mqttClient_cmdExpiryHndlr);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
+    goto cleanup;
+  }
 
-    case PINGRESP:
-      mqttClient_processPingResp(clientData);
-      break;
+  rc = le_timer_SetMsInterval(clientData->session.cmdTimer, MQTT_CLIENT_CMD_TIMEOUT_MS);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    goto cleanup;
+  }  
+
+  rc = le_timer_SetContextPtr(clientData->session.cmdTimer, clientData);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
 
-    default:
-      LE_ERROR("unknown packet type(%u)", packetType);
-      break;
-    }
+  clientData->session.pingTimer = le_timer_Create(MQTT_CLIENT_PING_TIMER);
+  if (!clientData->session.pingTimer)
+  {
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
 
-    clientData->session.cmdRetries = 0;
+  rc = le_timer_SetHandler(clientData->session.pingTimer, mqttClient_pingExpiryHndlr);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
+    goto cleanup;
   }
 
-cleanup:
-  return;
-}
+  rc = le_timer_SetMsInterval(clientData->session.pingTimer, clientData->session.config.keepAlive * 1000);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    goto cleanup;
+  }  
 
-static void mqttClient_dataConnectionStateHandler(const char* intfName, bool isConnected, void* contextPtr)
-{
-  mqttClient_t* clientData = (mqttClient_t*)contextPtr;
-  int32_t rc = LE_OK;
+  rc = le_timer_SetRepeat(clientData->session.pingTimer, 0);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetRepeat() failed(%d)", rc);
+    goto cleanup;
+  }  
 
-  LE_ASSERT(clientData);
+  rc = le_timer_SetContextPtr(clientData->session.pingTimer, clientData);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
 
-  LE_DEBUG("interface('%s') connected(%u)", intfName, isConnected);
-  if (isConnected)
+  clientData->session.inflightTimer = le_timer_Create(MQTT_CLIENT_INFLIGHT_TIMER);
+  if (!clientData->session.inflightTimer)
   {
-    if ((clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET) && !clientData->session.isConnected)
-    {
-      LE_INFO("starting session");           
-      rc = mqttClient_startSession(clientData);
-      if (rc)
-      {        
-        LE_ERROR("mqttClient_startSession() failed(%d)", rc);
-        goto cleanup;
-      }
-    }
-    else
-    {
-        LE_INFO("No ongoing MQTT Connection request");
-    }
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
   }
-  else
+
+  rc = le_timer_SetHandler(clientData->session.inflightTimer, mqttClient_inflightExpiryHndlr);
+  if (rc)
   {
-    LE_INFO("disconnected('%s')", intfName);
-    mqttClient_disconnectData(clientData);
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
+    goto cleanup;
   }
 
-cleanup:
+  rc = le_timer_SetContextPtr(clientData->session.inflightTimer, clientData);
   if (rc)
   {
-    int32_t err = mqttClient_disconnectData(clientData);
-    if (err)
-    {        
-      LE_ERROR("mqttClient_disconnectData() failed(%d)", err);
-    }
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
+
+  clientData->session.lingerTimer = le_timer_Create(MQTT_CLIENT_LINGER_TIMER);
+  if (!clientData->session.lingerTimer)
+  {
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
   }
 
-  return;
-}
+  rc = le_timer_SetHandler(clientData->session.lingerTimer, mqttClient_lingerExpiryHndlr);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
+    goto cleanup;
+  }
 
-static int mqttClient_connect(mqttClient_t* clientData)
-{
-  struct sockaddr_in address;
-  struct addrinfo *result = NULL;
-  struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};  
-  int rc = LE_OK;
+  rc = le_timer_SetMsInterval(clientData->session.lingerTimer, clientData->session.config.coalesceLingerMs ? clientData->session.config.coalesceLingerMs:1);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    goto cleanup;
+  }  
 
-  LE_ASSERT(clientData);
+  rc = le_timer_SetContextPtr(clientData->session.lingerTimer, clientData);
+  if (rc)
+  {
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
 
-  if (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET)
+  clientData->session.attemptTimer = le_timer_Create(MQTT_CLIENT_ATTEMPT_TIMER);
+  if (!clientData->session.attemptTimer)
   {
-    LE_WARN("socket already connected");
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
-  rc = getaddrinfo(clientData->session.config.brokerUrl, NULL, &hints, &result);
+  rc = le_timer_SetHandler(clientData->session.attemptTimer, mqttClient_attemptExpiryHndlr);
   if (rc)
   {
-    LE_ERROR("getaddrinfo() failed(%d)", rc);
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
     goto cleanup;
   }
-	
-  struct addrinfo* res = result;
-  while (res)
-  {
-    if (res->ai_family == AF_INET)
-    {
-      result = res;
-      break;
-    }
-			
-    res = res->ai_next;
-  }
 
-  if (result->ai_family == AF_INET)
+  rc = le_timer_SetMsInterval(clientData->session.attemptTimer, MQTT_CLIENT_CONNECT_ATTEMPT_DELAY_MS);
+  if (rc)
   {
-    address.sin_port = htons(clientData->session.config.portNumber);
-    address.sin_family = AF_INET;
-    address.sin_addr = ((struct sockaddr_in*)(result->ai_addr))->sin_addr;
-  }
-  else
+    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    goto cleanup;
+  }  
+
+  rc = le_timer_SetContextPtr(clientData->session.attemptTimer, clientData);
+  if (rc)
   {
-    LE_ERROR("find IP('%s') failed", clientData->session.config.brokerUrl);
-    rc = LE_FAULT;
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
     goto cleanup;
-  }
+  } 
 
-  clientData->session.sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-  if (clientData->session.sock == -1)
+  clientData->session.reconnectTimer = le_timer_Create(MQTT_CLIENT_RECONNECT_TIMER);
+  if (!clientData->session.reconnectTimer)
   {
-    LE_ERROR("socket() failed(%d)", errno);
-    rc = clientData->session.sock;
+    LE_ERROR("le_timer_Create() failed");
+    rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
-  clientData->session.sockFdMonitor = le_fdMonitor_Create(MQTT_CLIENT_SOCKET_MONITOR_NAME, clientData->session.sock, mqttClient_socketFdEventHandler, POLLIN | POLLOUT);
-  if (!clientData->session.sockFdMonitor)
+  rc = le_timer_SetHandler(clientData->session.reconnectTimer, mqttClient_reconnectExpiryHndlr);
+  if (rc)
   {
-    LE_ERROR("le_fdMonitor_Create() failed");
-    rc = LE_FAULT;
+    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
     goto cleanup;
   }
 
-  le_fdMonitor_SetContextPtr(clientData->session.sockFdMonitor, clientData);
-
-  clientData->session.tx.ptr = clientData->session.tx.buf;
-  clientData->session.rx.ptr = clientData->session.rx.buf;
-
-  rc = connect(clientData->session.sock, (struct sockaddr*)&address, sizeof(address));
-  if (rc == -1)
+  rc = le_timer_SetContextPtr(clientData->session.reconnectTimer, clientData);
+  if (rc)
   {
-    rc = le_timer_Start(clientData->session.connTimer);
-    if (rc)
-    {
-      LE_ERROR("le_timer_Start() failed(%d)", rc);
-      goto cleanup;
-    }
+    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    goto cleanup;
+  } 
 
-    if (errno != EINPROGRESS)
-    {
-      LE_ERROR("connect() failed(%d)", errno);
-      rc = LE_FAULT;
-      goto cleanup;
-    }
+  // publishes left over from a previous session are retransmitted once connected
+  mqttClient_inflightStartTimer(clientData);
 
-    LE_DEBUG("connecting('%s')", clientData->session.config.brokerUrl);
+  LE_INFO("connect(%s:%d)", clientData->session.config.brokerUrl, clientData->session.config.portNumber);
+  clientData->stats.consecutiveFailures = 0;
+  rc = mqttClient_connect(clientData); 
+  if (rc)
+  {
+    LE_ERROR("mqttClient_connect() failed(%d)", rc);
+    mqttClient_scheduleReconnect(clientData);
     rc = LE_OK;
-    goto cleanup;
   }
 
-  LE_DEBUG("connected('%s')", clientData->session.config.brokerUrl);
-
 cleanup:
-  freeaddrinfo(result);
-
-  if (rc && (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET))
+  if (rc)
   {
-    int err = mqttClient_close(clientData);
-    if (err)
-    {
-      LE_ERROR("mqttClient_close() failed(%d)", err);
-      goto cleanup;
-    }
+    LE_INFO("start session failed");
+    mqttClient_SendConnStateEvent(false, rc, -1);
   }
 
   return rc;
 }
 
-static int mqttClient_close(mqttClient_t* clientData)
+static int mqttClient_connectData(mqttClient_t* clientData)
 {
   int rc = LE_OK;
 
-  LE_ASSERT(clientData);
+  if (clientData->requestRef)
+  {
+    LE_ERROR("data connection request already exists");
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
 
-  if (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET)
+  clientData->requestRef = le_data_Request();
+  LE_INFO("requesting data connection(%p)", clientData->requestRef);
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_disconnectData(mqttClient_t* clientData)
+{
+  int rc = LE_OK;
+
+  if (!clientData->requestRef)
   {
-    le_fdMonitor_Delete(clientData->session.sockFdMonitor);
+    LE_ERROR("no data connection reference.");
+    goto cleanup;
+  }
+    
+  if (clientData->session.connState != MQTT_CLIENT_CONN_IDLE)
+  {
+    LE_INFO("Dispose MQTT resources.");
+    mqttClient_disconnect(clientData);
 
-    rc = close(clientData->session.sock);
-    if (rc == -1)
+    rc = mqttClient_close(clientData);
+    if (rc)
     {
-      LE_ERROR("close() failed(%d)", errno);
-      rc = LE_FAULT;
+      LE_ERROR("mqttClient_close() failed(%d)", rc);
       goto cleanup;
     }
-
-    clientData->session.sock = MQTT_CLIENT_INVALID_SOCKET;
-  }
-  else
-  {
-    LE_WARN("socket already closed");
   }
 
+  LE_INFO("releasing the data connection.");
+  le_data_Release(clientData->requestRef);
+  clientData->requestRef = NULL;
+  mqttClient_SendConnStateEvent(false, 0, 0);
+
 cleanup:
   return rc;
 }
 
-static int mqttClient_write(mqttClient_t* clientData, int length)
+static mqttClient_sub_t* mqttClient_subFind(mqttClient_t* clientData, const char* topicFilter)
 {
-  int bytes = length ? length:clientData->session.tx.bytesLeft;
-  le_result_t rc = LE_OK;
-
-  LE_ASSERT(clientData);
+  return MQTTTopic_find(clientData->topicTree, topicFilter);
+}
 
-  clientData->session.cmdLen = length;
+static mqttClient_sub_t* mqttClient_subAdd(mqttClient_t* clientData, const char* topicFilter)
+{
+  mqttClient_sub_t* sub = mqttClient_subFind(clientData, topicFilter);
+  int rc = 0;
 
-  if (clientData->session.sock == MQTT_CLIENT_INVALID_SOCKET)
+  if (sub)
   {
-    rc = mqttClient_connect(clientData);
-    if (rc)
-    {
-      LE_ERROR("mqttClient_connect() failed(%d)", errno);
-      rc = LE_IO_ERROR;
-      goto cleanup;
-    }
+    return sub;
   }
-  else
+
+  sub = le_mem_ForceAlloc(clientData->subPool);
+  memset(sub, 0, sizeof(*sub));
+  sub->link = LE_DLS_LINK_INIT;
+  sub->subscribers = LE_DLS_LIST_INIT;
+  strcpy(sub->topicFilter, topicFilter);
+  sub->state = MQTT_CLIENT_SUB_PENDING;
+
+  rc = MQTTTopic_add(clientData->topicTree, sub->topicFilter, sub);
+  if (rc != 1)
   {
-    while (bytes > 0)
-    {
-      mqttClient_dumpBuffer(clientData->session.tx.ptr, bytes);
-      int sent = write(clientData->session.sock, clientData->session.tx.ptr, bytes);
-      if (sent == -1)
-      {
-        if (errno == EAGAIN)
-        {
-          le_fdMonitor_Enable(clientData->session.sockFdMonitor, POLLOUT);
-          clientData->session.tx.bytesLeft = bytes;
-          LE_WARN("send blocked(%u)", clientData->session.tx.bytesLeft);
-          goto cleanup;
-        }
-        else
-        {
-          LE_ERROR("write() failed(%d)", errno);
-          rc = LE_IO_ERROR;
-          goto cleanup;
-        }
-      }
-      else
-      {
-        clientData->session.tx.ptr += sent;
-        bytes -= sent;
-      }
-    }
+    LE_ERROR("MQTTTopic_add('%s') failed(%d)", topicFilter, rc);
+    le_mem_Release(sub);
+    return NULL;
+  }
+
+  le_dls_Queue(&clientData->subList, &sub->link);
+  return sub;
+}
 
-    le_timer_Restart(clientData->session.pingTimer);
+static void mqttClient_subFree(mqttClient_t* clientData, mqttClient_sub_t* sub)
+{
+  MQTTTopic_remove(clientData->topicTree, sub->topicFilter, sub);
+  le_dls_Remove(&clientData->subList, &sub->link);
+  le_mem_Release(sub);
+}
 
-    clientData->session.tx.ptr = clientData->session.tx.buf;
-    clientData->session.rx.ptr = clientData->session.rx.buf;
+// drops the broker subscription once neither the client itself nor any subscriber wants the filter
+static void mqttClient_subRelease(mqttClient_t* clientData, mqttClient_sub_t* sub)
+{
+  if (sub->handler || !le_dls_IsEmpty(&sub->subscribers))
+  {
+    return;
   }
 
-cleanup:
-  return rc;
+  if (sub->state == MQTT_CLIENT_SUB_FAILED)
+  {
+    // the broker never accepted it
+    mqttClient_subFree(clientData, sub);
+  }
+  else if (sub->state != MQTT_CLIENT_SUB_UNSUBSCRIBING)
+  {
+    sub->state = MQTT_CLIENT_SUB_UNSUB_PENDING;
+  }
 }
 
-static char mqttClient_isTopicMatched(char* topicFilter, MQTTString* topicName)
+// a new network connection: whatever the broker did not keep has to be sent again
+static void mqttClient_subRestore(mqttClient_t* clientData, bool sessionPresent)
 {
-  char* curf = topicFilter;
-  char* curn = topicName->lenstring.data;
-  char* curn_end = curn + topicName->lenstring.len;
-    
-  // assume topic filter and name is in correct format
-  // # can only be at end
-  // + and # can only be next to separator
-  while (*curf && curn < curn_end)
+  le_dls_Link_t* link = le_dls_Peek(&clientData->subList);
+  int pending = 0;
+
+  clientData->session.cmdType = 0;
+  clientData->session.cmdSubCount = 0;
+
+  while (link)
   {
-    if (*curn == '/' && *curf != '/')
+    mqttClient_sub_t* sub = CONTAINER_OF(link, mqttClient_sub_t, link);
+
+    link = le_dls_PeekNext(&clientData->subList, link);
+
+    switch (sub->state)
+    {
+    case MQTT_CLIENT_SUB_SUBSCRIBED:
+      if (sessionPresent)
+      {
+        break;
+      }
+      /* FALLTHROUGH */
+    case MQTT_CLIENT_SUB_SUBSCRIBING:
+    case MQTT_CLIENT_SUB_FAILED:
+      sub->state = MQTT_CLIENT_SUB_PENDING;
       break;
 
-    if (*curf != '+' && *curf != '#' && *curf != *curn)
+    case MQTT_CLIENT_SUB_UNSUBSCRIBING:
+    case MQTT_CLIENT_SUB_UNSUB_PENDING:
+      if (sessionPresent)
+      {
+        sub->state = MQTT_CLIENT_SUB_UNSUB_PENDING;
+      }
+      else
+      {
+        mqttClient_subFree(clientData, sub);
+        continue;
+      }
       break;
 
-    if (*curf == '+')
-    {   
-      // skip until we meet the next separator, or end of string
-      char* nextpos = curn + 1;
-      while (nextpos < curn_end && *nextpos != '/') nextpos = ++curn + 1;
+    default:
+      break;
     }
-    else if (*curf == '#')
-      curn = curn_end - 1;    // skip until end of string
-        
-    curf++;
-      curn++;
-  };
-    
-  return (curn == curn_end) && (*curf == '\0');
+
+    pending += ((sub->state == MQTT_CLIENT_SUB_PENDING) || (sub->state == MQTT_CLIENT_SUB_UNSUB_PENDING));
+  }
+
+  LE_DEBUG("session present(%u) subscriptions to restore(%d)", sessionPresent, pending);
 }
 
-static int mqttClient_deliverMsg(mqttClient_t* clientData, MQTTString* topicName, mqttClient_msg_t* message)
+// packs every waiting filter that fits into a single SUBSCRIBE (or UNSUBSCRIBE) packet
+static int mqttClient_subSendNext(mqttClient_t* clientData)
 {
-  int i;
+  MQTTString topics[MQTT_CLIENT_SUBSCRIBE_BATCH_MAX];
+  int qos[MQTT_CLIENT_SUBSCRIBE_BATCH_MAX];
+  le_dls_Link_t* link = NULL;
+  size_t size = 2;
+  uint8_t waiting = MQTT_CLIENT_SUB_UNSUB_PENDING;
+  uint8_t sending = MQTT_CLIENT_SUB_UNSUBSCRIBING;
+  int count = 0;
+  int len = 0;
   int rc = LE_OK;
+  int i;
 
-  LE_ASSERT(clientData);
-  LE_ASSERT(topicName);
-  LE_ASSERT(message);
+  if (!clientData->session.isConnected || clientData->session.cmdType)
+  {
+    goto cleanup;
+  }
 
-  for (i = 0; i < MQTT_CLIENT_MAX_MESSAGE_HANDLERS; ++i)
+  // unsubscribes first, so a filter dropped and added again ends up subscribed
+  for (link = le_dls_Peek(&clientData->subList); link; link = le_dls_PeekNext(&clientData->subList, link))
   {
-    if ((clientData->msgHndlrs[i].topicFilter != 0) && 
-        (MQTTPacket_equals(topicName, (char*)clientData->msgHndlrs[i].topicFilter) || 
-         mqttClient_isTopicMatched((char*)clientData->msgHndlrs[i].topicFilter, topicName)))
+    if (CONTAINER_OF(link, mqttClient_sub_t, link)->state == waiting)
     {
-      if (clientData->msgHndlrs[i].fp != NULL)
-      {
-        mqttClient_msg_data_t msgData;
-        mqttClient_newMsgData(&msgData, topicName, message);
-        clientData->msgHndlrs[i].fp(&msgData);
-        goto cleanup;
-      }
+      break;
     }
   }
-    
-  mqttClient_msg_data_t msgData;
-  mqttClient_newMsgData(&msgData, topicName, message);
-  clientData->defaultMsgHndlr(&msgData);
-   
-cleanup:    
-  return rc;
-}
 
-static int mqttClient_startSession(mqttClient_t* clientData)
-{
-  int rc = LE_OK;
+  if (!link)
+  {
+    waiting = MQTT_CLIENT_SUB_PENDING;
+    sending = MQTT_CLIENT_SUB_SUBSCRIBING;
+  }
 
-  LE_ASSERT(clientData);
+  for (link = le_dls_Peek(&clientData->subList); link && (count < MQTT_CLIENT_SUBSCRIBE_BATCH_MAX); link = le_dls_PeekNext(&clientData->subList, link))
+  {
+    mqttClient_sub_t* sub = CONTAINER_OF(link, mqttClient_sub_t, link);
+    size_t filterSize = 2 + strlen(sub->topicFilter) + (sending == MQTT_CLIENT_SUB_SUBSCRIBING);
 
-  memcpy(&clientData->session.config, &clientData->config, sizeof(clientData->config));
+    if (sub->state != waiting)
+    {
+      continue;
+    }
 
-  clientData->session.connTimer = le_timer_Create(MQTT_CLIENT_CONNECT_TIMER);
-  if (!clientData->session.connTimer)
-  {
-    LE_ERROR("le_timer_Create() failed");
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    // the fixed header takes up to 5 bytes in front of the variable header and payload
+    if (size + filterSize > sizeof(clientData->session.tx.buf) - 5)
+    {
+      break;
+    }
+
+    size += filterSize;
+    topics[count].cstring = NULL;
+    topics[count].lenstring.data = sub->topicFilter;
+    topics[count].lenstring.len = strlen(sub->topicFilter);
+    qos[count] = sub->qos;
+    clientData->session.cmdSubs[count++] = sub;
   }
 
-  rc = le_timer_SetHandler(clientData->session.connTimer, mqttClient_connExpiryHndlr);
-  if (rc)
+  if (!count)
   {
-    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
     goto cleanup;
   }
 
-  rc = le_timer_SetMsInterval(clientData->session.connTimer, MQTT_CLIENT_CONNECT_TIMEOUT_MS);
-  if (rc)
+  clientData->session.cmdPacketId = mqttClient_getNextPacketId(clientData);
+  if (sending == MQTT_CLIENT_SUB_SUBSCRIBING)
   {
-    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
-    goto cleanup;
-  }  
-
-  rc = le_timer_SetContextPtr(clientData->session.connTimer, clientData);
-  if (rc)
+    len = MQTTSerialize_subscribe(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, clientData->session.cmdPacketId, count, topics, qos);
+    clientData->session.cmdType = SUBSCRIBE;
+  }
+  else
   {
-    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
-    goto cleanup;
-  } 
+    len = MQTTSerialize_unsubscribe(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, clientData->session.cmdPacketId, count, topics);
+    clientData->session.cmdType = UNSUBSCRIBE;
+  }
 
-  clientData->session.cmdTimer = le_timer_Create(MQTT_CLIENT_COMMAND_TIMER);
-  if (!clientData->session.cmdTimer)
+  if (len <= 0)
   {
-    LE_ERROR("le_timer_Create() failed");
+    LE_ERROR("MQTTSerialize_%s() failed(%d)", (sending == MQTT_CLIENT_SUB_SUBSCRIBING) ? "subscribe":"unsubscribe", len);
+    clientData->session.cmdType = 0;
     rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
-  rc = le_timer_SetHandler(clientData->session.cmdTimer, mqttClient_cmdExpiryHndlr);
-  if (rc)
+  for (i = 0; i < count; i++)
   {
-    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
-    goto cleanup;
+    clientData->session.cmdSubs[i]->state = sending;
   }
 
-  rc = le_timer_SetMsInterval(clientData->session.cmdTimer, MQTT_CLIENT_CMD_TIMEOUT_MS);
+  clientData->session.cmdSubCount = count;
+  LE_INFO("<--- %s filters(%d) packet ID(%u)", (sending == MQTT_CLIENT_SUB_SUBSCRIBING) ? "SUBSCRIBE":"UNSUBSCRIBE", count, clientData->session.cmdPacketId);
+
+  rc = mqttClient_writeCmd(clientData, len);
   if (rc)
   {
-    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
-    goto cleanup;
-  }  
+    LE_ERROR("mqttClient_writeCmd() failed(%d)", rc); 
+    goto cleanup;             
+  }
 
-  rc = le_timer_SetContextPtr(clientData->session.cmdTimer, clientData);
+  rc = le_timer_Start(clientData->session.cmdTimer);
   if (rc)
   {
-    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
+    LE_ERROR("le_timer_Start() failed(%d)", rc);
     goto cleanup;
-  } 
+  }
 
-  clientData->session.pingTimer = le_timer_Create(MQTT_CLIENT_PING_TIMER);
-  if (!clientData->session.pingTimer)
+cleanup:
+  return rc;
+}
+
+int mqttClient_subscribeMany(mqttClient_t* clientData, const char* const* topicFilters, const mqttClient_QoS_e* qos, int count,
+    mqttClient_msgHndlr_f messageHandler)
+{
+  int rc = LE_OK;
+  int i;
+
+  LE_ASSERT(clientData);
+  LE_ASSERT(topicFilters);
+  LE_ASSERT(qos);
+
+  for (i = 0; i < count; i++)
   {
-    LE_ERROR("le_timer_Create() failed");
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    if (!topicFilters[i] || (strlen(topicFilters[i]) > MQTT_CLIENT_TOPIC_NAME_LEN) || !MQTTTopic_isValidFilter(topicFilters[i]) ||
+        (qos[i] > MQTT_CLIENT_QOS2))
+    {
+      LE_ERROR("invalid topic filter(%d)", i);
+      rc = LE_BAD_PARAMETER;
+      goto cleanup;
+    }
   }
 
-  rc = le_timer_SetHandler(clientData->session.pingTimer, mqttClient_pingExpiryHndlr);
-  if (rc)
+  // filters are recorded even while offline, they go out with the restore after the next CONNACK
+  for (i = 0; i < count; i++)
   {
-    LE_ERROR("le_timer_SetHandler() failed(%d)", rc);
-    goto cleanup;
+    mqttClient_sub_t* sub = mqttClient_subAdd(clientData, topicFilters[i]);
+
+    if (!sub)
+    {
+      LE_ERROR("mqttClient_subAdd('%s') failed", topicFilters[i]);
+      rc = LE_NO_MEMORY;
+      goto cleanup;
+    }
+
+    if (((sub->state != MQTT_CLIENT_SUB_SUBSCRIBED) && (sub->state != MQTT_CLIENT_SUB_SUBSCRIBING)) || (sub->qos != qos[i]))
+    {
+      sub->state = MQTT_CLIENT_SUB_PENDING;
+    }
+
+    sub->qos = qos[i];
+    sub->handler = messageHandler;
   }
 
-  rc = le_timer_SetMsInterval(clientData->session.pingTimer, clientData->session.config.keepAlive * 1000);
+  rc = mqttClient_subSendNext(clientData);
   if (rc)
   {
-    LE_ERROR("le_timer_SetMsInterval() failed(%d)", rc);
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
     goto cleanup;
-  }  
+  }
 
-  rc = le_timer_SetRepeat(clientData->session.pingTimer, 0);
-  if (rc)
-  {
-    LE_ERROR("le_timer_SetRepeat() failed(%d)", rc);
-    goto cleanup;
-  }  
+cleanup:
+  return rc;
+}
 
-  rc = le_timer_SetContextPtr(clientData->session.pingTimer, clientData);
-  if (rc)
-  {
-    LE_ERROR("le_timer_SetContextPtr() failed(%d)", rc);
-    goto cleanup;
-  } 
+int mqttClient_unsubscribeMany(mqttClient_t* clientData, const char* const* topicFilters, int count)
+{
+  int rc = LE_OK;
+  int i;
 
-  LE_INFO("connect(%s:%d)", clientData->session.config.brokerUrl, clientData->session.config.portNumber);
-  rc = mqttClient_connect(clientData); 
-  if (rc)
+  LE_ASSERT(clientData);
+  LE_ASSERT(topicFilters);
+
+  for (i = 0; i < count; i++)
   {
-    LE_ERROR("mqttClient_connect() failed(%d)", rc);
-    goto cleanup;
+    mqttClient_sub_t* sub = topicFilters[i] ? mqttClient_subFind(clientData, topicFilters[i]):NULL;
+
+    if (!sub)
+    {
+      LE_WARN("not subscribed('%s')", topicFilters[i] ? topicFilters[i]:"");
+      continue;
+    }
+
+    sub->handler = NULL;
+    mqttClient_subRelease(clientData, sub);
   }
 
-cleanup:
+  rc = mqttClient_subSendNext(clientData);
   if (rc)
   {
-    LE_INFO("start session failed");
-    mqttClient_SendConnStateEvent(false, rc, -1);
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
+    goto cleanup;
   }
 
+cleanup:
   return rc;
 }
 
-static int mqttClient_connectData(mqttClient_t* clientData)
+mqttClient_subscriber_t* mqttClient_addSubscriber(mqttClient_t* clientData, const char* topicFilter, mqttClient_QoS_e qos,
+    mqttClient_subscriberHndlr_f messageHandler, void* context)
 {
+  mqttClient_subscriber_t* subscriber = NULL;
+  mqttClient_sub_t* sub = NULL;
+  bool live = false;
   int rc = LE_OK;
 
-  if (clientData->requestRef)
+  LE_ASSERT(clientData);
+  LE_ASSERT(messageHandler);
+
+  if (!topicFilter || (strlen(topicFilter) > MQTT_CLIENT_TOPIC_NAME_LEN) || !MQTTTopic_isValidFilter(topicFilter) || (qos > MQTT_CLIENT_QOS2))
   {
-    LE_ERROR("data connection request already exists");
-    rc = LE_BAD_PARAMETER;
+    LE_ERROR("invalid topic filter('%s') QoS(%d)", topicFilter ? topicFilter:"", qos);
     goto cleanup;
   }
 
-  clientData->requestRef = le_data_Request();
-  LE_INFO("requesting data connection(%p)", clientData->requestRef);
+  sub = mqttClient_subAdd(clientData, topicFilter);
+  if (!sub)
+  {
+    LE_ERROR("mqttClient_subAdd('%s') failed", topicFilter);
+    goto cleanup;
+  }
+
+  subscriber = le_mem_ForceAlloc(clientData->subscriberPool);
+  subscriber->link = LE_DLS_LINK_INIT;
+  subscriber->sub = sub;
+  subscriber->handler = messageHandler;
+  subscriber->context = context;
+  le_dls_Queue(&sub->subscribers, &subscriber->link);
+
+  // only the first subscriber of a filter, or one asking for a higher QoS, reaches the broker
+  live = (sub->state == MQTT_CLIENT_SUB_PENDING) || (sub->state == MQTT_CLIENT_SUB_SUBSCRIBING) || (sub->state == MQTT_CLIENT_SUB_SUBSCRIBED);
+  if (!live || (qos > sub->qos))
+  {
+    sub->qos = (live && (sub->qos > qos)) ? sub->qos:qos;
+    sub->state = MQTT_CLIENT_SUB_PENDING;
+  }
+
+  LE_DEBUG("subscriber(%p) filter('%s') state(%u)", subscriber, topicFilter, sub->state);
+
+  rc = mqttClient_subSendNext(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
+  }
 
 cleanup:
-  return rc;
+  return subscriber;
 }
 
-int mqttClient_read(uint8_t* buf, int len)
+void mqttClient_removeSubscriber(mqttClient_t* clientData, mqttClient_subscriber_t* subscriber)
 {
-  mqttClient_t* clientData = mqttMain_getClient();
-  uint8_t* ptr = (clientData->session.rx.ptr != buf) ? buf:clientData->session.rx.ptr;
-  int bytes = 0;
-  int ret = LE_OK;
+  mqttClient_sub_t* sub = NULL;
+  int rc = LE_OK;
 
-  LE_ASSERT(buf);
+  LE_ASSERT(clientData);
+  LE_ASSERT(subscriber);
 
-  while (bytes < len)
-  {
-    LE_DEBUG("read(%u)", len - bytes);
-    ret = recv(clientData->session.sock, ptr, len - bytes, 0);
-    if (ret == -1)
-    {
-      if (errno != EAGAIN)
-      {
-        LE_ERROR("recv() failed(%d)", errno);
-        bytes = ret;
-        goto cleanup;
-      }
-      else
-      {
-        if (clientData->session.rx.ptr != buf)
-        {
-         clientData->session.rx.ptr = ptr;
-         clientData->session.rx.bytesLeft = len - bytes;
-         LE_WARN("read blocked(%u)", clientData->session.rx.bytesLeft);
-        }
-        else
-        {
-          LE_ERROR("read blocked(%u)", len - bytes);
-          bytes = ret;
-        }
+  sub = subscriber->sub;
+  LE_DEBUG("subscriber(%p) filter('%s')", subscriber, sub->topicFilter);
 
-        goto cleanup;
-      }
-    }
-    else if (ret == 0)
-    {
-      LE_WARN("peer closed connection");
-      bytes = ret;
-      ret = mqttClient_disconnectData(clientData);
-      if (ret)
-      {
-        LE_ERROR("mqttClient_disconnectData() failed(%d)", ret);
-	goto cleanup;
-      }
+  le_dls_Remove(&sub->subscribers, &subscriber->link);
+  le_mem_Release(subscriber);
 
-      goto cleanup;
-    }
-    else
-    {
-      mqttClient_dumpBuffer(ptr, ret);
-      ptr += ret;
-      bytes += ret;
-    }
+  mqttClient_subRelease(clientData, sub);
+
+  rc = mqttClient_subSendNext(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttClient_subSendNext() failed(%d)", rc);
   }
+}
 
-cleanup:
-  return bytes;
+int mqttClient_subscribe(mqttClient_t* clientData, const char* topicFilter, mqttClient_QoS_e qos, mqttClient_msgHndlr_f messageHandler)
+{ 
+  return mqttClient_subscribeMany(clientData, &topicFilter, &qos, 1, messageHandler);
 }
 
-int mqttClient_disconnectData(mqttClient_t* clientData)
+int mqttClient_unsubscribe(mqttClient_t* clientData, const char* topicFilter)
+{   
+  return mqttClient_unsubscribeMany(clientData, &topicFilter, 1);
+}
+
+static int mqttClient_publishBegin(mqttClient_t* clientData, const char* topicName, size_t topicLen, mqttClient_msg_t* message, bool* stored)
 {
   int rc = LE_OK;
 
-  if (!clientData->requestRef)
+  *stored = false;
+
+  // offline too: the store would keep what the drain can never send
+  if (MQTTPacket_len(topicLen + 4 + message->payloadLen) > mqttBuffer_getMaxSize())
   {
-    LE_ERROR("no data connection reference.");
+    LE_ERROR("payload too large(%zu)", message->payloadLen);
+    rc = LE_OVERFLOW;
     goto cleanup;
   }
-    
-  if (clientData->session.isConnected)
-  {
-    LE_INFO("Dispose MQTT resources.");
-    mqttClient_disconnect(clientData);
 
-    rc = mqttClient_close(clientData);
+  if (!clientData->session.isConnected)
+  {
+    // keep it on flash until the session is back, it is drained after the next CONNACK
+    rc = mqttStore_append(topicName, message->payload, message->payloadLen, message->qos, message->retained);
     if (rc)
     {
-      LE_ERROR("mqttClient_close() failed(%d)", rc);
+      LE_ERROR("mqttStore_append() failed(%d)", rc);
       goto cleanup;
     }
-  }
-
-  LE_INFO("releasing the data connection.");
-  le_data_Release(clientData->requestRef);
-  clientData->requestRef = NULL;
-  mqttClient_SendConnStateEvent(false, 0, 0);
-
-cleanup:
-  return rc;
-}
-
-int mqttClient_subscribe(mqttClient_t* clientData, const char* topicFilter, mqttClient_QoS_e qos, mqttClient_msgHndlr_f messageHandler)
-{ 
-  int rc = LE_OK;  
-    
-  LE_ASSERT(clientData);
-  LE_ASSERT(topicFilter);
 
-  if (!clientData->session.isConnected)
-  {
-    LE_WARN("not connected");
+    *stored = true;
     goto cleanup;
   }
 
-  MQTTString topic = MQTTString_initializer;
-  topic.cstring = (char *)topicFilter;
-  int len = MQTTSerialize_subscribe(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, mqttClient_getNextPacketId(clientData), 1, &topic, (int*)&qos);
-  if (len <= 0)
+  if (message->qos == MQTT_CLIENT_QOS1 || message->qos == MQTT_CLIENT_QOS2)
   {
-    LE_ERROR("MQTTSerialize_subscribe() failed(%d)", len);
-    rc = LE_BAD_PARAMETER;
-    goto cleanup;
+    if (clientData->session.inflightCount >= clientData->session.config.inflightWindow)
+    {
+      LE_WARN("in-flight window full(%u)", clientData->session.inflightCount);
+      rc = LE_BUSY;
+      goto cleanup;
+    }
+
+    message->id = mqttClient_getNextPacketId(clientData);
   }
 
-  int i;
-  for (i = 0; i < MQTT_CLIENT_MAX_MESSAGE_HANDLERS; ++i)
+cleanup:
+  return rc;
+}
+
+static int mqttClient_publishEnd(mqttClient_t* clientData, const struct iovec* iov, int iovcnt, mqttClient_msg_t* message)
+{
+  int rc = LE_OK;
+
+  if (message->qos == MQTT_CLIENT_QOS1 || message->qos == MQTT_CLIENT_QOS2)
   {
-    if (!clientData->msgHndlrs[i].topicFilter)
+    rc = mqttClient_inflightAdd(clientData, message->id, message->qos, iov, iovcnt);
+    if (rc)
     {
-      LE_DEBUG("call msg handler('%s')", topicFilter);
-      clientData->msgHndlrs[i].topicFilter = topicFilter;
-      clientData->msgHndlrs[i].fp = messageHandler;
-      break;
+      LE_ERROR("mqttClient_inflightAdd() failed(%d)", rc);
+      goto cleanup;
     }
   }
 
-  if (i == MQTT_CLIENT_MAX_MESSAGE_HANDLERS)
+  if (clientData->session.config.coalesceLingerMs)
   {
-    LE_ERROR("no empty msg handlers");
-    rc = LE_BAD_PARAMETER;
+    rc = mqttClient_writeCoalesced(clientData, iov, iovcnt);
   }
-
-  rc = mqttClient_write(clientData, len);
-  if (rc)
+  else
   {
-    LE_ERROR("mqttClient_write() failed(%d)", rc); 
-    goto cleanup;             
+    rc = mqttClient_writev(clientData, iov, iovcnt);
   }
 
-  rc = le_timer_Start(clientData->session.cmdTimer);
   if (rc)
   {
-    LE_ERROR("le_timer_Start() failed(%d)", rc);
+    LE_ERROR("mqttClient_writev() failed(%d)", rc);
     goto cleanup;
-  }
-        
+  } 
+  
 cleanup:
   return rc;
 }
 
-int mqttClient_unsubscribe(mqttClient_t* clientData, const char* topicFilter)
-{   
-  MQTTString topic = MQTTString_initializer;
+int mqttClient_publish(mqttClient_t* clientData, const char* topicName, mqttClient_msg_t* message)
+{
+  struct iovec iov[2];
   int rc = LE_OK;
-       
+  MQTTString topic = MQTTString_initializer;
+  topic.cstring = (char *)topicName;
+  bool stored = false;
+  int len = 0;
+
   LE_ASSERT(clientData);
 
-  if (!clientData->session.isConnected)
+  rc = mqttClient_publishBegin(clientData, topicName, MQTTstrlen(topic), message, &stored);
+  if (rc || stored)
   {
-    LE_WARN("not connected");
     goto cleanup;
   }
-    
-  topic.cstring = (char *)topicFilter;
-  int len = MQTTSerialize_unsubscribe(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, mqttClient_getNextPacketId(clientData), 1, &topic);
+
+  // only the header is serialized, the payload is written from the caller's buffer
+  len = MQTTSerialize_publishHeader(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, message->qos, 
+      message->retained, message->id, topic, message->payloadLen);
   if (len <= 0)
   {
-    LE_ERROR("MQTTSerialize_unsubscribe() failed(%d)", len);
+    LE_ERROR("MQTTSerialize_publishHeader() failed(%d)", len);
     rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
-  rc = mqttClient_write(clientData, len);
-  if (rc)
-  { 
-    LE_ERROR("mqttClient_write() failed(%d)", rc);
-    goto cleanup; 
+  iov[0].iov_base = clientData->session.tx.buf;
+  iov[0].iov_len = len;
+  iov[1].iov_base = (void*)message->payload;
+  iov[1].iov_len = message->payloadLen;
+
+  rc = mqttClient_publishEnd(clientData, iov, NUM_ARRAY_MEMBERS(iov), message);
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_prepareTopic(mqttClient_topic_t* topic, const char* topicName)
+{
+  MQTTString name = MQTTString_initializer;
+  int rc = LE_OK;
+
+  LE_ASSERT(topic);
+  LE_ASSERT(topicName);
+
+  topic->nameLen = strlen(topicName);
+  if (topic->nameLen > MQTT_CLIENT_TOPIC_NAME_LEN)
+  {
+    LE_ERROR("topic too long(%zu)", topic->nameLen);
+    rc = LE_OVERFLOW;
+    goto cleanup;
   }
- 
-  rc = le_timer_Start(clientData->session.cmdTimer);
-  if (rc)
+
+  memcpy(topic->name, topicName, topic->nameLen + 1);
+  name.lenstring.data = topic->name;
+  name.lenstring.len = topic->nameLen;
+
+  topic->tmplLen = MQTTSerialize_publishTemplate(topic->tmpl, sizeof(topic->tmpl), name);
+  if (topic->tmplLen <= 0)
   {
-    LE_ERROR("le_timer_Start() failed(%d)", rc);
+    LE_ERROR("MQTTSerialize_publishTemplate() failed(%d)", topic->tmplLen);
+    rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
+  LE_DEBUG("prepared topic('%s') template(%d)", topic->name, topic->tmplLen);
+
 cleanup:
   return rc;
 }
 
-int mqttClient_publish(mqttClient_t* clientData, const char* topicName, mqttClient_msg_t* message)
+int mqttClient_publishPrepared(mqttClient_t* clientData, mqttClient_topic_t* topic, mqttClient_msg_t* message)
 {
+  unsigned char* packed = NULL;
+  mqttClient_msg_t compressed;
+  struct iovec iov[2];
+  unsigned char* hdr = NULL;
+  bool stored = false;
+  size_t packedLen;
   int rc = LE_OK;
-  MQTTString topic = MQTTString_initializer;
-  topic.cstring = (char *)topicName;
   int len = 0;
 
   LE_ASSERT(clientData);
+  LE_ASSERT(topic);
 
-  if (!clientData->session.isConnected)
+  // before the store, so what waits on flash is the compressed payload too.  Deflate gives up one
+  // byte short of the payload, which is all the room it needs; the store and the in-flight table
+  // copy what they keep, so the buffer only lives until the packet is written
+  if (topic->compress && (message->payloadLen > 1) && ((packed = mqttBuffer_alloc(message->payloadLen - 1)) != NULL) &&
+      !mqttCompress_deflate(message->payload, message->payloadLen, packed, message->payloadLen - 1, &packedLen))
   {
-    LE_WARN("not connected");
-    goto cleanup;
+    LE_DEBUG("topic('%s') compressed(%zu -> %zu)", topic->name, message->payloadLen, packedLen);
+    compressed = *message;
+    compressed.payload = (const char*)packed;
+    compressed.payloadLen = packedLen;
+    message = &compressed;
   }
 
-  if (message->qos == MQTT_CLIENT_QOS1 || message->qos == MQTT_CLIENT_QOS2)
-    message->id = mqttClient_getNextPacketId(clientData);
+  rc = mqttClient_publishBegin(clientData, topic->name, topic->nameLen, message, &stored);
+  if (rc || stored)
+  {
+    goto cleanup;
+  }
 
-  len = MQTTSerialize_publish(clientData->session.tx.buf, sizeof(clientData->session.tx.buf), 0, message->qos, 
-      message->retained, message->id, topic, (unsigned char*)message->payload, message->payloadLen);
+  // the topic is already serialized, only the fixed header and packet ID change per message
+  len = MQTTSerialize_publishPrepared(topic->tmpl, topic->tmplLen, 0, message->qos, message->retained, message->id,
+      message->payloadLen, &hdr);
   if (len <= 0)
   {
-    LE_ERROR("MQTTSerialize_publish() failed(%d)", len);
+    LE_ERROR("MQTTSerialize_publishPrepared() failed(%d)", len);
     rc = LE_BAD_PARAMETER;
     goto cleanup;
   }
 
-  rc = mqttClient_write(clientData, len);
-  if (rc)
-  {
-    LE_ERROR("mqttClient_write() failed(%d)", rc);
-    goto cleanup;
-  } 
-  
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = len;
+  iov[1].iov_base = (void*)message->payload;
+  iov[1].iov_len = message->payloadLen;
+
+  rc = mqttClient_publishEnd(clientData, iov, NUM_ARRAY_MEMBERS(iov), message);
+
 cleanup:
+  mqttBuffer_release(packed);
   return rc;
 }
 
+void mqttClient_msgRetain(mqttClient_msg_t* message)
+{
+  LE_ASSERT(message);
+  LE_ASSERT(message->slot);
+
+  mqttBuffer_addRef(message->slot);
+}
+
+void mqttClient_msgRelease(mqttClient_msg_t* message)
+{
+  LE_ASSERT(message);
+
+  mqttBuffer_release(message->slot);
+  message->slot = NULL;
+}
+
 int mqttClient_disconnect(mqttClient_t* clientData)
 {  
   int rc = LE_OK;
 
   LE_ASSERT(clientData);
 
+  // from here on a lost connection is final
+  clientData->session.connState = MQTT_CLIENT_CONN_IDLE;
+
+  if (le_timer_IsRunning(clientData->session.reconnectTimer))
+  {
+    rc = le_timer_Stop(clientData->session.reconnectTimer);
+    if (rc)
+    {
+      LE_ERROR("le_timer_Stop() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
   if (le_timer_IsRunning(clientData->session.connTimer))
   {
     rc = le_timer_Stop(clientData->session.connTimer);
@@ -1633,24 +3554,61 @@ int mqttClient_disconnect(mqttClient_t* clientData)
     }
   }
 
-  rc = le_timer_Stop(clientData->session.pingTimer);
-  if (rc)
+  if (le_timer_IsRunning(clientData->session.pingTimer))
   {
-    LE_ERROR("le_timer_Stop() failed(%d)", rc);
-    goto cleanup;
+    rc = le_timer_Stop(clientData->session.pingTimer);
+    if (rc)
+    {
+      LE_ERROR("le_timer_Stop() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
+  if (le_timer_IsRunning(clientData->session.inflightTimer))
+  {
+    rc = le_timer_Stop(clientData->session.inflightTimer);
+    if (rc)
+    {
+      LE_ERROR("le_timer_Stop() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
+  if (le_timer_IsRunning(clientData->session.lingerTimer))
+  {
+    rc = le_timer_Stop(clientData->session.lingerTimer);
+    if (rc)
+    {
+      LE_ERROR("le_timer_Stop() failed(%d)", rc);
+      goto cleanup;
+    }
   }
 
   int len = MQTTSerialize_disconnect(clientData->session.tx.buf, sizeof(clientData->session.tx.buf));
-  if (len > 0)
+  if ((len > 0) && (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET))
   {
     rc = mqttClient_write(clientData, len); 
     if (rc)
     {
-      LE_ERROR("mqttClient_write() failed(%d)", rc);
-      goto cleanup;
+      // the session is torn down regardless
+      LE_WARN("mqttClient_write() failed(%d)", rc);
+      rc = LE_OK;
     }           
   }
       
+  // a connect still racing must not outlive its timers
+  mqttClient_attemptsAbort(clientData);
+  mqttStore_stopDrain();
+  mqttStore_sync();
+  mqttSession_flush(clientData);
+  le_timer_Delete(clientData->session.reconnectTimer);
+  clientData->session.reconnectTimer = NULL;
+  le_timer_Delete(clientData->session.attemptTimer);
+  clientData->session.attemptTimer = NULL;
+  le_timer_Delete(clientData->session.lingerTimer);
+  clientData->session.lingerTimer = NULL;
+  le_timer_Delete(clientData->session.inflightTimer);
+  clientData->session.inflightTimer = NULL;
   le_timer_Delete(clientData->session.pingTimer);
   le_timer_Delete(clientData->session.cmdTimer);
   le_timer_Delete(clientData->session.connTimer);
@@ -1695,27 +3653,251 @@ cleanup:
   return rc;
 }
 
+int mqttClient_setInflightWindow(mqttClient_t* clientData, uint32_t windowSize)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if ((windowSize == 0) || (windowSize > MQTT_CLIENT_INFLIGHT_WINDOW_MAX))
+  {
+    LE_ERROR("invalid in-flight window(%u)", windowSize);
+    rc = LE_OUT_OF_RANGE;
+    goto cleanup;
+  }
+
+  LE_INFO("in-flight window(%u -> %u)", clientData->config.inflightWindow, windowSize);
+  clientData->config.inflightWindow = windowSize;
+  clientData->session.config.inflightWindow = windowSize;
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_setCoalescing(mqttClient_t* clientData, uint32_t lingerMs, uint32_t maxBytes)
+{
+  LE_ASSERT(clientData);
+
+  if (maxBytes == 0)
+  {
+    maxBytes = MQTT_CLIENT_COALESCE_MAX_BYTES_DEFAULT;
+  }
+
+  LE_INFO("coalescing linger(%u -> %u ms) max bytes(%u -> %u)", clientData->config.coalesceLingerMs, lingerMs,
+      clientData->config.coalesceMaxBytes, maxBytes);
+  clientData->config.coalesceLingerMs = lingerMs;
+  clientData->config.coalesceMaxBytes = maxBytes;
+  clientData->session.config.coalesceLingerMs = lingerMs;
+  clientData->session.config.coalesceMaxBytes = maxBytes;
+
+  if (clientData->session.lingerTimer)
+  {
+    if (le_timer_IsRunning(clientData->session.lingerTimer))
+    {
+      le_timer_Stop(clientData->session.lingerTimer);
+      if (clientData->session.sock != MQTT_CLIENT_INVALID_SOCKET)
+      {
+        mqttClient_txFlush(clientData);
+      }
+    }
+
+    le_timer_SetMsInterval(clientData->session.lingerTimer, lingerMs ? lingerMs:1);
+  }
+
+  return LE_OK;
+}
+
+int mqttClient_setDnsCacheTtl(mqttClient_t* clientData, uint32_t ttlSec)
+{
+  LE_ASSERT(clientData);
+
+  mqttResolver_setCacheTtl(ttlSec);
+  return LE_OK;
+}
+
+int mqttClient_setReconnectBackoff(mqttClient_t* clientData, uint32_t baseMs, uint32_t capMs)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if (!baseMs || (capMs < baseMs))
+  {
+    LE_ERROR("invalid reconnect backoff(%u, %u)", baseMs, capMs);
+    rc = LE_BAD_PARAMETER;
+    goto cleanup;
+  }
+
+  LE_INFO("reconnect backoff(%u..%u -> %u..%u ms)", clientData->config.reconnectBaseMs, clientData->config.reconnectCapMs, baseMs, capMs);
+  clientData->config.reconnectBaseMs = baseMs;
+  clientData->config.reconnectCapMs = capMs;
+  clientData->session.config.reconnectBaseMs = baseMs;
+  clientData->session.config.reconnectCapMs = capMs;
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_setPersistentSession(mqttClient_t* clientData, bool enable)
+{
+  LE_ASSERT(clientData);
+
+  return mqttSession_enable(clientData, enable);
+}
+
+int mqttClient_setStoreDrainRate(mqttClient_t* clientData, uint32_t msgsPerSec)
+{
+  LE_ASSERT(clientData);
+
+  mqttStore_setDrainRate(msgsPerSec);
+  return LE_OK;
+}
+
+int mqttClient_setDispatchWorkers(mqttClient_t* clientData, uint32_t workers)
+{
+  LE_ASSERT(clientData);
+  return mqttDispatch_start(workers, clientData->ioThread, mqttClient_rxResume, clientData);
+}
+
+int mqttClient_setPayloadEncoding(mqttClient_t* clientData, uint32_t encoding)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if (encoding > MQTT_CLIENT_PAYLOAD_CBOR)
+  {
+    LE_ERROR("invalid payload encoding(%u)", encoding);
+    rc = LE_OUT_OF_RANGE;
+    goto cleanup;
+  }
+
+  LE_INFO("payload encoding(%u -> %u)", clientData->config.payloadEncoding, encoding);
+  clientData->config.payloadEncoding = encoding;
+  clientData->session.config.payloadEncoding = encoding;
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_setCompression(mqttClient_t* clientData, uint32_t topics, uint32_t minBytes)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  if (topics & ~(MQTT_CLIENT_COMPRESS_MESSAGES | MQTT_CLIENT_COMPRESS_ACKS))
+  {
+    LE_ERROR("invalid compressed topics(0x%x)", topics);
+    rc = LE_OUT_OF_RANGE;
+    goto cleanup;
+  }
+
+  if (minBytes == 0)
+  {
+    minBytes = MQTT_COMPRESS_MIN_BYTES_DEFAULT;
+  }
+
+  // the stream is only allocated once something is to be compressed
+  if (topics)
+  {
+    rc = mqttCompress_init();
+    if (rc)
+    {
+      LE_ERROR("mqttCompress_init() failed(%d)", rc);
+      goto cleanup;
+    }
+  }
+
+  LE_INFO("compressed topics(0x%x -> 0x%x)", clientData->config.compressTopics, topics);
+  mqttCompress_setMinBytes(minBytes);
+  clientData->config.compressTopics = topics;
+  clientData->config.compressMinBytes = minBytes;
+  clientData->session.config.compressTopics = topics;
+  clientData->session.config.compressMinBytes = minBytes;
+  clientData->publishTopic.compress = !!(topics & MQTT_CLIENT_COMPRESS_MESSAGES);
+  clientData->ackTopic.compress = !!(topics & MQTT_CLIENT_COMPRESS_ACKS);
+
+cleanup:
+  return rc;
+}
+
+int mqttClient_setMaxPacketSize(mqttClient_t* clientData, uint32_t maxPacketSize)
+{
+  LE_ASSERT(clientData);
+  return mqttBuffer_setMaxSize(maxPacketSize);
+}
+
 void mqttClient_init(mqttClient_t* clientData)
 {
+  char topic[MQTT_CLIENT_TOPIC_NAME_LEN + 1];
+  int i;
+
   LE_ASSERT(clientData);
 
   memset(clientData, 0, sizeof(mqttClient_t));
   clientData->session.tx.ptr = clientData->session.tx.buf;
-  clientData->session.rx.ptr = clientData->session.rx.buf;
 
   clientData->session.sock = MQTT_CLIENT_INVALID_SOCKET;
+  for (i = 0; i < MQTT_CLIENT_CONNECT_MAX_ATTEMPTS; i++)
+  {
+    clientData->session.attempts[i].sock = MQTT_CLIENT_INVALID_SOCKET;
+  }
+
   strcpy(clientData->config.brokerUrl, MQTT_CLIENT_URL_AIRVANTAGE_SERVER);
   clientData->config.portNumber = MQTT_CLIENT_PORT_AIRVANTAGE_SERVER;
 
   clientData->config.keepAlive = MQTT_CLIENT_PING_TIMEOUT_MS;
   clientData->config.QoS = MQTT_CLIENT_DEFAULT_QOS;
+  clientData->config.inflightWindow = MQTT_CLIENT_INFLIGHT_WINDOW_DEFAULT;
+  clientData->config.coalesceMaxBytes = MQTT_CLIENT_COALESCE_MAX_BYTES_DEFAULT;
+  clientData->config.reconnectBaseMs = MQTT_CLIENT_RECONNECT_BASE_MS;
+  clientData->config.reconnectCapMs = MQTT_CLIENT_RECONNECT_CAP_MS;
+
+  mqttBuffer_init();
+  mqttResolver_init();
+  mqttSession_init(clientData);
+  if (mqttStore_init())
+  {
+    LE_ERROR("offline store unavailable, publishes while disconnected are lost");
+  }
+  clientData->session.txPool = le_mem_CreatePool(MQTT_CLIENT_TX_POOL, sizeof(mqttClient_txPacket_t));
+  clientData->session.txQueue = LE_DLS_LIST_INIT;
+  clientData->subPool = le_mem_CreatePool(MQTT_CLIENT_SUB_POOL, sizeof(mqttClient_sub_t));
+  clientData->subList = LE_DLS_LIST_INIT;
+  clientData->subscriberPool = le_mem_CreatePool(MQTT_CLIENT_SUBSCRIBER_POOL, sizeof(mqttClient_subscriber_t));
+  clientData->topicTree = MQTTTopic_create();
+  LE_ASSERT(clientData->topicTree);
 
   clientData->connStateEvent = le_event_CreateId("MqttConnState", sizeof(mqttClient_connStateData_t));
   clientData->inMsgEvent = le_event_CreateId("MqttInMsg", sizeof(mqttClient_inMsg_t));
+  clientData->commandEvent = le_event_CreateIdWithRefCounting("MqttCommand");
+  clientData->ioThread = le_thread_GetCurrent();
+  clientData->commandPool = le_mem_CreatePool(MQTT_CLIENT_COMMAND_POOL, sizeof(mqttClient_command_t));
 
   le_info_ConnectService();
   le_info_GetImei(clientData->deviceId, sizeof(clientData->deviceId));
   LE_DEBUG("IMEI('%s')", clientData->deviceId);
   sprintf(clientData->subscribeTopic, "%s%s", clientData->deviceId, MQTT_CLIENT_TOPIC_NAME_SUBSCRIBE);
+
+  // the device topics never change, serialize them once
+  snprintf(topic, sizeof(topic), "%s%s", clientData->deviceId, MQTT_CLIENT_TOPIC_NAME_PUBLISH);
+  if (mqttClient_prepareTopic(&clientData->publishTopic, topic))
+  {
+    LE_ERROR("mqttClient_prepareTopic('%s') failed", topic);
+  }
+
+  snprintf(topic, sizeof(topic), "%s%s", clientData->deviceId, MQTT_CLIENT_TOPIC_NAME_ACK);
+  if (mqttClient_prepareTopic(&clientData->ackTopic, topic))
+  {
+    LE_ERROR("mqttClient_prepareTopic('%s') failed", topic);
+  }
+
+  // devices powered up together must still pick different backoff delays
+  clientData->session.backoffSeed = le_clk_GetAbsoluteTime().usec ^ getpid();
+  for (i = 0; clientData->deviceId[i]; i++)
+  {
+    clientData->session.backoffSeed = clientData->session.backoffSeed * 31 + clientData->deviceId[i];
+  }
 }
 
@@ -0,0 +1,135 @@
+/**
+ * @file
+ *
+ * Deflate with a preset dictionary for outbound payloads.
+ *
+ * One zlib stream is kept for the life of the process and reset for every payload, so its window
+ * and hash tables (about 32 KB with the window and memory levels below) are allocated once, on the
+ * first enable.  The dictionary is loaded again after each reset: deflate only refers back into
+ * it, nothing is carried over from one payload to the next, and every payload inflates on its own.
+ * Only the I/O thread publishes, the stream is not locked.
+ *
+ * The dictionary holds the strings the device keeps sending: record keys, the list and timestamp
+ * shapes of the serializers, and the acks.  The most frequent ones come last, where references
+ * are shortest.  It is part of the wire format: a receiver needs the same bytes to inflate.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <zlib.h>
+
+#include "legato.h"
+#include "interfaces.h"
+#include "mqttCompress.h"
+
+static const char mqttCompress_dictionary[] =
+  "{\"temperature\":\"\",\"humidity\":\"\",\"pressure\":\"\",\"battery\":\"\",\"counter\":\"\",\"status\":\"running\"}"
+  "{\"temperature\":[{\"timestamp\":1500000000000,\"value\":\"0.00\"},{\"timestamp\":null,\"value\":\""
+  "\"},{\"timestamp\":1500000000000,\"value\":\"\"}]}"
+  ",\"message\":\"\",\"status\":\"ERROR\"}]"
+  "[{\"uid\":\"\",\"status\":\"OK\"}]";
+
+static z_stream mqttCompress_stream;
+static bool mqttCompress_ready;
+static uint32_t mqttCompress_minBytes = MQTT_COMPRESS_MIN_BYTES_DEFAULT;
+static uint32_t mqttCompress_compressed;
+static uint32_t mqttCompress_uncompressed;
+static uint64_t mqttCompress_bytesIn;
+static uint64_t mqttCompress_bytesOut;
+static uint64_t mqttCompress_cpuNs;
+
+static uint64_t mqttCompress_cpuTime(void);
+
+static uint64_t mqttCompress_cpuTime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int mqttCompress_init(void)
+{
+  int rc = LE_OK;
+
+  if (mqttCompress_ready)
+  {
+    goto cleanup;
+  }
+
+  memset(&mqttCompress_stream, 0, sizeof(mqttCompress_stream));
+  rc = deflateInit2(&mqttCompress_stream, MQTT_COMPRESS_LEVEL, Z_DEFLATED, MQTT_COMPRESS_WINDOW_BITS,
+      MQTT_COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+  if (rc != Z_OK)
+  {
+    LE_ERROR("deflateInit2() failed(%d)", rc);
+    rc = LE_FAULT;
+    goto cleanup;
+  }
+
+  LE_INFO("compression dictionary(%zu bytes) id(0x%08lx)", sizeof(mqttCompress_dictionary) - 1,
+      adler32(adler32(0, NULL, 0), (const Bytef*)mqttCompress_dictionary, sizeof(mqttCompress_dictionary) - 1));
+  mqttCompress_ready = true;
+  rc = LE_OK;
+
+cleanup:
+  return rc;
+}
+
+void mqttCompress_setMinBytes(uint32_t minBytes)
+{
+  LE_INFO("compression threshold(%u -> %u bytes)", mqttCompress_minBytes, minBytes);
+  mqttCompress_minBytes = minBytes;
+}
+
+// LE_NOT_POSSIBLE when the payload is better sent as it is: under the threshold, or not made smaller
+int mqttCompress_deflate(const void* data, size_t dataLen, void* out, size_t outSize, size_t* outLen)
+{
+  uint64_t start;
+  int rc = LE_OK;
+
+  if (!mqttCompress_ready || !dataLen || (dataLen < mqttCompress_minBytes))
+  {
+    return LE_NOT_POSSIBLE;
+  }
+
+  start = mqttCompress_cpuTime();
+
+  deflateReset(&mqttCompress_stream);
+  deflateSetDictionary(&mqttCompress_stream, (const Bytef*)mqttCompress_dictionary, sizeof(mqttCompress_dictionary) - 1);
+
+  // an output buffer one byte short of the payload stops deflate as soon as it cannot win
+  mqttCompress_stream.next_in = (Bytef*)data;
+  mqttCompress_stream.avail_in = dataLen;
+  mqttCompress_stream.next_out = out;
+  mqttCompress_stream.avail_out = (outSize < dataLen) ? outSize:dataLen - 1;
+
+  if (deflate(&mqttCompress_stream, Z_FINISH) != Z_STREAM_END)
+  {
+    mqttCompress_uncompressed++;
+    rc = LE_NOT_POSSIBLE;
+    goto cleanup;
+  }
+
+  *outLen = mqttCompress_stream.total_out;
+  mqttCompress_compressed++;
+  mqttCompress_bytesIn += dataLen;
+  mqttCompress_bytesOut += *outLen;
+
+cleanup:
+  mqttCompress_cpuNs += mqttCompress_cpuTime() - start;
+  return rc;
+}
+
+// compressed payloads with their size before and after, the ones that did not shrink, and the CPU
+// time spent on both
+void mqttCompress_getStatus(uint32_t* compressed, uint32_t* uncompressed, uint64_t* bytesIn, uint64_t* bytesOut,
+    uint64_t* cpuUs)
+{
+  *compressed = mqttCompress_compressed;
+  *uncompressed = mqttCompress_uncompressed;
+  *bytesIn = mqttCompress_bytesIn;
+  *bytesOut = mqttCompress_bytesOut;
+  *cpuUs = mqttCompress_cpuNs / 1000;
+}
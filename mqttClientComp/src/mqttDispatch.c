@@ -0,0 +1,255 @@
+/**
+ * @file
+ *
+ * Worker pool for inbound message handlers.
+ *
+ * Each worker owns a single-producer single-consumer ring fed by the I/O loop: the head index is
+ * only written by the I/O loop, the tail only by the worker, and both are published with
+ * release/acquire ordering so neither side takes a lock.  A semaphore counts the filled entries and
+ * the worker sleeps on it.
+ *
+ * The I/O loop never waits for a worker.  It asks for room before it acks a PUBLISH; when the ring
+ * is full it raises the worker's stalled flag, stops reading the socket and leaves the packet where
+ * it was received.  The worker clears the flag as soon as it has freed an entry and queues the
+ * resume function to the I/O thread, which delivers the packet and reads on.  Meanwhile timers,
+ * acks and API calls carry on, and the broker is held back by TCP flow control instead of losing
+ * messages.
+ *
+ * An entry holds a copy of the message and a reference on its receive slot, the topic name and
+ * payload stay where the packet was received.  The worker releases the slot once the handler
+ * returns.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include "legato.h"
+#include "interfaces.h"
+#include "mqttClient.h"
+#include "mqttDispatch.h"
+
+typedef struct _mqttDispatch_entry_t
+{
+  mqttClient_msgHndlr_f                handler;
+  mqttClient_msg_t                     message;
+  MQTTString                           topicName;
+} mqttDispatch_entry_t;
+
+typedef struct _mqttDispatch_worker_t
+{
+  le_thread_Ref_t                      thread;
+  le_sem_Ref_t                         filled;
+  uint32_t                             head;
+  uint32_t                             tail;
+  uint32_t                             stalled;
+  mqttDispatch_entry_t                 ring[MQTT_DISPATCH_QUEUE_SIZE];
+} mqttDispatch_worker_t;
+
+static mqttDispatch_worker_t mqttDispatch_workers[MQTT_DISPATCH_WORKERS_MAX];
+static uint32_t mqttDispatch_count;
+static uint32_t mqttDispatch_posted;
+static uint32_t mqttDispatch_stalls;
+static le_thread_Ref_t mqttDispatch_ioThread;
+static le_event_DeferredFunc_t mqttDispatch_resume;
+static void* mqttDispatch_resumeContext;
+
+static void* mqttDispatch_workerMain(void*);
+static uint32_t mqttDispatch_hash(const char*, int);
+static mqttDispatch_worker_t* mqttDispatch_worker(const char*, int);
+static uint32_t mqttDispatch_room(mqttDispatch_worker_t*);
+
+static uint32_t mqttDispatch_hash(const char* data, int len)
+{
+  uint32_t hash = 2166136261u;
+
+  while (len-- > 0)
+  {
+    hash = (hash ^ (unsigned char)*data++) * 16777619;
+  }
+
+  return hash;
+}
+
+static mqttDispatch_worker_t* mqttDispatch_worker(const char* topic, int topicLen)
+{
+  // one topic, one worker: per-topic order is the ring order
+  return &mqttDispatch_workers[mqttDispatch_hash(topic, topicLen) % mqttDispatch_count];
+}
+
+// only called from the I/O loop, the head is its own.  Sequentially consistent so the load cannot
+// pass the stalled flag raised just before it
+static uint32_t mqttDispatch_room(mqttDispatch_worker_t* worker)
+{
+  return MQTT_DISPATCH_QUEUE_SIZE - (worker->head - __atomic_load_n(&worker->tail, __ATOMIC_SEQ_CST));
+}
+
+static void* mqttDispatch_workerMain(void* context)
+{
+  mqttDispatch_worker_t* worker = context;
+
+  for (;;)
+  {
+    mqttDispatch_entry_t* entry;
+    mqttClient_msg_data_t msgData;
+    uint32_t head;
+    uint32_t tail;
+
+    le_sem_Wait(worker->filled);
+
+    // pairs with the release store of head, the entry is complete once it is visible
+    head = __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&worker->tail, __ATOMIC_RELAXED);
+    LE_ASSERT(tail != head);
+    entry = &worker->ring[tail % MQTT_DISPATCH_QUEUE_SIZE];
+
+    msgData.message = &entry->message;
+    msgData.topicName = &entry->topicName;
+    msgData.shmOffset = -1;
+    entry->handler(&msgData);
+
+    mqttClient_msgRelease(&entry->message);
+    __atomic_store_n(&worker->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    // either the I/O loop sees the entry freed, or it raised the flag before and is resumed here
+    if (__atomic_exchange_n(&worker->stalled, 0, __ATOMIC_SEQ_CST))
+    {
+      le_event_QueueFunctionToThread(mqttDispatch_ioThread, mqttDispatch_resume, mqttDispatch_resumeContext, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+// workers cannot be stopped, so the pool can be started once and never resized.  resume is queued
+// to ioThread after mqttDispatch_hasRoom() said no and the worker has made room
+int mqttDispatch_start(uint32_t count, le_thread_Ref_t ioThread, le_event_DeferredFunc_t resume, void* context)
+{
+  char name[32];
+  uint32_t i;
+  int rc = LE_OK;
+
+  if (count > MQTT_DISPATCH_WORKERS_MAX)
+  {
+    LE_ERROR("invalid worker count(%u)", count);
+    rc = LE_OUT_OF_RANGE;
+    goto cleanup;
+  }
+  else if (count == mqttDispatch_count)
+  {
+    goto cleanup;
+  }
+  else if (mqttDispatch_count)
+  {
+    LE_ERROR("already running %u workers", mqttDispatch_count);
+    rc = LE_NOT_PERMITTED;
+    goto cleanup;
+  }
+
+  mqttDispatch_ioThread = ioThread;
+  mqttDispatch_resume = resume;
+  mqttDispatch_resumeContext = context;
+
+  for (i = 0; i < count; i++)
+  {
+    mqttDispatch_worker_t* worker = &mqttDispatch_workers[i];
+
+    snprintf(name, sizeof(name), "%s%u", MQTT_DISPATCH_THREAD_NAME, i);
+    worker->filled = le_sem_Create(name, 0);
+    worker->head = worker->tail = 0;
+    worker->stalled = 0;
+    worker->thread = le_thread_Create(name, mqttDispatch_workerMain, worker);
+    le_thread_Start(worker->thread);
+  }
+
+  LE_INFO("dispatching inbound messages to %u workers", count);
+  mqttDispatch_count = count;
+
+cleanup:
+  return rc;
+}
+
+bool mqttDispatch_isRunning(void)
+{
+  return mqttDispatch_count != 0;
+}
+
+// false when the worker for this topic cannot take need more messages: the caller stops reading and
+// waits for the resume function
+bool mqttDispatch_hasRoom(const char* topic, int topicLen, uint32_t need)
+{
+  mqttDispatch_worker_t* worker;
+
+  if (!mqttDispatch_count || !need)
+  {
+    return true;
+  }
+
+  // a message matching more handlers than a ring holds waits for an empty ring
+  if (need > MQTT_DISPATCH_QUEUE_SIZE)
+  {
+    need = MQTT_DISPATCH_QUEUE_SIZE;
+  }
+
+  worker = mqttDispatch_worker(topic, topicLen);
+  if (mqttDispatch_room(worker) >= need)
+  {
+    return true;
+  }
+
+  __atomic_store_n(&worker->stalled, 1, __ATOMIC_SEQ_CST);
+  if (mqttDispatch_room(worker) >= need)
+  {
+    // freed in between, a resume the worker may already have queued finds nothing to do
+    __atomic_store_n(&worker->stalled, 0, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  mqttDispatch_stalls++;
+  return false;
+}
+
+// LE_NOT_POSSIBLE when the handler has to be called in place: no workers, or a message that does
+// not live in a receive slot.  LE_NO_MEMORY when the ring is full, which mqttDispatch_hasRoom()
+// leaves to messages matching more handlers than a ring holds
+int mqttDispatch_post(mqttClient_msgHndlr_f handler, mqttClient_msg_data_t* msgData)
+{
+  mqttDispatch_worker_t* worker;
+  mqttDispatch_entry_t* entry;
+  const char* topic;
+  uint32_t head;
+  int topicLen;
+
+  if (!mqttDispatch_count || !msgData->message->slot)
+  {
+    return LE_NOT_POSSIBLE;
+  }
+
+  topic = msgData->topicName->cstring ? msgData->topicName->cstring:msgData->topicName->lenstring.data;
+  topicLen = MQTTstrlen(*msgData->topicName);
+  worker = mqttDispatch_worker(topic, topicLen);
+
+  if (!mqttDispatch_room(worker))
+  {
+    return LE_NO_MEMORY;
+  }
+
+  head = worker->head;
+  entry = &worker->ring[head % MQTT_DISPATCH_QUEUE_SIZE];
+  entry->handler = handler;
+  entry->message = *msgData->message;
+  entry->topicName = *msgData->topicName;
+  mqttClient_msgRetain(&entry->message);
+
+  __atomic_store_n(&worker->head, head + 1, __ATOMIC_RELEASE);
+  le_sem_Post(worker->filled);
+
+  mqttDispatch_posted++;
+  return LE_OK;
+}
+
+void mqttDispatch_getStatus(uint32_t* workers, uint32_t* posted, uint32_t* stalls)
+{
+  *workers = mqttDispatch_count;
+  *posted = mqttDispatch_posted;
+  *stalls = mqttDispatch_stalls;
+}
@@ -0,0 +1,308 @@
+/**
+ * @file
+ *
+ * Broker name resolution off the event loop.
+ *
+ * getaddrinfo() blocks for as long as the DNS server takes to answer, which on a marginal cellular
+ * link can be several seconds.  Requests are therefore queued to a worker thread running its own
+ * event loop; the worker performs the lookup and queues the answer back to the thread that asked.
+ * All bookkeeping (pending requests, the cache) is only ever touched from the requesting thread.
+ *
+ * The answer keeps both IPv6 and IPv4 addresses.  They are interleaved by family, starting with the
+ * family getaddrinfo() ranked first, so that a caller racing connection attempts (RFC 8305) falls
+ * back to the other family on its second attempt rather than after exhausting the first one.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "legato.h"
+#include "mqttResolver.h"
+
+typedef struct _mqttResolver_req_t
+{
+  le_dls_Link_t                        link;
+  char                                 host[MQTT_RESOLVER_MAX_HOST_LEN];
+  mqttResolver_addrList_t              addrs;
+  mqttResolver_resultHndlr_f           handler;
+  void*                                context;
+  le_thread_Ref_t                      caller;
+  uint32_t                             requestId;
+  int                                  rc;
+  bool                                 fromCache;
+} mqttResolver_req_t;
+
+typedef struct _mqttResolver_cacheEntry_t
+{
+  char                                 host[MQTT_RESOLVER_MAX_HOST_LEN];
+  mqttResolver_addrList_t              addrs;
+  le_clk_Time_t                        expiry;
+} mqttResolver_cacheEntry_t;
+
+static le_thread_Ref_t mqttResolver_thread;
+static le_mem_PoolRef_t mqttResolver_reqPool;
+static le_dls_List_t mqttResolver_pending = LE_DLS_LIST_INIT;
+static mqttResolver_cacheEntry_t mqttResolver_cache[MQTT_RESOLVER_CACHE_SIZE];
+static uint32_t mqttResolver_cacheTtl = MQTT_RESOLVER_CACHE_TTL_SEC;
+static uint32_t mqttResolver_nextRequestId = 1;
+
+static void* mqttResolver_threadMain(void*);
+static void mqttResolver_lookup(void*, void*);
+static void mqttResolver_deliver(void*, void*);
+static mqttResolver_cacheEntry_t* mqttResolver_cacheFind(const char*);
+static void mqttResolver_cacheStore(const char*, const mqttResolver_addrList_t*);
+
+static void* mqttResolver_threadMain(void* context)
+{
+  le_event_RunLoop();
+  return NULL;
+}
+
+// worker thread: nothing but the request itself may be touched here
+static void mqttResolver_lookup(void* param1, void* param2)
+{
+  mqttResolver_req_t* req = param1;
+  struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+  struct addrinfo* result = NULL;
+  struct addrinfo* res;
+  int firstFamily = AF_UNSPEC;
+  int pass;
+
+  req->addrs.count = 0;
+  req->rc = getaddrinfo(req->host, NULL, &hints, &result);
+  if (req->rc)
+  {
+    LE_ERROR("getaddrinfo('%s') failed(%d)", req->host, req->rc);
+    req->rc = LE_NOT_FOUND;
+    goto cleanup;
+  }
+
+  for (res = result; res; res = res->ai_next)
+  {
+    if ((res->ai_family == AF_INET) || (res->ai_family == AF_INET6))
+    {
+      firstFamily = res->ai_family;
+      break;
+    }
+  }
+
+  // alternate families: first pass takes the n-th address of each family in turn
+  for (pass = 0; (pass < MQTT_RESOLVER_MAX_ADDRS) && (req->addrs.count < MQTT_RESOLVER_MAX_ADDRS); pass++)
+  {
+    int families[2] = { firstFamily, (firstFamily == AF_INET6) ? AF_INET:AF_INET6 };
+    bool found = false;
+    int f;
+
+    for (f = 0; (f < 2) && (req->addrs.count < MQTT_RESOLVER_MAX_ADDRS); f++)
+    {
+      int n = 0;
+
+      for (res = result; res; res = res->ai_next)
+      {
+        if ((res->ai_family != families[f]) || (res->ai_addrlen > sizeof(struct sockaddr_storage)))
+        {
+          continue;
+        }
+
+        if (n++ == pass)
+        {
+          memcpy(&req->addrs.addr[req->addrs.count], res->ai_addr, res->ai_addrlen);
+          req->addrs.addrLen[req->addrs.count] = res->ai_addrlen;
+          req->addrs.count++;
+          found = true;
+          break;
+        }
+      }
+    }
+
+    if (!found)
+    {
+      break;
+    }
+  }
+
+  if (!req->addrs.count)
+  {
+    LE_ERROR("no usable address('%s')", req->host);
+    req->rc = LE_NOT_FOUND;
+  }
+
+cleanup:
+  if (result) freeaddrinfo(result);
+  le_event_QueueFunctionToThread(req->caller, mqttResolver_deliver, req, NULL);
+}
+
+static void mqttResolver_deliver(void* param1, void* param2)
+{
+  mqttResolver_req_t* req = param1;
+
+  le_dls_Remove(&mqttResolver_pending, &req->link);
+
+  if (!req->rc && !req->fromCache)
+  {
+    mqttResolver_cacheStore(req->host, &req->addrs);
+  }
+
+  if (req->handler)
+  {
+    LE_DEBUG("resolved('%s') addresses(%u) cached(%u)", req->host, req->addrs.count, req->fromCache);
+    req->handler(req->requestId, req->rc, &req->addrs, req->context);
+  }
+
+  le_mem_Release(req);
+}
+
+static mqttResolver_cacheEntry_t* mqttResolver_cacheFind(const char* host)
+{
+  le_clk_Time_t now = le_clk_GetRelativeTime();
+  int i;
+
+  for (i = 0; i < MQTT_RESOLVER_CACHE_SIZE; i++)
+  {
+    mqttResolver_cacheEntry_t* entry = &mqttResolver_cache[i];
+
+    if (entry->addrs.count && !strcmp(entry->host, host))
+    {
+      if (le_clk_GreaterThan(now, entry->expiry))
+      {
+        entry->addrs.count = 0;
+        return NULL;
+      }
+
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void mqttResolver_cacheStore(const char* host, const mqttResolver_addrList_t* addrs)
+{
+  le_clk_Time_t ttl = { mqttResolver_cacheTtl, 0 };
+  mqttResolver_cacheEntry_t* entry = NULL;
+  int i;
+
+  if (!mqttResolver_cacheTtl)
+  {
+    return;
+  }
+
+  // reuse the host's slot, else an empty one, else the one closest to expiry
+  for (i = 0; i < MQTT_RESOLVER_CACHE_SIZE; i++)
+  {
+    mqttResolver_cacheEntry_t* slot = &mqttResolver_cache[i];
+
+    if (!strcmp(slot->host, host))
+    {
+      entry = slot;
+      break;
+    }
+
+    if (!entry || (entry->addrs.count && (!slot->addrs.count || le_clk_GreaterThan(entry->expiry, slot->expiry))))
+    {
+      entry = slot;
+    }
+  }
+
+  strncpy(entry->host, host, sizeof(entry->host) - 1);
+  entry->host[sizeof(entry->host) - 1] = '\0';
+  memcpy(&entry->addrs, addrs, sizeof(entry->addrs));
+  entry->expiry = le_clk_Add(le_clk_GetRelativeTime(), ttl);
+}
+
+void mqttResolver_init(void)
+{
+  mqttResolver_reqPool = le_mem_CreatePool(MQTT_RESOLVER_REQUEST_POOL, sizeof(mqttResolver_req_t));
+  le_mem_ExpandPool(mqttResolver_reqPool, 2);
+
+  mqttResolver_thread = le_thread_Create(MQTT_RESOLVER_THREAD_NAME, mqttResolver_threadMain, NULL);
+  le_thread_Start(mqttResolver_thread);
+}
+
+uint32_t mqttResolver_resolve(const char* host, mqttResolver_resultHndlr_f handler, void* context)
+{
+  mqttResolver_req_t* req = NULL;
+  mqttResolver_cacheEntry_t* entry = NULL;
+
+  LE_ASSERT(host);
+  LE_ASSERT(handler);
+
+  req = le_mem_ForceAlloc(mqttResolver_reqPool);
+  memset(req, 0, sizeof(*req));
+  req->link = LE_DLS_LINK_INIT;
+  strncpy(req->host, host, sizeof(req->host) - 1);
+  req->handler = handler;
+  req->context = context;
+  req->caller = le_thread_GetCurrent();
+  req->requestId = mqttResolver_nextRequestId++;
+  if (!mqttResolver_nextRequestId) mqttResolver_nextRequestId = 1;
+
+  le_dls_Queue(&mqttResolver_pending, &req->link);
+
+  // answer from the cache through the event loop too, callers never see a re-entrant callback
+  entry = mqttResolver_cacheFind(host);
+  if (entry)
+  {
+    memcpy(&req->addrs, &entry->addrs, sizeof(req->addrs));
+    req->fromCache = true;
+    le_event_QueueFunction(mqttResolver_deliver, req, NULL);
+  }
+  else
+  {
+    LE_DEBUG("resolving('%s') request(%u)", host, req->requestId);
+    le_event_QueueFunctionToThread(mqttResolver_thread, mqttResolver_lookup, req, NULL);
+  }
+
+  return req->requestId;
+}
+
+void mqttResolver_cancel(uint32_t requestId)
+{
+  le_dls_Link_t* link = le_dls_Peek(&mqttResolver_pending);
+
+  // the worker still owns the request, so just drop the callback
+  while (link)
+  {
+    mqttResolver_req_t* req = CONTAINER_OF(link, mqttResolver_req_t, link);
+
+    if (req->requestId == requestId)
+    {
+      LE_DEBUG("cancel request(%u)", requestId);
+      req->handler = NULL;
+      break;
+    }
+
+    link = le_dls_PeekNext(&mqttResolver_pending, link);
+  }
+}
+
+void mqttResolver_invalidate(const char* host)
+{
+  mqttResolver_cacheEntry_t* entry = mqttResolver_cacheFind(host);
+
+  if (entry)
+  {
+    LE_DEBUG("invalidate('%s')", host);
+    entry->addrs.count = 0;
+  }
+}
+
+void mqttResolver_setCacheTtl(uint32_t ttlSec)
+{
+  int i;
+
+  LE_INFO("DNS cache TTL(%u -> %u seconds)", mqttResolver_cacheTtl, ttlSec);
+  mqttResolver_cacheTtl = ttlSec;
+
+  if (!ttlSec)
+  {
+    for (i = 0; i < MQTT_RESOLVER_CACHE_SIZE; i++)
+    {
+      mqttResolver_cache[i].addrs.count = 0;
+    }
+  }
+}
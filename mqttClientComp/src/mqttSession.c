@@ -0,0 +1,335 @@
+/**
+ * @file
+ *
+ * Durable MQTT session state.
+ *
+ * The file is a snapshot, rewritten as a whole: a header carrying the packet ID counter and a
+ * checksum, followed by one record per in-flight entry.  PUBLISH entries keep the serialized packet
+ * so it can be resent with DUP set, PUBREL entries only need their packet ID.  Changes are batched:
+ * the first change arms a short timer and everything that happens before it fires lands in one
+ * write.  The snapshot goes to a temporary file which is fsync'd and renamed over the previous one,
+ * so a reset in the middle of a write leaves the last complete snapshot in place.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "legato.h"
+#include "interfaces.h"
+#include "mqttClient.h"
+#include "mqttSession.h"
+
+typedef struct _mqttSession_hdr_t
+{
+  uint32_t                             magic;
+  uint16_t                             version;
+  uint16_t                             count;
+  uint16_t                             nextPacketId;
+  uint16_t                             reserved;
+  uint32_t                             checksum;
+} mqttSession_hdr_t;
+
+typedef struct _mqttSession_rec_t
+{
+  uint16_t                             packetId;
+  uint8_t                              qos;
+  uint8_t                              state;
+  uint32_t                             packetLen;
+} mqttSession_rec_t;
+
+static le_timer_Ref_t mqttSession_timer;
+static bool mqttSession_dirty;
+
+static void mqttSession_flushExpiryHndlr(le_timer_Ref_t);
+static uint32_t mqttSession_checksum(uint32_t, const void*, size_t);
+static int mqttSession_load(mqttClient_t*);
+
+static uint32_t mqttSession_checksum(uint32_t hash, const void* data, size_t len)
+{
+  const uint8_t* ptr = data;
+
+  // FNV-1a, enough to reject a torn or foreign file
+  while (len--)
+  {
+    hash ^= *ptr++;
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+static void mqttSession_flushExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  rc = mqttSession_flush(clientData);
+  if (rc)
+  {
+    LE_ERROR("mqttSession_flush() failed(%d)", rc);
+  }
+}
+
+static int mqttSession_load(mqttClient_t* clientData)
+{
+  mqttSession_hdr_t hdr;
+  le_clk_Time_t now = le_clk_GetRelativeTime();
+  uint32_t hash = 2166136261u;
+  FILE* file = NULL;
+  int rc = LE_OK;
+  int i;
+
+  file = fopen(MQTT_SESSION_FILE, "rb");
+  if (!file)
+  {
+    rc = LE_NOT_FOUND;
+    goto cleanup;
+  }
+
+  if ((fread(&hdr, sizeof(hdr), 1, file) != 1) || (hdr.magic != MQTT_SESSION_MAGIC) || (hdr.version != MQTT_SESSION_VERSION))
+  {
+    LE_ERROR("invalid session file('%s')", MQTT_SESSION_FILE);
+    rc = LE_FORMAT_ERROR;
+    goto cleanup;
+  }
+
+  hash = mqttSession_checksum(hash, &hdr, offsetof(mqttSession_hdr_t, checksum));
+
+  for (i = 0; i < hdr.count; i++)
+  {
+    mqttSession_rec_t rec;
+    mqttClient_inflight_t* entry;
+
+    if (fread(&rec, sizeof(rec), 1, file) != 1)
+    {
+      rc = LE_FORMAT_ERROR;
+      goto cleanup;
+    }
+
+    hash = mqttSession_checksum(hash, &rec, sizeof(rec));
+    entry = &clientData->session.inflight[rec.packetId % MQTT_CLIENT_INFLIGHT_TABLE_SIZE];
+    if ((entry->state != MQTT_CLIENT_INFLIGHT_FREE) || (rec.state == MQTT_CLIENT_INFLIGHT_FREE) || (rec.packetLen > mqttBuffer_getMaxSize()))
+    {
+      rc = LE_FORMAT_ERROR;
+      goto cleanup;
+    }
+
+    entry->packet = rec.packetLen ? mqttBuffer_alloc(rec.packetLen):NULL;
+    if (rec.packetLen && (!entry->packet || (fread(entry->packet, rec.packetLen, 1, file) != 1)))
+    {
+      mqttBuffer_release(entry->packet);
+      entry->packet = NULL;
+      rc = LE_FORMAT_ERROR;
+      goto cleanup;
+    }
+
+    hash = mqttSession_checksum(hash, entry->packet, rec.packetLen);
+    entry->packetId = rec.packetId;
+    entry->packetLen = rec.packetLen;
+    entry->qos = rec.qos;
+    entry->state = rec.state;
+    entry->retries = 0;
+    entry->deadline = now;
+    clientData->session.inflightCount++;
+  }
+
+  if (hash != hdr.checksum)
+  {
+    LE_ERROR("session file checksum mismatch(0x%08x 0x%08x)", hash, hdr.checksum);
+    rc = LE_FORMAT_ERROR;
+    goto cleanup;
+  }
+
+  clientData->session.nextPacketId = hdr.nextPacketId;
+  LE_INFO("restored session in-flight(%u) next packet ID(%u)", hdr.count, hdr.nextPacketId);
+
+cleanup:
+  if (file) fclose(file);
+
+  if (rc == LE_FORMAT_ERROR)
+  {
+    // a half-restored table is worse than none
+    for (i = 0; i < MQTT_CLIENT_INFLIGHT_TABLE_SIZE; i++)
+    {
+      mqttClient_inflight_t* entry = &clientData->session.inflight[i];
+
+      if (entry->state != MQTT_CLIENT_INFLIGHT_FREE)
+      {
+        mqttBuffer_release(entry->packet);
+        memset(entry, 0, sizeof(*entry));
+      }
+    }
+
+    clientData->session.inflightCount = 0;
+  }
+
+  return rc;
+}
+
+void mqttSession_init(mqttClient_t* clientData)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  mqttSession_timer = le_timer_Create(MQTT_SESSION_FLUSH_TIMER);
+  le_timer_SetHandler(mqttSession_timer, mqttSession_flushExpiryHndlr);
+  le_timer_SetMsInterval(mqttSession_timer, MQTT_SESSION_FLUSH_MS);
+  le_timer_SetContextPtr(mqttSession_timer, clientData);
+
+  // an existing file means persistent sessions were enabled before this process started
+  rc = mqttSession_load(clientData);
+  if (rc == LE_OK)
+  {
+    clientData->config.persistentSession = 1;
+  }
+  else if (rc != LE_NOT_FOUND)
+  {
+    LE_WARN("discarding session file(%d)", rc);
+    unlink(MQTT_SESSION_FILE);
+  }
+}
+
+int mqttSession_enable(mqttClient_t* clientData, bool enable)
+{
+  int rc = LE_OK;
+
+  LE_ASSERT(clientData);
+
+  LE_INFO("persistent session(%u -> %u)", clientData->config.persistentSession, enable);
+  clientData->config.persistentSession = enable;
+  clientData->session.config.persistentSession = enable;
+
+  if (enable)
+  {
+    mqttSession_dirty = true;
+    rc = mqttSession_flush(clientData);
+  }
+  else
+  {
+    le_timer_Stop(mqttSession_timer);
+    mqttSession_dirty = false;
+    if ((unlink(MQTT_SESSION_FILE) == -1) && (errno != ENOENT))
+    {
+      LE_ERROR("unlink('%s') failed(%d)", MQTT_SESSION_FILE, errno);
+      rc = LE_IO_ERROR;
+    }
+  }
+
+  return rc;
+}
+
+void mqttSession_markDirty(mqttClient_t* clientData)
+{
+  if (!clientData->config.persistentSession)
+  {
+    return;
+  }
+
+  mqttSession_dirty = true;
+  if (!le_timer_IsRunning(mqttSession_timer))
+  {
+    le_timer_Start(mqttSession_timer);
+  }
+}
+
+int mqttSession_flush(mqttClient_t* clientData)
+{
+  mqttSession_hdr_t hdr = { MQTT_SESSION_MAGIC, MQTT_SESSION_VERSION, 0, 0, 0, 2166136261u };
+  FILE* file = NULL;
+  int rc = LE_OK;
+  int i;
+
+  LE_ASSERT(clientData);
+
+  if (!mqttSession_dirty || !clientData->config.persistentSession)
+  {
+    goto cleanup;
+  }
+
+  if (le_timer_IsRunning(mqttSession_timer))
+  {
+    le_timer_Stop(mqttSession_timer);
+  }
+
+  if ((mkdir(MQTT_SESSION_DIR, 0700) == -1) && (errno != EEXIST))
+  {
+    LE_ERROR("mkdir('%s') failed(%d)", MQTT_SESSION_DIR, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  file = fopen(MQTT_SESSION_TMP_FILE, "wb");
+  if (!file)
+  {
+    LE_ERROR("fopen('%s') failed(%d)", MQTT_SESSION_TMP_FILE, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  hdr.count = clientData->session.inflightCount;
+  hdr.nextPacketId = clientData->session.nextPacketId;
+  hdr.checksum = mqttSession_checksum(hdr.checksum, &hdr, offsetof(mqttSession_hdr_t, checksum));
+
+  // the checksum covers the records, so they are hashed first and the header is written last
+  if (fseek(file, sizeof(hdr), SEEK_SET))
+  {
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  for (i = 0; i < MQTT_CLIENT_INFLIGHT_TABLE_SIZE; i++)
+  {
+    mqttClient_inflight_t* entry = &clientData->session.inflight[i];
+    mqttSession_rec_t rec;
+
+    if (entry->state == MQTT_CLIENT_INFLIGHT_FREE)
+    {
+      continue;
+    }
+
+    rec.packetId = entry->packetId;
+    rec.qos = entry->qos;
+    rec.state = entry->state;
+    rec.packetLen = (entry->state == MQTT_CLIENT_INFLIGHT_PUBLISH_SENT) ? entry->packetLen:0;
+
+    hdr.checksum = mqttSession_checksum(hdr.checksum, &rec, sizeof(rec));
+    hdr.checksum = mqttSession_checksum(hdr.checksum, entry->packet, rec.packetLen);
+
+    if ((fwrite(&rec, sizeof(rec), 1, file) != 1) || (rec.packetLen && (fwrite(entry->packet, rec.packetLen, 1, file) != 1)))
+    {
+      LE_ERROR("fwrite() failed(%d)", errno);
+      rc = LE_IO_ERROR;
+      goto cleanup;
+    }
+  }
+
+  if (fseek(file, 0, SEEK_SET) || (fwrite(&hdr, sizeof(hdr), 1, file) != 1) || fflush(file) || fsync(fileno(file)))
+  {
+    LE_ERROR("write('%s') failed(%d)", MQTT_SESSION_TMP_FILE, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  fclose(file);
+  file = NULL;
+
+  if (rename(MQTT_SESSION_TMP_FILE, MQTT_SESSION_FILE) == -1)
+  {
+    LE_ERROR("rename('%s') failed(%d)", MQTT_SESSION_FILE, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  mqttSession_dirty = false;
+  LE_DEBUG("session saved in-flight(%u) next packet ID(%u)", hdr.count, hdr.nextPacketId);
+
+cleanup:
+  if (file) fclose(file);
+  return rc;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file
+ *
+ * Shared-memory ring for inbound payloads.
+ *
+ * The ring is a POSIX shared memory object, unlinked as soon as it is mapped so that it disappears
+ * with the process; apps reach it only through the descriptors handed out by mqttShm_getFd(), which
+ * are reopened read-only.  Payloads are allocated at the head as a header followed by the data, all
+ * rounded up to 8 bytes.  A payload that does not fit before the end of the ring leaves a padding
+ * entry behind and starts over at offset 0.  Releases may come in any order, the tail only moves
+ * over entries whose reference count has dropped to zero, so one slow reader holds back the space
+ * behind it but never corrupts what it is reading.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "legato.h"
+#include "interfaces.h"
+#include "mqttShm.h"
+
+#define MQTT_SHM_ALIGN(n)                             (((n) + 7) & ~7)
+
+typedef struct _mqttShm_hdr_t
+{
+  uint32_t                             len;
+  uint32_t                             refs;
+} mqttShm_hdr_t;
+
+static unsigned char* mqttShm_base;
+static int mqttShm_fd = -1;
+static uint32_t mqttShm_head;
+static uint32_t mqttShm_tail;
+static uint32_t mqttShm_used;
+static uint32_t mqttShm_count;
+static uint32_t mqttShm_dropped;
+
+static mqttShm_hdr_t* mqttShm_hdr(uint32_t);
+static void mqttShm_reclaim(void);
+
+static inline mqttShm_hdr_t* mqttShm_hdr(uint32_t off)
+{
+  return (mqttShm_hdr_t*)(mqttShm_base + off);
+}
+
+static void mqttShm_reclaim(void)
+{
+  while (mqttShm_used && !mqttShm_hdr(mqttShm_tail)->refs)
+  {
+    uint32_t len = mqttShm_hdr(mqttShm_tail)->len;
+
+    mqttShm_used -= len;
+    mqttShm_tail = (mqttShm_tail + len) % MQTT_SHM_SIZE;
+  }
+
+  if (!mqttShm_used)
+  {
+    // empty, start from the beginning so the next payload has the whole ring in one piece
+    mqttShm_head = mqttShm_tail = 0;
+  }
+}
+
+int mqttShm_init(void)
+{
+  int rc = LE_OK;
+
+  mqttShm_fd = shm_open(MQTT_SHM_NAME, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if ((mqttShm_fd == -1) && (errno == EEXIST))
+  {
+    // left over by a crashed instance
+    shm_unlink(MQTT_SHM_NAME);
+    mqttShm_fd = shm_open(MQTT_SHM_NAME, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  }
+
+  if (mqttShm_fd == -1)
+  {
+    LE_ERROR("shm_open('%s') failed(%d)", MQTT_SHM_NAME, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  shm_unlink(MQTT_SHM_NAME);
+
+  if (ftruncate(mqttShm_fd, MQTT_SHM_SIZE) == -1)
+  {
+    LE_ERROR("ftruncate() failed(%d)", errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  mqttShm_base = mmap(NULL, MQTT_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mqttShm_fd, 0);
+  if (mqttShm_base == MAP_FAILED)
+  {
+    LE_ERROR("mmap() failed(%d)", errno);
+    mqttShm_base = NULL;
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+cleanup:
+  if (rc && (mqttShm_fd != -1))
+  {
+    close(mqttShm_fd);
+    mqttShm_fd = -1;
+  }
+
+  return rc;
+}
+
+// a new read-only descriptor on the ring, the caller owns it
+int mqttShm_getFd(void)
+{
+  char path[32];
+  int fd = -1;
+
+  if (mqttShm_fd == -1)
+  {
+    LE_ERROR("shared memory unavailable");
+    goto cleanup;
+  }
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", mqttShm_fd);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    LE_ERROR("open('%s') failed(%d)", path, errno);
+    goto cleanup;
+  }
+
+cleanup:
+  return fd;
+}
+
+uint32_t mqttShm_getSize(void)
+{
+  return mqttShm_base ? MQTT_SHM_SIZE:0;
+}
+
+// copies the payload in with one reference, offset receives where the data starts in the mapping
+int mqttShm_alloc(const void* data, size_t dataLen, uint32_t* offset)
+{
+  uint32_t len = MQTT_SHM_ALIGN(sizeof(mqttShm_hdr_t) + dataLen);
+  uint32_t start = mqttShm_head;
+  int rc = LE_OK;
+
+  if (!mqttShm_base)
+  {
+    rc = LE_NOT_POSSIBLE;
+    goto cleanup;
+  }
+
+  if ((mqttShm_head > mqttShm_tail) || !mqttShm_used)
+  {
+    if (len > MQTT_SHM_SIZE - mqttShm_head)
+    {
+      // does not fit at the end, wrap if it fits in front of the tail
+      if (len > mqttShm_tail)
+      {
+        goto full;
+      }
+
+      mqttShm_hdr(mqttShm_head)->len = MQTT_SHM_SIZE - mqttShm_head;
+      mqttShm_hdr(mqttShm_head)->refs = 0;
+      mqttShm_used += MQTT_SHM_SIZE - mqttShm_head;
+      start = 0;
+    }
+  }
+  else if (len > mqttShm_tail - mqttShm_head)
+  {
+    goto full;
+  }
+
+  mqttShm_hdr(start)->len = len;
+  mqttShm_hdr(start)->refs = 1;
+  memcpy(mqttShm_base + start + sizeof(mqttShm_hdr_t), data, dataLen);
+
+  mqttShm_head = (start + len) % MQTT_SHM_SIZE;
+  mqttShm_used += len;
+  mqttShm_count++;
+  *offset = start + sizeof(mqttShm_hdr_t);
+  goto cleanup;
+
+full:
+  LE_WARN("shared memory full, used(%u) payload(%zu)", mqttShm_used, dataLen);
+  mqttShm_dropped++;
+  rc = LE_NO_MEMORY;
+
+cleanup:
+  return rc;
+}
+
+void mqttShm_addRef(uint32_t offset)
+{
+  LE_ASSERT((offset >= sizeof(mqttShm_hdr_t)) && (offset < MQTT_SHM_SIZE));
+  mqttShm_hdr(offset - sizeof(mqttShm_hdr_t))->refs++;
+}
+
+void mqttShm_release(uint32_t offset)
+{
+  mqttShm_hdr_t* hdr;
+
+  LE_ASSERT((offset >= sizeof(mqttShm_hdr_t)) && (offset < MQTT_SHM_SIZE));
+  hdr = mqttShm_hdr(offset - sizeof(mqttShm_hdr_t));
+  LE_ASSERT(hdr->refs);
+
+  if (!--hdr->refs)
+  {
+    mqttShm_count--;
+    mqttShm_reclaim();
+  }
+}
+
+void mqttShm_getStatus(uint32_t* count, uint32_t* bytes, uint32_t* dropped)
+{
+  *count = mqttShm_count;
+  *bytes = mqttShm_used;
+  *dropped = mqttShm_dropped;
+}
@@ -0,0 +1,533 @@
+/**
+ * @file
+ *
+ * Offline store-and-forward log.
+ *
+ * The log is one file of MQTT_STORE_SEGMENT_COUNT segments, mapped shared so appends are plain
+ * memory copies.  Each segment starts with a header carrying a sequence number that grows by one
+ * every time the writer moves on, so after a restart the segments can be put back in ring order.
+ * Records never straddle segments; a zero length (or too little room for another header) ends a
+ * segment.  Every record repeats its segment's sequence number inside its checksum, which keeps
+ * records left over from the previous lap of the ring from being replayed.
+ *
+ * Writes are made durable by group commit: the first append after a sync arms a short timer and a
+ * single msync() covers everything appended until it fires.  Drained records are flagged as consumed
+ * in place, so a restart resumes after the last record that was handed to the client.
+ *
+ * <HR>
+ *
+ * Copyright (C) Sierra Wireless, Inc. Use of this work is subject to license.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "legato.h"
+#include "interfaces.h"
+#include "mqttClient.h"
+#include "mqttStore.h"
+
+#define MQTT_STORE_FILE_SIZE                          (MQTT_STORE_SEGMENT_SIZE * MQTT_STORE_SEGMENT_COUNT)
+#define MQTT_STORE_ALIGN(n)                           (((n) + 3) & ~3)
+
+typedef struct _mqttStore_segHdr_t
+{
+  uint32_t                             magic;
+  uint32_t                             seq;
+} mqttStore_segHdr_t;
+
+typedef struct _mqttStore_recHdr_t
+{
+  uint32_t                             len;
+  uint32_t                             seq;
+  uint32_t                             checksum;
+  uint16_t                             topicLen;
+  uint8_t                              qos;
+  uint8_t                              retained;
+  uint8_t                              consumed;
+  uint8_t                              reserved[3];
+} mqttStore_recHdr_t;
+
+typedef struct _mqttStore_pos_t
+{
+  uint32_t                             seg;
+  uint32_t                             off;
+} mqttStore_pos_t;
+
+static unsigned char* mqttStore_base;
+static mqttStore_pos_t mqttStore_write;
+static mqttStore_pos_t mqttStore_read;
+static uint32_t mqttStore_nextSeq = 1;
+static uint32_t mqttStore_depth;
+static uint32_t mqttStore_bytes;
+static uint32_t mqttStore_dropped;
+static uint32_t mqttStore_drainRate = MQTT_STORE_DRAIN_RATE_DEFAULT;
+static uint64_t mqttStore_drainCredit;
+static le_timer_Ref_t mqttStore_syncTimer;
+static le_timer_Ref_t mqttStore_drainTimer;
+
+static void mqttStore_syncExpiryHndlr(le_timer_Ref_t);
+static void mqttStore_drainExpiryHndlr(le_timer_Ref_t);
+static uint32_t mqttStore_checksum(const mqttStore_recHdr_t*, const unsigned char*);
+static mqttStore_segHdr_t* mqttStore_seg(uint32_t);
+static mqttStore_recHdr_t* mqttStore_rec(const mqttStore_pos_t*);
+static void mqttStore_openSegment(uint32_t);
+static void mqttStore_evictSegment(uint32_t);
+static mqttStore_recHdr_t* mqttStore_peek(void);
+static void mqttStore_recover(void);
+
+static inline mqttStore_segHdr_t* mqttStore_seg(uint32_t seg)
+{
+  return (mqttStore_segHdr_t*)(mqttStore_base + seg * MQTT_STORE_SEGMENT_SIZE);
+}
+
+// NULL at the end of a segment
+static mqttStore_recHdr_t* mqttStore_rec(const mqttStore_pos_t* pos)
+{
+  mqttStore_segHdr_t* seg = mqttStore_seg(pos->seg);
+  mqttStore_recHdr_t* rec;
+
+  if (pos->off + sizeof(mqttStore_recHdr_t) > MQTT_STORE_SEGMENT_SIZE)
+  {
+    return NULL;
+  }
+
+  rec = (mqttStore_recHdr_t*)((unsigned char*)seg + pos->off);
+  if (!rec->len || (rec->seq != seg->seq) || (pos->off + sizeof(*rec) + rec->len > MQTT_STORE_SEGMENT_SIZE) ||
+      (rec->checksum != mqttStore_checksum(rec, (unsigned char*)(rec + 1))))
+  {
+    return NULL;
+  }
+
+  return rec;
+}
+
+static uint32_t mqttStore_checksum(const mqttStore_recHdr_t* rec, const unsigned char* data)
+{
+  uint32_t fields[3] = { rec->len, rec->seq, (rec->topicLen << 16) | (rec->qos << 8) | rec->retained };
+  const unsigned char* ptr = (const unsigned char*)fields;
+  uint32_t hash = 2166136261u;
+  uint32_t i;
+
+  // FNV-1a over the immutable header fields and the data, the consumed flag is excluded
+  for (i = 0; i < sizeof(fields); i++)
+  {
+    hash = (hash ^ ptr[i]) * 16777619;
+  }
+
+  for (i = 0; i < rec->len; i++)
+  {
+    hash = (hash ^ data[i]) * 16777619;
+  }
+
+  return hash;
+}
+
+static void mqttStore_syncExpiryHndlr(le_timer_Ref_t timer)
+{
+  int rc = mqttStore_sync();
+  if (rc)
+  {
+    LE_ERROR("mqttStore_sync() failed(%d)", rc);
+  }
+}
+
+static void mqttStore_openSegment(uint32_t seg)
+{
+  mqttStore_segHdr_t* hdr = mqttStore_seg(seg);
+  mqttStore_recHdr_t* first = (mqttStore_recHdr_t*)(hdr + 1);
+
+  first->len = 0;
+  hdr->magic = MQTT_STORE_SEGMENT_MAGIC;
+  hdr->seq = mqttStore_nextSeq++;
+
+  mqttStore_write.seg = seg;
+  mqttStore_write.off = sizeof(mqttStore_segHdr_t);
+}
+
+static void mqttStore_evictSegment(uint32_t seg)
+{
+  mqttStore_pos_t pos = { seg, sizeof(mqttStore_segHdr_t) };
+  mqttStore_recHdr_t* rec;
+  uint32_t count = 0;
+
+  if (mqttStore_read.seg == seg)
+  {
+    pos.off = mqttStore_read.off;
+  }
+
+  while ((rec = mqttStore_rec(&pos)) != NULL)
+  {
+    if (!rec->consumed)
+    {
+      mqttStore_depth--;
+      mqttStore_bytes -= rec->len - rec->topicLen;
+      count++;
+    }
+
+    pos.off += MQTT_STORE_ALIGN(sizeof(*rec) + rec->len);
+  }
+
+  if (count)
+  {
+    LE_WARN("store full, evicted(%u) oldest messages", count);
+    mqttStore_dropped += count;
+  }
+}
+
+static mqttStore_recHdr_t* mqttStore_peek(void)
+{
+  mqttStore_recHdr_t* rec;
+
+  while (mqttStore_depth)
+  {
+    rec = mqttStore_rec(&mqttStore_read);
+    if (!rec)
+    {
+      if (mqttStore_read.seg == mqttStore_write.seg)
+      {
+        break;
+      }
+
+      mqttStore_read.seg = (mqttStore_read.seg + 1) % MQTT_STORE_SEGMENT_COUNT;
+      mqttStore_read.off = sizeof(mqttStore_segHdr_t);
+      continue;
+    }
+
+    if (!rec->consumed)
+    {
+      return rec;
+    }
+
+    mqttStore_read.off += MQTT_STORE_ALIGN(sizeof(*rec) + rec->len);
+  }
+
+  return NULL;
+}
+
+static void mqttStore_recover(void)
+{
+  uint32_t newest = 0;
+  uint32_t oldest;
+  uint32_t seg;
+  bool found = false;
+
+  for (seg = 0; seg < MQTT_STORE_SEGMENT_COUNT; seg++)
+  {
+    mqttStore_segHdr_t* hdr = mqttStore_seg(seg);
+
+    if ((hdr->magic == MQTT_STORE_SEGMENT_MAGIC) && hdr->seq && (!found || (hdr->seq > mqttStore_seg(newest)->seq)))
+    {
+      newest = seg;
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    mqttStore_openSegment(0);
+    return;
+  }
+
+  // walk back while the sequence numbers stay contiguous
+  oldest = newest;
+  for (seg = 1; seg < MQTT_STORE_SEGMENT_COUNT; seg++)
+  {
+    uint32_t prev = (newest + MQTT_STORE_SEGMENT_COUNT - seg) % MQTT_STORE_SEGMENT_COUNT;
+    mqttStore_segHdr_t* hdr = mqttStore_seg(prev);
+
+    if ((hdr->magic != MQTT_STORE_SEGMENT_MAGIC) || (hdr->seq != mqttStore_seg(newest)->seq - seg))
+    {
+      break;
+    }
+
+    oldest = prev;
+  }
+
+  mqttStore_nextSeq = mqttStore_seg(newest)->seq + 1;
+  mqttStore_read.seg = oldest;
+  mqttStore_read.off = sizeof(mqttStore_segHdr_t);
+
+  for (seg = oldest; ; seg = (seg + 1) % MQTT_STORE_SEGMENT_COUNT)
+  {
+    mqttStore_pos_t pos = { seg, sizeof(mqttStore_segHdr_t) };
+    mqttStore_recHdr_t* rec;
+
+    while ((rec = mqttStore_rec(&pos)) != NULL)
+    {
+      if (!rec->consumed)
+      {
+        mqttStore_depth++;
+        mqttStore_bytes += rec->len - rec->topicLen;
+      }
+
+      pos.off += MQTT_STORE_ALIGN(sizeof(*rec) + rec->len);
+    }
+
+    if (seg == newest)
+    {
+      mqttStore_write = pos;
+      break;
+    }
+  }
+
+  LE_INFO("store recovered depth(%u) bytes(%u) segments(%u..%u)", mqttStore_depth, mqttStore_bytes, oldest, newest);
+}
+
+int mqttStore_init(void)
+{
+  int fd = -1;
+  int rc = LE_OK;
+
+  if ((mkdir(MQTT_STORE_DIR, 0700) == -1) && (errno != EEXIST))
+  {
+    LE_ERROR("mkdir('%s') failed(%d)", MQTT_STORE_DIR, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  fd = open(MQTT_STORE_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    LE_ERROR("open('%s') failed(%d)", MQTT_STORE_FILE, errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  if (ftruncate(fd, MQTT_STORE_FILE_SIZE) == -1)
+  {
+    LE_ERROR("ftruncate() failed(%d)", errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  mqttStore_base = mmap(NULL, MQTT_STORE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mqttStore_base == MAP_FAILED)
+  {
+    LE_ERROR("mmap() failed(%d)", errno);
+    mqttStore_base = NULL;
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+  mqttStore_recover();
+
+  mqttStore_syncTimer = le_timer_Create(MQTT_STORE_SYNC_TIMER);
+  le_timer_SetHandler(mqttStore_syncTimer, mqttStore_syncExpiryHndlr);
+  le_timer_SetMsInterval(mqttStore_syncTimer, MQTT_STORE_SYNC_MS);
+
+  mqttStore_drainTimer = le_timer_Create(MQTT_STORE_DRAIN_TIMER);
+  le_timer_SetHandler(mqttStore_drainTimer, mqttStore_drainExpiryHndlr);
+  le_timer_SetMsInterval(mqttStore_drainTimer, MQTT_STORE_DRAIN_TICK_MS);
+  le_timer_SetRepeat(mqttStore_drainTimer, 0);
+
+cleanup:
+  // the mapping keeps the file referenced
+  if (fd != -1) close(fd);
+  return rc;
+}
+
+int mqttStore_append(const char* topic, const void* payload, size_t payloadLen, uint8_t qos, uint8_t retained)
+{
+  size_t topicLen = strlen(topic);
+  size_t need = MQTT_STORE_ALIGN(sizeof(mqttStore_recHdr_t) + topicLen + payloadLen);
+  mqttStore_recHdr_t* rec;
+  int rc = LE_OK;
+
+  if (!mqttStore_base)
+  {
+    rc = LE_NOT_POSSIBLE;
+    goto cleanup;
+  }
+
+  if ((topicLen > MQTT_STORE_MAX_TOPIC_LEN) || (need > MQTT_STORE_SEGMENT_SIZE - sizeof(mqttStore_segHdr_t)))
+  {
+    LE_ERROR("message too large to store(%zu)", payloadLen);
+    rc = LE_OVERFLOW;
+    goto cleanup;
+  }
+
+  if (mqttStore_write.off + need > MQTT_STORE_SEGMENT_SIZE)
+  {
+    uint32_t next = (mqttStore_write.seg + 1) % MQTT_STORE_SEGMENT_COUNT;
+
+    if (mqttStore_write.off + sizeof(mqttStore_recHdr_t) <= MQTT_STORE_SEGMENT_SIZE)
+    {
+      ((mqttStore_recHdr_t*)((unsigned char*)mqttStore_seg(mqttStore_write.seg) + mqttStore_write.off))->len = 0;
+    }
+
+    // the ring is full when the reader still has data in the segment about to be reused
+    if (next == mqttStore_read.seg)
+    {
+      mqttStore_evictSegment(next);
+      mqttStore_read.seg = (next + 1) % MQTT_STORE_SEGMENT_COUNT;
+      mqttStore_read.off = sizeof(mqttStore_segHdr_t);
+    }
+
+    mqttStore_openSegment(next);
+  }
+
+  rec = (mqttStore_recHdr_t*)((unsigned char*)mqttStore_seg(mqttStore_write.seg) + mqttStore_write.off);
+  memcpy(rec + 1, topic, topicLen);
+  memcpy((unsigned char*)(rec + 1) + topicLen, payload, payloadLen);
+  rec->seq = mqttStore_seg(mqttStore_write.seg)->seq;
+  rec->topicLen = topicLen;
+  rec->qos = qos;
+  rec->retained = retained;
+  rec->consumed = 0;
+  memset(rec->reserved, 0, sizeof(rec->reserved));
+  rec->len = topicLen + payloadLen;
+  rec->checksum = mqttStore_checksum(rec, (unsigned char*)(rec + 1));
+
+  mqttStore_write.off += need;
+  if (mqttStore_write.off + sizeof(mqttStore_recHdr_t) <= MQTT_STORE_SEGMENT_SIZE)
+  {
+    ((mqttStore_recHdr_t*)((unsigned char*)mqttStore_seg(mqttStore_write.seg) + mqttStore_write.off))->len = 0;
+  }
+
+  mqttStore_depth++;
+  mqttStore_bytes += payloadLen;
+  LE_DEBUG("stored('%s') payload(%zu) depth(%u)", topic, payloadLen, mqttStore_depth);
+
+  if (!le_timer_IsRunning(mqttStore_syncTimer))
+  {
+    le_timer_Start(mqttStore_syncTimer);
+  }
+
+cleanup:
+  return rc;
+}
+
+int mqttStore_sync(void)
+{
+  int rc = LE_OK;
+
+  if (!mqttStore_base)
+  {
+    goto cleanup;
+  }
+
+  if (le_timer_IsRunning(mqttStore_syncTimer))
+  {
+    le_timer_Stop(mqttStore_syncTimer);
+  }
+
+  if (msync(mqttStore_base, MQTT_STORE_FILE_SIZE, MS_SYNC) == -1)
+  {
+    LE_ERROR("msync() failed(%d)", errno);
+    rc = LE_IO_ERROR;
+    goto cleanup;
+  }
+
+cleanup:
+  return rc;
+}
+
+static void mqttStore_drainExpiryHndlr(le_timer_Ref_t timer)
+{
+  mqttClient_t* clientData = le_timer_GetContextPtr(timer);
+  uint32_t budget = MQTT_STORE_DRAIN_BATCH_MAX;
+  mqttStore_recHdr_t* rec;
+  char topic[MQTT_STORE_MAX_TOPIC_LEN + 1];
+
+  LE_ASSERT(clientData);
+
+  // a token bucket in thousandths of a message, so a rate that is not a multiple of the ticks per
+  // second keeps its fraction, and rates below one per tick send every few ticks
+  if (mqttStore_drainRate)
+  {
+    mqttStore_drainCredit += (uint64_t)mqttStore_drainRate * MQTT_STORE_DRAIN_TICK_MS;
+    if (mqttStore_drainCredit > MQTT_STORE_DRAIN_BATCH_MAX * 1000)
+    {
+      mqttStore_drainCredit = MQTT_STORE_DRAIN_BATCH_MAX * 1000;
+    }
+
+    budget = mqttStore_drainCredit / 1000;
+  }
+
+  while (budget-- && clientData->session.isConnected && ((rec = mqttStore_peek()) != NULL))
+  {
+    mqttClient_msg_t msg =
+    {
+      .qos = rec->qos,
+      .retained = rec->retained,
+      .dup = 0,
+      .id = 0,
+      .payload = (const char*)(rec + 1) + rec->topicLen,
+      .payloadLen = rec->len - rec->topicLen,
+    };
+    int rc;
+
+    memcpy(topic, rec + 1, rec->topicLen);
+    topic[rec->topicLen] = '\0';
+
+    // the payload is read straight from the mapping, publish copies whatever it has to keep
+    rc = mqttClient_publish(clientData, topic, &msg);
+    if ((rc == LE_BUSY) || !clientData->session.isConnected)
+    {
+      goto cleanup;
+    }
+    else if (rc)
+    {
+      LE_ERROR("dropping stored message('%s') failed(%d)", topic, rc);
+    }
+
+    if (mqttStore_drainRate)
+    {
+      mqttStore_drainCredit -= 1000;
+    }
+
+    rec->consumed = 1;
+    mqttStore_depth--;
+    mqttStore_bytes -= msg.payloadLen;
+    mqttStore_read.off += MQTT_STORE_ALIGN(sizeof(*rec) + rec->len);
+
+    if (!le_timer_IsRunning(mqttStore_syncTimer))
+    {
+      le_timer_Start(mqttStore_syncTimer);
+    }
+  }
+
+  if (!mqttStore_depth)
+  {
+    LE_INFO("store drained");
+    mqttStore_stopDrain();
+  }
+
+cleanup:
+  return;
+}
+
+void mqttStore_startDrain(mqttClient_t* clientData)
+{
+  if (!mqttStore_base || !mqttStore_depth || le_timer_IsRunning(mqttStore_drainTimer))
+  {
+    return;
+  }
+
+  LE_INFO("draining store depth(%u) bytes(%u) rate(%u/s)", mqttStore_depth, mqttStore_bytes, mqttStore_drainRate);
+  mqttStore_drainCredit = 0;
+  le_timer_SetContextPtr(mqttStore_drainTimer, clientData);
+  le_timer_Start(mqttStore_drainTimer);
+}
+
+void mqttStore_stopDrain(void)
+{
+  if (mqttStore_drainTimer && le_timer_IsRunning(mqttStore_drainTimer))
+  {
+    le_timer_Stop(mqttStore_drainTimer);
+  }
+}
+
+void mqttStore_setDrainRate(uint32_t msgsPerSec)
+{
+  LE_INFO("store drain rate(%u -> %u/s)", mqttStore_drainRate, msgsPerSec);
+  mqttStore_drainRate = msgsPerSec;
+}
+
+void mqttStore_getStatus(uint32_t* depth, uint32_t* bytes, uint32_t* dropped)
+{
+  *depth = mqttStore_depth;
+  *bytes = mqttStore_bytes;
+  *dropped = mqttStore_dropped;
+}